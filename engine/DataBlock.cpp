@@ -36,6 +36,325 @@ static unsigned char s2a[65536];
 static unsigned char s2u[65536];
 }
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+    ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define G711_VECTOR
+#include <immintrin.h>
+#define SSE4_TARGET __attribute__((target("sse4.1")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// Convert a number of samples between two G.711 or linear formats
+typedef void (*G711Convert)(void* dst, const void* src, unsigned int samples);
+
+struct G711Kernels
+{
+    const char* name;
+    G711Convert slin2alaw;
+    G711Convert slin2mulaw;
+    G711Convert alaw2slin;
+    G711Convert mulaw2slin;
+    G711Convert alaw2mulaw;
+    G711Convert mulaw2alaw;
+};
+
+static inline void table16to8(unsigned char* d, const unsigned short* s, unsigned int len,
+    const unsigned char* c)
+{
+    while (len--)
+	*d++ = c[*s++];
+}
+
+static inline void table8to16(unsigned short* d, const unsigned char* s, unsigned int len,
+    const unsigned short* c)
+{
+    while (len--)
+	*d++ = c[*s++];
+}
+
+static inline void table8to8(unsigned char* d, const unsigned char* s, unsigned int len,
+    const unsigned char* c)
+{
+    while (len--)
+	*d++ = c[*s++];
+}
+
+static void tableSlin2Alaw(void* dst, const void* src, unsigned int len)
+    { table16to8((unsigned char*)dst,(const unsigned short*)src,len,s2a); }
+static void tableSlin2Mulaw(void* dst, const void* src, unsigned int len)
+    { table16to8((unsigned char*)dst,(const unsigned short*)src,len,s2u); }
+static void tableAlaw2Slin(void* dst, const void* src, unsigned int len)
+    { table8to16((unsigned short*)dst,(const unsigned char*)src,len,a2s); }
+static void tableMulaw2Slin(void* dst, const void* src, unsigned int len)
+    { table8to16((unsigned short*)dst,(const unsigned char*)src,len,u2s); }
+static void tableAlaw2Mulaw(void* dst, const void* src, unsigned int len)
+    { table8to8((unsigned char*)dst,(const unsigned char*)src,len,a2u); }
+static void tableMulaw2Alaw(void* dst, const void* src, unsigned int len)
+    { table8to8((unsigned char*)dst,(const unsigned char*)src,len,u2a); }
+
+static const G711Kernels s_tableKernels = {
+    "table",
+    tableSlin2Alaw, tableSlin2Mulaw,
+    tableAlaw2Slin, tableMulaw2Slin,
+    tableAlaw2Mulaw, tableMulaw2Alaw
+};
+
+#ifdef G711_VECTOR
+// The vector kernels compute exactly what the lookup tables hold.
+// A linear sample is encoded by counting the quantization levels below it:
+//  the segment is found with one compare per segment boundary, the value is
+//  shifted right by the segment with a multiply high and the mantissa is
+//  clamped as the tables switch segment only past its first level.
+// Samples are handled in 16 bit lanes, encoded values are packed to octets.
+// A-law to mu-law and back keep the 256 octet tables which stay in L1 cache
+//  and are faster than any shuffle based lookup.
+
+// High octet of 0x8000 >> n, the low octet of the lane is zeroed by shuffle
+static const char s_shiftMul[16] = { (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+// Left shift multipliers by exponent, octet 8 onward zero the high half of the lane
+static const char s_alawMul[16] = { 1, 1, 2, 4, 8, 16, 32, 64 };
+static const char s_mulawMul[16] = { 1, 2, 4, 8, 16, 32, 64, (char)128 };
+
+#define SSE_SEG(v,t) _mm_cmpgt_epi16(v,_mm_set1_epi16(t))
+
+// Shift unsigned lanes of at most 15 bits right by the segment in each lane
+SSE4_TARGET static inline __m128i sseShift(__m128i v, __m128i seg)
+{
+    const __m128i mul = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)s_shiftMul),
+	_mm_or_si128(_mm_slli_epi16(seg,8),_mm_set1_epi16(0x80)));
+    return _mm_mulhi_epu16(_mm_slli_epi16(v,1),mul);
+}
+
+SSE4_TARGET static inline __m128i sseAlawIndex(__m128i x)
+{
+    const __m128i neg = _mm_srai_epi16(x,15);
+    const __m128i w = _mm_blendv_epi8(x,_mm_subs_epi16(_mm_set1_epi16(15),x),neg);
+    __m128i seg = _mm_add_epi16(_mm_add_epi16(SSE_SEG(w,535),SSE_SEG(w,1063)),
+	_mm_add_epi16(SSE_SEG(w,2119),SSE_SEG(w,4231)));
+    seg = _mm_sub_epi16(_mm_setzero_si128(),
+	_mm_add_epi16(seg,_mm_add_epi16(SSE_SEG(w,8455),SSE_SEG(w,16903))));
+    __m128i q = sseShift(_mm_subs_epu16(w,_mm_set1_epi16(8)),seg);
+    q = _mm_srli_epi16(_mm_add_epi16(q,_mm_set1_epi16(8)),4);
+    q = _mm_add_epi16(_mm_min_epi16(q,_mm_set1_epi16(32)),_mm_slli_epi16(seg,4));
+    return _mm_blendv_epi8(_mm_min_epi16(q,_mm_set1_epi16(127)),
+	_mm_add_epi16(q,_mm_set1_epi16(127)),neg);
+}
+
+SSE4_TARGET static inline __m128i sseMulawIndex(__m128i x)
+{
+    const __m128i neg = _mm_srai_epi16(x,15);
+    const __m128i z = _mm_blendv_epi8(_mm_adds_epi16(x,_mm_set1_epi16(128)),
+	_mm_subs_epi16(_mm_set1_epi16(143),x),neg);
+    __m128i seg = _mm_add_epi16(_mm_add_epi16(SSE_SEG(z,263),SSE_SEG(z,527)),
+	_mm_add_epi16(SSE_SEG(z,1055),SSE_SEG(z,2111)));
+    seg = _mm_sub_epi16(_mm_setzero_si128(),_mm_add_epi16(seg,
+	_mm_add_epi16(_mm_add_epi16(SSE_SEG(z,4223),SSE_SEG(z,8447)),SSE_SEG(z,16895))));
+    __m128i t = _mm_srai_epi16(_mm_sub_epi16(sseShift(z,seg),_mm_set1_epi16(124)),3);
+    t = _mm_add_epi16(_mm_min_epi16(t,_mm_set1_epi16(16)),_mm_slli_epi16(seg,4));
+    return _mm_blendv_epi8(_mm_sub_epi16(_mm_set1_epi16(255),_mm_min_epi16(t,_mm_set1_epi16(127))),
+	_mm_sub_epi16(_mm_set1_epi16(128),t),neg);
+}
+
+SSE4_TARGET static inline __m128i sseAlawDecode(__m128i b)
+{
+    b = _mm_xor_si128(b,_mm_set1_epi16(0x55));
+    const __m128i e = _mm_and_si128(_mm_srli_epi16(b,4),_mm_set1_epi16(7));
+    __m128i v = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(b,_mm_set1_epi16(15)),4),_mm_set1_epi16(8));
+    v = _mm_add_epi16(v,_mm_andnot_si128(_mm_cmpeq_epi16(e,_mm_setzero_si128()),_mm_set1_epi16(256)));
+    const __m128i mul = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)s_alawMul),
+	_mm_or_si128(e,_mm_set1_epi16((short)0x8000)));
+    v = _mm_mullo_epi16(v,mul);
+    return _mm_blendv_epi8(_mm_sub_epi16(_mm_setzero_si128(),v),v,
+	_mm_cmpgt_epi16(b,_mm_set1_epi16(127)));
+}
+
+SSE4_TARGET static inline __m128i sseMulawDecode(__m128i b)
+{
+    b = _mm_xor_si128(b,_mm_set1_epi16(0xff));
+    const __m128i e = _mm_srli_epi16(b,4);
+    __m128i v = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(b,_mm_set1_epi16(15)),3),_mm_set1_epi16(132));
+    const __m128i mul = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)s_mulawMul),
+	_mm_or_si128(_mm_and_si128(e,_mm_set1_epi16(7)),_mm_set1_epi16((short)0x8000)));
+    v = _mm_sub_epi16(_mm_mullo_epi16(v,mul),_mm_set1_epi16(132));
+    return _mm_blendv_epi8(v,_mm_sub_epi16(_mm_setzero_si128(),v),
+	_mm_cmpgt_epi16(b,_mm_set1_epi16(127)));
+}
+
+SSE4_TARGET static void sseSlin2Alaw(void* dst, const void* src, unsigned int len)
+{
+    unsigned char* d = (unsigned char*)dst;
+    const short* s = (const short*)src;
+    for (; len >= 16; len -= 16, s += 16, d += 16) {
+	__m128i r = _mm_packus_epi16(sseAlawIndex(_mm_loadu_si128((const __m128i*)s)),
+	    sseAlawIndex(_mm_loadu_si128((const __m128i*)(s + 8))));
+	_mm_storeu_si128((__m128i*)d,_mm_xor_si128(r,_mm_set1_epi8((char)0xd5)));
+    }
+    tableSlin2Alaw(d,s,len);
+}
+
+SSE4_TARGET static void sseSlin2Mulaw(void* dst, const void* src, unsigned int len)
+{
+    unsigned char* d = (unsigned char*)dst;
+    const short* s = (const short*)src;
+    for (; len >= 16; len -= 16, s += 16, d += 16)
+	_mm_storeu_si128((__m128i*)d,_mm_packus_epi16(sseMulawIndex(_mm_loadu_si128((const __m128i*)s)),
+	    sseMulawIndex(_mm_loadu_si128((const __m128i*)(s + 8)))));
+    tableSlin2Mulaw(d,s,len);
+}
+
+SSE4_TARGET static void sseAlaw2Slin(void* dst, const void* src, unsigned int len)
+{
+    short* d = (short*)dst;
+    const unsigned char* s = (const unsigned char*)src;
+    for (; len >= 8; len -= 8, s += 8, d += 8)
+	_mm_storeu_si128((__m128i*)d,sseAlawDecode(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)s))));
+    tableAlaw2Slin(d,s,len);
+}
+
+SSE4_TARGET static void sseMulaw2Slin(void* dst, const void* src, unsigned int len)
+{
+    short* d = (short*)dst;
+    const unsigned char* s = (const unsigned char*)src;
+    for (; len >= 8; len -= 8, s += 8, d += 8)
+	_mm_storeu_si128((__m128i*)d,sseMulawDecode(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)s))));
+    tableMulaw2Slin(d,s,len);
+}
+
+static const G711Kernels s_sse4Kernels = {
+    "sse4.1",
+    sseSlin2Alaw, sseSlin2Mulaw,
+    sseAlaw2Slin, sseMulaw2Slin,
+    tableAlaw2Mulaw, tableMulaw2Alaw
+};
+
+#define AVX_SEG(v,t) _mm256_cmpgt_epi16(v,_mm256_set1_epi16(t))
+
+AVX2_TARGET static inline __m256i avxShift(__m256i v, __m256i seg)
+{
+    const __m256i mul = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)s_shiftMul)),
+	_mm256_or_si256(_mm256_slli_epi16(seg,8),_mm256_set1_epi16(0x80)));
+    return _mm256_mulhi_epu16(_mm256_slli_epi16(v,1),mul);
+}
+
+AVX2_TARGET static inline __m256i avxAlawIndex(__m256i x)
+{
+    const __m256i neg = _mm256_srai_epi16(x,15);
+    const __m256i w = _mm256_blendv_epi8(x,_mm256_subs_epi16(_mm256_set1_epi16(15),x),neg);
+    __m256i seg = _mm256_add_epi16(_mm256_add_epi16(AVX_SEG(w,535),AVX_SEG(w,1063)),
+	_mm256_add_epi16(AVX_SEG(w,2119),AVX_SEG(w,4231)));
+    seg = _mm256_sub_epi16(_mm256_setzero_si256(),
+	_mm256_add_epi16(seg,_mm256_add_epi16(AVX_SEG(w,8455),AVX_SEG(w,16903))));
+    __m256i q = avxShift(_mm256_subs_epu16(w,_mm256_set1_epi16(8)),seg);
+    q = _mm256_srli_epi16(_mm256_add_epi16(q,_mm256_set1_epi16(8)),4);
+    q = _mm256_add_epi16(_mm256_min_epi16(q,_mm256_set1_epi16(32)),_mm256_slli_epi16(seg,4));
+    return _mm256_blendv_epi8(_mm256_min_epi16(q,_mm256_set1_epi16(127)),
+	_mm256_add_epi16(q,_mm256_set1_epi16(127)),neg);
+}
+
+AVX2_TARGET static inline __m256i avxMulawIndex(__m256i x)
+{
+    const __m256i neg = _mm256_srai_epi16(x,15);
+    const __m256i z = _mm256_blendv_epi8(_mm256_adds_epi16(x,_mm256_set1_epi16(128)),
+	_mm256_subs_epi16(_mm256_set1_epi16(143),x),neg);
+    __m256i seg = _mm256_add_epi16(_mm256_add_epi16(AVX_SEG(z,263),AVX_SEG(z,527)),
+	_mm256_add_epi16(AVX_SEG(z,1055),AVX_SEG(z,2111)));
+    seg = _mm256_sub_epi16(_mm256_setzero_si256(),_mm256_add_epi16(seg,
+	_mm256_add_epi16(_mm256_add_epi16(AVX_SEG(z,4223),AVX_SEG(z,8447)),AVX_SEG(z,16895))));
+    __m256i t = _mm256_srai_epi16(_mm256_sub_epi16(avxShift(z,seg),_mm256_set1_epi16(124)),3);
+    t = _mm256_add_epi16(_mm256_min_epi16(t,_mm256_set1_epi16(16)),_mm256_slli_epi16(seg,4));
+    return _mm256_blendv_epi8(_mm256_sub_epi16(_mm256_set1_epi16(255),_mm256_min_epi16(t,_mm256_set1_epi16(127))),
+	_mm256_sub_epi16(_mm256_set1_epi16(128),t),neg);
+}
+
+AVX2_TARGET static inline __m256i avxAlawDecode(__m256i b)
+{
+    b = _mm256_xor_si256(b,_mm256_set1_epi16(0x55));
+    const __m256i e = _mm256_and_si256(_mm256_srli_epi16(b,4),_mm256_set1_epi16(7));
+    __m256i v = _mm256_add_epi16(_mm256_slli_epi16(_mm256_and_si256(b,_mm256_set1_epi16(15)),4),_mm256_set1_epi16(8));
+    v = _mm256_add_epi16(v,_mm256_andnot_si256(_mm256_cmpeq_epi16(e,_mm256_setzero_si256()),_mm256_set1_epi16(256)));
+    const __m256i mul = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)s_alawMul)),
+	_mm256_or_si256(e,_mm256_set1_epi16((short)0x8000)));
+    v = _mm256_mullo_epi16(v,mul);
+    return _mm256_blendv_epi8(_mm256_sub_epi16(_mm256_setzero_si256(),v),v,
+	_mm256_cmpgt_epi16(b,_mm256_set1_epi16(127)));
+}
+
+AVX2_TARGET static inline __m256i avxMulawDecode(__m256i b)
+{
+    b = _mm256_xor_si256(b,_mm256_set1_epi16(0xff));
+    const __m256i e = _mm256_srli_epi16(b,4);
+    __m256i v = _mm256_add_epi16(_mm256_slli_epi16(_mm256_and_si256(b,_mm256_set1_epi16(15)),3),_mm256_set1_epi16(132));
+    const __m256i mul = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)s_mulawMul)),
+	_mm256_or_si256(_mm256_and_si256(e,_mm256_set1_epi16(7)),_mm256_set1_epi16((short)0x8000)));
+    v = _mm256_sub_epi16(_mm256_mullo_epi16(v,mul),_mm256_set1_epi16(132));
+    return _mm256_blendv_epi8(v,_mm256_sub_epi16(_mm256_setzero_si256(),v),
+	_mm256_cmpgt_epi16(b,_mm256_set1_epi16(127)));
+}
+
+AVX2_TARGET static void avxSlin2Alaw(void* dst, const void* src, unsigned int len)
+{
+    unsigned char* d = (unsigned char*)dst;
+    const short* s = (const short*)src;
+    for (; len >= 32; len -= 32, s += 32, d += 32) {
+	// packing works in 128 bit lanes, restore the order of the quadwords
+	__m256i r = _mm256_packus_epi16(avxAlawIndex(_mm256_loadu_si256((const __m256i*)s)),
+	    avxAlawIndex(_mm256_loadu_si256((const __m256i*)(s + 16))));
+	r = _mm256_permute4x64_epi64(r,0xd8);
+	_mm256_storeu_si256((__m256i*)d,_mm256_xor_si256(r,_mm256_set1_epi8((char)0xd5)));
+    }
+    // the SSE tail is not VEX encoded, avoid the AVX to SSE transition penalty
+    _mm256_zeroupper();
+    sseSlin2Alaw(d,s,len);
+}
+
+AVX2_TARGET static void avxSlin2Mulaw(void* dst, const void* src, unsigned int len)
+{
+    unsigned char* d = (unsigned char*)dst;
+    const short* s = (const short*)src;
+    for (; len >= 32; len -= 32, s += 32, d += 32) {
+	__m256i r = _mm256_packus_epi16(avxMulawIndex(_mm256_loadu_si256((const __m256i*)s)),
+	    avxMulawIndex(_mm256_loadu_si256((const __m256i*)(s + 16))));
+	_mm256_storeu_si256((__m256i*)d,_mm256_permute4x64_epi64(r,0xd8));
+    }
+    // the SSE tail is not VEX encoded, avoid the AVX to SSE transition penalty
+    _mm256_zeroupper();
+    sseSlin2Mulaw(d,s,len);
+}
+
+AVX2_TARGET static void avxAlaw2Slin(void* dst, const void* src, unsigned int len)
+{
+    short* d = (short*)dst;
+    const unsigned char* s = (const unsigned char*)src;
+    for (; len >= 16; len -= 16, s += 16, d += 16)
+	_mm256_storeu_si256((__m256i*)d,avxAlawDecode(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)s))));
+    // the SSE tail is not VEX encoded, avoid the AVX to SSE transition penalty
+    _mm256_zeroupper();
+    sseAlaw2Slin(d,s,len);
+}
+
+AVX2_TARGET static void avxMulaw2Slin(void* dst, const void* src, unsigned int len)
+{
+    short* d = (short*)dst;
+    const unsigned char* s = (const unsigned char*)src;
+    for (; len >= 16; len -= 16, s += 16, d += 16)
+	_mm256_storeu_si256((__m256i*)d,avxMulawDecode(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)s))));
+    // the SSE tail is not VEX encoded, avoid the AVX to SSE transition penalty
+    _mm256_zeroupper();
+    sseMulaw2Slin(d,s,len);
+}
+
+static const G711Kernels s_avx2Kernels = {
+    "avx2",
+    avxSlin2Alaw, avxSlin2Mulaw,
+    avxAlaw2Slin, avxMulaw2Slin,
+    tableAlaw2Mulaw, tableMulaw2Alaw
+};
+#endif // G711_VECTOR
+
+// Kernels selected by default and the best ones supported by this CPU
+static const G711Kernels* s_g711 = &s_tableKernels;
+static const G711Kernels* s_g711Best = &s_tableKernels;
+
 class InitG711
 {
 public:
@@ -68,6 +387,14 @@ public:
 		val = (--v) ^ 0xd5;
 	    s2a[i] = val;
 	}
+#ifdef G711_VECTOR
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	    s_g711Best = &s_avx2Kernels;
+	else if (__builtin_cpu_supports("sse4.1"))
+	    s_g711Best = &s_sse4Kernels;
+#endif
+	s_g711 = s_g711Best;
     }
 };
 
@@ -286,38 +613,38 @@ bool DataBlock::convert(const DataBlock& src, const String& sFormat,
 	return true;
     }
     unsigned sl = 0, dl = 0;
-    void *ctable = 0;
+    G711Convert conv = 0;
     if (sFormat == YSTRING("slin")) {
 	sl = 2;
 	dl = 1;
 	if (dFormat == YSTRING("alaw"))
-	    ctable = s2a;
+	    conv = s_g711->slin2alaw;
 	else if (dFormat == YSTRING("mulaw"))
-	    ctable = s2u;
+	    conv = s_g711->slin2mulaw;
     }
     else if (sFormat == YSTRING("alaw")) {
 	sl = 1;
 	if (dFormat == YSTRING("mulaw")) {
 	    dl = 1;
-	    ctable = a2u;
+	    conv = s_g711->alaw2mulaw;
 	}
 	else if (dFormat == YSTRING("slin")) {
 	    dl = 2;
-	    ctable = a2s;
+	    conv = s_g711->alaw2slin;
 	}
     }
     else if (sFormat == YSTRING("mulaw")) {
 	sl = 1;
 	if (dFormat == YSTRING("alaw")) {
 	    dl = 1;
-	    ctable = u2a;
+	    conv = s_g711->mulaw2alaw;
 	}
 	else if (dFormat == YSTRING("slin")) {
 	    dl = 2;
-	    ctable = u2s;
+	    conv = s_g711->mulaw2slin;
 	}
     }
-    if (!ctable) {
+    if (!conv) {
 	clear();
 	return false;
     }
@@ -330,30 +657,16 @@ bool DataBlock::convert(const DataBlock& src, const String& sFormat,
 	return true;
     }
     resize(len * dl);
-    if ((sl == 1) && (dl == 1)) {
-	unsigned char *s = (unsigned char *) src.data();
-	unsigned char *d = (unsigned char *) data();
-	unsigned char *c = (unsigned char *) ctable;
-	while (len--)
-	    *d++ = c[*s++];
-    }
-    else if ((sl == 1) && (dl == 2)) {
-	unsigned char *s = (unsigned char *) src.data();
-	unsigned short *d = (unsigned short *) data();
-	unsigned short *c = (unsigned short *) ctable;
-	while (len--)
-	    *d++ = c[*s++];
-    }
-    else if ((sl == 2) && (dl == 1)) {
-	unsigned short *s = (unsigned short *) src.data();
-	unsigned char *d = (unsigned char *) data();
-	unsigned char *c = (unsigned char *) ctable;
-	while (len--)
-	    *d++ = c[*s++];
-    }
+    conv(data(),src.data(),len);
     return true;
 }
 
+const char* DataBlock::vectorConvert(bool vector)
+{
+    s_g711 = vector ? s_g711Best : &s_tableKernels;
+    return s_g711->name;
+}
+
 // Decode a single nibble, return -1 on error
 inline signed char hexDecode(char c)
 {
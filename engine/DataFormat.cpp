@@ -21,6 +21,46 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+
+#ifndef _WINDOWS
+#include <pthread.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+    ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define RESAMP_VECTOR
+#include <immintrin.h>
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// Filter taps per output sample at the lower of the two rates, multiple of 16
+#define RESAMP_TAPS 64
+// Kaiser window shape, about 80dB stop band attenuation
+#define RESAMP_BETA 8.0
+// Cutoff relative to the lower Nyquist frequency
+#define RESAMP_ROLLOFF 0.92
+// Coefficients fixed point precision
+#define RESAMP_SHIFT 14
+
+// Media clock tick period in usec, the usual 20ms packetization
+#define CLOCK_TICK 20000
+// Default number of shared media clock threads, zero gives each source its own
+#define CLOCK_THREADS 0
+// Most media clock threads that can be configured
+#define CLOCK_MAX 64
+// Most ticks a clocked source may fall behind before skipping ahead
+#define CLOCK_BEHIND 5
+
+// Frames louder than this mean square energy (about -45 dBm0) are never silence
+#define VAD_MAX_SILENCE 32768
+// Lowest noise level the voice activity detector will assume
+#define VAD_MIN_NOISE 256
+// Shift for the rate the noise level rises while there is signal
+#define VAD_SHIFT_RAISE 7
+// Frames analyzed between updates of the global statistics
+#define VAD_FLUSH 256
 
 namespace TelEngine {
 
@@ -46,6 +86,10 @@ static const FormatInfo s_formats[] = {
     FormatInfo("g729", 10, 10000),
     FormatInfo("plain", 0, 0, "text", 0),
     FormatInfo("raw", 0, 0, "data", 0),
+    FormatInfo("slin/44100", 882, 10000, "audio", 44100, 1, true),
+    FormatInfo("slin/48000", 960, 10000, "audio", 48000, 1, true),
+    FormatInfo("2*slin/44100", 1764, 10000, "audio", 44100, 2),
+    FormatInfo("2*slin/48000", 1920, 10000, "audio", 48000, 2),
 };
 
 // FIXME: put proper conversion costs everywhere below
@@ -89,10 +133,44 @@ static TranslatorCaps s_simpleCaps32k[] = {
 static TranslatorCaps s_resampCaps[] = {
     { s_formats+0, s_formats+3, 2 },
     { s_formats+0, s_formats+6, 2 },
+    { s_formats+0, s_formats+20, 2 },
+    { s_formats+0, s_formats+21, 2 },
     { s_formats+3, s_formats+0, 2 },
     { s_formats+3, s_formats+6, 2 },
+    { s_formats+3, s_formats+20, 2 },
+    { s_formats+3, s_formats+21, 2 },
     { s_formats+6, s_formats+0, 2 },
     { s_formats+6, s_formats+3, 2 },
+    { s_formats+6, s_formats+20, 2 },
+    { s_formats+6, s_formats+21, 2 },
+    { s_formats+20, s_formats+0, 2 },
+    { s_formats+20, s_formats+3, 2 },
+    { s_formats+20, s_formats+6, 2 },
+    { s_formats+20, s_formats+21, 2 },
+    { s_formats+21, s_formats+0, 2 },
+    { s_formats+21, s_formats+3, 2 },
+    { s_formats+21, s_formats+6, 2 },
+    { s_formats+21, s_formats+20, 2 },
+    { s_formats+9, s_formats+10, 2 },
+    { s_formats+9, s_formats+11, 2 },
+    { s_formats+9, s_formats+22, 2 },
+    { s_formats+9, s_formats+23, 2 },
+    { s_formats+10, s_formats+9, 2 },
+    { s_formats+10, s_formats+11, 2 },
+    { s_formats+10, s_formats+22, 2 },
+    { s_formats+10, s_formats+23, 2 },
+    { s_formats+11, s_formats+9, 2 },
+    { s_formats+11, s_formats+10, 2 },
+    { s_formats+11, s_formats+22, 2 },
+    { s_formats+11, s_formats+23, 2 },
+    { s_formats+22, s_formats+9, 2 },
+    { s_formats+22, s_formats+10, 2 },
+    { s_formats+22, s_formats+11, 2 },
+    { s_formats+22, s_formats+23, 2 },
+    { s_formats+23, s_formats+9, 2 },
+    { s_formats+23, s_formats+10, 2 },
+    { s_formats+23, s_formats+11, 2 },
+    { s_formats+23, s_formats+22, 2 },
     { 0, 0, 0 }
 };
 
@@ -103,12 +181,117 @@ static TranslatorCaps s_stereoCaps[] = {
     { s_formats+10, s_formats+3, 2 },
     { s_formats+6, s_formats+11, 1 },
     { s_formats+11, s_formats+6, 2 },
+    { s_formats+20, s_formats+22, 1 },
+    { s_formats+22, s_formats+20, 2 },
+    { s_formats+21, s_formats+23, 1 },
+    { s_formats+23, s_formats+21, 2 },
     { 0, 0, 0 }
 };
 
 static Mutex s_dataMutex(true,"DataEndpoint");
 static Mutex s_consSrcMutex(false,"DataConsumer::Source");
 
+// Immutable copy of a source's consumers, Forward walks it without holding the source locked
+class DataSourceSnapshot : public RefObject
+{
+public:
+    DataSourceSnapshot(const ObjList& consumers);
+    virtual void destroyed();
+    DataConsumer** m_consumers;
+    unsigned int m_count;
+};
+
+// A thread running the consumers of a source, reused by other threads when done
+class DataSourceReader : public GenObject
+{
+public:
+    inline DataSourceReader(void* thread)
+	: m_thread(thread), m_count(0), m_waiting(false)
+	{ }
+    void* m_thread;
+    unsigned int m_count;
+    bool m_waiting;
+};
+
+// Best translator factory found for a pair of formats, NULL if none can convert
+class ChainEntry : public GenObject
+{
+public:
+    inline ChainEntry(const FormatInfo* src, const FormatInfo* dest, TranslatorFactory* factory, int cost)
+	: m_src(src), m_dest(dest), m_factory(factory), m_cost(cost)
+	{ }
+    const FormatInfo* m_src;
+    const FormatInfo* m_dest;
+    TranslatorFactory* m_factory;
+    int m_cost;
+};
+
+#define CHAIN_BUCKETS 61
+
+// The chain cache is read without holding the translators mutex
+static Mutex s_chainMutex(false,"DataTranslator::Chains");
+static ObjList s_chains[CHAIN_BUCKETS];
+static unsigned int s_chainCount = 0;
+static unsigned int s_chainBusy = 0;
+static unsigned int s_chainHold = 0;
+static u_int64_t s_chainHits = 0;
+static u_int64_t s_chainMisses = 0;
+
+static inline ObjList& chainBucket(const FormatInfo* src, const FormatInfo* dest)
+{
+    return s_chains[(((unsigned long)src >> 3) * 31 + ((unsigned long)dest >> 3)) % CHAIN_BUCKETS];
+}
+
+// Find a cached format pair, the chains mutex must be locked
+static ChainEntry* findChain(const FormatInfo* src, const FormatInfo* dest)
+{
+    for (ObjList* l = chainBucket(src,dest).skipNull(); l; l = l->skipNext()) {
+	ChainEntry* e = static_cast<ChainEntry*>(l->get());
+	if ((e->m_src == src) && (e->m_dest == dest))
+	    return e;
+    }
+    return 0;
+}
+
+// Remember the planning result for a format pair, unless a factory is being removed
+static void storeChain(const FormatInfo* src, const FormatInfo* dest, TranslatorFactory* factory, int cost)
+{
+    Lock lock(s_chainMutex);
+    if (s_chainHold || findChain(src,dest))
+	return;
+    chainBucket(src,dest).append(new ChainEntry(src,dest,factory,cost));
+    s_chainCount++;
+}
+
+// Cost of converting a format pair advertised by a factory, -1 if none
+static int factoryCost(TranslatorFactory* factory, const FormatInfo* src, const FormatInfo* dest)
+{
+    int cost = -1;
+    const TranslatorCaps* caps = factory->getCapabilities();
+    for (; caps && caps->src && caps->dest; caps++) {
+	if ((caps->src == src) && (caps->dest == dest) && ((cost == -1) || (cost > caps->cost)))
+	    cost = caps->cost;
+    }
+    return cost;
+}
+
+// Drop all cached chains, optionally wait for creations using them to finish
+static void flushChains(bool wait)
+{
+    s_chainMutex.lock();
+    if (s_chainCount) {
+	for (int i = 0; i < CHAIN_BUCKETS; i++)
+	    s_chains[i].clear();
+	s_chainCount = 0;
+    }
+    while (wait && s_chainBusy) {
+	s_chainMutex.unlock();
+	Thread::idle();
+	s_chainMutex.lock();
+    }
+    s_chainMutex.unlock();
+}
+
 class ThreadedSourcePrivate : public Thread
 {
     friend class ThreadedSource;
@@ -136,6 +319,35 @@ private:
     RefPointer<ThreadedSource> m_source;
 };
 
+// Thread that paces many clocked sources on a shared tick
+class MediaClock : public Thread
+{
+public:
+    MediaClock(unsigned int index);
+    ~MediaClock();
+    virtual void run();
+    virtual void cleanup();
+    void attach(ClockedSource* source);
+    void status(String& str);
+    inline unsigned int count() const
+	{ return m_count; }
+    static MediaClock* pick(ClockedSource* source);
+    static int limit();
+private:
+    bool serve(ClockedSource* source, u_int64_t tick);
+    void release(ObjList* item);
+    void releaseAll();
+    Mutex m_mutex;
+    ObjList m_sources;
+    unsigned int m_index;
+    unsigned int m_count;
+    u_int64_t m_ticks;
+    u_int64_t m_jitter;
+    u_int64_t m_maxJitter;
+    u_int64_t m_busy;
+    u_int64_t m_overruns;
+};
+
 // slin/alaw/mulaw converter
 class SimpleTranslator : public DataTranslator
 {
@@ -181,65 +393,281 @@ private:
     DataBlock m_buffer;
 };
 
-// slin basic mono resampler
+// Dot product of a window of samples with a phase of the filter, taps is multiple of 16
+typedef int (*ResampDot)(const short* x, const short* h, unsigned int taps);
+
+static int scalarDot(const short* x, const short* h, unsigned int taps)
+{
+    int acc = 0;
+    while (taps--)
+	acc += (int)*x++ * *h++;
+    return acc;
+}
+
+#ifdef RESAMP_VECTOR
+SSE2_TARGET static int sse2Dot(const short* x, const short* h, unsigned int taps)
+{
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    for (; taps; taps -= 16, x += 16, h += 16) {
+	acc0 = _mm_add_epi32(acc0,_mm_madd_epi16(_mm_loadu_si128((const __m128i*)x),
+	    _mm_loadu_si128((const __m128i*)h)));
+	acc1 = _mm_add_epi32(acc1,_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(x + 8)),
+	    _mm_loadu_si128((const __m128i*)(h + 8))));
+    }
+    acc0 = _mm_add_epi32(acc0,acc1);
+    acc0 = _mm_add_epi32(acc0,_mm_shuffle_epi32(acc0,0x4e));
+    acc0 = _mm_add_epi32(acc0,_mm_shuffle_epi32(acc0,0xb1));
+    return _mm_cvtsi128_si32(acc0);
+}
+
+AVX2_TARGET static int avx2Dot(const short* x, const short* h, unsigned int taps)
+{
+    __m256i acc = _mm256_setzero_si256();
+    for (; taps; taps -= 16, x += 16, h += 16)
+	acc = _mm256_add_epi32(acc,_mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)x),
+	    _mm256_loadu_si256((const __m256i*)h)));
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc),_mm256_extracti128_si256(acc,1));
+    sum = _mm_add_epi32(sum,_mm_shuffle_epi32(sum,0x4e));
+    sum = _mm_add_epi32(sum,_mm_shuffle_epi32(sum,0xb1));
+    return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+static ResampDot selectDot()
+{
+#ifdef RESAMP_VECTOR
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+	return avx2Dot;
+    if (__builtin_cpu_supports("sse2"))
+	return sse2Dot;
+#endif
+    return scalarDot;
+}
+
+static const ResampDot s_resampDot = selectDot();
+
+// Zero order modified Bessel function of the first kind
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    x = x * x / 4.0;
+    for (int k = 1; k < 50; k++) {
+	term *= x / ((double)k * k);
+	sum += term;
+	if (term < sum * 1e-12)
+	    break;
+    }
+    return sum;
+}
+
+// Polyphase filter bank for a rational ratio, shared by all resamplers using it
+class ResampBank : public GenObject
+{
+public:
+    ResampBank(unsigned int up, unsigned int down);
+    virtual ~ResampBank()
+	{
+	    delete[] m_coefs;
+	    delete[] m_step;
+	}
+    inline const short* phase(unsigned int p) const
+	{ return m_coefs + p * m_taps; }
+    static const ResampBank* get(unsigned int up, unsigned int down);
+    unsigned int m_up;
+    unsigned int m_down;
+    unsigned int m_taps;
+    short* m_coefs;
+    unsigned int* m_step;
+};
+
+static ObjList s_resampBanks;
+static Mutex s_resampMutex(false,"Resampler");
+
+static ObjList s_codecPools;
+static Mutex s_codecPoolsMutex(false,"DataCodecPool::List");
+
+static MediaClock* s_clocks[CLOCK_MAX];
+static int s_clockLimit = -1;
+static Mutex s_clocksMutex(false,"MediaClock::List");
+
+static u_int64_t s_vadFrames = 0;
+static u_int64_t s_vadSilent = 0;
+static Mutex s_vadMutex(false,"DataVad");
+
+// Check if a format is mono signed linear that voice detection can analyze
+static bool vadFormat(const FormatInfo* info)
+{
+    return info && info->converter && (info->numChannels == 1) && !::strncmp(info->name,"slin",4);
+}
+
+ResampBank::ResampBank(unsigned int up, unsigned int down)
+    : m_up(up), m_down(down), m_taps(RESAMP_TAPS)
+{
+    // cut below the lower of the two Nyquist frequencies
+    double bw = 1.0;
+    if (down > up) {
+	bw = (double)up / down;
+	m_taps = ((RESAMP_TAPS * down / up) + 15) & ~15;
+    }
+    unsigned int len = m_up * m_taps;
+    double fc = RESAMP_ROLLOFF * bw / (2.0 * m_up);
+    double center = (len - 1) / 2.0;
+    double norm = besselI0(RESAMP_BETA);
+    double* proto = new double[len];
+    for (unsigned int i = 0; i < len; i++) {
+	double t = i - center;
+	double r = t / (center + 1.0);
+	double v = 2.0 * fc;
+	if (t != 0.0)
+	    v = ::sin(2.0 * M_PI * fc * t) / (M_PI * t);
+	proto[i] = v * besselI0(RESAMP_BETA * ::sqrt(1.0 - r * r)) / norm;
+    }
+    // split the prototype in phases with taps reversed to run over rising sample addresses
+    m_coefs = new short[len];
+    m_step = new unsigned int[m_up];
+    for (unsigned int p = 0; p < m_up; p++) {
+	double sum = 0.0;
+	for (unsigned int j = 0; j < m_taps; j++)
+	    sum += proto[p + j * m_up];
+	short* h = m_coefs + p * m_taps;
+	int total = 0;
+	unsigned int peak = 0;
+	int top = 0;
+	for (unsigned int j = 0; j < m_taps; j++) {
+	    // every phase gets unity gain at DC
+	    short v = (short)::floor(proto[p + j * m_up] * (1 << RESAMP_SHIFT) / sum + 0.5);
+	    h[m_taps - 1 - j] = v;
+	    total += v;
+	    if (::abs(v) > top) {
+		top = ::abs(v);
+		peak = m_taps - 1 - j;
+	    }
+	}
+	// put the rounding error in the largest tap
+	h[peak] += (1 << RESAMP_SHIFT) - total;
+	m_step[p] = (p + m_down) / m_up;
+    }
+    delete[] proto;
+}
+
+const ResampBank* ResampBank::get(unsigned int up, unsigned int down)
+{
+    Lock lock(s_resampMutex);
+    for (ObjList* l = s_resampBanks.skipNull(); l; l = l->skipNext()) {
+	const ResampBank* b = static_cast<const ResampBank*>(l->get());
+	if ((b->m_up == up) && (b->m_down == down))
+	    return b;
+    }
+    ResampBank* b = new ResampBank(up,down);
+    s_resampBanks.append(b);
+    return b;
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+    while (b) {
+	unsigned int t = a % b;
+	a = b;
+	b = t;
+    }
+    return a;
+}
+
+// slin polyphase FIR resampler for any number of interleaved channels
 class ResampTranslator : public DataTranslator
 {
 private:
-    int m_sRate, m_dRate;
-    short m_last;
+    const ResampBank* m_bank;
+    unsigned int m_chans;
+    unsigned int m_phase;
+    unsigned int m_offset;
+    unsigned int m_tsRest;
+    DataBlock m_history;
+    DataBlock m_work;
+    DataBlock m_buffer;
 public:
     ResampTranslator(const DataFormat& sFormat, const DataFormat& dFormat)
 	: DataTranslator(sFormat,dFormat),
-	m_sRate(sFormat.sampleRate()), m_dRate(dFormat.sampleRate()), m_last(0)
-	{ }
+	m_bank(0), m_chans(sFormat.numChannels()), m_phase(0), m_offset(0), m_tsRest(0)
+	{
+	    unsigned int sRate = sFormat.sampleRate();
+	    unsigned int dRate = dFormat.sampleRate();
+	    if (!(sRate && dRate && m_chans) || (m_chans != (unsigned int)dFormat.numChannels()))
+		return;
+	    unsigned int div = gcd(sRate,dRate);
+	    m_bank = ResampBank::get(dRate / div,sRate / div);
+	    m_history.assign(0,2 * m_chans * (m_bank->m_taps - 1));
+	}
     virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
 	{
-	    unsigned int n = data.length();
-	    if (!n || (n & 1) || !m_sRate || !m_dRate || !ref())
+	    unsigned int n = data.length() / (2 * m_chans);
+	    if (!n || !m_bank || (data.length() % (2 * m_chans)) || !ref())
 		return 0;
 	    unsigned long len = 0;
-	    n /= 2;
 	    DataSource* src = getTransSource();
 	    if (src) {
-		long delta = tStamp - m_timestamp;
-		short* s = (short*) data.data();
-		DataBlock oblock;
-		if (m_dRate > m_sRate) {
-		    int mul = m_dRate / m_sRate;
-		    // linear interpolation between existing samples
-		    delta *= mul;
-		    oblock.assign(0,2*n*mul);
-		    short* d = (short*) oblock.data();
-		    while (n--) {
-			short v = *s++;
-			for (int i = 1; i <= mul; i++)
-			    *d++ = ((m_last * (mul - i)) + (v * i)) / mul;
-			m_last = v;
-		    }
-		}
-		else {
-		    int div = m_sRate / m_dRate;
-		    // average an integer number of samples
-		    delta /= div;
-		    n /= div;
-		    oblock.assign(0,2*n);
-		    short* d = (short*) oblock.data();
-		    while (n--) {
-			int v = 0;
-			for (int i = 0; i < div; i++)
-			    v += *s++;
-			v /= div;
-			// saturate average result
+		unsigned int up = m_bank->m_up;
+		unsigned int down = m_bank->m_down;
+		unsigned int hist = m_bank->m_taps - 1;
+		unsigned int total = hist + n;
+		// grow the buffers only when a larger frame shows up
+		if (m_work.length() < 2 * m_chans * total)
+		    m_work.assign(0,2 * m_chans * total);
+		unsigned int maxOut = (unsigned int)(((u_int64_t)n * up + down - 1) / down) + 1;
+		if (m_buffer.length() < 2 * m_chans * maxOut)
+		    m_buffer.assign(0,2 * m_chans * maxOut);
+		const short* s = (const short*)data.data();
+		short* h = (short*)m_history.data();
+		short* d = (short*)m_buffer.data();
+		unsigned int outs = 0;
+		for (unsigned int c = 0; c < m_chans; c++) {
+		    // history followed by the new samples of this channel
+		    short* w = (short*)m_work.data() + c * total;
+		    ::memcpy(w,h + c * hist,2 * hist);
+		    for (unsigned int i = 0; i < n; i++)
+			w[hist + i] = s[i * m_chans + c];
+		    unsigned int phase = m_phase;
+		    unsigned int offs = m_offset;
+		    unsigned int k = 0;
+		    for (; (offs + hist < total) && (k < maxOut); k++) {
+			int v = (s_resampDot(w + offs,m_bank->phase(phase),hist + 1)
+			    + (1 << (RESAMP_SHIFT - 1))) >> RESAMP_SHIFT;
+			// saturate filter overshoot
 			if (v > 32767)
 			    v = 32767;
-			if (v < -32767)
-			    v = -32767;
-			*d++ = v;
+			if (v < -32768)
+			    v = -32768;
+			d[k * m_chans + c] = v;
+			offs += m_bank->m_step[phase];
+			phase += down;
+			phase %= up;
+		    }
+		    ::memcpy(h + c * hist,w + n,2 * hist);
+		    if (c == m_chans - 1) {
+			m_phase = phase;
+			m_offset = offs - n;
+			outs = k;
 		    }
 		}
+		long delta = tStamp - m_timestamp;
+		if (delta > 0) {
+		    // carry the fractional part so timestamps don't drift
+		    u_int64_t t = (u_int64_t)delta * up + m_tsRest;
+		    delta = (long)(t / down);
+		    m_tsRest = (unsigned int)(t % down);
+		}
+		else
+		    delta = delta * (long)up / (long)down;
 		if (src->timeStamp() != invalidStamp())
 		    delta += src->timeStamp();
-		len = src->Forward(oblock, delta, flags);
+		if (outs) {
+		    DataBlock oblock(d,2 * m_chans * outs,false);
+		    len = src->Forward(oblock,delta,flags);
+		    oblock.clear(false);
+		}
 	    }
 	    deref();
 	    return len;
@@ -521,6 +949,28 @@ bool DataConsumer::synchronize(DataSource* source)
 }
 
 
+DataSourceSnapshot::DataSourceSnapshot(const ObjList& consumers)
+    : m_consumers(0), m_count(0)
+{
+    m_consumers = new DataConsumer*[consumers.count()];
+    for (ObjList* l = consumers.skipNull(); l; l = l->skipNext()) {
+	DataConsumer* c = static_cast<DataConsumer*>(l->get());
+	if (c->ref())
+	    m_consumers[m_count++] = c;
+    }
+}
+
+void DataSourceSnapshot::destroyed()
+{
+    for (unsigned int i = 0; i < m_count; i++)
+	m_consumers[i]->deref();
+    delete[] m_consumers;
+    m_consumers = 0;
+    m_count = 0;
+    RefObject::destroyed();
+}
+
+
 bool DataSource::valid() const
 {
     Lock mylock(const_cast<DataSource*>(this));
@@ -548,6 +998,12 @@ unsigned long DataSource::Forward(const DataBlock& data, unsigned long tStamp, u
 	DDebug(DebugInfo,"Forwarding on a dead DataSource! [%p]",this);
 	return 0;
     }
+    // the detector is replaced and deleted only with the source locked
+    if (!(flags & DataSilent)) {
+	DataVad* vad = m_vad;
+	if (vad)
+	    flags = vad->mark(data,flags);
+    }
 
     // try to evaluate amount of samples in this packet
     const FormatInfo* f = m_format.getInfo();
@@ -562,30 +1018,51 @@ unsigned long DataSource::Forward(const DataBlock& data, unsigned long tStamp, u
 	    m_timestamp,nSamp,this);
 	tStamp = m_timestamp + nSamp;
     }
+    DataSourceSnapshot* snap = m_snapshot;
+    if (!snap) {
+	m_timestamp = tStamp;
+	m_nextStamp = nSamp ? (tStamp + nSamp) : invalidStamp();
+	return 0;
+    }
+    // attach and detach replace the snapshot so we can run the consumers unlocked
+    snap->ref();
+    DataSourceReader* reader = addReader();
+    mylock.drop();
+
     unsigned long len = invalidStamp();
     bool empty = true;
-    ObjList* l = m_consumers.skipNull();
-    while (l) {
-	DataConsumer* c = static_cast<DataConsumer *>(l->get());
+    bool invalid = false;
+    for (unsigned int i = 0; i < snap->m_count; i++) {
+	DataConsumer* c = snap->m_consumers[i];
 	unsigned long ll = c->Consume(data,tStamp,flags,this);
 	if (ll || c->valid()) {
 	    // get the minimum data amount forwarded to all consumers
 	    if (len > ll)
 		len = ll;
-	    l = l->skipNext();
 	    empty = false;
 	}
-	else {
+	else
+	    invalid = true;
+    }
+    if (empty)
+	len = 0;
+
+    lock();
+    if (invalid) {
+	for (unsigned int i = 0; i < snap->m_count; i++) {
+	    DataConsumer* c = snap->m_consumers[i];
+	    if (c->valid())
+		continue;
 	    DDebug(DebugInfo,"Consumer %p becomes invalid [%p]",c,this);
 	    detachInternal(c);
-	    // do not advance in list, we just removed the current element
-	    l = l->skipNull();
 	}
     }
-    if (empty)
-	len = 0;
     m_timestamp = tStamp;
     m_nextStamp = nSamp ? (tStamp + nSamp) : invalidStamp();
+    // the last reader of a replaced snapshot releases the consumers
+    snap->deref();
+    releaseReader(reader);
+    unlock();
     return len;
 }
 
@@ -621,6 +1098,7 @@ bool DataSource::attach(DataConsumer* consumer, bool override)
     }
     consumer->synchronize(this);
     m_consumers.append(consumer);
+    updateSnapshot();
     return true;
 }
 
@@ -633,10 +1111,14 @@ bool DataSource::detach(DataConsumer* consumer)
 	return false;
     }
     DDebug(DebugAll,"DataSource [%p] detaching consumer [%p]",this,consumer);
-    // lock the source to prevent races with the Forward method
     lock();
+    RefPointer<DataSourceSnapshot> snap = m_snapshot;
     bool ok = detachInternal(consumer);
+    // make sure no Forward is still running the consumer once we return
+    if (ok)
+	quiesce();
     unlock();
+    snap = 0;
     deref();
     return ok;
 }
@@ -653,6 +1135,7 @@ bool DataSource::detachInternal(DataConsumer* consumer)
 	if (temp->m_override == this)
 	    temp->m_override = 0;
 	s_consSrcMutex.unlock();
+	updateSnapshot();
 	temp->deref();
 	return true;
     }
@@ -660,19 +1143,147 @@ bool DataSource::detachInternal(DataConsumer* consumer)
     return false;
 }
 
+// Identity of the calling thread, threads not created by Yate have no Thread
+//  object so they are told apart by their system thread identifier
+static void* readerThread()
+{
+    Thread* thread = Thread::current();
+    if (thread)
+	return thread;
+#ifdef _WINDOWS
+    return (void*)(UINT_PTR)::GetCurrentThreadId();
+#else
+    return (void*)::pthread_self();
+#endif
+}
+
+DataSourceReader* DataSource::addReader()
+{
+    void* thread = readerThread();
+    DataSourceReader* idle = 0;
+    for (ObjList* l = m_readers.skipNull(); l; l = l->skipNext()) {
+	DataSourceReader* r = static_cast<DataSourceReader*>(l->get());
+	if (r->m_thread == thread && r->m_count) {
+	    // nested forward in the same thread
+	    r->m_count++;
+	    return r;
+	}
+	if (!(idle || r->m_count))
+	    idle = r;
+    }
+    if (idle)
+	idle->m_thread = thread;
+    else {
+	idle = new DataSourceReader(thread);
+	m_readers.append(idle);
+    }
+    idle->m_count = 1;
+    return idle;
+}
+
+void DataSource::releaseReader(DataSourceReader* reader)
+{
+    if (reader && reader->m_count)
+	reader->m_count--;
+}
+
+// Wait for other threads to finish forwarding, source must be locked
+// The calling thread may be forwarding itself, its own nesting is not waited for.
+// Readers that are waiting here from inside a consumer are not waited for either
+//  so two consumers detaching each other can't deadlock
+void DataSource::quiesce()
+{
+    void* thread = readerThread();
+    DataSourceReader* own = 0;
+    for (;;) {
+	bool busy = false;
+	for (ObjList* l = m_readers.skipNull(); l; l = l->skipNext()) {
+	    DataSourceReader* r = static_cast<DataSourceReader*>(l->get());
+	    if (!r->m_count)
+		continue;
+	    if (r->m_thread == thread)
+		own = r;
+	    else if (!r->m_waiting)
+		busy = true;
+	}
+	if (!busy)
+	    break;
+	if (own)
+	    own->m_waiting = true;
+	unlock();
+	// sleep, a yield may grab the mutex back before the forwarding thread wakes
+	Thread::msleep(1);
+	lock();
+    }
+    if (own)
+	own->m_waiting = false;
+}
+
+unsigned int DataSource::listeners(unsigned int* chains)
+{
+    Lock mylock(this);
+    unsigned int count = 0;
+    for (ObjList* l = m_consumers.skipNull(); l; l = l->skipNext()) {
+	DataTranslator* trans = YOBJECT(DataTranslator,static_cast<DataConsumer*>(l->get()));
+	if (!(trans && trans->getTransSource())) {
+	    count++;
+	    continue;
+	}
+	if (chains)
+	    (*chains)++;
+	count += trans->getTransSource()->listeners();
+    }
+    return count;
+}
+
+void DataSource::updateSnapshot()
+{
+    DataSourceSnapshot* snap = m_snapshot;
+    m_snapshot = m_consumers.skipNull() ? new DataSourceSnapshot(m_consumers) : 0;
+    TelEngine::destruct(snap);
+}
+
 void DataSource::destroyed()
 {
     m_translator = 0;
     clear();
+    lock();
+    DataVad* vad = m_vad;
+    m_vad = 0;
+    unlock();
+    delete vad;
     DataNode::destroyed();
 }
 
+bool DataSource::setVad(bool enable, unsigned int hangover)
+{
+    const FormatInfo* info = getFormat().getInfo();
+    if (enable && !vadFormat(info))
+	return false;
+    Lock mylock(this);
+    if (enable == (m_vad != 0))
+	return enable;
+    DataVad* vad = m_vad;
+    m_vad = enable ? new DataVad(info->sampleRate,hangover) : 0;
+    mylock.drop();
+    delete vad;
+    return enable;
+}
+
+bool DataSource::vad() const
+{
+    Lock mylock(const_cast<DataSource*>(this));
+    return m_vad != 0;
+}
+
 void DataSource::clear()
 {
-    // keep the source locked to prevent races with the Forward method
     lock();
+    RefPointer<DataSourceSnapshot> snap = m_snapshot;
     while (detachInternal(static_cast<DataConsumer*>(m_consumers.get())))
 	;
+    // wait for running Forward calls as the source may be going away
+    quiesce();
     unlock();
 }
 
@@ -1138,12 +1749,372 @@ bool ThreadedSource::looping(bool runConsumers) const
 }
 
 
+// Index zero builds a clock dedicated to a single source
+MediaClock::MediaClock(unsigned int index)
+    : Thread(index ? "Media Clock" : "Clocked Source",index ? Thread::High : Thread::Normal),
+      m_mutex(false,"MediaClock"), m_index(index), m_count(0),
+      m_ticks(0), m_jitter(0), m_maxJitter(0), m_busy(0), m_overruns(0)
+{
+    DDebug(DebugAll,"MediaClock::MediaClock(%u) [%p]",index,this);
+}
+
+MediaClock::~MediaClock()
+{
+    DDebug(DebugAll,"MediaClock::~MediaClock() %u [%p]",m_index,this);
+    s_clocksMutex.lock();
+    if (m_index && (s_clocks[m_index - 1] == this))
+	s_clocks[m_index - 1] = 0;
+    s_clocksMutex.unlock();
+}
+
+// Number of shared clocks, read once from the configuration
+int MediaClock::limit()
+{
+    Lock lock(s_clocksMutex);
+    if (s_clockLimit < 0) {
+	int n = Engine::config().getIntValue("telephony","media_clocks",CLOCK_THREADS);
+	s_clockLimit = (n < 0) ? 0 : ((n > CLOCK_MAX) ? CLOCK_MAX : n);
+    }
+    return s_clockLimit;
+}
+
+// Attach a source to a clock of its own if clocks are not shared, else start
+//  a new clock until the configured number runs, then use the least loaded
+MediaClock* MediaClock::pick(ClockedSource* source)
+{
+    if (!limit()) {
+	MediaClock* c = new MediaClock(0);
+	// attach first, the dedicated clock stops when it has no source
+	c->attach(source);
+	if (c->startup())
+	    return c;
+	Debug(DebugWarn,"Failed to start clocked source thread [%p]",source);
+	c->m_sources.remove(source,false);
+	delete c;
+	source->deref();
+	return 0;
+    }
+    Lock lock(s_clocksMutex);
+    MediaClock* clock = 0;
+    int free = -1;
+    for (int i = 0; i < s_clockLimit; i++) {
+	MediaClock* c = s_clocks[i];
+	if (!c) {
+	    if (free < 0)
+		free = i;
+	}
+	else if (!clock || (c->count() < clock->count()))
+	    clock = c;
+    }
+    if (!(clock && ((free < 0) || !clock->count()))) {
+	if (free < 0)
+	    return 0;
+	MediaClock* c = new MediaClock(free + 1);
+	if (c->startup()) {
+	    s_clocks[free] = c;
+	    clock = c;
+	}
+	else {
+	    Debug(DebugWarn,"Failed to start media clock thread %d",free + 1);
+	    // the destructor needs the list mutex
+	    lock.drop();
+	    delete c;
+	    if (!clock)
+		return 0;
+	}
+    }
+    clock->attach(source);
+    return clock;
+}
+
+void MediaClock::attach(ClockedSource* source)
+{
+    source->ref();
+    Lock lock(m_mutex);
+    m_sources.append(source);
+    m_count++;
+}
+
+// Wake up at absolute deadlines and let each source catch up with the tick
+void MediaClock::run()
+{
+    u_int64_t next = Time::now();
+    while (!Thread::check(false)) {
+	next += CLOCK_TICK;
+	u_int64_t now = Time::now();
+	if (now < next)
+	    Thread::usleep(next - now);
+	else if (now > next + CLOCK_BEHIND * CLOCK_TICK) {
+	    Debug(DebugMild,"Media clock %u late by %u ms, skipping ahead",
+		m_index,(unsigned int)((now - next) / 1000));
+	    next = now;
+	}
+	u_int64_t jitter = 0;
+	u_int64_t maxJitter = 0;
+	unsigned int served = 0;
+	u_int64_t start = Time::now();
+	m_mutex.lock();
+	ObjList* l = m_sources.skipNull();
+	while (l) {
+	    ClockedSource* src = static_cast<ClockedSource*>(l->get());
+	    m_mutex.unlock();
+	    // how late the source got its tick, including the ones served before
+	    u_int64_t late = Time::now() - next;
+	    jitter += late;
+	    served++;
+	    if (maxJitter < late)
+		maxJitter = late;
+	    bool keep = serve(src,next);
+	    m_mutex.lock();
+	    if (keep)
+		l = l->skipNext();
+	    else {
+		// only this thread removes sources so the list item is still valid
+		m_mutex.unlock();
+		release(l);
+		m_mutex.lock();
+		l = l->skipNull();
+	    }
+	}
+	u_int64_t busy = Time::now() - start;
+	m_ticks++;
+	if (served)
+	    m_jitter += jitter / served;
+	if (m_maxJitter < maxJitter)
+	    m_maxJitter = maxJitter;
+	m_busy += busy;
+	if (busy > CLOCK_TICK)
+	    m_overruns++;
+	bool empty = !m_sources.skipNull();
+	m_mutex.unlock();
+	if (empty && !m_index)
+	    break;
+    }
+    releaseAll();
+}
+
+void MediaClock::cleanup()
+{
+    releaseAll();
+}
+
+// Call the source until it reaches the tick, return false if it leaves the clock
+bool MediaClock::serve(ClockedSource* source, u_int64_t tick)
+{
+    if (source->m_stopping)
+	return false;
+    // a source restarts on the current tick, don't burst data after a stall
+    if (source->m_due + CLOCK_BEHIND * CLOCK_TICK < tick)
+	source->m_due = tick;
+    while (source->m_due <= tick) {
+	int dur = source->tick(source->m_due);
+	if ((dur < 0) || source->m_stopping)
+	    return false;
+	if (!dur) {
+	    source->m_due = 0;
+	    break;
+	}
+	source->m_due += dur;
+    }
+    return true;
+}
+
+// Remove the source from a list item and give it a chance to clean up
+void MediaClock::release(ObjList* item)
+{
+    m_mutex.lock();
+    ClockedSource* src = static_cast<ClockedSource*>(item->remove(false));
+    if (src)
+	m_count--;
+    m_mutex.unlock();
+    if (!src)
+	return;
+    src->lock();
+    src->m_clock = 0;
+    src->m_stopping = false;
+    src->unlock();
+    src->cleanup();
+    src->deref();
+}
+
+void MediaClock::releaseAll()
+{
+    while (m_sources.skipNull())
+	release(m_sources.skipNull());
+}
+
+void MediaClock::status(String& str)
+{
+    Lock lock(m_mutex);
+    str << "clock" << m_index << "=" << m_count << "|" << m_ticks;
+    str << "|" << (m_ticks ? m_jitter / m_ticks : 0) << "|" << m_maxJitter;
+    str << "|" << (m_ticks ? m_busy / m_ticks : 0) << "|" << m_overruns;
+}
+
+
+ClockedSource::ClockedSource(const char* format)
+    : DataSource(format),
+      m_clock(0), m_due(0), m_stopping(false)
+{
+}
+
+void ClockedSource::destroyed()
+{
+    if (m_clock)
+	Debug(DebugFail,"ClockedSource destroyed attached to clock %p [%p]",m_clock,this);
+    DataSource::destroyed();
+}
+
+bool ClockedSource::start()
+{
+    Lock mylock(this);
+    if (m_clock)
+	return !m_stopping;
+    m_due = 0;
+    m_clock = MediaClock::pick(this);
+    return (0 != m_clock);
+}
+
+void ClockedSource::stop()
+{
+    Lock mylock(this);
+    if (m_clock)
+	m_stopping = true;
+}
+
+bool ClockedSource::running() const
+{
+    Lock mylock(const_cast<ClockedSource*>(this));
+    return m_clock && !m_stopping;
+}
+
+void ClockedSource::cleanup()
+{
+}
+
+bool ClockedSource::looping(bool runConsumers) const
+{
+    Lock mylock(const_cast<ClockedSource*>(this));
+    if ((refcount() <= 1) && !(runConsumers && alive() && m_consumers.count()))
+	return false;
+    return m_clock && !m_stopping && !Engine::exiting();
+}
+
+unsigned int ClockedSource::tickPeriod()
+{
+    return CLOCK_TICK;
+}
+
+bool ClockedSource::sharedClocks()
+{
+    return MediaClock::limit() > 0;
+}
+
+unsigned int ClockedSource::clockStatus(String& str)
+{
+    Lock lock(s_clocksMutex);
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < CLOCK_MAX; i++) {
+	if (!s_clocks[i])
+	    continue;
+	if (str)
+	    str << ",";
+	s_clocks[i]->status(str);
+	n++;
+    }
+    return n;
+}
+
+
+DataVad::DataVad(unsigned int rate, unsigned int hangover)
+    : m_hangover(rate * hangover / 1000), m_remain(m_hangover),
+      m_energy2(0), m_noise2(VAD_MIN_NOISE), m_speech(true),
+      m_frames(0), m_silent(0), m_flushFrames(0), m_flushSilent(0)
+{
+}
+
+DataVad::~DataVad()
+{
+    flush();
+}
+
+void DataVad::reset()
+{
+    m_remain = m_hangover;
+    m_energy2 = 0;
+    m_noise2 = VAD_MIN_NOISE;
+    m_speech = true;
+}
+
+bool DataVad::process(const DataBlock& data)
+{
+    unsigned int n = data.length() / 2;
+    const int16_t* s = (const int16_t*)data.data();
+    if (!(n && s))
+	return m_speech;
+    u_int64_t sum = 0;
+    for (unsigned int i = 0; i < n; i++)
+	sum += (unsigned int)((int)s[i] * s[i]);
+    m_energy2 = (unsigned int)(sum / n);
+    // noise follows quiet frames at once and rises slowly during signal
+    if (m_energy2 < m_noise2)
+	m_noise2 = (m_energy2 > VAD_MIN_NOISE) ? m_energy2 : VAD_MIN_NOISE;
+    else if (m_noise2 < VAD_MAX_SILENCE)
+	m_noise2 += 1 + (m_noise2 >> VAD_SHIFT_RAISE);
+    // signal is at least 3dB above noise or loud anyway
+    if ((m_energy2 > VAD_MAX_SILENCE) || (m_energy2 > (m_noise2 << 1))) {
+	m_remain = m_hangover;
+	m_speech = true;
+    }
+    else {
+	m_speech = (m_remain != 0);
+	m_remain = (m_remain > n) ? (m_remain - n) : 0;
+    }
+    m_frames++;
+    m_flushFrames++;
+    if (!m_speech) {
+	m_silent++;
+	m_flushSilent++;
+    }
+    if (m_flushFrames >= VAD_FLUSH)
+	flush();
+    return m_speech;
+}
+
+// Add the local counters to the global ones, done in batches to keep the lock cold
+void DataVad::flush()
+{
+    if (!m_flushFrames)
+	return;
+    Lock lock(s_vadMutex);
+    s_vadFrames += m_flushFrames;
+    s_vadSilent += m_flushSilent;
+    m_flushFrames = m_flushSilent = 0;
+}
+
+void DataVad::statistics(u_int64_t& frames, u_int64_t& silent)
+{
+    Lock lock(s_vadMutex);
+    frames = s_vadFrames;
+    silent = s_vadSilent;
+}
+
+unsigned int DataVad::maxSilence()
+{
+    return VAD_MAX_SILENCE;
+}
+
+
 DataTranslator::DataTranslator(const char* sFormat, const char* dFormat)
     : DataConsumer(sFormat)
 {
     DDebug(DebugAll,"DataTranslator::DataTranslator('%s','%s') [%p]",sFormat,dFormat,this);
     m_tsource = new DataSource(dFormat);
     m_tsource->setTranslator(this);
+    // decoders mark the silence so the rest of the chain can skip it
+    const FormatInfo* info = m_format.getInfo();
+    if (info && !info->converter && Engine::config().getBoolValue("telephony","vad"))
+	m_tsource->setVad(true,Engine::config().getIntValue("telephony","vad_hangover",200,20,2000));
 }
 
 DataTranslator::DataTranslator(const char* sFormat, DataSource* source)
@@ -1227,6 +2198,8 @@ void DataTranslator::install(TranslatorFactory* factory)
 	return;
     s_factories.append(factory)->setDelete(false);
     s_compose.append(factory)->setDelete(false);
+    // a new factory may provide cheaper chains
+    flushChains(false);
 }
 
 void DataTranslator::compose()
@@ -1330,10 +2303,22 @@ void DataTranslator::uninstall(TranslatorFactory* factory)
     s_mutex.lock();
     s_compose.remove(factory,false);
     s_factories.remove(factory,false);
-    // notify chained factories about the removal
+    s_chainMutex.lock();
+    s_chainHold++;
+    s_chainMutex.unlock();
+    flushChains(false);
+    s_mutex.unlock();
+    // creations from the cache may still use this factory or chains built on it,
+    //  they run without the mutex and may need it to build chained translators
+    flushChains(true);
+    // notify chained factories about the removal only after they are no longer used
+    s_mutex.lock();
     ListIterator iter(s_factories);
     while (TranslatorFactory* f = static_cast<TranslatorFactory*>(iter.get()))
 	f->removed(factory);
+    s_chainMutex.lock();
+    s_chainHold--;
+    s_chainMutex.unlock();
     s_mutex.unlock();
 }
 
@@ -1505,26 +2490,58 @@ bool DataTranslator::canConvert(const FormatInfo* fmt1, const FormatInfo* fmt2)
     return false;
 }
 
-int DataTranslator::cost(const DataFormat& sFormat, const DataFormat& dFormat)
+TranslatorFactory* DataTranslator::bestFactory(const FormatInfo* src, const FormatInfo* dest, int& cost)
 {
-    int c = -1;
-    const FormatInfo* src = sFormat.getInfo();
-    const FormatInfo* dest = dFormat.getInfo();
-    if (!(src && dest))
-	return c;
-    s_mutex.lock();
-    compose();
+    TranslatorFactory* best = 0;
+    cost = -1;
     ObjList* l = s_factories.skipNull();
     for (; l; l=l->skipNext()) {
 	TranslatorFactory* f = static_cast<TranslatorFactory*>(l->get());
 	const TranslatorCaps* caps = f->getCapabilities();
 	for (; caps && caps->src && caps->dest; caps++) {
-	    if ((c == -1) || (c > caps->cost)) {
-		if ((caps->src == src) && (caps->dest == dest))
-		    c = caps->cost;
+	    if ((cost == -1) || (cost > caps->cost)) {
+		if ((caps->src == src) && (caps->dest == dest)) {
+		    cost = caps->cost;
+		    best = f;
+		}
 	    }
 	}
     }
+    return best;
+}
+
+unsigned int DataTranslator::chainCache(u_int64_t& hits, u_int64_t& misses)
+{
+    Lock lock(s_chainMutex);
+    hits = s_chainHits;
+    misses = s_chainMisses;
+    return s_chainCount;
+}
+
+int DataTranslator::cost(const DataFormat& sFormat, const DataFormat& dFormat)
+{
+    int c = -1;
+    const FormatInfo* src = sFormat.getInfo();
+    const FormatInfo* dest = dFormat.getInfo();
+    if (!(src && dest))
+	return c;
+    s_chainMutex.lock();
+    ChainEntry* e = findChain(src,dest);
+    if (e) {
+	s_chainHits++;
+	c = e->m_cost;
+    }
+    else
+	s_chainMisses++;
+    s_chainMutex.unlock();
+    if (e)
+	return c;
+    s_mutex.lock();
+    compose();
+    TranslatorFactory* f = bestFactory(src,dest,c);
+    // only creation may prove that no factory at all can convert
+    if (f)
+	storeChain(src,dest,f,c);
     s_mutex.unlock();
     return c;
 }
@@ -1540,21 +2557,81 @@ DataTranslator* DataTranslator::create(const DataFormat& sFormat, const DataForm
     bool counting = getObjCounting();
     NamedCounter* saved = Thread::getCurrentObjCounter(counting);
 
-    s_mutex.lock();
-    compose();
-    ObjList *l = s_factories.skipNull();
-    for (; l; l=l->skipNext()) {
-	TranslatorFactory* f = static_cast<TranslatorFactory*>(l->get());
-	if (counting)
-	    Thread::setCurrentObjCounter(f->objectsCounter());
-	trans = f->create(sFormat,dFormat);
-	if (trans) {
+    const FormatInfo* src = sFormat.getInfo();
+    const FormatInfo* dest = dFormat.getInfo();
+    bool cached = false;
+    bool search = true;
+    if (src && dest) {
+	// fast path, no need to lock the factory list
+	TranslatorFactory* f = 0;
+	s_chainMutex.lock();
+	ChainEntry* e = findChain(src,dest);
+	if (e) {
+	    s_chainHits++;
+	    cached = true;
+	    f = e->m_factory;
+	    if (f)
+		s_chainBusy++;
+	}
+	else
+	    s_chainMisses++;
+	s_chainMutex.unlock();
+	if (f) {
+	    if (counting)
+		Thread::setCurrentObjCounter(f->objectsCounter());
+	    trans = f->create(sFormat,dFormat);
+	    s_chainMutex.lock();
+	    s_chainBusy--;
+	    s_chainMutex.unlock();
+	    if (trans)
+		Debug(DebugAll,"Created DataTranslator %p for '%s' -> '%s' by cached factory %p (len=%u)",
+		    trans,sFormat.c_str(),dFormat.c_str(),f,f->length());
+	}
+	else if (cached)
+	    search = false;
+    }
+
+    if (search && !trans) {
+	s_mutex.lock();
+	compose();
+	int c = -1;
+	TranslatorFactory* best = 0;
+	if (src && dest) {
+	    // try the cheapest factory first
+	    best = bestFactory(src,dest,c);
+	    if (best) {
+		if (counting)
+		    Thread::setCurrentObjCounter(best->objectsCounter());
+		trans = best->create(sFormat,dFormat);
+	    }
+	}
+	if (trans)
 	    Debug(DebugAll,"Created DataTranslator %p for '%s' -> '%s' by factory %p (len=%u)",
-		trans,sFormat.c_str(),dFormat.c_str(),f,f->length());
-	    break;
+		trans,sFormat.c_str(),dFormat.c_str(),best,best->length());
+	else {
+	    best = 0;
+	    ObjList *l = s_factories.skipNull();
+	    for (; l; l=l->skipNext()) {
+		TranslatorFactory* f = static_cast<TranslatorFactory*>(l->get());
+		if (counting)
+		    Thread::setCurrentObjCounter(f->objectsCounter());
+		trans = f->create(sFormat,dFormat);
+		if (trans) {
+		    Debug(DebugAll,"Created DataTranslator %p for '%s' -> '%s' by factory %p (len=%u)",
+			trans,sFormat.c_str(),dFormat.c_str(),f,f->length());
+		    best = f;
+		    // remember what this factory costs, not the failed cheapest one
+		    if (src && dest)
+			c = factoryCost(f,src,dest);
+		    break;
+		}
+	    }
 	}
+	// don't remember a failure of a factory that claims it can convert
+	if (src && dest && !cached && (best || (c < 0)))
+	    storeChain(src,dest,best,c);
+	s_mutex.unlock();
     }
-    s_mutex.unlock();
     if (counting)
 	Thread::setCurrentObjCounter(saved);
 
@@ -1587,6 +2664,13 @@ bool DataTranslator::attachChain(DataSource* source, DataConsumer* consumer, boo
 	source->attach(consumer,override);
 	retv = true;
     }
+    else if (DataSource* shared = (override || !source->shareTranslators()) ? 0 :
+	    sharedChain(source,consumer->getFormat())) {
+	// reuse the chain already converting to the same format
+	shared->attach(consumer);
+	shared->deref();
+	retv = true;
+    }
     else {
 	// then try to create a translator or chain of them
 	DataTranslator* trans2 = create(source->getFormat(),consumer->getFormat());
@@ -1620,7 +2704,12 @@ bool DataTranslator::detachChain(DataSource* source, DataConsumer* consumer)
 	    return true;
 	tsource->lock();
 	RefPointer<DataTranslator> trans = tsource->getTranslator();
+	// keep a chain shared with other consumers
+	bool shared = trans && tsource->m_consumers.find(consumer)
+	    && (tsource->m_consumers.count() > 1);
 	tsource->unlock();
+	if (shared && tsource->detach(consumer))
+	    return true;
 	if (trans && detachChain(source,trans))
 	    return true;
 	Debug(DebugWarn,"DataTranslator failed to detach chain [%p] -> [%p]",source,consumer);
@@ -1629,6 +2718,32 @@ bool DataTranslator::detachChain(DataSource* source, DataConsumer* consumer)
 }
 
 
+// Find the end of a translator chain attached to a source converting to a format
+// Returns a referenced source or NULL
+DataSource* DataTranslator::sharedChain(DataSource* source, const DataFormat& format)
+{
+    Lock mylock(source);
+    for (ObjList* l = source->m_consumers.skipNull(); l; l = l->skipNext()) {
+	DataTranslator* trans = YOBJECT(DataTranslator,static_cast<DataConsumer*>(l->get()));
+	DataSource* tsource = trans ? trans->getTransSource() : 0;
+	// follow the chain, inner sources feed only the next translator
+	while (tsource) {
+	    Lock lck(tsource);
+	    ObjList* c = tsource->m_consumers.skipNull();
+	    if (!c || c->skipNext())
+		break;
+	    trans = YOBJECT(DataTranslator,static_cast<DataConsumer*>(c->get()));
+	    if (!(trans && trans->getTransSource()))
+		break;
+	    tsource = trans->getTransSource();
+	}
+	if (tsource && (tsource->getFormat() == format) && tsource->ref())
+	    return tsource;
+    }
+    return 0;
+}
+
+
 TranslatorFactory::~TranslatorFactory()
 {
     DataTranslator::uninstall(this);
@@ -1800,4 +2915,109 @@ DataTranslator* ChainedFactory::create(const DataFormat& sFormat, const DataForm
     return trans2;
 }
 
+
+DataCodecPool::DataCodecPool(const char* name, unsigned int limit)
+    : m_name(name), m_mutex(false,"DataCodecPool"),
+      m_count(0), m_limit(limit),
+      m_reused(0), m_created(0), m_dropped(0)
+{
+    Lock lock(s_codecPoolsMutex);
+    s_codecPools.append(this)->setDelete(false);
+}
+
+DataCodecPool::~DataCodecPool()
+{
+    s_codecPoolsMutex.lock();
+    s_codecPools.remove(this,false);
+    s_codecPoolsMutex.unlock();
+    clear();
+}
+
+DataCodecState* DataCodecPool::get(const String& kind)
+{
+    Lock lock(m_mutex);
+    DataCodecState* state = static_cast<DataCodecState*>(m_idle.remove(kind,false));
+    if (state) {
+	m_count--;
+	m_reused++;
+    }
+    else
+	m_created++;
+    return state;
+}
+
+void DataCodecPool::put(DataCodecState* state)
+{
+    if (!state)
+	return;
+    // reset outside the lock, it may be expensive
+    if (m_limit && state->reset()) {
+	Lock lock(m_mutex);
+	if (m_count < m_limit) {
+	    // most recently used first, its memory is more likely cached
+	    m_idle.insert(state);
+	    m_count++;
+	    return;
+	}
+    }
+    m_mutex.lock();
+    m_dropped++;
+    m_mutex.unlock();
+    TelEngine::destruct(state);
+}
+
+void DataCodecPool::clear()
+{
+    m_mutex.lock();
+    ObjList tmp;
+    while (GenObject* o = m_idle.remove(false))
+	tmp.append(o);
+    m_count = 0;
+    m_mutex.unlock();
+}
+
+void DataCodecPool::configure()
+{
+    const NamedList* sect = Engine::config().getSection(YSTRING("telephony"));
+    int lim = m_limit;
+    if (sect) {
+	lim = sect->getIntValue(YSTRING("codec_pool"),lim,0,100000);
+	lim = sect->getIntValue("codec_pool_" + m_name,lim,0,100000);
+    }
+    limit(lim);
+}
+
+void DataCodecPool::limit(unsigned int limit)
+{
+    ObjList tmp;
+    Lock lock(m_mutex);
+    m_limit = limit;
+    while (m_count > m_limit) {
+	GenObject* o = m_idle[m_idle.count() - 1];
+	if (!o)
+	    break;
+	tmp.append(m_idle.remove(o,false));
+	m_count--;
+	m_dropped++;
+    }
+}
+
+void DataCodecPool::status(String& str)
+{
+    Lock lock(m_mutex);
+    str << m_name << "=" << m_count << "|" << m_limit << "|" << m_reused
+	<< "|" << m_created << "|" << m_dropped;
+}
+
+unsigned int DataCodecPool::statusAll(String& str)
+{
+    Lock lock(s_codecPoolsMutex);
+    for (ObjList* l = s_codecPools.skipNull(); l; l = l->skipNext()) {
+	if (str)
+	    str << ",";
+	static_cast<DataCodecPool*>(l->get())->status(str);
+    }
+    return s_codecPools.count();
+}
+
 /* vi: set ts=8 sw=4 sts=4 noet: */
@@ -17,7 +17,7 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
  */
 
-#include "yatengine.h"
+#include "yatephone.h"
 #include "yateversn.h"
 
 #ifdef _WINDOWS
@@ -528,6 +528,38 @@ bool EngineStatusHandler::received(Message &msg)
 		objects(msg.retValue(),details);
 	    return true;
 	}
+	if (sel == YSTRING("codecs")) {
+	    String str;
+	    unsigned int n = DataCodecPool::statusAll(str);
+	    msg.retValue() << "name=codecs,type=system";
+	    msg.retValue() << ",format=Idle|Limit|Reused|Created|Dropped";
+	    msg.retValue() << ";pools=" << n;
+	    if (details)
+		msg.retValue().append(str,";");
+	    msg.retValue() << "\r\n";
+	    return true;
+	}
+	if (sel == YSTRING("mediaclock")) {
+	    String str;
+	    unsigned int n = ClockedSource::clockStatus(str);
+	    msg.retValue() << "name=mediaclock,type=system";
+	    msg.retValue() << ",format=Sources|Ticks|Jitter|MaxJitter|Busy|Overruns";
+	    msg.retValue() << ";clocks=" << n << ",tick=" << ClockedSource::tickPeriod();
+	    if (details)
+		msg.retValue().append(str,";");
+	    msg.retValue() << "\r\n";
+	    return true;
+	}
+	if (sel == YSTRING("vad")) {
+	    u_int64_t frames = 0;
+	    u_int64_t silent = 0;
+	    DataVad::statistics(frames,silent);
+	    msg.retValue() << "name=vad,type=system";
+	    msg.retValue() << ";frames=" << frames << ",silent=" << silent;
+	    msg.retValue() << ",percent=" << (unsigned int)(frames ? (silent * 100 / frames) : 0);
+	    msg.retValue() << "\r\n";
+	    return true;
+	}
 	return false;
     }
     msg.retValue() << "name=engine,type=system";
@@ -562,6 +594,11 @@ bool EngineStatusHandler::received(Message &msg)
 	msg.retValue() << ",waiting=" << locks;
     msg.retValue() << ",acceptcalls=" << lookup(Engine::accept(),Engine::getCallAcceptStates());
     msg.retValue() << ",congestion=" << Engine::getCongestion();
+    u_int64_t hits, misses;
+    msg.retValue() << ",chains=" << DataTranslator::chainCache(hits,misses);
+    msg.retValue() << ",chainhits=" << hits << ",chainmisses=" << misses;
+    if (hits + misses)
+	msg.retValue() << ",chainhitrate=" << (unsigned int)(hits * 100 / (hits + misses));
     if (details) {
 	NamedIterator iter(Engine::runParams());
 	char sep = ';';
@@ -740,6 +777,9 @@ void EngineCommand::doCompletion(Message &msg, const String& partLine, const Str
     else if (partLine == YSTRING("status")) {
 	completeOne(msg.retValue(),"engine",partWord);
 	completeOne(msg.retValue(),"objects",partWord);
+	completeOne(msg.retValue(),"codecs",partWord);
+	completeOne(msg.retValue(),"mediaclock",partWord);
+	completeOne(msg.retValue(),"vad",partWord);
     }
     else if (partLine == YSTRING("status objects")) {
 	for (ObjList* l = getObjCounters().skipNull();l;l = l->skipNext())
@@ -20,6 +20,24 @@
 #include "yatemath.h"
 #include <stdio.h>
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// SSE2 kernels are used when the build targets them, AVX ones are compiled
+//  separately and picked at run time if the CPU supports them.
+// Scalar code is always there for the remaining elements
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define YMATH_SSE
+#include <emmintrin.h>
+#endif
+#if defined(YMATH_SSE) && defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+    ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define YMATH_AVX
+#include <immintrin.h>
+#define AVX_TARGET __attribute__((target("avx")))
+#endif
+
 using namespace TelEngine;
 
 #ifdef DEBUG
@@ -309,6 +327,268 @@ String& BitVector::appendTo(String& buf, unsigned int offs, int len) const
 }
 
 
+#ifdef YMATH_SSE
+// Sign masks of the real or imaginary parts of 2 packed complex numbers
+static inline __m128 signRe2()
+{
+    return _mm_castsi128_ps(_mm_set_epi32(0,0x80000000,0,0x80000000));
+}
+
+static inline __m128 signIm2()
+{
+    return _mm_castsi128_ps(_mm_set_epi32(0x80000000,0,0x80000000,0));
+}
+
+// Multiply 2 pairs of packed complex numbers
+static inline __m128 cmul2(__m128 a, __m128 b)
+{
+    __m128 re = _mm_shuffle_ps(b,b,_MM_SHUFFLE(2,2,0,0));
+    __m128 im = _mm_shuffle_ps(b,b,_MM_SHUFFLE(3,3,1,1));
+    __m128 sw = _mm_shuffle_ps(a,a,_MM_SHUFFLE(2,3,0,1));
+    sw = _mm_xor_ps(_mm_mul_ps(sw,im),signRe2());
+    return _mm_add_ps(_mm_mul_ps(a,re),sw);
+}
+
+// Swap real and imaginary parts then negate the ones selected by the mask
+// This multiplies by -j with the imaginary mask and by j with the real one
+static inline __m128 rot2(__m128 a, __m128 sign)
+{
+    return _mm_xor_ps(_mm_shuffle_ps(a,a,_MM_SHUFFLE(2,3,0,1)),sign);
+}
+
+// Add together the 4 floats in a register
+static inline float hsum4(__m128 a)
+{
+    a = _mm_add_ps(a,_mm_movehl_ps(a,a));
+    a = _mm_add_ss(a,_mm_shuffle_ps(a,a,_MM_SHUFFLE(1,1,1,1)));
+    return _mm_cvtss_f32(a);
+}
+#endif
+
+#ifdef YMATH_AVX
+static bool avxSupported()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx");
+}
+
+static const bool s_avxBest = avxSupported();
+static bool s_avx = s_avxBest;
+
+// Multiply 4 pairs of packed complex numbers
+AVX_TARGET static inline __m256 cmul4(__m256 a, __m256 b)
+{
+    __m256 sw = _mm256_permute_ps(a,_MM_SHUFFLE(2,3,0,1));
+    return _mm256_addsub_ps(_mm256_mul_ps(a,_mm256_moveldup_ps(b)),
+	_mm256_mul_ps(sw,_mm256_movehdup_ps(b)));
+}
+
+AVX_TARGET static inline __m128 fold8(__m256 a)
+{
+    return _mm_add_ps(_mm256_castps256_ps128(a),_mm256_extractf128_ps(a,1));
+}
+
+// The AVX kernels handle the multiples of the register width and return
+//  how many elements they processed, the rest is left to the caller
+AVX_TARGET static unsigned int avxDot(__m128& acc, const Complex* a, const Complex* b,
+    unsigned int len)
+{
+    __m256 acc8 = _mm256_setzero_ps();
+    unsigned int i = 0;
+    for (; i + 4 <= len; i += 4)
+	acc8 = _mm256_add_ps(acc8,cmul4(_mm256_loadu_ps((const float*)(a + i)),
+	    _mm256_loadu_ps((const float*)(b + i))));
+    acc = fold8(acc8);
+    return i;
+}
+
+AVX_TARGET static unsigned int avxDot(__m128& acc, const float* a, const float* b,
+    unsigned int len)
+{
+    __m256 acc8 = _mm256_setzero_ps();
+    unsigned int i = 0;
+    for (; i + 8 <= len; i += 8)
+	acc8 = _mm256_add_ps(acc8,_mm256_mul_ps(_mm256_loadu_ps(a + i),_mm256_loadu_ps(b + i)));
+    acc = fold8(acc8);
+    return i;
+}
+
+AVX_TARGET static unsigned int avxMulAcc(Complex* dest, const Complex* a, const Complex* b,
+    unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i + 4 <= len; i += 4)
+	_mm256_storeu_ps((float*)(dest + i),_mm256_add_ps(_mm256_loadu_ps((float*)(dest + i)),
+	    cmul4(_mm256_loadu_ps((const float*)(a + i)),_mm256_loadu_ps((const float*)(b + i)))));
+    return i;
+}
+#endif
+
+
+//
+// FFT
+//
+FFT::FFT(unsigned int length)
+    : m_length(0), m_swap(0), m_swaps(0), m_twiddle(0)
+{
+    setup(length);
+}
+
+FFT::~FFT()
+{
+    clear();
+}
+
+void FFT::clear()
+{
+    delete[] m_swap;
+    delete[] m_twiddle;
+    m_swap = 0;
+    m_twiddle = 0;
+    m_swaps = 0;
+    m_length = 0;
+}
+
+bool FFT::setup(unsigned int length)
+{
+    if (length == m_length)
+	return true;
+    if (length && ((length < 2) || (length & (length - 1))))
+	return false;
+    clear();
+    if (!length)
+	return true;
+    unsigned int bits = 0;
+    while ((1U << bits) < length)
+	bits++;
+    // index pairs exchanged by the bit reversed permutation of the input
+    m_swap = new unsigned int[length];
+    for (unsigned int i = 0; i < length; i++) {
+	unsigned int rev = 0;
+	for (unsigned int b = 0, v = i; b < bits; b++, v >>= 1)
+	    rev = (rev << 1) | (v & 1);
+	if (i < rev) {
+	    m_swap[2 * m_swaps] = i;
+	    m_swap[2 * m_swaps + 1] = rev;
+	    m_swaps++;
+	}
+    }
+    // each radix-4 pass of quarter block h keeps W^k, W^2k and W^3k for k < h
+    unsigned int n = 0;
+    for (unsigned int h = (bits & 1) ? 2 : 1; 4 * h <= length; h *= 4)
+	n += 3 * h;
+    m_twiddle = new Complex[n ? n : 1];
+    Complex* w = m_twiddle;
+    for (unsigned int h = (bits & 1) ? 2 : 1; 4 * h <= length; h *= 4) {
+	for (unsigned int m = 1; m <= 3; m++) {
+	    for (unsigned int k = 0; k < h; k++, w++) {
+		double a = -2 * M_PI * m * k / (4 * h);
+		w->set((float)::cos(a),(float)::sin(a));
+	    }
+	}
+    }
+    m_length = length;
+    return true;
+}
+
+// Radix-4 decimation in time pass combining 4 transforms of length h
+static void fftPass4(Complex* data, unsigned int len, unsigned int h, const Complex* w,
+    bool inverse)
+{
+    const Complex* w1 = w;
+    const Complex* w2 = w + h;
+    const Complex* w3 = w + 2 * h;
+    for (Complex* blk = data; blk < data + len; blk += 4 * h) {
+	Complex* a = blk;
+	Complex* b = blk + h;
+	Complex* c = blk + 2 * h;
+	Complex* d = blk + 3 * h;
+	unsigned int k = 0;
+#ifdef YMATH_SSE
+	if (h >= 2) {
+	    __m128 conj = inverse ? signIm2() : _mm_setzero_ps();
+	    __m128 rot = inverse ? signRe2() : signIm2();
+	    for (; k < h; k += 2) {
+		__m128 va = _mm_loadu_ps((float*)(a + k));
+		__m128 vb = cmul2(_mm_loadu_ps((float*)(b + k)),
+		    _mm_xor_ps(_mm_loadu_ps((const float*)(w2 + k)),conj));
+		__m128 vc = cmul2(_mm_loadu_ps((float*)(c + k)),
+		    _mm_xor_ps(_mm_loadu_ps((const float*)(w1 + k)),conj));
+		__m128 vd = cmul2(_mm_loadu_ps((float*)(d + k)),
+		    _mm_xor_ps(_mm_loadu_ps((const float*)(w3 + k)),conj));
+		__m128 t0 = _mm_add_ps(va,vb);
+		__m128 t1 = _mm_sub_ps(va,vb);
+		__m128 t2 = _mm_add_ps(vc,vd);
+		__m128 t3 = rot2(_mm_sub_ps(vc,vd),rot);
+		_mm_storeu_ps((float*)(a + k),_mm_add_ps(t0,t2));
+		_mm_storeu_ps((float*)(b + k),_mm_add_ps(t1,t3));
+		_mm_storeu_ps((float*)(c + k),_mm_sub_ps(t0,t2));
+		_mm_storeu_ps((float*)(d + k),_mm_sub_ps(t1,t3));
+	    }
+	}
+#endif
+	for (; k < h; k++) {
+	    Complex x1 = w1[k];
+	    Complex x2 = w2[k];
+	    Complex x3 = w3[k];
+	    if (inverse) {
+		x1.im(-x1.im());
+		x2.im(-x2.im());
+		x3.im(-x3.im());
+	    }
+	    Complex vb = b[k] * x2;
+	    Complex vc = c[k] * x1;
+	    Complex vd = d[k] * x3;
+	    Complex t0 = a[k] + vb;
+	    Complex t1 = a[k] - vb;
+	    Complex t2 = vc + vd;
+	    Complex t3 = vc - vd;
+	    // multiply by -j for the forward transform, by j for the inverse
+	    if (inverse)
+		t3.set(-t3.im(),t3.re());
+	    else
+		t3.set(t3.im(),-t3.re());
+	    a[k] = t0 + t2;
+	    b[k] = t1 + t3;
+	    c[k] = t0 - t2;
+	    d[k] = t1 - t3;
+	}
+    }
+}
+
+bool FFT::transform(Complex* data, bool inverse) const
+{
+    if (!(data && m_length))
+	return false;
+    for (unsigned int i = 0; i < m_swaps; i++) {
+	Complex tmp = data[m_swap[2 * i]];
+	data[m_swap[2 * i]] = data[m_swap[2 * i + 1]];
+	data[m_swap[2 * i + 1]] = tmp;
+    }
+    unsigned int h = 1;
+    if (m_length & 0xaaaaaaaa) {
+	// odd power of 2, start with transforms of length 2
+	for (Complex* d = data; d < data + m_length; d += 2) {
+	    Complex tmp = d[0];
+	    d[0] += d[1];
+	    d[1] = tmp - d[1];
+	}
+	h = 2;
+    }
+    const Complex* w = m_twiddle;
+    for (; 4 * h <= m_length; h *= 4) {
+	fftPass4(data,m_length,h,w,inverse);
+	w += 3 * h;
+    }
+    if (inverse) {
+	float scale = 1.0f / m_length;
+	for (Complex* d = data; d < data + m_length; d++)
+	    *d *= scale;
+    }
+    return true;
+}
+
+
 //
 // Math
 //
@@ -342,4 +622,127 @@ String& Math::dumpFloat(String& dest, const float& val, const char* sep,
     return dest.append(s,sep);
 }
 
+const char* Math::vectorKernels(bool avx)
+{
+#ifdef YMATH_AVX
+    s_avx = avx && s_avxBest;
+    if (s_avx)
+	return "avx";
+#endif
+#ifdef YMATH_SSE
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+// Sum of products of complex numbers
+Complex Math::dot(const Complex* a, const Complex* b, unsigned int len)
+{
+    Complex sum;
+    if (!(a && b))
+	return sum;
+    unsigned int i = 0;
+#ifdef YMATH_SSE
+    __m128 acc = _mm_setzero_ps();
+#endif
+#ifdef YMATH_AVX
+    if (s_avx)
+	i = avxDot(acc,a,b,len);
+#endif
+#ifdef YMATH_SSE
+    // two sums hide the latency of the additions
+    __m128 acc2 = _mm_setzero_ps();
+    for (; i + 4 <= len; i += 4) {
+	acc = _mm_add_ps(acc,cmul2(_mm_loadu_ps((const float*)(a + i)),
+	    _mm_loadu_ps((const float*)(b + i))));
+	acc2 = _mm_add_ps(acc2,cmul2(_mm_loadu_ps((const float*)(a + i + 2)),
+	    _mm_loadu_ps((const float*)(b + i + 2))));
+    }
+    for (; i + 2 <= len; i += 2)
+	acc = _mm_add_ps(acc,cmul2(_mm_loadu_ps((const float*)(a + i)),
+	    _mm_loadu_ps((const float*)(b + i))));
+    acc = _mm_add_ps(acc,acc2);
+    float tmp[4];
+    _mm_storeu_ps(tmp,acc);
+    sum.set(tmp[0] + tmp[2],tmp[1] + tmp[3]);
+#endif
+    for (; i < len; i++)
+	sum += a[i] * b[i];
+    return sum;
+}
+
+// Dot product of float vectors
+float Math::dot(const float* a, const float* b, unsigned int len)
+{
+    if (!(a && b))
+	return 0;
+    float sum = 0;
+    unsigned int i = 0;
+#ifdef YMATH_SSE
+    __m128 acc = _mm_setzero_ps();
+#endif
+#ifdef YMATH_AVX
+    if (s_avx)
+	i = avxDot(acc,a,b,len);
+#endif
+#ifdef YMATH_SSE
+    for (; i + 4 <= len; i += 4)
+	acc = _mm_add_ps(acc,_mm_mul_ps(_mm_loadu_ps(a + i),_mm_loadu_ps(b + i)));
+    sum = hsum4(acc);
+#endif
+    for (; i < len; i++)
+	sum += a[i] * b[i];
+    return sum;
+}
+
+// Complex multiply and accumulate
+void Math::mulAcc(Complex* dest, const Complex* a, const Complex* b, unsigned int len)
+{
+    if (!(dest && a && b))
+	return;
+    unsigned int i = 0;
+#ifdef YMATH_AVX
+    if (s_avx)
+	i = avxMulAcc(dest,a,b,len);
+#endif
+#ifdef YMATH_SSE
+    for (; i + 2 <= len; i += 2)
+	_mm_storeu_ps((float*)(dest + i),_mm_add_ps(_mm_loadu_ps((float*)(dest + i)),
+	    cmul2(_mm_loadu_ps((const float*)(a + i)),_mm_loadu_ps((const float*)(b + i)))));
+#endif
+    for (; i < len; i++)
+	dest[i] += a[i] * b[i];
+}
+
+// Magnitudes of complex numbers
+void Math::norm(float* dest, const Complex* src, unsigned int len)
+{
+    if (!(dest && src))
+	return;
+    unsigned int i = 0;
+#ifdef YMATH_SSE
+    // all sources are loaded before storing so it can be done in place
+    for (; i + 4 <= len; i += 4) {
+	__m128 p = _mm_loadu_ps((const float*)(src + i));
+	__m128 q = _mm_loadu_ps((const float*)(src + i + 2));
+	p = _mm_mul_ps(p,p);
+	q = _mm_mul_ps(q,q);
+	__m128 n = _mm_add_ps(_mm_shuffle_ps(p,q,_MM_SHUFFLE(2,0,2,0)),
+	    _mm_shuffle_ps(p,q,_MM_SHUFFLE(3,1,3,1)));
+	_mm_storeu_ps(dest + i,_mm_sqrt_ps(n));
+    }
+#endif
+    for (; i < len; i++)
+	dest[i] = src[i].norm();
+}
+
+// Energy of a complex buffer
+float Math::power(const Complex* data, unsigned int len)
+{
+    if (!data)
+	return 0;
+    return dot((const float*)data,(const float*)data,2 * len);
+}
+
 /* vi: set ts=8 sw=4 sts=4 noet: */
@@ -289,6 +289,28 @@ const unsigned char* SHA1::rawDigest()
     return m_bin;
 }
 
+bool SHA1::hmacDigest(unsigned char* digest, const SHA1& ipad, const SHA1& opad,
+    const void* data, unsigned int len, const void* extra, unsigned int extraLen)
+{
+    if (!(digest && ipad.m_private && opad.m_private) || ipad.m_hex || opad.m_hex)
+	return false;
+    if ((len && !data) || (extraLen && !extra))
+	return false;
+    // work on stack copies so the pad states can be reused
+    sha1_ctx ctx;
+    ::memcpy(&ctx,ipad.m_private,sizeof(ctx));
+    if (len)
+	sha1_update(&ctx,(const u_int8_t*)data,len);
+    if (extraLen)
+	sha1_update(&ctx,(const u_int8_t*)extra,extraLen);
+    u_int8_t inner[SHA1_DIGEST_SIZE];
+    sha1_final(&ctx,inner);
+    ::memcpy(&ctx,opad.m_private,sizeof(ctx));
+    sha1_update(&ctx,inner,sizeof(inner));
+    sha1_final(&ctx,(u_int8_t*)digest);
+    return true;
+}
+
 // NIST FIPS 186-2 change notice 1 PRF with 160 bit SHA1 function G(t,c)
 bool SHA1::fips186prf(DataBlock& out, const DataBlock& seed, unsigned int len)
 {
@@ -22,20 +22,29 @@
 
 using namespace TelEngine;
 
+// Number of packets over which the late loss rate is evaluated
+#define LATE_WINDOW 50
+// Late loss percent above which the playout delay is increased
+#define LATE_PERCENT 2
+// Playout delay increment on excessive late loss in microseconds
+#define LATE_BOOST 10000
+
 namespace { // anonymous
 
 class RTPDelayedData : public DataBlock
 {
 public:
     inline RTPDelayedData(u_int64_t when, bool mark, int payload,
-	unsigned int tstamp, const void* data, int len)
+	unsigned int tstamp, const void* data, int len, bool spurt = false)
 	: DataBlock(const_cast<void*>(data),len), m_scheduled(when),
-	  m_marker(mark), m_payload(payload), m_timestamp(tstamp)
+	  m_marker(mark), m_spurt(spurt), m_payload(payload), m_timestamp(tstamp)
 	{ }
     inline u_int64_t scheduled() const
 	{ return m_scheduled; }
     inline bool marker() const
 	{ return m_marker; }
+    inline bool spurt() const
+	{ return m_spurt; }
     int payload() const
 	{ return m_payload; }
     inline unsigned int timestamp() const
@@ -43,6 +52,7 @@ public:
 private:
     u_int64_t m_scheduled;
     bool m_marker;
+    bool m_spurt;
     int m_payload;
     unsigned int m_timestamp;
 };
@@ -54,7 +64,11 @@ RTPDejitter::RTPDejitter(RTPReceiver* receiver, unsigned int mindelay, unsigned
     DebugEnabler* dbg, const char* traceId)
     : RTPProcessor(dbg,traceId),
       m_receiver(receiver), m_minDelay(mindelay), m_maxDelay(maxdelay),
-      m_headStamp(0), m_tailStamp(0), m_headTime(0), m_sampRate(125000), m_fastRate(10)
+      m_headStamp(0), m_tailStamp(0), m_headTime(0), m_sampRate(125000), m_fastRate(10),
+      m_adaptive(false), m_fixedRate(false), m_delay(0), m_boost(0),
+      m_lastStamp(0), m_lastDelta(0), m_spurtStamp(0), m_lastArrival(0), m_spurtTime(0),
+      m_transit(0), m_avgTransit(0), m_jitter(0),
+      m_late(0), m_dropped(0), m_concealed(0), m_winCount(0), m_winLate(0), m_lateRun(0)
 {
     if (m_maxDelay > 1000000)
 	m_maxDelay = 1000000;
@@ -64,21 +78,181 @@ RTPDejitter::RTPDejitter(RTPReceiver* receiver, unsigned int mindelay, unsigned
 	m_minDelay = 5000;
     if (m_minDelay > m_maxDelay - 30000)
 	m_minDelay = m_maxDelay - 30000;
+    m_delay = m_minDelay;
 }
 
 RTPDejitter::~RTPDejitter()
 {
-    DDebug(dbg(),DebugInfo,"Dejitter destroyed with %u packets [%p]",m_packets.count(),this);
+    DDebug(dbg(),DebugInfo,"Dejitter destroyed with %u packets, %u late, %u dropped, %u concealed [%p]",
+	m_packets.count(),m_late,m_dropped,m_concealed,this);
 }
 
 void RTPDejitter::clear()
 {
     m_packets.clear();
     m_headStamp = m_tailStamp = 0;
+    m_lastArrival = m_spurtTime = 0;
+    m_lastDelta = 0;
+    m_lateRun = 0;
+}
+
+void RTPDejitter::adaptive(bool enable, unsigned int clockRate)
+{
+    m_adaptive = enable;
+    m_fixedRate = enable && (clockRate >= 6667) && (clockRate <= 50000);
+    if (m_fixedRate)
+	m_sampRate = 1000000000 / clockRate;
+    m_delay = m_minDelay;
+    m_boost = 0;
+    clear();
+    DDebug(dbg(),DebugInfo,"Dejitter adaptive mode %s, clock %u [%p]",
+	String::boolText(enable),clockRate,this);
+}
+
+void RTPDejitter::stats(NamedList& stat) const
+{
+    stat.setParam("jitter",String(jitter() / 1000));
+    stat.setParam("playdelay",String(m_delay / 1000));
+    stat.setParam("latepkts",String(m_late));
+    stat.setParam("droppedpkts",String(m_dropped));
+    stat.setParam("concealedpkts",String(m_concealed));
+}
+
+// Update the RFC 3550 interarrival jitter from consecutive packets
+// The transit time is accumulated from differences so rate changes don't skew it
+void RTPDejitter::updateJitter(unsigned int timestamp, u_int64_t arrival)
+{
+    if (m_lastArrival) {
+	int dTs = timestamp - m_lastStamp;
+	int64_t dArr = arrival - m_lastArrival;
+	if (m_adaptive && !m_fixedRate && dTs > 0 && dArr > 0
+	    && (dTs * (int64_t)m_sampRate) < 250000000) {
+	    int64_t rate = 1000 * dArr / dTs;
+	    if (m_fastRate) {
+		m_fastRate--;
+		rate = (7 * m_sampRate + rate) >> 3;
+	    }
+	    else
+		rate = (31 * m_sampRate + rate) >> 5;
+	    if (rate > 150000)
+		rate = 150000; // 6.67 kHz
+	    else if (rate < 20000)
+		rate = 20000; // 50 kHz
+	    m_sampRate = rate;
+	}
+	int64_t d = dArr - (dTs * (int64_t)m_sampRate / 1000);
+	m_transit += d;
+	if (d < 0)
+	    d = -d;
+	// J(i) = J(i-1) + (|D(i-1,i)| - J(i-1)) / 16, kept scaled by 16
+	m_jitter += d - ((m_jitter + 8) >> 4);
+	m_avgTransit += (m_transit - m_avgTransit) / 16;
+    }
+    else
+	m_transit = m_avgTransit = 0;
+    m_lastStamp = timestamp;
+    m_lastArrival = arrival;
+}
+
+// Account one packet in the late loss window and adjust the target delay
+void RTPDejitter::updateDelay(bool late)
+{
+    if (late) {
+	m_late++;
+	m_winLate++;
+	m_lateRun++;
+    }
+    else
+	m_lateRun = 0;
+    if (++m_winCount < LATE_WINDOW)
+	return;
+    if (m_winLate * 100 > m_winCount * LATE_PERCENT) {
+	m_boost += LATE_BOOST;
+	if (m_boost > m_maxDelay)
+	    m_boost = m_maxDelay;
+    }
+    else if (!m_winLate)
+	m_boost -= (m_boost < 2000) ? m_boost : 2000;
+    m_winCount = m_winLate = 0;
 }
 
 bool RTPDejitter::rtpRecv(bool marker, int payload, unsigned int timestamp, const void* data, int len)
 {
+    return rtpRecv(marker,payload,timestamp,data,len,Time::now());
+}
+
+bool RTPDejitter::adaptiveRecv(bool marker, int payload, unsigned int timestamp,
+    const void* data, int len, u_int64_t arrival)
+{
+    if (m_headStamp && ((int)(timestamp - m_headStamp)) <= 0) {
+	if (timestamp == m_headStamp)
+	    return true;
+	DDebug(dbg(),DebugNote,"Dejitter late TS %u, last delivered was %u [%p]",
+	    timestamp,m_headStamp,this);
+	updateDelay(true);
+	return false;
+    }
+    bool reorder = m_lastArrival && ((int)(timestamp - m_lastStamp)) < 0;
+    bool gap = m_lastArrival && m_lastDelta && ((timestamp - m_lastStamp) > 2 * m_lastDelta);
+    updateJitter(timestamp,arrival);
+    // playout delay changes only when the buffer is empty, normally in silence
+    bool spurt = false;
+    if (m_packets.skipNull()) {
+	if (m_tailStamp == timestamp)
+	    return true;
+    }
+    else if (!m_spurtTime || ((marker || gap || m_lateRun >= 2) && !reorder)) {
+	unsigned int target = 4 * jitter() + m_boost;
+	if (target < m_minDelay)
+	    target = m_minDelay;
+	else if (target > m_maxDelay)
+	    target = m_maxDelay;
+	if (m_delay != target)
+	    XDebug(dbg(),DebugAll,"Dejitter playout delay %u -> %u [%p]",m_delay,target,this);
+	m_delay = target;
+	m_spurtStamp = timestamp;
+	// correct for the transit deviation of this very packet
+	m_spurtTime = arrival + m_delay - (m_transit - m_avgTransit);
+	if (m_spurtTime < arrival)
+	    m_spurtTime = arrival;
+	m_lateRun = 0;
+	spurt = true;
+    }
+    u_int64_t when = m_spurtTime + ((int)(timestamp - m_spurtStamp)) * (int64_t)m_sampRate / 1000;
+    if (when < arrival) {
+	DDebug(dbg(),DebugNote,"Dejitter TS %u late by " FMT64 "us [%p]",
+	    timestamp,arrival - when,this);
+	updateDelay(true);
+	return false;
+    }
+    if (when > arrival + m_maxDelay) {
+	DDebug(dbg(),DebugNote,"Packet with TS %u falls after max buffer [%p]",timestamp,this);
+	m_dropped++;
+	return false;
+    }
+    updateDelay(false);
+    if (m_tailStamp && ((int)(timestamp - m_tailStamp)) < 0) {
+	for (ObjList* l = m_packets.skipNull(); l; l = l->skipNext()) {
+	    RTPDelayedData* pkt = static_cast<RTPDelayedData*>(l->get());
+	    if (pkt->timestamp() == timestamp)
+		return true;
+	    if (((int)(pkt->timestamp() - timestamp)) > 0) {
+		l->insert(new RTPDelayedData(when,marker,payload,timestamp,data,len));
+		return true;
+	    }
+	}
+    }
+    m_tailStamp = timestamp;
+    m_packets.append(new RTPDelayedData(when,marker,payload,timestamp,data,len,spurt));
+    return true;
+}
+
+bool RTPDejitter::rtpRecv(bool marker, int payload, unsigned int timestamp,
+    const void* data, int len, u_int64_t arrival)
+{
+    if (m_adaptive)
+	return adaptiveRecv(marker,payload,timestamp,data,len,arrival);
+    updateJitter(timestamp,arrival);
     u_int64_t when = 0;
     bool insert = false;
 
@@ -90,9 +264,10 @@ bool RTPDejitter::rtpRecv(bool marker, int payload, unsigned int timestamp, cons
 	else if (dTs < 0) {
 	    DDebug(dbg(),DebugNote,"Dejitter dropping TS %u, last delivered was %u [%p]",
 		timestamp,m_headStamp,this);
+	    m_late++;
 	    return false;
 	}
-	u_int64_t now = Time::now();
+	u_int64_t now = arrival;
 	int64_t rate = 1000 * (now - m_headTime) / dTs;
 	if (rate > 0) {
 	    if (m_sampRate) {
@@ -123,6 +298,7 @@ bool RTPDejitter::rtpRecv(bool marker, int payload, unsigned int timestamp, cons
 		insert = true;
 	    else if (when > now + m_maxDelay) {
 		DDebug(dbg(),DebugNote,"Packet with TS %u falls after max buffer [%p]",timestamp,this);
+		m_dropped++;
 		return false;
 	    }
 	}
@@ -131,10 +307,11 @@ bool RTPDejitter::rtpRecv(bool marker, int payload, unsigned int timestamp, cons
 	if (m_tailStamp && ((int)(timestamp - m_tailStamp)) < 0) {
 	    // until we get some statistics don't attempt to reorder packets
 	    DDebug(dbg(),DebugNote,"Dejitter got TS %u while last queued was %u [%p]",timestamp,m_tailStamp,this);
+	    m_dropped++;
 	    return false;
 	}
 	// we got no packets out yet so use a fixed interval
-	when = Time::now() + m_minDelay;
+	when = arrival + m_minDelay;
     }
 
     if (insert) {
@@ -165,6 +342,16 @@ void RTPDejitter::timerTick(const Time& when)
     if (packet->scheduled() > when)
 	return;
     m_packets.remove(packet,false);
+    if (m_headStamp && !(packet->marker() || packet->spurt())) {
+	// count the frames missing between consecutive delivered packets
+	unsigned int dTs = packet->timestamp() - m_headStamp;
+	if (dTs < 0x80000000) {
+	    if (!m_lastDelta || dTs < m_lastDelta)
+		m_lastDelta = dTs;
+	    else if (dTs >= 2 * m_lastDelta)
+		m_concealed += dTs / m_lastDelta - 1;
+	}
+    }
     // remember the last delivered
     m_headStamp = packet->timestamp();
     m_headTime = packet->scheduled();
@@ -181,6 +368,7 @@ void RTPDejitter::timerTick(const Time& when)
 	m_packets.remove(packet,true);
 	count++;
     }
+    m_dropped += count;
     if (count)
 	TraceDebug(m_traceId,dbg(),(count > 1) ? DebugMild : DebugNote,
 	    "Dropped %u delayed packet%s from buffer [%p]",count,((count > 1) ? "s" : ""),this);
@@ -0,0 +1,240 @@
+/**
+ * quality.cpp
+ * Yet Another RTP Stack
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatertp.h>
+
+using namespace TelEngine;
+
+// Default codec impairment, G.711 with packet loss concealment
+#define DEFAULT_IE 0
+#define DEFAULT_BPL 251
+
+RTPQuality::RTPQuality(unsigned int clockRate)
+    : m_clockRate(clockRate ? clockRate : 8000),
+      m_ie(DEFAULT_IE), m_bpl(DEFAULT_BPL)
+{
+    reset();
+}
+
+void RTPQuality::reset()
+{
+    m_received = m_expected = m_reordered = 0;
+    m_seq = 0;
+    m_resync = true;
+    m_timestamp = m_frameTs = 0;
+    m_arrival = 0;
+    m_transit = 0;
+    m_jitter = 0;
+    m_lastLost = false;
+    m_lossEvents = m_lossStarts = m_lossEnds = 0;
+    m_recvRun = m_burstLen = m_burstLost = 0;
+    m_bursts = m_burstPkts = m_burstLostPkts = 0;
+}
+
+// Account a lost packet in the RFC 3611 burst/gap model
+void RTPQuality::lossEvent()
+{
+    if (m_burstLen && (m_recvRun < Gmin)) {
+	// still inside the current burst
+	m_burstLen += m_recvRun + 1;
+	m_burstLost++;
+    }
+    else {
+	// an isolated loss belongs to the gap, not to a burst
+	if (m_burstLost > 1) {
+	    m_bursts++;
+	    m_burstPkts += m_burstLen;
+	    m_burstLostPkts += m_burstLost;
+	}
+	m_burstLen = m_burstLost = 1;
+    }
+    m_recvRun = 0;
+    if (!m_lastLost)
+	m_lossStarts++;
+    m_lastLost = true;
+    m_lossEvents++;
+}
+
+void RTPQuality::received(u_int16_t seq, unsigned int timestamp, u_int64_t arrival)
+{
+    m_received++;
+    int delta = (int16_t)(seq - m_seq);
+    if (m_resync) {
+	// first packet or sequence resynchronized, nothing to compare with
+	m_resync = false;
+	m_expected++;
+	delta = 0;
+    }
+    else if (delta == 1) {
+	m_expected++;
+	// packet duration is the smallest increment between consecutive packets
+	unsigned int dTs = timestamp - m_timestamp;
+	if (dTs && (dTs < m_clockRate) && (!m_frameTs || dTs < m_frameTs))
+	    m_frameTs = dTs;
+    }
+    else if (delta > 1) {
+	m_expected += delta;
+	for (int i = 1; i < delta; i++)
+	    lossEvent();
+    }
+    else {
+	// the packet was already accounted as lost
+	m_reordered++;
+	if (m_lossEvents)
+	    m_lossEvents--;
+    }
+    if (delta >= 0) {
+	if (m_lastLost)
+	    m_lossEnds++;
+	m_lastLost = false;
+	m_recvRun++;
+	m_seq = seq;
+	m_timestamp = timestamp;
+    }
+    // RFC 3550 interarrival jitter, arrival time converted to timestamp units
+    int64_t transit = (int64_t)(arrival * m_clockRate / 1000000) - (int64_t)timestamp;
+    if (m_arrival) {
+	int64_t d = transit - m_transit;
+	if (d < 0)
+	    d = -d;
+	// ignore timestamp wraparounds and discontinuities
+	if (d < (int64_t)m_clockRate)
+	    m_jitter += (u_int32_t)d - ((m_jitter + 8) >> 4);
+    }
+    m_transit = transit;
+    m_arrival = arrival;
+}
+
+void RTPQuality::burstTotals(u_int32_t& bursts, u_int32_t& burstPkts, u_int32_t& burstLost) const
+{
+    bursts = m_bursts;
+    burstPkts = m_burstPkts;
+    burstLost = m_burstLostPkts;
+    if (m_burstLost > 1) {
+	// the current burst is not closed yet
+	bursts++;
+	burstPkts += m_burstLen;
+	burstLost += m_burstLost;
+    }
+}
+
+unsigned int RTPQuality::burstDensity() const
+{
+    u_int32_t bursts, pkts, lost;
+    burstTotals(bursts,pkts,lost);
+    if (!pkts)
+	return 0;
+    u_int64_t d = (u_int64_t)lost * 256 / pkts;
+    return (d > 255) ? 255 : (unsigned int)d;
+}
+
+unsigned int RTPQuality::gapDensity() const
+{
+    u_int32_t bursts, pkts, lost;
+    burstTotals(bursts,pkts,lost);
+    if (m_expected <= pkts)
+	return 0;
+    u_int32_t gapLost = (m_lossEvents > lost) ? m_lossEvents - lost : 0;
+    u_int64_t d = (u_int64_t)gapLost * 256 / (m_expected - pkts);
+    return (d > 255) ? 255 : (unsigned int)d;
+}
+
+unsigned int RTPQuality::burstDuration() const
+{
+    u_int32_t bursts, pkts, lost;
+    burstTotals(bursts,pkts,lost);
+    if (!bursts)
+	return 0;
+    return (unsigned int)((u_int64_t)pkts * frameMs() / bursts);
+}
+
+unsigned int RTPQuality::gapDuration() const
+{
+    u_int32_t bursts, pkts, lost;
+    burstTotals(bursts,pkts,lost);
+    if (m_expected <= pkts)
+	return 0;
+    return (unsigned int)((u_int64_t)(m_expected - pkts) * frameMs() / (bursts + 1));
+}
+
+unsigned int RTPQuality::rFactor(unsigned int delay, u_int32_t discarded) const
+{
+    if (!m_expected)
+	return 0;
+    // packet loss probability in percent, late packets are as good as lost
+    double ppl = 100.0 * (lost() + discarded) / m_expected;
+    if (ppl > 100.0)
+	ppl = 100.0;
+    // burst ratio from the Gilbert model transition probabilities
+    double burstR = 1.0;
+    u_int32_t recvEvents = (m_received > m_reordered) ? m_received - m_reordered : 0;
+    if (recvEvents && m_lossEvents && m_lossStarts) {
+	double p = (double)m_lossStarts / recvEvents;
+	double q = (double)(m_lossEnds ? m_lossEnds : 1) / m_lossEvents;
+	burstR = 1.0 / (p + q);
+	if (burstR < 1.0)
+	    burstR = 1.0;
+    }
+    double ieEff = m_ie + (95.0 - m_ie) * ppl / (ppl / burstR + m_bpl / 10.0);
+    // add the packetization time to the network and buffering delay
+    double d = delay + frameMs();
+    double id = 0.024 * d;
+    if (d > 177.3)
+	id += 0.11 * (d - 177.3);
+    double r = 93.2 - id - ieEff;
+    if (r <= 0.0)
+	return 0;
+    if (r >= 100.0)
+	return 100;
+    return (unsigned int)(r + 0.5);
+}
+
+unsigned int RTPQuality::mos(unsigned int rFactor)
+{
+    if (!rFactor)
+	return 10;
+    if (rFactor >= 100)
+	return 45;
+    double r = rFactor;
+    double m = 1.0 + 0.035 * r + r * (r - 60.0) * (100.0 - r) * 7.0e-6;
+    if (m < 1.0)
+	m = 1.0;
+    return (unsigned int)(10.0 * m + 0.5);
+}
+
+void RTPQuality::stats(NamedList& stat, unsigned int delay, u_int32_t discarded,
+    const char* prefix) const
+{
+    String pref(prefix);
+    unsigned int r = rFactor(delay,discarded);
+    unsigned int m = mos(r);
+    stat.setParam(pref + "jitter",String(jitterMs()));
+    stat.setParam(pref + "reordered",String(m_reordered));
+    stat.setParam(pref + "burstdensity",String(burstDensity() * 100 / 255));
+    stat.setParam(pref + "gapdensity",String(gapDensity() * 100 / 255));
+    stat.setParam(pref + "burstduration",String(burstDuration()));
+    stat.setParam(pref + "gapduration",String(gapDuration()));
+    stat.setParam(pref + "rfactor",String(r));
+    String tmp;
+    tmp << (m / 10) << "." << (m % 10);
+    stat.setParam(pref + "mos",tmp);
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -139,6 +139,15 @@ void RTPReceiver::setDejitter(RTPDejitter* dejitter)
     m_dejitter = dejitter;
 }
 
+void RTPReceiver::setDejitter(unsigned int mindelay, unsigned int maxdelay,
+    bool adaptive, unsigned int clockRate)
+{
+    RTPDejitter* dejitter = new RTPDejitter(this,mindelay,maxdelay,dbg(),m_traceId);
+    if (adaptive)
+	dejitter->adaptive(true,clockRate);
+    setDejitter(dejitter);
+}
+
 void RTPReceiver::rtpData(const void* data, int len)
 {
     // trivial check for basic fields validity
@@ -199,6 +208,7 @@ void RTPReceiver::rtpData(const void* data, int len)
 	if (m_debugData)
 	    TraceDebug(m_traceId,dbg(),m_debugDataLevel,"RTP recv INIT SEQ=%u TS=%u TS_LAST=%u [%p]",
 		seq,ts,m_tsLast,this);
+	m_quality.resync();
 	if (m_dejitter)
 	    m_dejitter->clear();
     }
@@ -223,6 +233,7 @@ void RTPReceiver::rtpData(const void* data, int len)
 	    TraceDebug(m_traceId,dbg(),m_debugDataLevel,
 		"RTP recv SEQ=%u TS=%u TS_LAST=%u new SSRC accepted, dropping [%p]",
 		seq,ts,m_tsLast,this);
+	m_quality.resync();
 	if (m_dejitter)
 	    m_dejitter->clear();
 	// drop this packet, next packet will come in correctly
@@ -282,6 +293,7 @@ void RTPReceiver::rtpData(const void* data, int len)
 			else
 			    m_warnSeq = -1;
 			m_syncLost++;
+			m_quality.resync();
 			if (m_dejitter)
 			    m_dejitter->clear();
 			// drop this packet, next packet will come in correctly
@@ -322,6 +334,7 @@ void RTPReceiver::rtpData(const void* data, int len)
 	    "RTP recv payload=%d SEQ=%u (delta=%d) TS=%u TS_LAST %u -> %u%s [%p]",
 	    typ,seq,ds,ts,m_tsLast,(ts - m_ts),extra,this);
     }
+    m_quality.received(seq,ts,Time::now());
     m_tsLast = ts - m_ts;
     m_seqCount = 0;
     m_ioPackets++;
@@ -482,6 +495,20 @@ void RTPReceiver::stats(NamedList& stat) const
     stat.setParam("synclost",String(m_syncLost));
     stat.setParam("wrongssrc",String(m_wrongSSRC));
     stat.setParam("seqslost",String(m_seqLost));
+    if (m_dejitter)
+	m_dejitter->stats(stat);
+    qualityStats(stat);
+}
+
+void RTPReceiver::qualityStats(NamedList& stat, const char* prefix) const
+{
+    unsigned int delay = 0;
+    u_int32_t discarded = 0;
+    if (m_dejitter) {
+	delay = m_dejitter->delay() / 1000;
+	discarded = m_dejitter->late() + m_dejitter->dropped();
+    }
+    m_quality.stats(stat,delay,discarded,prefix);
 }
 
 
@@ -744,6 +771,28 @@ bool UDPSession::initGroup(int msec, Thread::Priority prio, const String& affini
     return true;
 }
 
+bool UDPSession::initGroup(RTPGroupPool& pool)
+{
+    if (m_group)
+	return true;
+    if (m_transport)
+	group(m_transport->group());
+    if (!m_group)
+	pool.assign(this);
+    if (!m_group)
+	return false;
+    if (m_transport)
+	m_transport->group(m_group);
+    return true;
+}
+
+void* UDPSession::getObject(const String& name) const
+{
+    if (name == YATOM("UDPSession"))
+	return const_cast<UDPSession*>(this);
+    return RTPProcessor::getObject(name);
+}
+
 bool UDPSession::initTransport()
 {
     if (m_transport)
@@ -772,7 +821,7 @@ RTPSession::RTPSession(DebugEnabler* dbg, const char* traceId)
     : UDPSession(dbg,traceId), Mutex(true,"RTPSession"),
       m_direction(FullStop),
       m_send(0), m_recv(0), m_secure(0),
-      m_reportTime(0), m_reportInterval(0),
+      m_reportTime(0), m_reportInterval(0), m_reportXR(false),
       m_warnSeq(1)
 {
     DDebug(this->dbg(),DebugInfo,"RTPSession::RTPSession() [%p]",this);
@@ -1029,11 +1078,28 @@ static void store32(unsigned char* buf, unsigned int& len, u_int32_t val)
     buf[len++] = (unsigned char)(val & 0xff);
 }
 
+static void store16(unsigned char* buf, unsigned int& len, unsigned int val)
+{
+    if (val > 0xffff)
+	val = 0xffff;
+    buf[len++] = (unsigned char)(val >> 8);
+    buf[len++] = (unsigned char)(val & 0xff);
+}
+
+// Fraction of a total as fixed point number with the binary point at the left
+static unsigned char fraction8(u_int32_t val, u_int32_t total)
+{
+    if (!total)
+	return 0;
+    u_int64_t f = (u_int64_t)val * 256 / total;
+    return (f > 255) ? 255 : (unsigned char)f;
+}
+
 void RTPSession::sendRtcpReport(const Time& when)
 {
     if (!((m_send || m_recv) && m_transport && m_transport->rtcpSock()->valid()))
 	return;
-    unsigned char buf[52];
+    unsigned char buf[96];
     buf[0] = 0x80; // RC=0
     buf[1] = 0xc9; // RR
     buf[2] = 0;
@@ -1058,8 +1124,8 @@ void RTPSession::sendRtcpReport(const Time& when)
 	u_int32_t lostf = 0xff & (lost * 255 / (lost + m_recv->ioPackets()));
 	store32(buf,len,(lost & 0xffffff) | (lostf << 24));
 	store32(buf,len,(uint32_t)m_recv->fullSeq());
-	// TODO: Compute and store Jitter, LSR and DLSR
-	store32(buf,len,0);
+	store32(buf,len,m_recv->quality().jitter());
+	// TODO: Compute and store LSR and DLSR
 	store32(buf,len,0);
 	store32(buf,len,0);
     }
@@ -1068,8 +1134,56 @@ void RTPSession::sendRtcpReport(const Time& when)
 	return;
     DDebug(dbg(),DebugInfo,"RTPSession sending RTCP Report [%p]",this);
     unsigned int lptr = 4;
-    store32(buf,lptr,(m_send ? m_send->ssrcInit() : 0));
+    u_int32_t ssrc = m_send ? m_send->ssrcInit() : 0;
+    store32(buf,lptr,ssrc);
     buf[3] = (len - 1) / 4; // same as ((len + 3) / 4) - 1
+    if (m_reportXR && m_recv && m_recv->ioPackets()) {
+	// Extended Report with a VoIP Metrics block, see RFC 3611
+	const RTPQuality& q = m_recv->quality();
+	const RTPDejitter* dj = m_recv->dejitter();
+	unsigned int delay = 0;
+	u_int32_t discarded = 0;
+	if (dj) {
+	    delay = dj->delay() / 1000;
+	    discarded = dj->late() + dj->dropped();
+	}
+	unsigned int rf = q.rFactor(delay,discarded);
+	unsigned char mos = (unsigned char)RTPQuality::mos(rf);
+	buf[len++] = 0x80;
+	buf[len++] = 0xcf; // XR
+	buf[len++] = 0;
+	buf[len++] = 10; // len = 11 x 32bit
+	store32(buf,len,ssrc);
+	buf[len++] = 7; // VoIP Metrics
+	buf[len++] = 0;
+	buf[len++] = 0;
+	buf[len++] = 8; // block len = 9 x 32bit
+	store32(buf,len,m_recv->ssrc());
+	buf[len++] = fraction8(q.lost(),q.expected());
+	buf[len++] = fraction8(discarded,q.expected());
+	buf[len++] = (unsigned char)q.burstDensity();
+	buf[len++] = (unsigned char)q.gapDensity();
+	store16(buf,len,q.burstDuration());
+	store16(buf,len,q.gapDuration());
+	// round trip delay is unknown, end system delay
+	store16(buf,len,0);
+	store16(buf,len,delay + q.frameMs());
+	// signal, noise and residual echo levels are unavailable
+	buf[len++] = 127;
+	buf[len++] = 127;
+	buf[len++] = 127;
+	buf[len++] = RTPQuality::Gmin;
+	buf[len++] = (unsigned char)rf;
+	buf[len++] = 127; // external R factor
+	buf[len++] = mos; // MOS-LQ
+	buf[len++] = mos; // MOS-CQ
+	// receiver configuration: jitter buffer adaptive or non-adaptive
+	buf[len++] = dj ? (dj->adaptive() ? 0x30 : 0x20) : 0;
+	buf[len++] = 0;
+	store16(buf,len,delay);
+	store16(buf,len,delay);
+	store16(buf,len,dj ? dj->maxDelay() / 1000 : 0);
+    }
     static_cast<RTPProcessor*>(m_transport)->rtcpData(buf,len);
 }
 
@@ -21,12 +21,44 @@
 #include <yatertp.h>
 #include <string.h>
 
+#ifndef _WINDOWS
+#include <unistd.h>
+#endif
+
 #define BUF_SIZE 1500
 
+// Interval between pool balance checks in usec
+#define BALANCE_INTERVAL 1000000
+
+// Time an empty pooled group keeps running in usec
+#define POOL_IDLE 10000000
+
+// Time the pool waits for its groups to stop in msec
+#define POOL_STOP 2000
+
 using namespace TelEngine;
 
 static unsigned long s_sleep = 5;
 
+// Number of online CPUs, used when the affinity is not available
+static unsigned int onlineCpus()
+{
+#ifdef _WINDOWS
+    SYSTEM_INFO info;
+    ::GetSystemInfo(&info);
+    long n = info.dwNumberOfProcessors;
+#else
+    long n = ::sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return (n > 0) ? n : 1;
+}
+
+const TokenDict RTPGroupPool::s_policies[] = {
+    { "streams", Streams },
+    { "busy",    Busy },
+    { 0, 0 }
+};
+
 // Set IPv6 sin6_scope_id for remote addresses from local address
 // recvFrom() will set the sin6_scope_id of the remote socket address
 // This will avoid socket address comparison mismatch (same address, different scope id)
@@ -45,7 +77,8 @@ static inline void setScopeId(const SocketAddr& local, SocketAddr& sa1,
 
 RTPGroup::RTPGroup(int msec, Priority prio, const String& affinity)
     : Mutex(true,"RTPGroup"),
-      Thread("RTP Group",prio), m_listChanged(false)
+      Thread("RTP Group",prio), m_listChanged(false),
+      m_streams(0), m_busy(0), m_idle(0), m_pool(0), m_migrate(0), m_migrateCount(0), m_cpu(-1)
 {
     DDebug(DebugInfo,"RTPGroup::RTPGroup() [%p]",this);
     if (msec < 1)
@@ -70,6 +103,9 @@ void RTPGroup::cleanup()
 {
     DDebug(DebugInfo,"RTPGroup::cleanup() [%p]",this);
     lock();
+    RTPGroupPool* pool = m_pool;
+    m_pool = 0;
+    m_migrate = 0;
     m_listChanged = true;
     ObjList* l = &m_processors;
     while (l) {
@@ -83,6 +119,8 @@ void RTPGroup::cleanup()
     }
     m_processors.clear();
     unlock();
+    if (pool)
+	pool->detach(this);
 }
 
 void RTPGroup::run()
@@ -109,8 +147,32 @@ void RTPGroup::run()
 		    break;
 	    }
 	}
+	if (m_migrate)
+	    migrate();
+	// pooled groups keep running for a while if they have no processors
+	RTPGroupPool* pool = m_pool;
+	bool idle = false;
+	if (pool) {
+	    if (ok)
+		m_idle = 0;
+	    else if (!m_idle)
+		m_idle = t + POOL_IDLE;
+	    else
+		idle = (t > m_idle);
+	    ok = true;
+	}
+	int64_t busy = (int64_t)(Time::now() - t.usec());
+	m_busy += ((busy << 4) - (int64_t)m_busy) >> 4;
 	unlock();
-	Thread::msleep(msec,true);
+	// the pool waits for us to leave it so it is still valid here
+	if (pool) {
+	    if (idle || pool->m_stopping)
+		ok = !pool->release(this);
+	    else
+		pool->balance(t);
+	}
+	if (ok)
+	    Thread::msleep(msec,true);
     }
     DDebug(DebugInfo,"RTPGroup::run() ran out of processors [%p]",this);
 }
@@ -121,6 +183,8 @@ void RTPGroup::join(RTPProcessor* proc)
     lock();
     m_listChanged = true;
     m_processors.append(proc)->setDelete(false);
+    if (proc->getObject(YATOM("UDPSession")))
+	m_streams++;
     startup();
     unlock();
 }
@@ -130,10 +194,34 @@ void RTPGroup::part(RTPProcessor* proc)
     DDebug(DebugAll,"RTPGroup::part(%p) [%p]",proc,this);
     lock();
     m_listChanged = true;
-    m_processors.remove(proc,false);
+    if (m_processors.remove(proc,false) && m_streams && proc->getObject(YATOM("UDPSession")))
+	m_streams--;
     unlock();
 }
 
+// Move one session and its transport to the migration target, called locked
+void RTPGroup::migrate()
+{
+    RTPGroup* dest = m_migrate;
+    if (m_migrateCount) {
+	for (ObjList* l = m_processors.skipNull(); l; l = l->skipNext()) {
+	    UDPSession* s = static_cast<UDPSession*>(static_cast<RTPProcessor*>(l->get())->getObject(YATOM("UDPSession")));
+	    if (!s)
+		continue;
+	    DDebug(DebugAll,"RTPGroup migrating session %p to %p [%p]",s,dest,this);
+	    RTPProcessor* trans = s->transport();
+	    static_cast<RTPProcessor*>(s)->group(dest);
+	    if (trans && trans->group() == this)
+		trans->group(dest);
+	    if (--m_migrateCount)
+		return;
+	    break;
+	}
+    }
+    m_migrateCount = 0;
+    m_migrate = 0;
+}
+
 void RTPGroup::setMinSleep(int msec)
 {
     if (msec < 1)
@@ -144,6 +232,208 @@ void RTPGroup::setMinSleep(int msec)
 }
 
 
+RTPGroupPool::RTPGroupPool()
+    : Mutex(false,"RTPGroupPool"),
+      m_perCpu(0), m_sleep(0), m_priority(Thread::Normal),
+      m_policy(Streams), m_imbalance(0), m_nextBalance(0), m_stopping(false)
+{
+    DDebug(DebugInfo,"RTPGroupPool::RTPGroupPool() [%p]",this);
+}
+
+RTPGroupPool::~RTPGroupPool()
+{
+    DDebug(DebugInfo,"RTPGroupPool::~RTPGroupPool() [%p]",this);
+    lock();
+    m_stopping = true;
+    m_perCpu = 0;
+    // the groups use the pool until they leave it
+    for (unsigned int i = 0; m_groups.skipNull(); i++) {
+	if (i >= POOL_STOP) {
+	    Debug(DebugWarn,"RTPGroupPool abandoning %u groups that did not stop [%p]",
+		m_groups.count(),this);
+	    break;
+	}
+	unlock();
+	Thread::msleep(1);
+	lock();
+    }
+    m_groups.clear();
+    unlock();
+}
+
+void RTPGroupPool::setup(unsigned int perCpu, const String& cpus, int msec, Thread::Priority prio)
+{
+    Lock mylock(this);
+    if (perCpu > 16)
+	perCpu = 16;
+    m_perCpu = perCpu;
+    m_cpus = cpus;
+    m_sleep = msec;
+    m_priority = prio;
+}
+
+void RTPGroupPool::balancing(Policy policy, unsigned int imbalance)
+{
+    Lock mylock(this);
+    m_policy = policy;
+    m_imbalance = imbalance;
+}
+
+RTPGroup* RTPGroupPool::assign(RTPProcessor* proc)
+{
+    Lock mylock(this);
+    if (!(m_perCpu && proc))
+	return 0;
+    DataBlock mask;
+    if (m_cpus)
+	Thread::parseCPUMask(m_cpus,mask);
+    else
+	Thread::getCurrentAffinity(mask);
+    // create any groups missing on the allowed CPUs
+    unsigned int cpus = 0;
+    const unsigned char* bits = mask.data(0);
+    for (unsigned int i = 0; i < (mask.length() << 3); i++) {
+	if (!(bits[i >> 3] & (1 << (i & 7))))
+	    continue;
+	cpus++;
+	unsigned int n = 0;
+	for (ObjList* l = m_groups.skipNull(); l; l = l->skipNext())
+	    if (static_cast<RTPGroup*>(l->get())->m_cpu == (int)i)
+		n++;
+	for (; n < m_perCpu; n++) {
+	    RTPGroup* grp = new RTPGroup(m_sleep,m_priority,String(i));
+	    grp->m_cpu = i;
+	    grp->m_pool = this;
+	    m_groups.append(grp)->setDelete(false);
+	    grp->startup();
+	}
+    }
+    if (!cpus) {
+	// affinity is not known, run unpinned groups
+	for (unsigned int n = m_groups.count(); n < m_perCpu * onlineCpus(); n++) {
+	    RTPGroup* grp = new RTPGroup(m_sleep,m_priority);
+	    grp->m_pool = this;
+	    m_groups.append(grp)->setDelete(false);
+	    grp->startup();
+	}
+    }
+    RTPGroup* best = 0;
+    unsigned int min = 0;
+    for (ObjList* l = m_groups.skipNull(); l; l = l->skipNext()) {
+	RTPGroup* grp = static_cast<RTPGroup*>(l->get());
+	unsigned int s = score(grp);
+	if (!best || (s < min) || ((s == min) && (grp->streams() < best->streams()))) {
+	    best = grp;
+	    min = s;
+	}
+    }
+    // join while locked so the group cannot leave the pool meanwhile
+    if (best)
+	proc->group(best);
+    return best;
+}
+
+unsigned int RTPGroupPool::count()
+{
+    Lock mylock(this);
+    return m_groups.count();
+}
+
+void RTPGroupPool::status(String& str)
+{
+    Lock mylock(this);
+    unsigned int i = 0;
+    for (ObjList* l = m_groups.skipNull(); l; l = l->skipNext(), i++) {
+	RTPGroup* grp = static_cast<RTPGroup*>(l->get());
+	str.append("group",",") << i << "=";
+	if (grp->m_cpu >= 0)
+	    str << grp->m_cpu;
+	str << ":" << grp->streams() << ":" << grp->busy();
+    }
+}
+
+unsigned int RTPGroupPool::score(const RTPGroup* grp) const
+{
+    return (m_policy == Busy) ? grp->busy() : grp->streams();
+}
+
+// Called periodically by pooled groups, start migrating sessions from the
+//  most to the least loaded group if the difference is large enough
+void RTPGroupPool::balance(const Time& when)
+{
+    if (when < m_nextBalance)
+	return;
+    Lock mylock(this);
+    if (when < m_nextBalance)
+	return;
+    m_nextBalance = when + BALANCE_INTERVAL;
+    if (!m_imbalance)
+	return;
+    RTPGroup* hi = 0;
+    RTPGroup* lo = 0;
+    for (ObjList* l = m_groups.skipNull(); l; l = l->skipNext()) {
+	RTPGroup* grp = static_cast<RTPGroup*>(l->get());
+	// wait for a previous migration to complete
+	if (grp->m_migrate)
+	    return;
+	if (!hi || score(grp) > score(hi))
+	    hi = grp;
+	if (!lo || score(grp) < score(lo))
+	    lo = grp;
+    }
+    if (!hi || hi == lo || !hi->streams())
+	return;
+    unsigned int diff = 0;
+    if (m_policy == Busy) {
+	// express the busy time difference in sessions of the loaded group
+	unsigned int cost = hi->busy() / hi->streams();
+	if (!cost)
+	    return;
+	diff = (hi->busy() - lo->busy()) / cost;
+	if (diff > hi->streams())
+	    diff = hi->streams();
+    }
+    else
+	diff = hi->streams() - lo->streams();
+    if (diff <= m_imbalance)
+	return;
+    Debug(DebugInfo,"RTPGroupPool migrating %u sessions from group %p (%u:%u) to %p (%u:%u) [%p]",
+	diff / 2,hi,hi->streams(),hi->busy(),lo,lo->streams(),lo->busy(),this);
+    hi->m_migrateCount = diff / 2;
+    hi->m_migrate = lo;
+}
+
+// Called by a pooled group that is idle or asked to stop, leave the pool
+//  unless a session joined it or a migration targets it meanwhile
+bool RTPGroupPool::release(RTPGroup* grp)
+{
+    Lock mylock(this);
+    Lock lck(grp);
+    if (!(m_stopping || (grp->m_idle && !grp->m_processors.skipNull())))
+	return false;
+    for (ObjList* l = m_groups.skipNull(); l; l = l->skipNext())
+	if (static_cast<RTPGroup*>(l->get())->m_migrate == grp)
+	    return false;
+    DDebug(DebugInfo,"RTPGroupPool releasing group %p [%p]",grp,this);
+    m_groups.remove(grp,false);
+    grp->m_pool = 0;
+    grp->m_migrate = 0;
+    grp->m_migrateCount = 0;
+    return true;
+}
+
+void RTPGroupPool::detach(RTPGroup* grp)
+{
+    Lock mylock(this);
+    m_groups.remove(grp,false);
+    for (ObjList* l = m_groups.skipNull(); l; l = l->skipNext()) {
+	RTPGroup* g = static_cast<RTPGroup*>(l->get());
+	if (g->m_migrate == grp)
+	    g->m_migrate = 0;
+    }
+}
+
+
 RTPProcessor::RTPProcessor(DebugEnabler* dbg, const char* traceId)
     : RTPDebug(dbg,traceId),
     m_wrongSrc(0), m_group(0)
@@ -160,13 +450,21 @@ RTPProcessor::~RTPProcessor()
 void RTPProcessor::group(RTPGroup* newgrp)
 {
     DDebug(dbg(),DebugAll,"RTPProcessor::group(%p) old=%p [%p]",newgrp,m_group,this);
-    if (newgrp == m_group)
+    for (;;) {
+	RTPGroup* old = m_group;
+	if (newgrp == old)
+	    return;
+	// a pooled group may migrate us while we wait for its lock
+	Lock lck(old);
+	if (old != m_group)
+	    continue;
+	if (old)
+	    old->part(this);
+	m_group = newgrp;
+	if (m_group)
+	    m_group->join(this);
 	return;
-    if (m_group)
-	m_group->part(this);
-    m_group = newgrp;
-    if (m_group)
-	m_group->join(this);
+    }
 }
 
 void RTPProcessor::rtpData(const void* data, int len)
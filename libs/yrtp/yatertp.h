@@ -45,6 +45,7 @@
 namespace TelEngine {
 
 class RTPGroup;
+class RTPGroupPool;
 class RTPTransport;
 class RTPSession;
 class RTPSender;
@@ -112,6 +113,7 @@ class YRTP_API RTPProcessor : public GenObject, public RTPDebug
     friend class UDPSession;
     friend class UDPTLSession;
     friend class RTPGroup;
+    friend class RTPGroupPool;
     friend class RTPTransport;
     friend class RTPSender;
     friend class RTPReceiver;
@@ -196,6 +198,7 @@ private:
 class YRTP_API RTPGroup : public GenObject, public Mutex, public Thread
 {
     friend class RTPProcessor;
+    friend class RTPGroupPool;
 
 public:
     /**
@@ -239,10 +242,134 @@ public:
      */
     void part(RTPProcessor* proc);
 
+    /**
+     * Get the number of RTP or UDPTL sessions handled by this group
+     * @return Count of sessions that joined this group
+     */
+    inline unsigned int streams() const
+	{ return m_streams; }
+
+    /**
+     * Get the average time spent processing one loop of this group
+     * @return Smoothed processing time in microseconds
+     */
+    inline unsigned int busy() const
+	{ return (unsigned int)(m_busy >> 4); }
+
+    /**
+     * Get the pool that owns this group
+     * @return Pointer to the owner pool, NULL if the group is not pooled
+     */
+    inline RTPGroupPool* pool() const
+	{ return m_pool; }
+
 private:
+    void migrate();
     ObjList m_processors;
     bool m_listChanged;
     unsigned long m_sleep;
+    unsigned int m_streams;
+    u_int64_t m_busy;
+    u_int64_t m_idle;
+    RTPGroupPool* m_pool;
+    RTPGroup* m_migrate;
+    unsigned int m_migrateCount;
+    int m_cpu;
+};
+
+/**
+ * A pool that keeps a fixed number of RTP groups on each allowed CPU, assigns
+ *  new sessions to the least loaded one and migrates sessions between groups
+ *  when the load gets unbalanced. Pooled groups keep running for a while
+ *  when empty, the missing ones are created again when needed.
+ * @short A load balanced set of RTP groups
+ */
+class YRTP_API RTPGroupPool : public Mutex
+{
+    friend class RTPGroup;
+
+public:
+    /**
+     * Load measure used to select and balance groups
+     */
+    enum Policy {
+	Streams = 0,
+	Busy = 1
+    };
+
+    /**
+     * Constructor, creates an empty pool
+     */
+    RTPGroupPool();
+
+    /**
+     * Destructor, stops the groups and waits for them to leave the pool
+     */
+    virtual ~RTPGroupPool();
+
+    /**
+     * Set the number of groups and the parameters of groups created later.
+     * Existing groups are kept, the pool is only grown
+     * @param perCpu Number of groups to keep for each CPU, zero disables the pool
+     * @param cpus Comma-separated list of CPUs and/or CPU ranges to use, empty to use the process affinity
+     * @param msec Minimum time to sleep in group loop in milliseconds
+     * @param prio Thread priority to run the groups
+     */
+    void setup(unsigned int perCpu, const String& cpus = String::empty(),
+	int msec = 0, Thread::Priority prio = Thread::Normal);
+
+    /**
+     * Set the load balancing parameters
+     * @param policy Load measure used to pick and balance groups
+     * @param imbalance Difference in sessions between groups that triggers a migration, zero disables migration
+     */
+    void balancing(Policy policy, unsigned int imbalance);
+
+    /**
+     * Check if the pool is enabled
+     * @return True if groups are kept for at least one CPU
+     */
+    inline bool enabled() const
+	{ return m_perCpu != 0; }
+
+    /**
+     * Add a processor to the least loaded group, create the groups if needed
+     * @param proc Pointer to the RTP processor that has no group yet
+     * @return Pointer to the group the processor joined, NULL if the pool is disabled
+     */
+    RTPGroup* assign(RTPProcessor* proc);
+
+    /**
+     * Get the number of groups in the pool
+     * @return Count of pooled groups
+     */
+    unsigned int count();
+
+    /**
+     * Append the load of each group to a status string
+     * @param str String to append group=cpu:streams:busy items to
+     */
+    void status(String& str);
+
+    /**
+     * Keywords of the balancing policies
+     */
+    static const TokenDict s_policies[];
+
+private:
+    void balance(const Time& when);
+    void detach(RTPGroup* grp);
+    bool release(RTPGroup* grp);
+    unsigned int score(const RTPGroup* grp) const;
+    ObjList m_groups;
+    unsigned int m_perCpu;
+    String m_cpus;
+    int m_sleep;
+    Thread::Priority m_priority;
+    Policy m_policy;
+    unsigned int m_imbalance;
+    u_int64_t m_nextBalance;
+    bool m_stopping;
 };
 
 /**
@@ -409,6 +536,8 @@ private:
  * A dejitter buffer that can be inserted in the receive data path to
  *  absorb variations in packet arrival time. Incoming packets are stored
  *  and forwarded at fixed intervals.
+ * In adaptive mode the playout delay follows the RFC 3550 interarrival jitter
+ *  and the late loss rate, it is changed only at the start of talkspurts.
  * @short Dejitter buffer for incoming data packets
  */
 class YRTP_API RTPDejitter : public RTPProcessor
@@ -442,11 +571,86 @@ public:
     virtual bool rtpRecv(bool marker, int payload, unsigned int timestamp,
 	const void* data, int len);
 
+    /**
+     * Process and store one RTP data packet with a known arrival time
+     * @param marker True if the marker bit is set in data packet
+     * @param payload Payload number
+     * @param timestamp Sampling instant of the packet data
+     * @param data Pointer to data block to process
+     * @param len Length of the data block in bytes
+     * @param arrival Arrival time of the packet in microseconds
+     * @return True if the data packet was queued
+     */
+    bool rtpRecv(bool marker, int payload, unsigned int timestamp,
+	const void* data, int len, u_int64_t arrival);
+
     /**
      * Clear the delayed packets queue and all variables
      */
     void clear();
 
+    /**
+     * Enable or disable the adaptive playout delay
+     * @param enable True to adapt the delay to the measured jitter
+     * @param clockRate RTP clock rate of the stream in Hz, zero to estimate it
+     */
+    void adaptive(bool enable, unsigned int clockRate = 0);
+
+    /**
+     * Check if the playout delay is adaptive
+     * @return True if the dejitter is in adaptive mode
+     */
+    inline bool adaptive() const
+	{ return m_adaptive; }
+
+    /**
+     * Retrieve the RFC 3550 interarrival jitter estimate
+     * @return Current jitter in microseconds
+     */
+    inline unsigned int jitter() const
+	{ return (unsigned int)(m_jitter >> 4); }
+
+    /**
+     * Retrieve the current playout delay
+     * @return Delay added to packets in microseconds
+     */
+    inline unsigned int delay() const
+	{ return m_delay; }
+
+    /**
+     * Retrieve the maximum length of the buffer
+     * @return Maximum delay added to packets in microseconds
+     */
+    inline unsigned int maxDelay() const
+	{ return m_maxDelay; }
+
+    /**
+     * Retrieve the number of packets that arrived too late to be played
+     * @return Count of late packets
+     */
+    inline u_int32_t late() const
+	{ return m_late; }
+
+    /**
+     * Retrieve the number of packets dropped by buffer overflow or delays
+     * @return Count of dropped packets
+     */
+    inline u_int32_t dropped() const
+	{ return m_dropped; }
+
+    /**
+     * Retrieve the number of packets missing at their playout time
+     * @return Count of packets the decoder had to conceal
+     */
+    inline u_int32_t concealed() const
+	{ return m_concealed; }
+
+    /**
+     * Get the dejitter statistics
+     * @param stat Parameters list to fill with statistics
+     */
+    void stats(NamedList& stat) const;
+
 protected:
     /**
      * Method called periodically to keep the data flowing
@@ -455,6 +659,10 @@ protected:
     virtual void timerTick(const Time& when);
 
 private:
+    bool adaptiveRecv(bool marker, int payload, unsigned int timestamp,
+	const void* data, int len, u_int64_t arrival);
+    void updateJitter(unsigned int timestamp, u_int64_t arrival);
+    void updateDelay(bool late);
     ObjList m_packets;
     RTPReceiver* m_receiver;
     unsigned int m_minDelay;
@@ -464,6 +672,214 @@ private:
     u_int64_t m_headTime;
     u_int64_t m_sampRate;
     unsigned char m_fastRate;
+    bool m_adaptive;
+    bool m_fixedRate;
+    unsigned int m_delay;
+    unsigned int m_boost;
+    unsigned int m_lastStamp;
+    unsigned int m_lastDelta;
+    unsigned int m_spurtStamp;
+    u_int64_t m_lastArrival;
+    u_int64_t m_spurtTime;
+    int64_t m_transit;
+    int64_t m_avgTransit;
+    u_int64_t m_jitter;
+    u_int32_t m_late;
+    u_int32_t m_dropped;
+    u_int32_t m_concealed;
+    u_int32_t m_winCount;
+    u_int32_t m_winLate;
+    unsigned int m_lateRun;
+};
+
+/**
+ * Reception quality metrics of a RTP stream computed incrementally as packets
+ *  arrive. No memory is allocated while updating so it can be kept for every
+ *  stream. Loss bursts are detected as in RFC 3611 and the call quality is
+ *  estimated with the simplified ITU-T G.107 E-model.
+ * @short RTP stream quality metrics
+ */
+class YRTP_API RTPQuality
+{
+public:
+    /**
+     * Minimum number of received packets that separate two loss bursts
+     */
+    enum {
+	Gmin = 16
+    };
+
+    /**
+     * Constructor
+     * @param clockRate RTP clock rate of the stream in Hz
+     */
+    RTPQuality(unsigned int clockRate = 8000);
+
+    /**
+     * Reset all the metrics and counters
+     */
+    void reset();
+
+    /**
+     * Restart sequence and jitter tracking after a stream discontinuity
+     */
+    inline void resync()
+	{ m_resync = true; m_arrival = 0; }
+
+    /**
+     * Set the RTP clock rate used to convert arrival times
+     * @param rate Clock rate of the stream in Hz, zero is ignored
+     */
+    inline void clockRate(unsigned int rate)
+	{ if (rate) m_clockRate = rate; }
+
+    /**
+     * Retrieve the RTP clock rate of the stream
+     * @return Clock rate in Hz
+     */
+    inline unsigned int clockRate() const
+	{ return m_clockRate; }
+
+    /**
+     * Set the codec impairment factors used by the E-model
+     * @param ie Equipment impairment factor of the codec
+     * @param bpl Packet loss robustness factor multiplied by 10
+     */
+    inline void impairment(unsigned int ie, unsigned int bpl)
+	{ m_ie = ie; m_bpl = bpl ? bpl : 1; }
+
+    /**
+     * Account one packet that passed sequence validation
+     * @param seq RTP sequence number of the packet
+     * @param timestamp RTP timestamp of the packet
+     * @param arrival Arrival time of the packet in microseconds
+     */
+    void received(u_int16_t seq, unsigned int timestamp, u_int64_t arrival);
+
+    /**
+     * Retrieve the number of packets received
+     * @return Count of packets received
+     */
+    inline u_int32_t receivedPkts() const
+	{ return m_received; }
+
+    /**
+     * Retrieve the number of packets expected from the sequence numbers
+     * @return Count of packets expected
+     */
+    inline u_int32_t expected() const
+	{ return m_expected; }
+
+    /**
+     * Retrieve the cumulative number of packets lost
+     * @return Expected packets minus the received ones, never negative
+     */
+    inline u_int32_t lost() const
+	{ return (m_expected > m_received) ? m_expected - m_received : 0; }
+
+    /**
+     * Retrieve the number of packets received out of order
+     * @return Count of reordered packets
+     */
+    inline u_int32_t reordered() const
+	{ return m_reordered; }
+
+    /**
+     * Retrieve the RFC 3550 interarrival jitter
+     * @return Jitter in timestamp units
+     */
+    inline unsigned int jitter() const
+	{ return m_jitter >> 4; }
+
+    /**
+     * Retrieve the interarrival jitter in milliseconds
+     * @return Jitter in milliseconds
+     */
+    inline unsigned int jitterMs() const
+	{ return (unsigned int)((u_int64_t)jitter() * 1000 / m_clockRate); }
+
+    /**
+     * Retrieve the duration of one packet
+     * @return Packet duration in milliseconds, zero if not known yet
+     */
+    inline unsigned int frameMs() const
+	{ return (unsigned int)((u_int64_t)m_frameTs * 1000 / m_clockRate); }
+
+    /**
+     * Retrieve the loss density inside bursts
+     * @return Fraction of packets lost in bursts, scaled to 0-255
+     */
+    unsigned int burstDensity() const;
+
+    /**
+     * Retrieve the loss density in the gaps between bursts
+     * @return Fraction of packets lost in gaps, scaled to 0-255
+     */
+    unsigned int gapDensity() const;
+
+    /**
+     * Retrieve the mean duration of loss bursts
+     * @return Mean burst duration in milliseconds
+     */
+    unsigned int burstDuration() const;
+
+    /**
+     * Retrieve the mean duration of the gaps between bursts
+     * @return Mean gap duration in milliseconds
+     */
+    unsigned int gapDuration() const;
+
+    /**
+     * Estimate the transmission rating factor
+     * @param delay One way delay of the media in milliseconds
+     * @param discarded Number of packets received but discarded as late
+     * @return R factor in range 0-100
+     */
+    unsigned int rFactor(unsigned int delay = 0, u_int32_t discarded = 0) const;
+
+    /**
+     * Convert a R factor to an estimated Mean Opinion Score
+     * @param rFactor Transmission rating factor in range 0-100
+     * @return MOS multiplied by 10, in range 10-45
+     */
+    static unsigned int mos(unsigned int rFactor);
+
+    /**
+     * Put the quality metrics in a list of parameters
+     * @param stat Parameters list to fill
+     * @param delay One way delay of the media in milliseconds
+     * @param discarded Number of packets received but discarded as late
+     * @param prefix Optional prefix to add to parameter names
+     */
+    void stats(NamedList& stat, unsigned int delay = 0, u_int32_t discarded = 0,
+	const char* prefix = 0) const;
+
+private:
+    void lossEvent();
+    void burstTotals(u_int32_t& bursts, u_int32_t& burstPkts, u_int32_t& burstLost) const;
+    unsigned int m_clockRate;
+    unsigned int m_ie;
+    unsigned int m_bpl;
+    u_int32_t m_received;
+    u_int32_t m_expected;
+    u_int32_t m_reordered;
+    u_int16_t m_seq;
+    bool m_resync;
+    unsigned int m_timestamp;
+    unsigned int m_frameTs;
+    u_int64_t m_arrival;
+    int64_t m_transit;
+    u_int32_t m_jitter;
+    bool m_lastLost;
+    u_int32_t m_lossEvents;
+    u_int32_t m_lossStarts;
+    u_int32_t m_lossEnds;
+    u_int32_t m_recvRun;
+    u_int32_t m_burstLen;
+    u_int32_t m_burstLost;
+    u_int32_t m_bursts;
+    u_int32_t m_burstPkts;
+    u_int32_t m_burstLostPkts;
 };
 
 /**
@@ -715,9 +1131,39 @@ public:
      * Allocate and set a new dejitter buffer in this receiver
      * @param mindelay Minimum length of the dejitter buffer in microseconds
      * @param maxdelay Maximum length of the dejitter buffer in microseconds
+     * @param adaptive True to adapt the playout delay to the measured jitter
+     * @param clockRate RTP clock rate of the stream in Hz, zero to estimate it
+     */
+    void setDejitter(unsigned int mindelay, unsigned int maxdelay,
+	bool adaptive = false, unsigned int clockRate = 0);
+
+    /**
+     * Retrieve the dejitter buffer of this receiver
+     * @return Pointer to the dejitter buffer, NULL if none is set
+     */
+    inline RTPDejitter* dejitter() const
+	{ return m_dejitter; }
+
+    /**
+     * Retrieve the reception quality metrics of this receiver
+     * @return Reference to the quality metrics
+     */
+    inline const RTPQuality& quality() const
+	{ return m_quality; }
+
+    /**
+     * Retrieve the reception quality metrics of this receiver for changing
+     * @return Reference to the quality metrics
      */
-    inline void setDejitter(unsigned int mindelay, unsigned int maxdelay)
-	{ setDejitter(new RTPDejitter(this,mindelay,maxdelay,dbg(),m_traceId)); }
+    inline RTPQuality& quality()
+	{ return m_quality; }
+
+    /**
+     * Put the reception quality metrics in a list of parameters
+     * @param stat Parameters list to fill
+     * @param prefix Optional prefix to add to parameter names
+     */
+    void qualityStats(NamedList& stat, const char* prefix = 0) const;
 
     /**
      * Process one RTP payload packet.
@@ -827,6 +1273,7 @@ private:
     unsigned int m_seqLost;
     unsigned int m_wrongSSRC;
     unsigned int m_syncLost;
+    RTPQuality m_quality;
 };
 
 /**
@@ -979,6 +1426,13 @@ public:
      */
     bool initGroup(int msec = 0, Thread::Priority prio = Thread::Normal, const String& affinity = String::empty());
 
+    /**
+     * Initialize the RTP session, join the least loaded group of a pool if none is present
+     * @param pool Pool of groups to pick from
+     * @return True if initialized, false on some failure
+     */
+    bool initGroup(RTPGroupPool& pool);
+
     /**
      * Set the remote network address of the RTP transport of this session
      * @param addr New remote RTP transport address
@@ -1037,6 +1491,13 @@ public:
      */
     virtual void transport(RTPTransport* trans);
 
+    /**
+     * Get a pointer to a derived class given that class name
+     * @param name Name of the class we are asking for
+     * @return Pointer to the requested class or NULL if this object doesn't implement it
+     */
+    virtual void* getObject(const String& name) const;
+
 protected:
     /**
      * Default constructor
@@ -1248,9 +1709,12 @@ public:
      * Allocate and set a new dejitter buffer for the receiver in the session
      * @param mindelay Minimum length of the dejitter buffer in microseconds
      * @param maxdelay Maximum length of the dejitter buffer in microseconds
+     * @param adaptive True to adapt the playout delay to the measured jitter
+     * @param clockRate RTP clock rate of the stream in Hz, zero to estimate it
      */
-    inline void setDejitter(unsigned int mindelay = 20, unsigned int maxdelay = 50)
-	{ if (m_recv) m_recv->setDejitter(mindelay,maxdelay); }
+    inline void setDejitter(unsigned int mindelay = 20, unsigned int maxdelay = 50,
+	bool adaptive = false, unsigned int clockRate = 0)
+	{ if (m_recv) m_recv->setDejitter(mindelay,maxdelay,adaptive,clockRate); }
 
     /**
      * Set the RTP/RTCP transport of data handled by this session
@@ -1366,6 +1830,13 @@ public:
      */
     void setReports(int interval);
 
+    /**
+     * Enable or disable RTCP Extended Reports with VoIP metrics
+     * @param enable True to add a RFC 3611 XR block to each RTCP report
+     */
+    inline void setReportXR(bool enable)
+	{ m_reportXR = enable; }
+
     /**
      * Put the collected statistical data
      * @param stats NamedList to populate with the data
@@ -1421,6 +1892,7 @@ private:
     RTPSecure* m_secure;
     u_int64_t m_reportTime;
     u_int64_t m_reportInterval;
+    bool m_reportXR;
     int m_warnSeq;                       // Warn on invalid sequence (1: DebugWarn, -1: DebugInfo)
 };
 
@@ -29,6 +29,9 @@
 
 using namespace TelEngine;
 
+// Number of buckets in the transaction matching indexes
+#define TRANS_INDEX_SIZE 16381
+
 static TokenDict sip_responses[] = {
     { "Trying", 100 },
     { "Ringing", 180 },
@@ -167,8 +170,19 @@ SIPEvent::~SIPEvent()
 }
 
 
+// Hash of the RFC 3261 transaction key: branch and method
+static inline unsigned int branchHash(const String& branch, const String& method)
+{
+    return branch.hash() * 31 + method.hash();
+}
+
+
 SIPEngine::SIPEngine(const char* userAgent)
     : Mutex(true,"SIPEngine"),
+      m_branchIndex(TRANS_INDEX_SIZE), m_callidIndex(TRANS_INDEX_SIZE),
+      m_firstOrder(0), m_lastOrder(0),
+      m_readyFirst(0), m_readyLast(0),
+      m_timers(0), m_timerCount(0), m_timerAlloc(0),
       m_t1(500000), m_t4(5000000), m_reqTransCount(5), m_rspTransCount(6),
       m_maxForwards(70),
       m_flags(0), m_lazyTrying(false),
@@ -191,6 +205,8 @@ SIPEngine::SIPEngine(const char* userAgent)
 SIPEngine::~SIPEngine()
 {
     DDebug(this,DebugInfo,"SIPEngine::~SIPEngine() [%p]",this);
+    clearTransactions();
+    delete[] m_timers;
 }
 
 SIPTransaction* SIPEngine::addMessage(SIPParty* ep, const char* buf, int len)
@@ -229,11 +245,10 @@ SIPTransaction* SIPEngine::addMessage(SIPMessage* message, bool* autoChangeParty
 	branch = *br;
     Lock lock(this);
     SIPTransaction* forked = 0;
-    ObjList* l = &m_transList;
-    for (; l; l = l->next()) {
+    ObjList found;
+    findTransactions(message,branch,found);
+    for (ObjList* l = found.skipNull(); l; l = l->skipNext()) {
 	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
-	if (!t)
-	    continue;
 	switch (t->processMessage(message,branch)) {
 	    case SIPTransaction::Matched:
 		return t;
@@ -260,6 +275,210 @@ SIPTransaction* SIPEngine::addMessage(SIPMessage* message, bool* autoChangeParty
     return new SIPTransaction(message,this,message->isOutgoing(),autoChangeParty);
 }
 
+void SIPEngine::findTransactions(SIPMessage* message, const String& branch, ObjList& list)
+{
+    // an ACK with the INVITE branch is matched by the INVITE transaction
+    const String& method = message->isACK() ? YSTRING("INVITE") : message->method;
+    const String& callid = message->getHeaderValue("Call-ID");
+    ObjList* buckets[2] = { 0, 0 };
+    if (branch)
+	buckets[0] = m_branchIndex.getHashList(branchHash(branch,method));
+    // RFC 2543 messages and ACKs to 2xx with a branch of their own need the Call-ID
+    if (branch.null() || message->isACK())
+	buckets[1] = m_callidIndex.getHashList(callid);
+    for (int i = 0; i < 2; i++) {
+	for (ObjList* l = buckets[i] ? buckets[i]->skipNull() : 0; l; l = l->skipNext()) {
+	    SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
+	    if (i) {
+		if (t->getCallID() != callid)
+		    continue;
+		if (branch && !(t->isInvite() && t->isIncoming()))
+		    continue;
+	    }
+	    else if ((t->m_branch != branch) || (t->getMethod() != method))
+		continue;
+	    if (list.find(t))
+		continue;
+	    // keep the candidates in transaction list order
+	    ObjList* p = list.skipNull();
+	    while (p && (static_cast<SIPTransaction*>(p->get())->m_order < t->m_order))
+		p = p->skipNext();
+	    (p ? p->insert(t) : list.append(t))->setDelete(false);
+	}
+    }
+}
+
+void SIPEngine::addIndex(SIPTransaction* transaction)
+{
+    if (transaction->m_branch) {
+	transaction->m_branchHash = branchHash(transaction->m_branch,transaction->getMethod());
+	m_branchIndex.append(transaction,transaction->m_branchHash)->setDelete(false);
+    }
+    m_callidIndex.append(transaction,transaction->getCallID().hash())->setDelete(false);
+}
+
+void SIPEngine::removeIndex(SIPTransaction* transaction)
+{
+    m_branchIndex.remove(transaction,transaction->m_branchHash,false);
+    m_callidIndex.remove(transaction,transaction->getCallID().hash(),false);
+}
+
+void SIPEngine::detach(SIPTransaction* transaction)
+{
+    removeIndex(transaction);
+    unready(transaction);
+    unschedule(transaction);
+    transaction->m_order = 0;
+}
+
+void SIPEngine::remove(SIPTransaction* transaction)
+{
+    Lock lock(this);
+    if (m_transList.remove(transaction,false))
+	detach(transaction);
+}
+
+void SIPEngine::append(SIPTransaction* transaction)
+{
+    Lock lock(this);
+    m_transList.append(transaction);
+    transaction->m_order = ++m_lastOrder;
+    addIndex(transaction);
+    schedule(transaction);
+    wake(transaction);
+}
+
+void SIPEngine::insert(SIPTransaction* transaction)
+{
+    Lock lock(this);
+    m_transList.insert(transaction);
+    transaction->m_order = --m_firstOrder;
+    addIndex(transaction);
+    schedule(transaction);
+    wake(transaction);
+}
+
+void SIPEngine::reindex(SIPTransaction* transaction)
+{
+    Lock lock(this);
+    if (!m_transList.find(transaction))
+	return;
+    removeIndex(transaction);
+    addIndex(transaction);
+}
+
+void SIPEngine::clearTransactions()
+{
+    Lock lock(this);
+    for (ObjList* l = m_transList.skipNull(); l; l = l->skipNext()) {
+	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
+	t->m_order = 0;
+	t->m_ready = false;
+	t->m_readyPrev = t->m_readyNext = 0;
+	t->m_timerPos = -1;
+    }
+    m_branchIndex.clear();
+    m_callidIndex.clear();
+    m_readyFirst = m_readyLast = 0;
+    m_timerCount = 0;
+    m_transList.clear();
+}
+
+void SIPEngine::wake(SIPTransaction* transaction)
+{
+    Lock lock(this);
+    // transactions not in the list (yet) are never picked up
+    if (transaction->m_ready || !transaction->m_order)
+	return;
+    transaction->m_ready = true;
+    transaction->m_readyPrev = m_readyLast;
+    transaction->m_readyNext = 0;
+    if (m_readyLast)
+	m_readyLast->m_readyNext = transaction;
+    else
+	m_readyFirst = transaction;
+    m_readyLast = transaction;
+}
+
+void SIPEngine::unready(SIPTransaction* transaction)
+{
+    if (!transaction->m_ready)
+	return;
+    if (transaction->m_readyPrev)
+	transaction->m_readyPrev->m_readyNext = transaction->m_readyNext;
+    else
+	m_readyFirst = transaction->m_readyNext;
+    if (transaction->m_readyNext)
+	transaction->m_readyNext->m_readyPrev = transaction->m_readyPrev;
+    else
+	m_readyLast = transaction->m_readyPrev;
+    transaction->m_ready = false;
+    transaction->m_readyPrev = transaction->m_readyNext = 0;
+}
+
+void SIPEngine::schedule(SIPTransaction* transaction)
+{
+    Lock lock(this);
+    if (!(transaction->m_timeout && transaction->m_order)) {
+	unschedule(transaction);
+	return;
+    }
+    if (transaction->m_timerPos < 0) {
+	if (m_timerCount >= m_timerAlloc) {
+	    unsigned int alloc = m_timerAlloc ? 2 * m_timerAlloc : 64;
+	    SIPTransaction** timers = new SIPTransaction*[alloc];
+	    for (unsigned int i = 0; i < m_timerCount; i++)
+		timers[i] = m_timers[i];
+	    delete[] m_timers;
+	    m_timers = timers;
+	    m_timerAlloc = alloc;
+	}
+	transaction->m_timerPos = m_timerCount;
+	m_timers[m_timerCount++] = transaction;
+    }
+    timerPlace(transaction->m_timerPos);
+}
+
+void SIPEngine::unschedule(SIPTransaction* transaction)
+{
+    if (transaction->m_timerPos < 0)
+	return;
+    unsigned int pos = transaction->m_timerPos;
+    transaction->m_timerPos = -1;
+    if (pos == --m_timerCount)
+	return;
+    m_timers[pos] = m_timers[m_timerCount];
+    m_timers[pos]->m_timerPos = pos;
+    timerPlace(pos);
+}
+
+void SIPEngine::timerPlace(unsigned int pos)
+{
+    SIPTransaction* t = m_timers[pos];
+    while (pos) {
+	unsigned int parent = (pos - 1) / 2;
+	if (m_timers[parent]->m_timeout <= t->m_timeout)
+	    break;
+	m_timers[pos] = m_timers[parent];
+	m_timers[pos]->m_timerPos = pos;
+	pos = parent;
+    }
+    for (;;) {
+	unsigned int child = 2 * pos + 1;
+	if (child >= m_timerCount)
+	    break;
+	if ((child + 1 < m_timerCount) && (m_timers[child + 1]->m_timeout < m_timers[child]->m_timeout))
+	    child++;
+	if (t->m_timeout <= m_timers[child]->m_timeout)
+	    break;
+	m_timers[pos] = m_timers[child];
+	m_timers[pos]->m_timerPos = pos;
+	pos = child;
+    }
+    m_timers[pos] = t;
+    t->m_timerPos = pos;
+}
+
 SIPTransaction* SIPEngine::forkInvite(SIPMessage* answer, SIPTransaction* trans)
 {
     // TODO: build new transaction or CANCEL
@@ -280,30 +499,30 @@ bool SIPEngine::process()
 SIPEvent* SIPEngine::getEvent()
 {
     Lock lock(this);
-    ObjList* l = m_transList.skipNull();
-    if (!l)
-	return 0;
     u_int64_t time = Time::now();
-    for (; l; l = l->skipNext()) {
-	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
-	SIPEvent* e = t->getEvent(true,time);
-	if (e) {
-	    DDebug(this,DebugInfo,"Got pending event %p (state %s) from transaction %p [%p]",
-		e,SIPTransaction::stateName(e->getState()),t,this);
-	    if (t->getState() == SIPTransaction::Invalid)
-		m_transList.remove(t);
-	    return e;
-	}
+    // transactions whose timer fired join the ones woken up by a change
+    while (m_timerCount && (m_timers[0]->m_timeout <= time)) {
+	SIPTransaction* t = m_timers[0];
+	unschedule(t);
+	wake(t);
     }
-    time = Time::now();
-    for (l = m_transList.skipNull(); l; l = l->skipNext()) {
-	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
+    while (m_readyFirst) {
+	SIPTransaction* t = m_readyFirst;
+	unready(t);
 	SIPEvent* e = t->getEvent(false,time);
+	if (t->getState() == SIPTransaction::Invalid) {
+	    detach(t);
+	    m_transList.remove(t);
+	}
+	else {
+	    schedule(t);
+	    // it may have more events, look again after the others had a turn
+	    if (e)
+		wake(t);
+	}
 	if (e) {
 	    DDebug(this,DebugInfo,"Got event %p (state %s) from transaction %p [%p]",
 		e,SIPTransaction::stateName(e->getState()),t,this);
-	    if (t->getState() == SIPTransaction::Invalid)
-		m_transList.remove(t);
 	    return e;
 	}
     }
@@ -519,6 +738,7 @@ int SIPEngine::authUser(const SIPMessage* message, String& user, bool proxy, Gen
     long bestAge = -1;
     String bestNonce;
     const char* hdr = proxy ? "Proxy-Authorization" : "Authorization";
+    message->parseHeaders();
     const ObjList* l = &message->header;
     for (; l; l = l->next()) {
 	const GenObject* o = l->get();
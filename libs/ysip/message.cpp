@@ -27,7 +27,59 @@
 
 using namespace TelEngine;
 
+namespace TelEngine {
+
+// One header line of a parsed message kept as name and value in the copy of
+//  the header block until the line object is first needed
+class SIPHeaderSpan
+{
+public:
+    inline bool matches(const char* str, unsigned int len) const
+	{ return !removed && (len == nameLen) && !::strncasecmp(name,str,len); }
+    const char* name;
+    unsigned int nameLen;
+    const char* value;
+    unsigned int valueLen;
+    MimeHeaderLine* line;
+    bool removed;
+};
+
+}
+
 static Regexp s_angled("<\\([^>]\\+\\)>");
+// Protects building header lines of messages that may be shared between threads
+static MutexPool s_spanMutex(17,false,"SIPHeaders");
+
+static inline bool isBlank(char c)
+{
+    return (c == ' ') || (c == '\t');
+}
+
+static inline bool isSpace(char c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') || (c == '\v') || (c == '\f');
+}
+
+static inline bool isDigit(char c)
+{
+    return (c >= '0') && (c <= '9');
+}
+
+static inline bool isAlpha(char c)
+{
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'));
+}
+
+// Match a SIP/<digit>.<digits> protocol version, return its length or 0
+static unsigned int sipVersion(const char* s)
+{
+    if (::strncasecmp(s,"SIP/",4) || !isDigit(s[4]) || (s[5] != '.') || !isDigit(s[6]))
+	return 0;
+    unsigned int n = 7;
+    while (isDigit(s[n]))
+	n++;
+    return n;
+}
 
 SIPMessage::SIPMessage(const SIPMessage& original)
     : RefObject(),
@@ -36,7 +88,8 @@ SIPMessage::SIPMessage(const SIPMessage& original)
       body(0), msgTraceId(original.msgTraceId), msgPrint(true), m_ep(0),
       m_valid(original.isValid()), m_answer(original.isAnswer()),
       m_outgoing(original.isOutgoing()), m_ack(original.isACK()),
-      m_cseq(-1), m_flags(original.getFlags()), m_dontSend(original.m_dontSend)
+      m_cseq(-1), m_flags(original.getFlags()), m_dontSend(original.m_dontSend),
+      m_spans(0), m_spanCount(0), m_spanMark(0)
 {
     DDebug(DebugAll,"SIPMessage::SIPMessage(&%p) [%p]",
 	&original,this);
@@ -45,6 +98,7 @@ SIPMessage::SIPMessage(const SIPMessage& original)
     setParty(original.getParty());
     setSequence(original.getSequence());
     bool via1 = true;
+    original.parseHeaders();
     const ObjList* l = &original.header;
     for (; l; l = l->next()) {
 	const MimeHeaderLine* hl = static_cast<MimeHeaderLine*>(l->get());
@@ -67,7 +121,7 @@ SIPMessage::SIPMessage(const char* _method, const char* _uri, const char* _versi
     : version(_version), method(_method), uri(_uri), code(0),
       body(0), msgPrint(true), m_ep(0), m_valid(true),
       m_answer(false), m_outgoing(true), m_ack(false), m_cseq(-1), m_flags(-1),
-      m_dontSend(false)
+      m_dontSend(false), m_spans(0), m_spanCount(0), m_spanMark(0)
 {
     DDebug(DebugAll,"SIPMessage::SIPMessage('%s','%s','%s') [%p]",
 	_method,_uri,_version,this);
@@ -76,7 +130,7 @@ SIPMessage::SIPMessage(const char* _method, const char* _uri, const char* _versi
 SIPMessage::SIPMessage(SIPParty* ep, const char* buf, int len, unsigned int* bodyLen)
     : code(0), body(0), msgPrint(true), m_ep(ep), m_valid(false),
       m_answer(false), m_outgoing(false), m_ack(false), m_cseq(-1), m_flags(-1),
-      m_dontSend(false)
+      m_dontSend(false), m_spans(0), m_spanCount(0), m_spanMark(0)
 {
     DDebug(DebugInfo,"SIPMessage::SIPMessage(%p,%d) [%p]\r\n------\r\n%s------",
 	buf,len,this,buf);
@@ -95,7 +149,7 @@ SIPMessage::SIPMessage(const SIPMessage* message, int _code, const char* _reason
     : code(_code), body(0), msgPrint(true),
       m_ep(0), m_valid(false),
       m_answer(true), m_outgoing(true), m_ack(false), m_cseq(-1), m_flags(-1),
-      m_dontSend(false)
+      m_dontSend(false), m_spans(0), m_spanCount(0), m_spanMark(0)
 {
     DDebug(DebugAll,"SIPMessage::SIPMessage(%p,%d,'%s') [%p]",
 	message,_code,_reason,this);
@@ -126,7 +180,7 @@ SIPMessage::SIPMessage(const SIPMessage* original, const SIPMessage* answer)
     : method("ACK"), code(0),
       body(0), msgPrint(true), m_ep(0), m_valid(false),
       m_answer(false), m_outgoing(true), m_ack(true), m_cseq(-1), m_flags(-1),
-      m_dontSend(false)
+      m_dontSend(false), m_spans(0), m_spanCount(0), m_spanMark(0)
 {
     DDebug(DebugAll,"SIPMessage::SIPMessage(%p,%p) [%p]",original,answer,this);
     if (!(original && original->isValid()))
@@ -190,6 +244,7 @@ SIPMessage::~SIPMessage()
     m_valid = false;
     setParty();
     setBody();
+    clearSpans();
 }
 
 void SIPMessage::complete(SIPEngine* engine, const char* user, const char* domain, const char* dlgTag, int flags)
@@ -375,6 +430,7 @@ int SIPMessage::copyAllHeaders(const SIPMessage* message, const char* name, cons
     if (!(message && name && *name))
 	return 0;
     int c = 0;
+    message->parseHeaders();
     const ObjList* l = &message->header;
     for (; l; l = l->next()) {
 	const MimeHeaderLine* hl = static_cast<const MimeHeaderLine*>(l->get());
@@ -391,34 +447,52 @@ bool SIPMessage::parseFirst(String& line)
     XDebug(DebugAll,"SIPMessage::parse firstline= '%s'",line.c_str());
     if (line.null())
 	return false;
-    static Regexp r("^\\([Ss][Ii][Pp]/[0-9]\\.[0-9]\\+\\)[[:space:]]\\+\\([0-9][0-9][0-9]\\)[[:space:]]\\+\\(.*\\)$");
-    if (line.matches(r)) {
-	// Answer: <version> <code> <reason-phrase>
-	m_answer = true;
-	version = line.matchString(1).toUpper();
-	code = line.matchString(2).toInteger();
-	reason = line.matchString(3);
-	DDebug(DebugAll,"got answer version='%s' code=%d reason='%s'",
-	    version.c_str(),code,reason.c_str());
-    }
-    else {
-	static Regexp r2("^\\([[:alpha:]]\\+\\)[[:space:]]\\+\\([^[:space:]]\\+\\)[[:space:]]\\+\\([Ss][Ii][Pp]/[0-9]\\.[0-9]\\+\\)$");
-	if (line.matches(r2)) {
-	    // Request: <method> <uri> <version>
-	    m_answer = false;
-	    method = line.matchString(1).toUpper();
-	    uri = line.matchString(2);
-	    version = line.matchString(3).toUpper();
-	    DDebug(DebugAll,"got request method='%s' uri='%s' version='%s'",
-		method.c_str(),uri.c_str(),version.c_str());
-	    if (method == YSTRING("ACK"))
-		m_ack = true;
-	}
-	else {
-	    TraceDebug(msgTraceId,DebugAll,"Invalid SIP line '%s'",line.c_str());
-	    return false;
+    // Scanned by hand, matching a regular expression costs more than all the rest
+    const char* s = line.c_str();
+    unsigned int n = sipVersion(s);
+    if (n && isSpace(s[n])) {
+	const char* p = s + n;
+	while (isSpace(*p))
+	    p++;
+	if (isDigit(p[0]) && isDigit(p[1]) && isDigit(p[2]) && isSpace(p[3])) {
+	    // Answer: <version> <code> <reason-phrase>
+	    m_answer = true;
+	    version.assign(s,n).toUpper();
+	    code = (p[0] - '0') * 100 + (p[1] - '0') * 10 + (p[2] - '0');
+	    for (p += 3; isSpace(*p); p++)
+		;
+	    reason = p;
+	    DDebug(DebugAll,"got answer version='%s' code=%d reason='%s'",
+		version.c_str(),code,reason.c_str());
+	    return true;
 	}
     }
+    // Request: <method> <uri> <version>
+    const char* m = s;
+    while (isAlpha(*m))
+	m++;
+    const char* u = m;
+    while (isSpace(*u))
+	u++;
+    const char* v = u;
+    while (*v && !isSpace(*v))
+	v++;
+    const char* e = v;
+    while (isSpace(*e))
+	e++;
+    n = sipVersion(e);
+    if ((m == s) || (u == m) || (v == u) || (e == v) || !n || e[n]) {
+	TraceDebug(msgTraceId,DebugAll,"Invalid SIP line '%s'",line.c_str());
+	return false;
+    }
+    m_answer = false;
+    method.assign(s,m - s).toUpper();
+    uri.assign(u,v - u);
+    version.assign(e,n).toUpper();
+    DDebug(DebugAll,"got request method='%s' uri='%s' version='%s'",
+	method.c_str(),uri.c_str(),version.c_str());
+    if (method == YSTRING("ACK"))
+	m_ack = true;
     return true;
 }
 
@@ -440,51 +514,108 @@ bool SIPMessage::parse(const char* buf, int len, unsigned int* bodyLen)
 	return false;
     }
     line->destruct();
+    // Unfold the header lines in a copy of the buffer and only remember where
+    //  names and values are, line objects are built when first requested
+    clearSpans();
+    m_raw.assign(0,len + 1);
+    char* w = (char*)m_raw.data();
+    unsigned int alloc = 0;
     int clen = -1;
+    bool ok = true;
     while (len > 0) {
-	line = MimeBody::getUnfoldedLine(buf,len);
-	if (line->null()) {
-	    // Found end of headers
-	    line->destruct();
-	    break;
+	char* s = w;
+	while (len > 0) {
+	    char c = *buf;
+	    if ((c == '\r') || (c == '\n')) {
+		// CR is optional but skip over it if exists
+		++buf;
+		--len;
+		if ((c == '\r') && (len > 0) && (*buf == '\n')) {
+		    ++buf;
+		    --len;
+		}
+		// Lines starting with blanks continue the current one
+		if ((w == s) || !((len > 0) && isBlank(*buf)))
+		    break;
+		while ((len > 0) && isBlank(*buf)) {
+		    ++buf;
+		    --len;
+		}
+		continue;
+	    }
+	    if (!c) {
+		// Should not happen - just end parsing like MimeBody does
+		Debug(DebugMild,"Unexpected NUL character while unfolding lines");
+		buf += len;
+		len = 0;
+		break;
+	    }
+	    *w++ = c;
+	    ++buf;
+	    --len;
 	}
-	int col = line->find(':');
-	if (col <= 0) {
-	    line->destruct();
-	    return false;
+	char* e = w;
+	while ((s < e) && isBlank(*s))
+	    ++s;
+	while ((e > s) && isBlank(e[-1]))
+	    --e;
+	// Found end of headers
+	if (s == e)
+	    break;
+	char* col = (char*)::memchr(s,':',e - s);
+	if (!col || (col == s)) {
+	    ok = false;
+	    break;
 	}
-	String name = line->substr(0,col);
-	name.trimBlanks();
-	if (name.null()) {
-	    line->destruct();
-	    return false;
+	char* v = col + 1;
+	while ((v < e) && isBlank(*v))
+	    ++v;
+	while ((col > s) && isBlank(col[-1]))
+	    --col;
+	*col = '\0';
+	if (m_spanCount >= alloc) {
+	    alloc = alloc ? 2 * alloc : 32;
+	    SIPHeaderSpan* spans = new SIPHeaderSpan[alloc];
+	    if (m_spans) {
+		::memcpy(spans,m_spans,m_spanCount * sizeof(SIPHeaderSpan));
+		delete[] m_spans;
+	    }
+	    m_spans = spans;
 	}
-	name = uncompactForm(name);
-	*line >> ":";
-	line->trimBlanks();
-	XDebug(DebugAll,"SIPMessage::parse header='%s' value='%s'",name.c_str(),line->c_str());
-
-	if ((name &= "WWW-Authenticate") ||
-	    (name &= "Proxy-Authenticate") ||
-	    (name &= "Authorization") ||
-	    (name &= "Proxy-Authorization"))
-	    header.append(new MimeAuthLine(name,*line));
-	else
-	    header.append(new MimeHeaderLine(name,*line));
+	SIPHeaderSpan& span = m_spans[m_spanCount++];
+	span.name = uncompactForm(s);
+	span.nameLen = (span.name == s) ? (col - s) : ::strlen(span.name);
+	span.value = v;
+	span.valueLen = e - v;
+	span.line = 0;
+	span.removed = false;
+	XDebug(DebugAll,"SIPMessage::parse header='%s' value='%.*s'",
+	    span.name,(int)span.valueLen,span.value);
 
-	if ((clen < 0) && (name &= "Content-Length"))
-	    clen = line->toInteger(-1,10);
-	else if ((m_cseq < 0) && (name &= "CSeq")) {
-	    int sep = line->find(' ');
+	if ((clen < 0) && span.matches("Content-Length",14))
+	    clen = String(v,e - v).toInteger(-1,10);
+	else if ((m_cseq < 0) && span.matches("CSeq",4)) {
+	    String tmp(v,e - v);
+	    int sep = tmp.find(' ');
 	    if (sep > 0) {
-		m_cseq = line->substr(0,sep).toInteger(-1,10);
+		m_cseq = tmp.substr(0,sep).toInteger(-1,10);
 		if (m_answer) {
-		    method = line->substr(sep + 1);
+		    method = tmp.substr(sep + 1);
 		    method.trimBlanks().toUpper();
 		}
 	    }
 	}
-	line->destruct();
+	w = e;
+    }
+    if (!(ok && m_spanCount)) {
+	clearSpans();
+	if (!ok)
+	    return false;
+    }
+    else {
+	// parsed lines will take the place of this nameless line in the list
+	m_spanMark = new MimeHeaderLine("","");
+	header.append(m_spanMark)->setDelete(false);
     }
     if (!bodyLen) {
 	if (clen >= 0) {
@@ -499,8 +630,8 @@ bool SIPMessage::parse(const char* buf, int len, unsigned int* bodyLen)
     }
     else
 	*bodyLen = (clen >= 0) ? clen : 0;
-    DDebug(DebugAll,"SIPMessage::parse %d header lines, body %p",
-	header.count(),body);
+    DDebug(DebugAll,"SIPMessage::parse %u header lines, body %p",
+	m_spanCount,body);
     return true;
 }
 
@@ -526,6 +657,23 @@ void SIPMessage::buildBody(const char* buf, int len)
     if (cType)
 	body = MimeBody::build(buf,len,*cType);
     // Move extra Content- header lines to body
+    if (body && m_spans) {
+	Lock lck(s_spanMutex.mutex((void*)this));
+	for (unsigned int i = 0; i < m_spanCount; i++) {
+	    SIPHeaderSpan& span = m_spans[i];
+	    if (span.removed || (span.valueLen < 8) || ::strncasecmp(span.value,"Content-",8))
+		continue;
+	    MimeHeaderLine* line = spanLine(span);
+	    if (*line &= "Content-Length")
+		continue;
+	    span.line = 0;
+	    span.removed = true;
+	    if (line == cType)
+		TelEngine::destruct(line);
+	    else
+		body->appendHdr(line);
+	}
+    }
     if (body) {
 	ListIterator iter(header);
 	for (GenObject* o = 0; (o = iter.get());) {
@@ -543,14 +691,141 @@ void SIPMessage::buildBody(const char* buf, int len)
 	header.count(),body);
 }
 
+// Build the line object of a header left unparsed, span lock must be held
+MimeHeaderLine* SIPMessage::spanLine(SIPHeaderSpan& span) const
+{
+    if (span.line)
+	return span.line;
+    String name(span.name,span.nameLen);
+    String value(span.value,span.valueLen);
+    if ((name &= "WWW-Authenticate") ||
+	(name &= "Proxy-Authenticate") ||
+	(name &= "Authorization") ||
+	(name &= "Proxy-Authorization"))
+	span.line = new MimeAuthLine(name,value);
+    else
+	span.line = new MimeHeaderLine(name,value);
+    return span.line;
+}
+
+// Find the first or last unparsed header with a given name and build its line,
+//  span lock must be held
+const MimeHeaderLine* SIPMessage::findSpan(const char* name, bool last) const
+{
+    if (!m_spans)
+	return 0;
+    unsigned int len = ::strlen(name);
+    SIPHeaderSpan* found = 0;
+    for (unsigned int i = 0; i < m_spanCount; i++) {
+	if (m_spans[i].matches(name,len)) {
+	    found = m_spans + i;
+	    if (!last)
+		break;
+	}
+    }
+    return found ? spanLine(*found) : 0;
+}
+
+// Build all unparsed headers and put them where the parser left them, after
+//  lines inserted and before lines appended meanwhile, span lock must be held
+void SIPMessage::buildSpans() const
+{
+    if (!m_spans)
+	return;
+    ObjList& list = const_cast<ObjList&>(header);
+    ObjList* pos = list.find(m_spanMark);
+    if (!pos)
+	pos = &list;
+    for (unsigned int i = m_spanCount; i--; ) {
+	SIPHeaderSpan& span = m_spans[i];
+	if (span.removed)
+	    continue;
+	pos->insert(spanLine(span));
+	span.line = 0;
+    }
+    const_cast<SIPMessage*>(this)->clearSpans();
+}
+
+void SIPMessage::clearSpans()
+{
+    if (m_spans) {
+	for (unsigned int i = 0; i < m_spanCount; i++)
+	    TelEngine::destruct(m_spans[i].line);
+	delete[] m_spans;
+	m_spans = 0;
+    }
+    m_spanCount = 0;
+    m_raw.clear();
+    if (m_spanMark) {
+	header.remove(m_spanMark,false);
+	TelEngine::destruct(m_spanMark);
+    }
+}
+
+// Append the text of the unparsed headers, span lock must be held
+void SIPMessage::spanLines(ObjList& lines) const
+{
+    ObjList* add = &lines;
+    for (unsigned int i = 0; i < m_spanCount; i++) {
+	const SIPHeaderSpan& span = m_spans[i];
+	if (span.removed)
+	    continue;
+	NamedString* ns = new NamedString(String(span.name,span.nameLen));
+	if (span.line)
+	    span.line->buildLine(*ns,false);
+	else
+	    ns->assign(span.value,span.valueLen);
+	add = add->append(ns);
+    }
+}
+
+void SIPMessage::parseHeaders() const
+{
+    Lock lck(s_spanMutex.mutex((void*)this));
+    buildSpans();
+}
+
+void SIPMessage::getHeaderLines(ObjList& lines) const
+{
+    Lock lck(s_spanMutex.mutex((void*)this));
+    // same order as buildSpans() would give, in front if the mark is gone
+    if (m_spans && !header.find(m_spanMark))
+	spanLines(lines);
+    for (const ObjList* l = header.skipNull(); l; l = l->skipNext()) {
+	const MimeHeaderLine* t = static_cast<const MimeHeaderLine*>(l->get());
+	if (t == m_spanMark) {
+	    if (m_spans)
+		spanLines(lines);
+	    continue;
+	}
+	NamedString* ns = new NamedString(t->name());
+	t->buildLine(*ns,false);
+	lines.append(ns);
+    }
+}
+
 const MimeHeaderLine* SIPMessage::getHeader(const char* name) const
 {
     if (!(name && *name))
 	return 0;
+    Lock lck(s_spanMutex.mutex((void*)this));
+    // parsed headers are in the place of the mark, in front if it is gone
+    if (m_spans && !header.find(m_spanMark)) {
+	const MimeHeaderLine* t = findSpan(name,false);
+	if (t)
+	    return t;
+    }
     const ObjList* l = &header;
     for (; l; l = l->next()) {
 	const MimeHeaderLine* t = static_cast<const MimeHeaderLine*>(l->get());
-	if (t && (t->name() &= name))
+	if (!t)
+	    continue;
+	if (t == m_spanMark) {
+	    t = findSpan(name,false);
+	    if (t)
+		return t;
+	}
+	else if (t->name() &= name)
 	    return t;
     }
     return 0;
@@ -560,11 +835,21 @@ const MimeHeaderLine* SIPMessage::getLastHeader(const char* name) const
 {
     if (!(name && *name))
 	return 0;
+    Lock lck(s_spanMutex.mutex((void*)this));
     const MimeHeaderLine* res = 0;
+    if (m_spans && !header.find(m_spanMark))
+	res = findSpan(name,true);
     const ObjList* l = &header;
     for (; l; l = l->next()) {
 	const MimeHeaderLine* t = static_cast<const MimeHeaderLine*>(l->get());
-	if (t && (t->name() &= name))
+	if (!t)
+	    continue;
+	if (t == m_spanMark) {
+	    t = findSpan(name,true);
+	    if (t)
+		res = t;
+	}
+	else if (t->name() &= name)
 	    res = t;
     }
     return res;
@@ -574,6 +859,17 @@ void SIPMessage::clearHeaders(const char* name)
 {
     if (!(name && *name))
 	return;
+    Lock lck(s_spanMutex.mutex((void*)this));
+    if (m_spans) {
+	unsigned int len = ::strlen(name);
+	for (unsigned int i = 0; i < m_spanCount; i++) {
+	    SIPHeaderSpan& span = m_spans[i];
+	    if (span.matches(name,len)) {
+		span.removed = true;
+		TelEngine::destruct(span.line);
+	    }
+	}
+    }
     ObjList* l = &header;
     while (l) {
 	const MimeHeaderLine* t = static_cast<const MimeHeaderLine*>(l->get());
@@ -589,6 +885,13 @@ int SIPMessage::countHeaders(const char* name) const
     if (!(name && *name))
 	return 0;
     int res = 0;
+    Lock lck(s_spanMutex.mutex((void*)this));
+    if (m_spans) {
+	unsigned int len = ::strlen(name);
+	for (unsigned int i = 0; i < m_spanCount; i++)
+	    if (m_spans[i].matches(name,len))
+		++res;
+    }
     const ObjList* l = &header;
     for (; l; l = l->next()) {
 	const MimeHeaderLine* t = static_cast<const MimeHeaderLine*>(l->get());
@@ -624,6 +927,7 @@ const String& SIPMessage::getHeaders() const
 	else
 	    m_string << method << " " << uri << " " << version << "\r\n";
 
+	parseHeaders();
 	const ObjList* l = &header;
 	for (; l; l = l->next()) {
 	    MimeHeaderLine* t = static_cast<MimeHeaderLine*>(l->get());
@@ -685,6 +989,7 @@ MimeAuthLine* SIPMessage::buildAuth(const String& username, const String& passwo
     const String& meth, const String& uri, bool proxy, SIPEngine* engine) const
 {
     const char* hdr = proxy ? "Proxy-Authenticate" : "WWW-Authenticate";
+    parseHeaders();
     const ObjList* l = &header;
     for (; l; l = l->next()) {
 	const MimeAuthLine* t = YOBJECT(MimeAuthLine,l->get());
@@ -752,6 +1057,7 @@ MimeAuthLine* SIPMessage::buildAuth(const SIPMessage& original, SIPEngine* engin
 ObjList* SIPMessage::getRoutes() const
 {
     ObjList* list = 0;
+    parseHeaders();
     const ObjList* l = &header;
     for (; l; l = l->next()) {
 	const MimeHeaderLine* h = YOBJECT(MimeHeaderLine,l->get());
@@ -47,15 +47,43 @@ static const char* compactForms[] = {
     "v", "Via",
     0 };
 
+// Full names indexed by the compact form letter, a perfect hash of the table above
+static const char* s_uncompact[26] = {
+    "Accept-Contact",      // a
+    "Referred-By",         // b
+    "Content-Type",        // c
+    "Request-Disposition", // d
+    "Content-Encoding",    // e
+    "From",                // f
+    0,                     // g
+    0,                     // h
+    "Call-ID",             // i
+    "Reject-Contact",      // j
+    "Supported",           // k
+    "Content-Length",      // l
+    "Contact",             // m
+    "Identity-Info",       // n
+    "Event",               // o
+    0,                     // p
+    0,                     // q
+    "Refer-To",            // r
+    "Subject",             // s
+    "To",                  // t
+    "Allow-Events",        // u
+    "Via",                 // v
+    0,                     // w
+    "Session-Expires",     // x
+    "Identity",            // y
+    0,                     // z
+};
+
 // Utility function, returns an uncompacted header name
 const char* uncompactForm(const char* header)
 {
-    if (header && header[0] && !header[1]) {
-	char c = header[0];
-	const char **p = compactForms;
-	for (; *p; p += 2)
-	    if (**p == c)
-		return *++p;
+    if (header && (header[0] >= 'a') && (header[0] <= 'z') && !header[1]) {
+	const char* name = s_uncompact[header[0] - 'a'];
+	if (name)
+	    return name;
     }
     return header;
 }
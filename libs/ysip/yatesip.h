@@ -52,6 +52,7 @@ extern YSIP_API TokenDict* SIPResponses;
 
 class SIPEngine;
 class SIPEvent;
+class SIPHeaderSpan;
 
 class YSIP_API SIPParty : public RefObject
 {
@@ -374,6 +375,19 @@ public:
      */
     const String& getParamValue(const char* name, const char* param, bool last = false) const;
 
+    /**
+     * Build all header lines left unparsed by the parser and move them to
+     *  the header list. Must be called before walking the header list.
+     */
+    void parseHeaders() const;
+
+    /**
+     * Get the name and text of all header lines in order without building
+     *  the line objects of headers left unparsed by the parser
+     * @param lines List to append a NamedString to for each header line
+     */
+    void getHeaderLines(ObjList& lines) const;
+
     /**
      * Append a new header line constructed from name and content
      * @param name Name of the header to add
@@ -518,7 +532,9 @@ public:
     String reason;
 
     /**
-     * All the headers should be in this list.
+     * All the headers should be in this list. Header lines of a parsed
+     *  message are built on first use and a nameless line holds their place,
+     *  call parseHeaders() before walking it.
      */
     ObjList header;
 
@@ -541,6 +557,11 @@ public:
 protected:
     bool parse(const char* buf, int len, unsigned int* bodyLen);
     bool parseFirst(String& line);
+    void buildSpans() const;
+    void clearSpans();
+    MimeHeaderLine* spanLine(SIPHeaderSpan& span) const;
+    const MimeHeaderLine* findSpan(const char* name, bool last) const;
+    void spanLines(ObjList& lines) const;
     SIPParty* m_ep;
     RefPointer<SIPSequence> m_seq;
     bool m_valid;
@@ -554,6 +575,10 @@ protected:
     String m_authUser;
     String m_authPass;
     bool m_dontSend;
+    DataBlock m_raw;
+    mutable SIPHeaderSpan* m_spans;
+    unsigned int m_spanCount;
+    MimeHeaderLine* m_spanMark;
 private:
     SIPMessage(); // no, thanks
 };
@@ -770,6 +795,7 @@ protected:
  */
 class YSIP_API SIPTransaction : public RefObject
 {
+    friend class SIPEngine;
 public:
     /**
      * Current state of the transaction
@@ -948,8 +974,7 @@ public:
      * Set the (re)transmission flag that allows the latest outgoing message
      *  to be send over the wire
      */
-    inline void setTransmit()
-	{ m_transmit = true; }
+    void setTransmit();
 
     /**
      * Change transaction status to Cleared
@@ -1204,6 +1229,14 @@ protected:
     bool m_autoAck;
     bool m_silent;
     String m_traceId;
+
+private:
+    unsigned int m_branchHash;
+    int64_t m_order;
+    bool m_ready;
+    SIPTransaction* m_readyPrev;
+    SIPTransaction* m_readyNext;
+    int m_timerPos;
 };
 
 /**
@@ -1394,9 +1427,9 @@ public:
 
     /**
      * Get a SIPEvent from the queue.
-     * This method mainly looks into the transaction list and get all kind of
-     * events, like an incoming request (INVITE, REGISTRATION), a timer, an
-     * outgoing message.
+     * This method looks only at the transactions that were woken up by a
+     *  change or by their timer and get all kind of events, like an incoming
+     *  request (INVITE, REGISTRATION), a timer, an outgoing message.
      * This method is thread safe
      */
     SIPEvent *getEvent();
@@ -1515,14 +1548,14 @@ public:
      * Get an authentication nonce
      * @param nonce String reference to fill with the current nonce
      */
-    void nonceGet(String& nonce);
+    virtual void nonceGet(String& nonce);
 
     /**
      * Get the age of an authentication nonce
      * @param nonce String nonce to check for validity and age
      * @return Age of the nonce in seconds, negative for invalid
      */
-    long nonceAge(const String& nonce);
+    virtual long nonceAge(const String& nonce);
 
     /**
      * Get a nonce count
@@ -1579,22 +1612,45 @@ public:
      * Remove a transaction from the list without dereferencing it
      * @param transaction Pointer to transaction to remove
      */
-    inline void remove(SIPTransaction* transaction)
-	{ lock(); m_transList.remove(transaction,false); unlock(); }
+    void remove(SIPTransaction* transaction);
 
     /**
      * Append a transaction to the end of the list
      * @param transaction Pointer to transaction to append
      */
-    inline void append(SIPTransaction* transaction)
-	{ lock(); m_transList.append(transaction); unlock(); }
+    void append(SIPTransaction* transaction);
 
     /**
      * Insert a transaction at the start of the list
      * @param transaction Pointer to transaction to insert
      */
-    inline void insert(SIPTransaction* transaction)
-	{ lock(); m_transList.insert(transaction); unlock(); }
+    void insert(SIPTransaction* transaction);
+
+    /**
+     * Update the matching index of a transaction whose branch has changed
+     * @param transaction Pointer to transaction to index again
+     */
+    void reindex(SIPTransaction* transaction);
+
+    /**
+     * Queue a transaction that may have an event for @ref getEvent()
+     * This method is thread safe
+     * @param transaction Pointer to transaction that changed
+     */
+    void wake(SIPTransaction* transaction);
+
+    /**
+     * Update the position of a transaction in the timer queue after its timeout changed
+     * This method is thread safe
+     * @param transaction Pointer to transaction whose timeout changed
+     */
+    void schedule(SIPTransaction* transaction);
+
+    /**
+     * Remove and dereference all transactions
+     * This method is thread safe
+     */
+    void clearTransactions();
 
     /**
      * Get the number of active SIP transactions
@@ -1604,11 +1660,81 @@ public:
 	{ Lock mylock(this); return m_transList.count(); }
 
 protected:
+    /**
+     * Find the transactions that may match a message, in transaction list order
+     * @param message The message to match
+     * @param branch RFC 3261 branch of the message, empty for RFC 2543 peers
+     * @param list List to fill with the candidate transactions, they are not owned
+     */
+    void findTransactions(SIPMessage* message, const String& branch, ObjList& list);
+
+    /**
+     * Add a transaction to the matching indexes
+     * @param transaction Pointer to transaction to index
+     */
+    void addIndex(SIPTransaction* transaction);
+
+    /**
+     * Remove a transaction from the matching indexes
+     * @param transaction Pointer to transaction to remove
+     */
+    void removeIndex(SIPTransaction* transaction);
+
+    /**
+     * Remove a transaction from the indexes and event queues after it left the list
+     * @param transaction Pointer to transaction to detach
+     */
+    void detach(SIPTransaction* transaction);
+
+    /**
+     * Remove a transaction from the queue of transactions with events
+     * @param transaction Pointer to transaction to remove
+     */
+    void unready(SIPTransaction* transaction);
+
+    /**
+     * Remove a transaction from the timer queue
+     * @param transaction Pointer to transaction to remove
+     */
+    void unschedule(SIPTransaction* transaction);
+
+    /**
+     * Move a timer queue entry up or down until the queue is ordered again
+     * @param pos Position of the entry whose timeout changed
+     */
+    void timerPlace(unsigned int pos);
+
+    /**
+     * Transactions hashed by RFC 3261 branch and method
+     */
+    HashList m_branchIndex;
+
+    /**
+     * Transactions hashed by Call-ID, matches RFC 2543 messages and end to end ACKs
+     */
+    HashList m_callidIndex;
+
     /**
      * The list that holds all the SIP transactions.
      */
     ObjList m_transList;
 
+    int64_t m_firstOrder;
+    int64_t m_lastOrder;
+
+    /**
+     * Transactions that may have an event, in the order they were woken up
+     */
+    SIPTransaction* m_readyFirst;
+    SIPTransaction* m_readyLast;
+
+    /**
+     * Binary heap of transactions ordered by their next timeout
+     */
+    SIPTransaction** m_timers;
+    unsigned int m_timerCount;
+    unsigned int m_timerAlloc;
+
     u_int64_t m_t1;
     u_int64_t m_t4;
     int m_reqTransCount;
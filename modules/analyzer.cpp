@@ -7,12 +7,6 @@
  * Yet Another Telephony Engine - a fully featured software PBX and IVR
  * Copyright (C) 2004-2014 Null Team
  *
- * FFT routine taken from Murphy McCauley's FFT DLL based in turn on the
- *  work of Don Cross <dcross@intersrv.com>
- * See http://www.fullspectrum.com/deeth/programming/fft.html
- *  and http://www.constantthought.com/
- * Thank both for a sleek routine that doesn't even fill a floppy ;-)
- *
  * This software is distributed under multiple licenses;
  * see the COPYING file in the main directory for licensing
  * information for this specific distribution.
@@ -26,6 +20,7 @@
  */
 
 #include <yatephone.h>
+#include <yatemath.h>
 
 // minimum allowed for the maximum
 #define ALLOW_MIN 2500.0
@@ -87,7 +82,6 @@ public:
 private:
     AsyncFFT(unsigned int length, WinType window, Priority prio);
     void buildWindow(WinType window);
-    unsigned int revBits(unsigned int index);
     void compute();
     bool m_ready;
     bool m_start;
@@ -95,9 +89,9 @@ private:
     Runnable* m_notify;
     unsigned int m_length;
     double* m_window;
-    double* m_real;
-    double* m_imag;
-    unsigned int m_nBits;
+    FFT m_fft;
+    Complex* m_data;
+    float* m_mag;
     const char* m_winName;
 };
 
@@ -227,19 +221,14 @@ AsyncFFT* AsyncFFT::create(unsigned int length, WinType window, Priority prio)
 AsyncFFT::AsyncFFT(unsigned int length, WinType window, Priority prio)
     : Thread("Async FFT",prio),
       m_ready(false), m_start(false), m_stop(false), m_notify(0),
-      m_length(0), m_window(0), m_real(0), m_imag(0), m_nBits(0), m_winName(0)
+      m_length(0), m_window(0), m_data(0), m_mag(0), m_winName(0)
 {
     DDebug(&__plugin,DebugAll,"AsyncFFT::AsyncFFT(%u) [%p]",length,this);
-    for (unsigned int i = 0; i <= 256 ;i++)
-	if (length & (1 << i)) {
-	    m_nBits = i;
-	    break;
-	}
-    if (!m_nBits)
+    if (!m_fft.setup(length))
 	return;
     m_length = length;
-    m_real = new double[m_length];
-    m_imag = new double[m_length];
+    m_data = new Complex[m_length];
+    m_mag = new float[(m_length >> 1) + 1];
     buildWindow(window);
 }
 
@@ -249,8 +238,8 @@ AsyncFFT::~AsyncFFT()
     m_notify = 0;
     m_ready = false;
     m_start = false;
-    delete[] m_real;
-    delete[] m_imag;
+    delete[] m_data;
+    delete[] m_mag;
     delete[] m_window;
 }
 
@@ -297,7 +286,7 @@ double AsyncFFT::at(int index) const
 	return 0.0;
     if (!m_ready)
 	return 0.0;
-    return m_real[index];
+    return m_mag[index];
 }
 
 void AsyncFFT::run()
@@ -322,80 +311,33 @@ void AsyncFFT::run()
 
 bool AsyncFFT::prepare(const short* samp)
 {
-    if (m_start || m_stop || !(samp && m_real))
+    if (m_start || m_stop || !(samp && m_data))
 	return false;
     m_ready = false;
     XDebug(&__plugin,DebugAll,"Preparing FFT buffer from %u samples [%p]",m_length,this);
-    unsigned int i, j;
-    for (i = 0; i < m_length; i++) {
-	j = revBits(i);
+    for (unsigned int i = 0; i < m_length; i++) {
 	if (m_window)
-	    m_real[i] = m_window[j] * samp[j];
+	    m_data[i].set(m_window[i] * samp[i],0);
 	else
-	    m_real[i] = samp[j];
-	m_imag[i] = 0.0;
+	    m_data[i].set(samp[i],0);
     }
     m_start = true;
     return true;
 }
 
-unsigned int AsyncFFT::revBits(unsigned int index)
-{
-    unsigned int i, rev;
-    for (i = rev = 0; i < m_nBits; i++) {
-	rev = (rev << 1) | (index & 1);
-	index >>= 1;
-    }
-    return rev;
-}
-
 void AsyncFFT::compute()
 {
 #ifdef XDEBUG
     Debug(&__plugin,DebugInfo,"Computing FFT with length %u [%p]",m_length,this);
     Time t;
 #endif
-    unsigned int i, j, n;
-    unsigned int blockEnd = 1;
-    for (unsigned int blockSize = 2; blockSize <= m_length; blockSize <<= 1) {
-	double delta_angle = M_2PI / blockSize;
-	double sm1 = ::sin(-delta_angle);
-	double sm2 = ::sin(-2 * delta_angle);
-	double cm1 = ::cos(-delta_angle);
-	double cm2 = ::cos(-2 * delta_angle);
-	double w = 2 * cm1;
-	double ar[3], ai[3];
-
-	for (i = 0; i < m_length; i += blockSize) {
-	    ar[1] = cm1;
-	    ai[1] = sm1;
-	    ar[2] = cm2;
-	    ai[2] = sm2;
-
-	    if (m_stop)
-		return;
-	    for (j = i, n = 0; n < blockEnd; j++, n++) {
-		ar[0] = w*ar[1] - ar[2];
-		ar[2] = ar[1];
-		ar[1] = ar[0];
-		ai[0] = w*ai[1] - ai[2];
-		ai[2] = ai[1];
-		ai[1] = ai[0];
-
-		unsigned int k = j + blockEnd;
-		double tr = ar[0]*m_real[k] - ai[0]*m_imag[k];
-		double ti = ar[0]*m_imag[k] + ai[0]*m_real[k];
-		m_real[k] = m_real[j] - tr;
-		m_imag[k] = m_imag[j] - ti;
-		m_real[j] += tr;
-		m_imag[j] += ti;
-	    }
-	}
-	blockEnd = blockSize;
-    }
-    n = m_length >> 1;
-    for (i = 0; i < n; i++)
-	m_real[i] = ::sqrt(m_real[i]*m_real[i] + m_imag[i]*m_imag[i]) / n;
+    if (m_stop || !m_fft.forward(m_data))
+	return;
+    unsigned int i;
+    unsigned int n = m_length >> 1;
+    Math::norm(m_mag,m_data,n + 1);
+    for (i = 0; i <= n; i++)
+	m_mag[i] /= n;
 #ifdef XDEBUG
     Debug(&__plugin,DebugInfo,"Computing FFT with length %u took " FMT64U " usec [%p]",
 	m_length,Time::now()-t,this);
@@ -403,7 +345,7 @@ void AsyncFFT::compute()
 
 #ifdef XDEBUG
     for (i = 0; i < n; i++)
-	Debug(&__plugin,DebugAll,"fft[%u] = %0.2f",i,m_real[i]);
+	Debug(&__plugin,DebugAll,"fft[%u] = %0.2f",i,m_mag[i]);
 #endif
 }
 
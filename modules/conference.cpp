@@ -23,6 +23,12 @@
 
 #include <yatephone.h>
 
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace TelEngine;
 namespace { // anonymous
 
@@ -33,6 +39,16 @@ namespace { // anonymous
 #define MAX_SPEAKERS 8
 #define DEF_SPEAKERS 3
 
+// maximum number of smart channels mixed together, 0 in config mixes all
+#define MAX_MIXERS 32
+#define DEF_MIXERS MAX_SPEAKERS
+
+// mixer clock period in usec, it matches the size of a data chunk
+#define MIX_TICK 20000
+
+// Mixes a talker keeps its own encoder after it was last mixed in
+#define OWN_HANGOVER 50
+
 // Speaking detector energy square hysteresis
 #define SPEAK_HIST_MIN 16384
 #define SPEAK_HIST_MAX 32768
@@ -65,6 +81,8 @@ namespace { // anonymous
 class ConfConsumer;
 class ConfSource;
 class ConfChan;
+class ConfMixer;
+class ConfEncoder;
 
 // The list of conference rooms
 static ObjList s_rooms;
@@ -75,6 +93,14 @@ static Mutex s_srcMutex(false,"Conference");
 // Hold the number of the newest allocated dynamic room
 static int s_roomAlloc = 0;
 
+// Defaults for new rooms, set from the configuration file
+static int s_mixers = DEF_MIXERS;
+static bool s_clock = false;
+
+// The mixer clock thread and the mutex protecting its pointer
+static ConfMixer* s_mixer = 0;
+static Mutex s_mixerMutex(false,"ConfMixer");
+
 // The conference room holds a list of connected channels and does the mixing.
 // It does also act as a data source for the sum of all channels
 class ConfRoom : public DataSource
@@ -106,7 +132,10 @@ public:
 	{ return m_minBuffer; }
     inline unsigned int maxBuffer() const
 	{ return m_maxBuffer; }
-    void mix(ConfConsumer* cons = 0);
+    inline bool clocked() const
+	{ return m_clock; }
+    void mix(ConfConsumer* cons = 0, bool tick = false);
+    ConfEncoder* getEncoder(const DataFormat& format);
     void addChannel(ConfChan* chan, bool player = false);
     void delChannel(ConfChan* chan);
     void addOwner(const String& id);
@@ -146,6 +175,14 @@ private:
     unsigned int m_minBuffer;
     unsigned int m_maxBuffer;
     unsigned int m_dataChunk;
+    bool m_clock;
+    int m_mixers;
+    DataBlock m_mixBuf;
+    DataBlock m_mixList;
+    u_int64_t m_mixCount;
+    u_int64_t m_mixTime;
+    u_int64_t m_silentMixes;
+    ObjList m_encoders;
 };
 
 // A conference channel is just a dumb holder of its data channels
@@ -188,8 +225,8 @@ class ConfConsumer : public DataConsumer
     YCLASS(ConfConsumer,DataConsumer);
 public:
     ConfConsumer(ConfRoom* room, bool smart = false)
-	: m_room(room), m_src(0), m_muted(false), m_smart(smart), m_speak(false),
-	  m_energy2(ENERGY_MIN), m_noise2(ENERGY_MIN), m_envelope2(ENERGY_MIN)
+	: m_room(room), m_src(0), m_muted(false), m_smart(smart), m_speak(false), m_mixed(false),
+	  m_silent(false), m_energy2(ENERGY_MIN), m_noise2(ENERGY_MIN), m_envelope2(ENERGY_MIN)
 	{ DDebug(DebugAll,"ConfConsumer::ConfConsumer(%p,%s) [%p]",room,String::boolText(smart),this); m_format = room->getFormat(); }
     ~ConfConsumer()
 	{ DDebug(DebugAll,"ConfConsumer::~ConfConsumer() [%p]",this); }
@@ -213,30 +250,87 @@ public:
     inline bool hasSignal() const
 	{ return (!m_muted) && (m_energy2 >= m_noise2); }
     inline bool shouldMix() const
-	{ return hasSignal() && (m_buffer.length() > 1); }
+	{ return hasSignal() && !m_silent && (m_buffer.length() > 1); }
 private:
-    void consumed(const int* mixed, unsigned int samples);
-    void dataForward(const int* mixed, unsigned int samples);
+    void consumed(const int* mixed, const DataBlock& data, unsigned int samples, u_int64_t frame,
+	unsigned long flags = 0);
+    void dataForward(const int* mixed, const DataBlock& data, unsigned int samples, u_int64_t frame,
+	unsigned long flags);
     RefPointer<ConfRoom> m_room;
     ConfSource* m_src;
     bool m_muted;
     bool m_smart;
     bool m_speak;
+    bool m_mixed;
+    bool m_silent;
     unsigned int m_energy2;
     unsigned int m_noise2;
     unsigned int m_envelope2;
     DataBlock m_buffer;
 };
 
+// Consumer collecting the output of an encoder's translators
+class ConfCapture : public DataConsumer
+{
+public:
+    inline ConfCapture(const String& format)
+	: DataConsumer(format)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ m_data.append(data); return invalidStamp(); }
+    DataBlock m_data;
+};
+
+// Converts the mix to another format, the room shares one for each format
+//  between all the channels that hear the common mix
+class ConfEncoder : public RefObject
+{
+public:
+    ConfEncoder(const String& sFormat, const String& dFormat);
+    virtual void destroyed();
+    virtual const String& toString() const
+	{ return m_format; }
+    inline bool valid() const
+	{ return m_trans != 0; }
+    const DataBlock& encode(const DataBlock& data, u_int64_t frame = 0, unsigned long flags = 0);
+private:
+    String m_format;
+    DataTranslator* m_trans;
+    ConfCapture* m_capture;
+    u_int64_t m_frame;
+    unsigned long m_stamp;
+};
+
 // Per channel data source with that channel's data removed from the mix
+// It can deliver directly in the channel's format so the common mix is
+//  encoded only once for all the channels using the same format
+// A talker gets a new encoder of its own and keeps it for all the data
+//  until it is out of the mix for a while, codec state is never shared
 class ConfSource : public DataSource
 {
     friend class ConfChan;
+    friend class ConfRoom;
 public:
     ConfSource(ConfConsumer* cons);
     ~ConfSource();
+    virtual bool setFormat(const DataFormat& format);
+    void forward(const DataBlock& data, bool shared, u_int64_t frame, unsigned long flags = 0);
 private:
     RefPointer<ConfConsumer> m_cons;
+    ConfEncoder* m_shared;
+    ConfEncoder* m_own;
+    unsigned int m_hangover;
+};
+
+// Thread that mixes the clocked rooms at a steady rate
+class ConfMixer : public Thread
+{
+public:
+    ConfMixer();
+    ~ConfMixer();
+    virtual void run();
+    static void start();
+    static void stop();
 };
 
 // The driver just holds all the channels (not conferences)
@@ -303,6 +397,53 @@ static unsigned int binLog(unsigned int x)
     return v;
 }
 
+// Saturate symmetrically the result of additions and substractions
+static inline int16_t saturate(int val)
+{
+    return (val < -32767) ? -32767 : ((val > 32767) ? 32767 : val);
+}
+
+// Add samples to the mix accumulator
+static void mixAdd(int* buf, const int16_t* p, unsigned int n)
+{
+    unsigned int i = 0;
+#ifdef __SSE2__
+    for (; i + 8 <= n; i += 8) {
+	__m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+	// sign extend the 16 bit samples to 32 bit
+	__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v,v),16);
+	__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v,v),16);
+	__m128i* d = (__m128i*)(buf + i);
+	_mm_storeu_si128(d,_mm_add_epi32(_mm_loadu_si128(d),lo));
+	_mm_storeu_si128(d + 1,_mm_add_epi32(_mm_loadu_si128(d + 1),hi));
+    }
+#endif
+    for (; i < n; i++)
+	buf[i] += p[i];
+}
+
+// Saturate the mix accumulator, optionally substracting a channel's own samples
+static void mixOut(int16_t* d, const int* buf, const int16_t* own, unsigned int n)
+{
+    unsigned int i = 0;
+#ifdef __SSE2__
+    // the packing saturates to -32768 so clamp again for symmetry
+    const __m128i min = _mm_set1_epi16(-32767);
+    for (; i + 8 <= n; i += 8) {
+	__m128i lo = _mm_loadu_si128((const __m128i*)(buf + i));
+	__m128i hi = _mm_loadu_si128((const __m128i*)(buf + i + 4));
+	if (own) {
+	    __m128i v = _mm_loadu_si128((const __m128i*)(own + i));
+	    lo = _mm_sub_epi32(lo,_mm_srai_epi32(_mm_unpacklo_epi16(v,v),16));
+	    hi = _mm_sub_epi32(hi,_mm_srai_epi32(_mm_unpackhi_epi16(v,v),16));
+	}
+	_mm_storeu_si128((__m128i*)(d + i),_mm_max_epi16(_mm_packs_epi32(lo,hi),min));
+    }
+#endif
+    for (; i < n; i++)
+	d[i] = saturate(own ? (buf[i] - own[i]) : buf[i]);
+}
+
 
 // Get a pointer to a conference by name, optionally creates it with given parameters
 // If a pointer is returned it must be dereferenced by the caller
@@ -329,8 +470,11 @@ ConfRoom* ConfRoom::get(const String& name, const NamedList* params)
 ConfRoom::ConfRoom(const String& name, const NamedList& params)
     : m_name(name), m_lonely(false), m_created(true), m_record(0),
       m_rate(8000), m_users(0), m_maxusers(10), m_maxLock(200),
-      m_expire(0), m_lonelyInterval(0), m_nextNotify(0), m_nextSpeakers(0)
+      m_expire(0), m_lonelyInterval(0), m_nextNotify(0), m_nextSpeakers(0),
+      m_clock(s_clock), m_mixers(s_mixers), m_mixCount(0), m_mixTime(0), m_silentMixes(0)
 {
+    // echo and utility listeners of one format share a translator
+    shareTranslators(true);
     m_rate = params.getIntValue("rate",m_rate,8000,48000);
     m_maxusers = params.getIntValue("maxusers",m_maxusers);
     DDebug(&__plugin,DebugInfo,"ConfRoom::ConfRoom('%s',%p) rate=%d maxusers=%d [%p]",
@@ -350,6 +494,10 @@ ConfRoom::ConfRoom(const String& name, const NamedList& params)
     else if (m_trackInterval < MIN_INTERVAL)
 	m_trackInterval = MIN_INTERVAL;
     setLonelyTimeout(params["lonely"]);
+    m_mixers = params.getIntValue("mixers",m_mixers,0,MAX_MIXERS);
+    m_clock = params.getBoolValue("clock",m_clock);
+    if (m_clock)
+	ConfMixer::start();
     if (m_rate != 8000)
 	m_format << "/" << m_rate;
     // size of the data blocks in bytes - divide by 2 to get samples
@@ -388,6 +536,7 @@ void ConfRoom::destroyed()
     if (m_expire)
 	__plugin.setConfToutCount(false);
     m_chans.clear();
+    m_encoders.clear();
     if (m_notify) {
 	Message* m = new Message("chan.notify");
 	m->addParam("targetid",m_notify);
@@ -538,7 +687,16 @@ void ConfRoom::dropAll(const char* reason)
 // Retrieve status information about this room
 void ConfRoom::msgStatus(Message& msg)
 {
+    unsigned int encoders = 0;
+    // echo listeners are attached directly to the room, it must be unlocked
+    unsigned int listeners = DataSource::listeners(&encoders);
     Lock mylock(this);
+    encoders += m_encoders.count();
+    for (ObjList* l = m_chans.skipNull(); l; l = l->skipNext()) {
+	ConfConsumer* co = static_cast<ConfConsumer*>(static_cast<ConfChan*>(l->get())->getConsumer());
+	if (co && co->m_src)
+	    listeners++;
+    }
     msg.retValue().clear();
     msg.retValue() << "name=" << __plugin.prefix() << m_name;
     msg.retValue() << ",type=conference";
@@ -554,6 +712,13 @@ void ConfRoom::msgStatus(Message& msg)
     msg.retValue() << ",users=" << m_users;
     msg.retValue() << ",chans=" << m_chans.count();
     msg.retValue() << ",owners=" << m_owners.count();
+    msg.retValue() << ",mixers=" << m_mixers;
+    msg.retValue() << ",clock=" << m_clock;
+    msg.retValue() << ",mixes=" << (unsigned int)m_mixCount;
+    msg.retValue() << ",mixtime=" << (unsigned int)(m_mixCount ? (m_mixTime / m_mixCount) : 0);
+    msg.retValue() << ",silentmixes=" << (unsigned int)m_silentMixes;
+    msg.retValue() << ",encoders=" << encoders;
+    msg.retValue() << ",listeners=" << listeners;
     if (m_notify)
 	msg.retValue() << ",notify=" << m_notify;
     if (m_playerId)
@@ -653,18 +818,34 @@ bool ConfRoom::setParams(NamedList& params)
     return true;
 }
 
+// Channel and its consumer as seen by the mixer
+struct MixParty
+{
+    ConfChan* chan;
+    ConfConsumer* cons;
+};
+
 // Mix in buffered data from all channels, only if we have enough in buffer
-void ConfRoom::mix(ConfConsumer* cons)
+// On mixer clock ticks mix exactly one chunk if any channel sent data
+void ConfRoom::mix(ConfConsumer* cons, bool tick)
 {
     unsigned int len = m_maxBuffer;
     unsigned int mlen = 0;
     Lock mylock(this);
+    u_int64_t start = Time::now();
+    unsigned int count = m_chans.count();
+    if (m_mixList.length() < count * sizeof(MixParty))
+	m_mixList.assign(0,count * sizeof(MixParty));
+    MixParty* parties = (MixParty*)m_mixList.data();
+    count = 0;
     // find out the minimum and maximum amount of data in buffers
     ObjList* l = m_chans.skipNull();
     for (; l; l = l->skipNext()) {
 	ConfChan* ch = static_cast<ConfChan*>(l->get());
 	ConfConsumer* co = static_cast<ConfConsumer*>(ch->getConsumer());
 	if (co) {
+	    parties[count].chan = ch;
+	    parties[count++].cons = co;
 	    unsigned int buffered = co->m_buffer.length();
 	    if (len > buffered)
 		len = buffered;
@@ -673,16 +854,20 @@ void ConfRoom::mix(ConfConsumer* cons)
 	}
     }
     XDebug(&__plugin,DebugAll,"ConfRoom::mix() buffer %u - %u [%p]",len,mlen,this);
-    // this many full chunks are in all buffers and we can safely mix
-    len = len / m_dataChunk;
-    // try to leave at least m_minBuffer free space
-    // mix: m_minBuffer - (m_maxBuffer - mlen) = mlen + m_minBuffer - m_maxBuffer
-    mlen += m_minBuffer;
-    if (mlen > m_maxBuffer) {
-	// at least this much data we need to consume so round up chunks
-	mlen = (mlen - m_maxBuffer + m_dataChunk - 1) / m_dataChunk;
-	if (len < mlen)
-	    len = mlen;
+    if (tick)
+	len = mlen ? 1 : 0;
+    else {
+	// this many full chunks are in all buffers and we can safely mix
+	len = len / m_dataChunk;
+	// try to leave at least m_minBuffer free space
+	// mix: m_minBuffer - (m_maxBuffer - mlen) = mlen + m_minBuffer - m_maxBuffer
+	mlen += m_minBuffer;
+	if (mlen > m_maxBuffer) {
+	    // at least this much data we need to consume so round up chunks
+	    mlen = (mlen - m_maxBuffer + m_dataChunk - 1) / m_dataChunk;
+	    if (len < mlen)
+		len = mlen;
+	}
     }
     if (!len)
 	return;
@@ -694,65 +879,96 @@ void ConfRoom::mix(ConfConsumer* cons)
 	speakChan[spk] = 0;
     }
     len = len * m_dataChunk / sizeof(int16_t);
-    DataBlock mixbuf(0,len*sizeof(int));
-    int* buf = (int*)mixbuf.data();
-    for (l = m_chans.skipNull(); l; l = l->skipNext()) {
-	ConfChan* ch = static_cast<ConfChan*>(l->get());
-	ConfConsumer* co = static_cast<ConfConsumer*>(ch->getConsumer());
-	if (co) {
-	    // avoid mixing in noise
-	    if (co->shouldMix()) {
-		unsigned int n = co->m_buffer.length() / 2;
+    if (m_mixBuf.length() < len * sizeof(int))
+	m_mixBuf.assign(0,len * sizeof(int));
+    int* buf = (int*)m_mixBuf.data();
+    ::memset(buf,0,len * sizeof(int));
+    // pick the channels to mix, only the loudest smart ones if limited
+    ConfConsumer* loud[MAX_MIXERS];
+    int nLoud = 0;
+    unsigned int i;
+    for (i = 0; i < count; i++) {
+	ConfConsumer* co = parties[i].cons;
+	// avoid mixing in noise
+	co->m_mixed = co->shouldMix() && !(m_mixers && co->smart());
+	if (co->m_mixed || !co->shouldMix())
+	    continue;
+	unsigned int vol = co->energy2();
+	int pos = nLoud;
+	if (pos == m_mixers) {
+	    if (vol <= loud[pos - 1]->energy2())
+		continue;
+	    pos--;
+	}
+	else
+	    nLoud++;
+	for (; pos > 0 && vol > loud[pos - 1]->energy2(); pos--)
+	    loud[pos] = loud[pos - 1];
+	loud[pos] = co;
+    }
+    for (int n = 0; n < nLoud; n++)
+	loud[n]->m_mixed = true;
+    // nobody mixed in, everybody hears silence
+    unsigned long flags = DataNode::DataSilent;
+    for (i = 0; i < count; i++) {
+	ConfChan* ch = parties[i].chan;
+	ConfConsumer* co = parties[i].cons;
+	if (co->m_mixed) {
+	    unsigned int n = co->m_buffer.length() / 2;
 #ifdef XDEBUG
-		if (ch->debugAt(DebugAll)) {
-		    int noise = co->noise();
-		    int energy = co->energy() - noise;
-		    if (energy < 0)
-			energy = 0;
-		    int tip = co->envelope() - energy - noise;
-		    if (tip < 0)
-			tip = 0;
-		    Debug(ch,DebugAll,"Cons %p samp=%u |%s%s%s>",
-			co,n,String('#',noise).safe(),
-			String('=',energy).safe(),String('-',tip).safe());
-		}
-#endif
-		if (n > len)
-		    n = len;
-		const int16_t* p = (const int16_t*)co->m_buffer.data();
-		for (unsigned int i=0; i < n; i++)
-		    buf[i] += *p++;
+	    if (ch->debugAt(DebugAll)) {
+		int noise = co->noise();
+		int energy = co->energy() - noise;
+		if (energy < 0)
+		    energy = 0;
+		int tip = co->envelope() - energy - noise;
+		if (tip < 0)
+		    tip = 0;
+		Debug(ch,DebugAll,"Cons %p samp=%u |%s%s%s>",
+		    co,n,String('#',noise).safe(),
+		    String('=',energy).safe(),String('-',tip).safe());
 	    }
-	    if (m_trackSpeakers && m_notify && !ch->isUtility() && co->speaking()) {
-		int vol = co->envelope();
-		for (spk = m_trackSpeakers-1; spk >= 0; spk--) {
-		    if (vol <= speakVol[spk])
-			break;
-		    if (spk < MAX_SPEAKERS-1) {
-			speakVol[spk+1] = speakVol[spk];
-			speakChan[spk+1] = speakChan[spk];
-		    }
-		    speakVol[spk] = vol;
-		    speakChan[spk] = ch;
+#endif
+	    if (n > len)
+		n = len;
+	    mixAdd(buf,(const int16_t*)co->m_buffer.data(),n);
+	    flags = 0;
+	}
+	if (m_trackSpeakers && m_notify && !ch->isUtility() && co->speaking()) {
+	    int vol = co->envelope();
+	    for (spk = m_trackSpeakers-1; spk >= 0; spk--) {
+		if (vol <= speakVol[spk])
+		    break;
+		if (spk < MAX_SPEAKERS-1) {
+		    speakVol[spk+1] = speakVol[spk];
+		    speakChan[spk+1] = speakChan[spk];
 		}
+		speakVol[spk] = vol;
+		speakChan[spk] = ch;
 	    }
 	}
     }
-    // we finished mixing - notify consumers about it
-    for (l = m_chans.skipNull(); l; l = l->skipNext()) {
-	ConfChan* ch = static_cast<ConfChan*>(l->get());
-	ConfConsumer* co = static_cast<ConfConsumer*>(ch->getConsumer());
-	if (co)
-	    co->consumed(buf,len);
-    }
+    // the full mix is shared by the room and all channels not mixed in
     DataBlock data(0,len*sizeof(int16_t));
-    int16_t* p = (int16_t*)data.data();
-    for (unsigned int i=0; i < len; i++) {
-	int val = buf[i];
-	// saturate symmetrically the result of addition
-	*p++ = (val < -32767) ? -32767 : ((val > 32767) ? 32767 : val);
+    if (flags)
+	m_silentMixes++;
+    else
+	mixOut((int16_t*)data.data(),buf,0,len);
+    // we finished mixing - notify consumers about it
+    m_mixCount++;
+    for (i = 0; i < count; i++)
+	parties[i].cons->consumed(buf,data,len,m_mixCount,flags);
+    // drop the shared encoders no longer used by any channel
+    l = m_encoders.skipNull();
+    while (l) {
+	if (static_cast<ConfEncoder*>(l->get())->refcount() == 1) {
+	    l->remove();
+	    l = l->skipNull();
+	}
+	else
+	    l = l->skipNext();
     }
-    mixbuf.clear();
+    m_mixTime += Time::now() - start;
     Message* m = 0;
     while (m_trackSpeakers && m_notify) {
 	u_int64_t now = Time::now();
@@ -824,11 +1040,31 @@ void ConfRoom::mix(ConfConsumer* cons)
 	break;
     }
     mylock.drop();
-    Forward(data);
+    Forward(data,invalidStamp(),flags);
     if (m)
 	Engine::enqueue(m);
 }
 
+// Get a shared encoder to a format, the room must be locked
+// If a pointer is returned it must be dereferenced by the caller
+ConfEncoder* ConfRoom::getEncoder(const DataFormat& format)
+{
+    ObjList* l = m_encoders.find(format);
+    ConfEncoder* enc = l ? static_cast<ConfEncoder*>(l->get()) : 0;
+    if (enc && enc->ref())
+	return enc;
+    enc = new ConfEncoder(getFormat(),format);
+    if (!enc->valid()) {
+	TelEngine::destruct(enc);
+	return 0;
+    }
+    DDebug(&__plugin,DebugAll,"Room '%s' created shared encoder to '%s' [%p]",
+	m_name.c_str(),format.c_str(),this);
+    m_encoders.append(enc);
+    enc->ref();
+    return enc;
+}
+
 // Update room data
 void ConfRoom::update(const NamedList& params)
 {
@@ -884,7 +1120,11 @@ unsigned long ConfConsumer::Consume(const DataBlock& data, unsigned long tStamp,
 {
     if (m_muted || data.null() || !m_room)
 	return 0;
-    if (m_smart) {
+    // frames found silent upstream are buffered for timing but not mixed
+    m_silent = (0 != (flags & DataSilent));
+    if (m_silent)
+	m_speak = false;
+    else if (m_smart) {
 	// we need to compute the average energy and take decay into account
 	int64_t sum2 = m_energy2;
 	unsigned int min2 = ENERGY_MAX;
@@ -949,18 +1189,20 @@ unsigned long ConfConsumer::Consume(const DataBlock& data, unsigned long tStamp,
 	m_buffer.append(data.data(),len);
 
     m_room->unlock();
-    if (m_buffer.length() >= m_room->minBuffer())
+    // clocked rooms are mixed by the mixer thread
+    if (!m_room->clocked() && (m_buffer.length() >= m_room->minBuffer()))
 	m_room->mix(this);
     return invalidStamp();
 }
 
 // Take out of the buffer the samples mixed in or skipped
 //  this method is called with the room locked
-void ConfConsumer::consumed(const int* mixed, unsigned int samples)
+void ConfConsumer::consumed(const int* mixed, const DataBlock& data, unsigned int samples, u_int64_t frame,
+    unsigned long flags)
 {
     if (!samples)
 	return;
-    dataForward(mixed,samples);
+    dataForward(mixed,data,samples,frame,flags);
     unsigned int n = m_buffer.length() / 2;
     if (samples > n) {
 	// buffer underflowed
@@ -980,7 +1222,8 @@ void ConfConsumer::consumed(const int* mixed, unsigned int samples)
 }
 
 // Substract our own data from the mix and send it on the no-echo source
-void ConfConsumer::dataForward(const int* mixed, unsigned int samples)
+void ConfConsumer::dataForward(const int* mixed, const DataBlock& data, unsigned int samples, u_int64_t frame,
+    unsigned long flags)
 {
     if (!(m_src && mixed))
 	return;
@@ -990,20 +1233,21 @@ void ConfConsumer::dataForward(const int* mixed, unsigned int samples)
     s_srcMutex.unlock();
     if (!src)
 	return;
+    // if we did not contribute we hear the same mix as everybody else
+    if (!m_mixed) {
+	src->forward(data,true,frame,flags);
+	return;
+    }
 
-    int16_t* d = (int16_t*)m_buffer.data();
+    // substract our own data - only as much as we have
     unsigned int n = m_buffer.length() / 2;
-    DataBlock data(0,samples*sizeof(int16_t));
-    int16_t* p = (int16_t*)data.data();
-    for (unsigned int i=0; i < samples; i++) {
-	int val = *mixed++;
-	// substract our own data if we contributed - only as much as we have
-	if ((i < n) && shouldMix())
-	    val -= d[i];
-	// saturate symmetrically the result of additions and substraction
-	*p++ = (val < -32767) ? -32767 : ((val > 32767) ? 32767 : val);
-    }
-    src->Forward(data);
+    if (n > samples)
+	n = samples;
+    DataBlock own(0,samples*sizeof(int16_t));
+    int16_t* p = (int16_t*)own.data();
+    mixOut(p,mixed,(const int16_t*)m_buffer.data(),n);
+    mixOut(p + n,mixed + n,0,samples - n);
+    src->forward(own,false,frame);
 }
 
 unsigned int ConfConsumer::energy() const
@@ -1038,8 +1282,41 @@ bool ConfConsumer::control(NamedList& msg)
 }
 
 
+ConfEncoder::ConfEncoder(const String& sFormat, const String& dFormat)
+    : m_format(dFormat), m_trans(0), m_capture(0), m_frame(0), m_stamp(0)
+{
+    DataTranslator* trans = DataTranslator::create(sFormat,dFormat);
+    if (!trans)
+	return;
+    // we hold the reference to the first translator of the chain
+    m_trans = trans->getFirstTranslator();
+    m_capture = new ConfCapture(dFormat);
+    trans->getTransSource()->attach(m_capture);
+}
+
+void ConfEncoder::destroyed()
+{
+    // destroying the chain detaches the capture consumer too
+    TelEngine::destruct(m_trans);
+    TelEngine::destruct(m_capture);
+    RefObject::destroyed();
+}
+
+// Encode a block of the mix, a shared encoder does it only once for each frame
+const DataBlock& ConfEncoder::encode(const DataBlock& data, u_int64_t frame, unsigned long flags)
+{
+    if (frame && (frame == m_frame))
+	return m_capture->m_data;
+    m_frame = frame;
+    m_capture->m_data.clear();
+    m_trans->Consume(data,m_stamp,flags);
+    m_stamp += data.length() / sizeof(int16_t);
+    return m_capture->m_data;
+}
+
+
 ConfSource::ConfSource(ConfConsumer* cons)
-    : m_cons(cons)
+    : m_cons(cons), m_shared(0), m_own(0), m_hangover(0)
 {
     if (m_cons) {
 	m_format = m_cons->getFormat();
@@ -1054,6 +1331,148 @@ ConfSource::~ConfSource()
 	m_cons->m_src = 0;
 	s_srcMutex.unlock();
     }
+    TelEngine::destruct(m_shared);
+    TelEngine::destruct(m_own);
+}
+
+// Accept any format the mix can be encoded to
+bool ConfSource::setFormat(const DataFormat& format)
+{
+    RefPointer<ConfRoom> room = m_cons ? m_cons->m_room : 0;
+    if (!room)
+	return false;
+    Lock mylock(room);
+    if (format == m_format)
+	return true;
+    // do not change the format under already attached consumers
+    lock();
+    bool busy = (0 != m_consumers.skipNull());
+    unlock();
+    if (busy)
+	return false;
+    ConfEncoder* shared = 0;
+    if (format != room->getFormat()) {
+	shared = room->getEncoder(format);
+	if (!shared)
+	    return false;
+    }
+    DDebug(&__plugin,DebugAll,"ConfSource format changed from '%s' to '%s' [%p]",
+	m_format.c_str(),format.c_str(),this);
+    m_format = format;
+    ConfEncoder* tmp = m_shared;
+    m_shared = shared;
+    shared = tmp;
+    // our own encoder is created again when we talk
+    ConfEncoder* own = m_own;
+    m_own = 0;
+    m_hangover = 0;
+    mylock.drop();
+    TelEngine::destruct(shared);
+    TelEngine::destruct(own);
+    return true;
+}
+
+// Forward mixed data, encoding it first if needed, called with the room locked
+void ConfSource::forward(const DataBlock& data, bool shared, u_int64_t frame, unsigned long flags)
+{
+    if (!m_shared) {
+	Forward(data,invalidStamp(),flags);
+	return;
+    }
+    if (!shared) {
+	m_hangover = OWN_HANGOVER;
+	if (!m_own) {
+	    // start with a fresh codec state when we start talking
+	    m_own = new ConfEncoder(m_cons->m_room->getFormat(),m_format);
+	    if (!m_own->valid()) {
+		TelEngine::destruct(m_own);
+		return;
+	    }
+	    XDebug(&__plugin,DebugAll,"ConfSource created own encoder to '%s' [%p]",
+		m_format.c_str(),this);
+	}
+    }
+    else if (m_own && !--m_hangover) {
+	// silent long enough, the switch back resets the codec state again
+	XDebug(&__plugin,DebugAll,"ConfSource returning to shared encoder [%p]",this);
+	TelEngine::destruct(m_own);
+    }
+    const DataBlock& enc = m_own ? m_own->encode(data,0,flags) : m_shared->encode(data,frame,flags);
+    if (enc.length())
+	Forward(enc,invalidStamp(),flags);
+}
+
+
+ConfMixer::ConfMixer()
+    : Thread("Conf Mixer",Thread::High)
+{
+    DDebug(&__plugin,DebugAll,"ConfMixer::ConfMixer() [%p]",this);
+}
+
+ConfMixer::~ConfMixer()
+{
+    DDebug(&__plugin,DebugAll,"ConfMixer::~ConfMixer() [%p]",this);
+    Lock lock(s_mixerMutex);
+    if (s_mixer == this)
+	s_mixer = 0;
+}
+
+// Mix one chunk in each clocked room every tick
+void ConfMixer::run()
+{
+    u_int64_t next = Time::now();
+    while (!Thread::check(false)) {
+	next += MIX_TICK;
+	u_int64_t now = Time::now();
+	if (now < next)
+	    Thread::usleep(next - now);
+	else if (now > next + 5 * MIX_TICK) {
+	    Debug(&__plugin,DebugMild,"Mixer clock late by %u ms, skipping ahead",
+		(unsigned int)((now - next) / 1000));
+	    next = now;
+	}
+	__plugin.lock();
+	ListIterator iter(s_rooms);
+	for (;;) {
+	    GenObject* obj = iter.get();
+	    if (!obj) {
+		__plugin.unlock();
+		break;
+	    }
+	    // a room being destroyed cannot be referenced, skip it
+	    RefPointer<ConfRoom> room = static_cast<ConfRoom*>(obj);
+	    __plugin.unlock();
+	    if (room && room->clocked())
+		room->mix(0,true);
+	    room = 0;
+	    __plugin.lock();
+	}
+    }
+}
+
+// Start the mixer thread if not already running
+void ConfMixer::start()
+{
+    Lock lock(s_mixerMutex);
+    if (s_mixer)
+	return;
+    s_mixer = new ConfMixer;
+    if (!s_mixer->startup()) {
+	Debug(&__plugin,DebugWarn,"Failed to start the mixer clock thread");
+	delete s_mixer;
+	s_mixer = 0;
+    }
+}
+
+// Stop the mixer thread and wait for it to terminate
+void ConfMixer::stop()
+{
+    s_mixerMutex.lock();
+    if (s_mixer)
+	s_mixer->cancel(false);
+    s_mixerMutex.unlock();
+    while (s_mixer)
+	Thread::idle();
 }
 
 
@@ -1370,6 +1789,10 @@ bool ConferenceDriver::received(Message &msg, int id)
 	"notify" - ID used for "chan.notify" room notifications, an empty
 	    string (default) will disable notifications
 	"record" - route that will make an outgoing record-only call
+	"mixers" - maximum number of smart channels mixed together, only the
+	    loudest ones are mixed in, 0 mixes all channels with signal
+	"clock" - set to true to mix from the single mixer clock thread
+	    instead of the channel threads
     Input parameters - per conference leg:
 	"utility" - true creates a channel that is used for housekeeping
 	    tasks like recording or playing prompts to everybody
@@ -1449,6 +1872,9 @@ bool ConferenceDriver::unload()
     m_handler = 0;
     Engine::uninstall(m_hangup);
     m_hangup = 0;
+    // the mixer thread may be waiting for the plugin lock
+    lock.drop();
+    ConfMixer::stop();
     return true;
 }
 
@@ -1507,6 +1933,9 @@ void ConferenceDriver::initialize()
     installRelay(Tone,75);
     installRelay(Text,75);
     setup();
+    Configuration cfg(Engine::configFile("conference"));
+    s_mixers = cfg.getIntValue("general","mixers",DEF_MIXERS,0,MAX_MIXERS);
+    s_clock = cfg.getBoolValue("general","clock",false);
     if (m_handler)
 	return;
     m_handler = new ConfHandler(150);
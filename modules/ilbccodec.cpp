@@ -47,6 +47,25 @@ static TranslatorCaps s_caps30[] = {
 static Mutex s_cmutex(false,"iLBCCodec");
 static int s_count = 0;
 
+// Idle encoder and decoder states kept for new calls
+static DataCodecPool s_pool("ilbc");
+
+// Encoder or decoder instance, kinds are "enc20", "enc30", "dec20", "dec30"
+class iLBCState : public DataCodecState
+{
+public:
+    inline iLBCState(const String& kind, bool encoding, int msec)
+	: DataCodecState(kind), m_encoding(encoding), m_mode(msec)
+	{ reset(); }
+    virtual bool reset();
+    bool m_encoding;
+    int m_mode;
+    union {
+	iLBC_Enc_Inst_t m_enc;
+	iLBC_Dec_Inst_t m_dec;
+    };
+};
+
 class iLBCFactory : public TranslatorFactory
 {
 public:
@@ -65,7 +84,8 @@ class iLBCPlugin : public Plugin
 public:
     iLBCPlugin();
     ~iLBCPlugin();
-    virtual void initialize() { }
+    virtual void initialize()
+	{ s_pool.configure(); }
     virtual bool isBusy() const;
 private:
     iLBCFactory* m_ilbc20;
@@ -82,18 +102,13 @@ private:
     bool m_encoding;
     DataBlock m_data;
     DataBlock m_outdata;
-    iLBC_Enc_Inst_t m_enc;
-    iLBC_Dec_Inst_t m_dec;
+    iLBCState* m_state;
     int m_mode;
 };
 
-iLBCCodec::iLBCCodec(const char* sFormat, const char* dFormat, bool encoding, int msec)
-    : DataTranslator(sFormat,dFormat), m_encoding(encoding), m_mode(msec)
+bool iLBCState::reset()
 {
-    Debug(DebugAll,"iLBCCodec::iLBCCodec(\"%s\",\"%s\",%scoding,%d) [%p]",
-	sFormat,dFormat, m_encoding ? "en" : "de",msec,this);
-
-    if (encoding) {
+    if (m_encoding) {
 	memset(&m_enc,0,sizeof(m_enc));
 	initEncode(&m_enc,m_mode);
     }
@@ -101,6 +116,20 @@ iLBCCodec::iLBCCodec(const char* sFormat, const char* dFormat, bool encoding, in
 	memset(&m_dec,0,sizeof(m_dec));
 	initDecode(&m_dec,m_mode,0);
     }
+    return true;
+}
+
+iLBCCodec::iLBCCodec(const char* sFormat, const char* dFormat, bool encoding, int msec)
+    : DataTranslator(sFormat,dFormat), m_encoding(encoding), m_state(0), m_mode(msec)
+{
+    Debug(DebugAll,"iLBCCodec::iLBCCodec(\"%s\",\"%s\",%scoding,%d) [%p]",
+	sFormat,dFormat, m_encoding ? "en" : "de",msec,this);
+
+    String kind(encoding ? "enc" : "dec");
+    kind << msec;
+    m_state = static_cast<iLBCState*>(s_pool.get(kind));
+    if (!m_state)
+	m_state = new iLBCState(kind,encoding,msec);
     s_cmutex.lock();
     s_count++;
     s_cmutex.unlock();
@@ -109,6 +138,7 @@ iLBCCodec::iLBCCodec(const char* sFormat, const char* dFormat, bool encoding, in
 iLBCCodec::~iLBCCodec()
 {
     Debug(DebugAll,"iLBCCodec::~ILBCCodec() [%p]",this);
+    s_pool.put(m_state);
     s_cmutex.lock();
     s_count--;
     s_cmutex.unlock();
@@ -148,7 +178,7 @@ unsigned long iLBCCodec::Consume(const DataBlock& data, unsigned long tStamp, un
 		for (int j=0; j<block; j++)
 		    buffer[j] = *s++;
 		// and now do the actual encoding directly to outdata
-		::iLBC_encode(d,buffer,&m_enc);
+		::iLBC_encode(d,buffer,&m_state->m_enc);
 		d += no_bytes;
 	    }
 	}
@@ -167,13 +197,13 @@ unsigned long iLBCCodec::Consume(const DataBlock& data, unsigned long tStamp, un
 		float buffer[BLOCKL_MAX];
 		if (flags & DataMissed) {
 		    // ask the codec to perform Packet Loss Concealement
-		    ::iLBC_decode(buffer,0,&m_dec,0);
+		    ::iLBC_decode(buffer,0,&m_state->m_dec,0);
 		    flags &= ~DataMissed;
 		    if (tStamp)
 			tStamp -= block;
 		}
 		else {
-		    ::iLBC_decode(buffer,s,&m_dec,1);
+		    ::iLBC_decode(buffer,s,&m_state->m_dec,1);
 		    s += no_bytes;
 		}
 		// convert the buffer back to 16 bit integer
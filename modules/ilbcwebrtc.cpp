@@ -61,6 +61,18 @@ extern "C" {
 using namespace TelEngine;
 namespace { // anonymous
 
+// Encoder or decoder instance, kinds are "enc20", "enc30", "dec20", "dec30"
+class iLBCwrState : public DataCodecState
+{
+public:
+    iLBCwrState(const String& kind, bool encoding, int msec);
+    virtual ~iLBCwrState();
+    virtual bool reset();
+    iLBC_encinst_t* m_enc;               // Encoder instance
+    iLBC_decinst_t* m_dec;               // Decoder instance
+    int m_mode;                          // Codec mode, 20/30 msec
+};
+
 class iLBCwrCodec : public DataTranslator
 {
 public:
@@ -72,6 +84,7 @@ public:
 	unsigned long flags);
 private:
     bool m_encoding;                     // Encoder/decoder flag
+    iLBCwrState* m_state;                // Pooled codec state
     iLBC_encinst_t* m_enc;               // Encoder instance
     iLBC_decinst_t* m_dec;               // Decoder instance
     int m_mode;                          // Codec mode, 20/30 msec
@@ -118,6 +131,9 @@ private:
 
 INIT_PLUGIN(iLBCwrModule);
 
+// Idle encoder and decoder states kept for new calls
+static DataCodecPool s_pool("ilbcwebrtc");
+
 static TranslatorCaps s_caps20[] = {
     { 0, 0 },
     { 0, 0 },
@@ -139,15 +155,12 @@ UNLOAD_PLUGIN(unloadNow)
 
 
 /*
- * iLBCwrCodec
+ * iLBCwrState
  */
-iLBCwrCodec::iLBCwrCodec(const char* sFormat, const char* dFormat, bool encoding, int msec)
-    : DataTranslator(sFormat,dFormat), m_encoding(encoding),
+iLBCwrState::iLBCwrState(const String& kind, bool encoding, int msec)
+    : DataCodecState(kind),
     m_enc(0), m_dec(0), m_mode(msec)
 {
-    Debug(&__plugin,DebugAll,"iLBCwrCodec(\"%s\",\"%s\",%scoding,%d) [%p]",
-	sFormat,dFormat,m_encoding ? "en" : "de",msec,this);
-    __plugin.incCount();
     if (encoding) {
 	::WebRtcIlbcfix_EncoderCreate(&m_enc);
 	::WebRtcIlbcfix_EncoderInit(m_enc,msec);
@@ -158,12 +171,48 @@ iLBCwrCodec::iLBCwrCodec(const char* sFormat, const char* dFormat, bool encoding
     }
 }
 
-iLBCwrCodec::~iLBCwrCodec()
+iLBCwrState::~iLBCwrState()
 {
     if (m_enc)
 	::WebRtcIlbcfix_EncoderFree(m_enc);
     if (m_dec)
 	::WebRtcIlbcfix_DecoderFree(m_dec);
+}
+
+bool iLBCwrState::reset()
+{
+    if (m_enc)
+	return ::WebRtcIlbcfix_EncoderInit(m_enc,m_mode) >= 0;
+    if (m_dec)
+	return ::WebRtcIlbcfix_DecoderInit(m_dec,m_mode) >= 0;
+    return false;
+}
+
+
+/*
+ * iLBCwrCodec
+ */
+iLBCwrCodec::iLBCwrCodec(const char* sFormat, const char* dFormat, bool encoding, int msec)
+    : DataTranslator(sFormat,dFormat), m_encoding(encoding),
+    m_state(0), m_enc(0), m_dec(0), m_mode(msec)
+{
+    Debug(&__plugin,DebugAll,"iLBCwrCodec(\"%s\",\"%s\",%scoding,%d) [%p]",
+	sFormat,dFormat,m_encoding ? "en" : "de",msec,this);
+    __plugin.incCount();
+    String kind(encoding ? "enc" : "dec");
+    kind << msec;
+    m_state = static_cast<iLBCwrState*>(s_pool.get(kind));
+    if (!m_state)
+	m_state = new iLBCwrState(kind,encoding,msec);
+    m_enc = m_state->m_enc;
+    m_dec = m_state->m_dec;
+}
+
+iLBCwrCodec::~iLBCwrCodec()
+{
+    m_enc = 0;
+    m_dec = 0;
+    s_pool.put(m_state);
     Debug(&__plugin,DebugAll,
 	"iLBCwrCodec(%scoding) destroyed [%p]",m_encoding ? "en" : "de",this);
     __plugin.decCount();
@@ -315,6 +364,7 @@ void iLBCwrModule::initialize()
 {
     static bool s_first = true;
     Output("Initializing module iLBC webrtc");
+    s_pool.configure();
     if (s_first) {
 	installRelay(Level);
 	installRelay(Status);
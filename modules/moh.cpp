@@ -49,21 +49,23 @@ static ObjList sources;
 static ObjList chans;
 static Mutex s_mutex(true,"MOH");
 
-class MOHSource : public ThreadedSource
+class MOHSource : public ClockedSource
 {
 public:
     ~MOHSource();
-    virtual void run();
     virtual void destroyed();
     inline const String &name()
 	{ return m_name; }
     static MOHSource* getSource(String& name, const NamedList& params);
+protected:
+    virtual int tick(u_int64_t when);
 private:
     MOHSource(const String &name, const String &command_line, unsigned int rate = 8000);
     String m_name;
     String m_command_line;
     bool create();
     DataBlock m_data;
+    unsigned int m_pos;
     pid_t m_pid;
     int m_in;
     bool m_swap;
@@ -126,12 +128,15 @@ public:
 
 
 MOHSource::MOHSource(const String &name, const String &command_line, unsigned int rate)
-    : ThreadedSource("slin"),
-      m_name(name), m_command_line(command_line), m_swap(false), m_brate(2*rate)
+    : ClockedSource("slin"),
+      m_name(name), m_command_line(command_line),
+      m_pos(0), m_pid(0), m_in(-1), m_swap(false), m_brate(2*rate), m_time(0)
 {
     Debug(DebugAll,"MOHSource::MOHSource('%s','%s',%u) [%p]",name.c_str(),command_line.c_str(),rate,this);
     if (rate != 8000)
 	m_format << "/" << rate;
+    // all listeners of a format are fed by the same encoder
+    shareTranslators(true);
 }
 
 MOHSource::~MOHSource()
@@ -151,7 +156,7 @@ void MOHSource::destroyed()
     s_mutex.lock();
     sources.remove(this,false);
     s_mutex.unlock();
-    ThreadedSource::destroyed();
+    ClockedSource::destroyed();
 }
 
 
@@ -177,10 +182,11 @@ MOHSource* MOHSource::getSource(String& name, const NamedList& params)
     }
     if (cmd) {
 	MOHSource *s = new MOHSource(name,cmd,rate);
-	if (s->start("MOH Source")) {
+	if (s->create() && s->start()) {
 	    sources.append(s);
 	    return s;
 	}
+	TelEngine::destruct(s);
     }
     return 0;
 }
@@ -230,65 +236,49 @@ bool MOHSource::create()
     }
     Debug(DebugInfo,"Launched External Script %s, pid: %d", m_command_line.c_str(), pid);
     m_in = ext2yate[0];
+    // the media clock must never wait for the external program
+    ::fcntl(m_in,F_SETFL,::fcntl(m_in,F_GETFL) | O_NONBLOCK);
 
     /* close what we're not using in the parent */
     close(ext2yate[1]);
 
     m_pid = pid;
+    m_data.assign(0,(m_brate*20)/1000);
+    m_time = Time::now();
     return true;
 }
 
-void MOHSource::run()
+// Send a block each time the media clock ticks if the program provided it
+int MOHSource::tick(u_int64_t when)
 {
-    if (!create()) {
-	m_pid = 0;
-	return;
+    if (!looping())
+	return -1;
+    unsigned int len = m_data.length() - m_pos;
+    int r = len;
+    if (m_in >= 0) {
+	unsigned char* ptr = m_data.data(m_pos,len);
+	r = ptr ? ::read(m_in,ptr,len) : 0;
     }
-
-    m_data.assign(0,(m_brate*20)/1000);
-    int r = 1;
-    u_int64_t tpos = Time::now();
-    m_time = tpos;
-
-    unsigned int pos = 0;
-    while ((r > 0) && looping()) {
-	unsigned int len = m_data.length() - pos;
-	if (m_in >= 0) {
-	    unsigned char* ptr = m_data.data(pos,len);
-	    r = ptr ? ::read(m_in,ptr,len) : 0;
-	}
-	else
-	    r = len;
-
-	if (r < 0) {
-	    if (errno == EINTR) {
-		r = 1;
-		continue;
-	    }
-	    break;
-	}
-	pos += r;
-	if (pos < m_data.length()) {
-	    if (!r)
-		Thread::yield();
-	    continue;
-	}
-	if (m_swap) {
-	    uint16_t* p = (uint16_t*)m_data.data();
-	    for (int i = 0; i < r; i+= 2) {
-		*p = ntohs(*p);
-		++p;
-	    }
-	}
-	int64_t dly = tpos - Time::now();
-	if (dly > 0) {
-	    XDebug("MOH",DebugAll,"Sleeping for " FMT64 " usec",dly);
-	    Thread::usleep((unsigned long)dly);
+    if (r < 0) {
+	if ((errno == EINTR) || (errno == EAGAIN))
+	    return 0;
+	return -1;
+    }
+    if (!r)
+	return -1;
+    m_pos += r;
+    if (m_pos < m_data.length())
+	return 0;
+    m_pos = 0;
+    if (m_swap) {
+	uint16_t* p = (uint16_t*)m_data.data();
+	for (unsigned int i = 0; i < m_data.length(); i+= 2) {
+	    *p = ntohs(*p);
+	    ++p;
 	}
-	Forward(m_data);
-	pos = 0;
-	tpos += (r*1000000ULL/m_brate);
     }
+    Forward(m_data);
+    return (int)(m_data.length()*1000000ULL/m_brate);
 }
 
 
@@ -421,9 +411,25 @@ bool StatusHandler::received(Message &msg)
     const char *sel = msg.getValue("module");
     if (sel && ::strcmp(sel,"moh"))
 	return false;
-    msg.retValue() << "name=moh,type=misc"
-		   << ";sources=" << sources.count()
-		   << ",chans=" << chans.count() << "\r\n";
+    String st("name=moh,type=misc,format=Encoders|Listeners");
+    s_mutex.lock();
+    st << ";sources=" << sources.count() << ",chans=" << chans.count();
+    if (msg.getBoolValue(YSTRING("details"),true)) {
+	st << ";";
+	bool first = true;
+	for (ObjList* l = sources.skipNull(); l; l = l->skipNext()) {
+	    MOHSource* s = static_cast<MOHSource*>(l->get());
+	    unsigned int encoders = 0;
+	    unsigned int listeners = s->listeners(&encoders);
+	    if (first)
+		first = false;
+	    else
+		st << ",";
+	    st << s->name() << "=" << encoders << "|" << listeners;
+	}
+    }
+    s_mutex.unlock();
+    msg.retValue() << st << "\r\n";
     return false;
 }
 
@@ -30,6 +30,7 @@
 
 #ifndef OPENSSL_NO_AES
 #include <openssl/aes.h>
+#include <openssl/evp.h>
 #ifdef NO_AESCTR
 #include <openssl/modes.h>
 #define AES_ctr128_encrypt(in,out,len,key,ivec,ecount,num) \
@@ -144,6 +145,10 @@ public:
 protected:
     AES_KEY* m_key;
     unsigned char m_initVector[AES_BLOCK_SIZE];
+private:
+    // EVP picks hardware AES (AES-NI) and generates the keystream in blocks
+    EVP_CIPHER_CTX* m_ctx;
+    bool m_ctxKey;
 };
 
 //AES - Cipher Feedback Mode
@@ -614,15 +619,19 @@ bool SslHandler::received(Message& msg)
 
 #ifndef OPENSSL_NO_AES
 AesCtrCipher::AesCtrCipher()
-    : m_key(0)
+    : m_key(0), m_ctx(0), m_ctxKey(false)
 {
     m_key = new AES_KEY;
+    m_ctx = ::EVP_CIPHER_CTX_new();
+    ::memset(m_initVector,0,AES_BLOCK_SIZE);
     DDebug(&__plugin,DebugAll,"AesCtrCipher::AesCtrCipher() key=%p [%p]",m_key,this);
 }
 
 AesCtrCipher::~AesCtrCipher()
 {
     DDebug(&__plugin,DebugAll,"AesCtrCipher::~AesCtrCipher() key=%p [%p]",m_key,this);
+    if (m_ctx)
+	::EVP_CIPHER_CTX_free(m_ctx);
     delete m_key;
 }
 
@@ -630,6 +639,23 @@ bool AesCtrCipher::setKey(const void* key, unsigned int len, Direction dir)
 {
     if (!(key && len && m_key))
 	return false;
+    m_ctxKey = false;
+    if (m_ctx) {
+	const EVP_CIPHER* type = 0;
+	switch (len) {
+	    case 16:
+		type = ::EVP_aes_128_ctr();
+		break;
+	    case 24:
+		type = ::EVP_aes_192_ctr();
+		break;
+	    case 32:
+		type = ::EVP_aes_256_ctr();
+		break;
+	}
+	m_ctxKey = type && (1 == ::EVP_EncryptInit_ex(m_ctx,type,0,
+	    (const unsigned char*)key,m_initVector));
+    }
     // AES_ctr128_encrypt is its own inverse
     return 0 == AES_set_encrypt_key((const unsigned char*)key,len*8,m_key);
 }
@@ -653,6 +679,22 @@ bool AesCtrCipher::encrypt(void* outData, unsigned int len, const void* inpData)
 	return false;
     if (!inpData)
 	inpData = outData;
+    if (m_ctxKey) {
+	// restart from our counter, this keeps the expanded key
+	int outLen = 0;
+	if (!(1 == ::EVP_EncryptInit_ex(m_ctx,0,0,0,m_initVector)
+	    && 1 == ::EVP_EncryptUpdate(m_ctx,(unsigned char*)outData,&outLen,
+		(const unsigned char*)inpData,len)))
+	    return false;
+	// advance the counter like AES_ctr128_encrypt, a partial block is discarded
+	unsigned int blocks = (len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+	for (int i = AES_BLOCK_SIZE - 1; blocks && (i >= 0); i--) {
+	    blocks += m_initVector[i];
+	    m_initVector[i] = (unsigned char)blocks;
+	    blocks >>= 8;
+	}
+	return true;
+    }
     unsigned int num = 0;
     unsigned char eCountBuf[AES_BLOCK_SIZE];
     AES_ctr128_encrypt(
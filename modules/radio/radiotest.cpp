@@ -67,6 +67,7 @@ protected:
     bool execute(const NamedList& cmds, const char* prefix);
     bool write();
     bool read();
+    void analyze(const Complex* samples, unsigned int len);
     void readTerminated(RadioTestRecv* th);
     void readStop();
     void hardCancelRecv();
@@ -102,6 +103,12 @@ protected:
     RadioTestIO m_rx;
     RadioReadBufs m_bufs;
     uint64_t m_rxSkippedSamples;
+    double m_rxPower;
+    uint64_t m_rxPowerSamples;
+    FFT m_rxFft;
+    ComplexVector m_rxFftData;
+    FloatVector m_rxSpectrum;
+    unsigned int m_rxSpectrumCount;
     DataBlock m_crt;
     DataBlock m_aux;
     DataBlock m_extra;
@@ -404,7 +411,10 @@ RadioTest::RadioTest(const NamedList& params, const NamedList& radioParams)
     m_sendBufCount(0),
     m_pulse(0),
     m_rx(false),
-    m_rxSkippedSamples(0)
+    m_rxSkippedSamples(0),
+    m_rxPower(0),
+    m_rxPowerSamples(0),
+    m_rxSpectrumCount(0)
 {
     m_params.setParam("orig_test_name",params.c_str());
     m_params.assign(__plugin.name() + "/" + params.c_str());
@@ -466,6 +476,16 @@ void RadioTest::run()
 		m_bufs.aux.samples = (float*)m_aux.data(0);
 		m_bufs.extra.samples = (float*)m_extra.data(0);
 		m_init.addParam("readsamples",String(n));
+		m_rxPower = 0;
+		m_rxPowerSamples = 0;
+		m_rxSpectrumCount = 0;
+		unsigned int len = m_params.getIntValue("rx_spectrum",0,0);
+		if (!m_rxFft.setup(len))
+		    TEST_FAIL_BREAK("Invalid rx_spectrum length, must be a power of 2",true);
+		m_rxFftData.resetStorage(len);
+		m_rxSpectrum.resetStorage(len);
+		if (len)
+		    m_init.addParam("rx_spectrum",String(len));
 	    }
 	}
 	// Create radio
@@ -593,6 +613,25 @@ void RadioTest::terminated(const char* error)
     }
     if (m_rxSkippedSamples)
 	report.addParam("rx_skipped_samples",String(m_rxSkippedSamples));
+    if (m_rxPowerSamples)
+	report.addParam("rx_power",String(m_rxPower / m_rxPowerSamples));
+    if (m_rxSpectrumCount) {
+	// Report the strongest bin, bins in the upper half are negative frequencies
+	unsigned int n = m_rxSpectrum.length();
+	const float* spec = m_rxSpectrum.data();
+	unsigned int peak = 0;
+	double total = 0;
+	for (unsigned int i = 0; i < n; i++) {
+	    total += spec[i];
+	    if (spec[i] > spec[peak])
+		peak = i;
+	}
+	int bin = (peak < n / 2) ? (int)peak : (int)peak - (int)n;
+	report.addParam("rx_spectrum_peak",String(bin));
+	if (total > 0)
+	    report.addParam("rx_spectrum_peak_ratio",String(spec[peak] / total));
+	report.addParam("rx_spectrum_count",String(m_rxSpectrumCount));
+    }
     String s;
     report.dump(s,"\r\n");
     Debug(this,DebugInfo,"Terminated [%p]%s",this,encloseDashes(s,true));
@@ -783,8 +822,10 @@ bool RadioTest::read()
 	m_rx.transferred += skipped;
     }
     if (!code) {
-	if (m_bufs.full(m_bufs.crt))
+	if (m_bufs.full(m_bufs.crt)) {
 	    m_rx.transferred += m_bufs.bufSamples();
+	    analyze((const Complex*)m_bufs.crt.samples,m_bufs.bufSamples());
+	}
 	return true;
     }
     if (code != RadioInterface::Cancelled)
@@ -793,6 +834,25 @@ bool RadioTest::read()
     return false;
 }
 
+// Accumulate received power and power spectrum of a full read buffer
+void RadioTest::analyze(const Complex* samples, unsigned int len)
+{
+    m_rxPower += Math::power(samples,len);
+    m_rxPowerSamples += len;
+    unsigned int n = m_rxFft.length();
+    if (!n)
+	return;
+    Complex* data = m_rxFftData.data();
+    // Short buffers are zero padded, long ones use the first samples only
+    for (unsigned int i = 0; i < n; i++)
+	data[i] = (i < len) ? samples[i] : Complex();
+    m_rxFft.forward(data);
+    float* spec = m_rxSpectrum.data();
+    for (unsigned int i = 0; i < n; i++)
+	spec[i] += data[i].norm2();
+    m_rxSpectrumCount++;
+}
+
 void RadioTest::readTerminated(RadioTestRecv* th)
 {
     Lock lck(s_testMutex);
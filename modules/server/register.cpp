@@ -176,6 +176,7 @@ public:
 protected:
     virtual void initialize();
     virtual void statusParams(String& str);
+    virtual void msgTimer(Message& msg);
     virtual bool received(Message& msg, int id);
 private:
     static int getPriority(const String& name);
@@ -247,7 +248,122 @@ private:
     String m_account;
 };
 
+// A location of an user, also kept in a heap ordered by expiration time
+class LocContact : public String
+{
+public:
+    inline LocContact(const String& data, const String& user)
+	: String(data), m_user(user), m_expires(0), m_index(-1)
+	{ }
+    String m_user;
+    u_int32_t m_expires;
+    int m_index;
+};
+
+// All locations of an user, most recent first
+class LocUser : public String
+{
+public:
+    inline LocUser(const String& name)
+	: String(name), m_checked(0)
+	{ }
+    ObjList m_contacts;
+    // when the user was last checked by the database
+    u_int32_t m_checked;
+};
+
+// A query waiting to be written for a location, all locations if empty
+class LocQuery : public String
+{
+public:
+    inline LocQuery(const String& user, const String& data, const String& account,
+	const String& query)
+	: String(data), m_user(user), m_account(account), m_query(query)
+	{ }
+    String m_user;
+    String m_account;
+    String m_query;
+};
+
+// Queries waiting to be written for an user
+class LocPending : public String
+{
+public:
+    inline LocPending(const String& name)
+	: String(name)
+	{ }
+    ObjList m_queries;
+};
+
+// Registered locations kept in memory, changes are written to the database later
+class LocationStore : public Mutex
+{
+public:
+    LocationStore();
+    ~LocationStore();
+    void initialize();
+    inline bool enabled() const
+	{ return m_enabled; }
+    inline unsigned int interval() const
+	{ return m_interval; }
+    inline bool routing() const
+	{ return m_enabled && m_route; }
+    // Refresh a location of a known user, return false if the user is not known
+    //  or must be checked by the database again. Add the user if requested
+    bool refresh(const String& user, const String& data, int expires, bool add = false);
+    // Remove one or all locations of an user
+    void remove(const String& user, const String& data);
+    // Route to the locations of an user, return false if not registered
+    bool route(Message& msg, const String& user);
+    // Remove the locations that expired
+    void expire(u_int32_t now);
+    // Queue a query, replace older queries of the same location
+    void queue(const String& user, const String& data, const String& account,
+	const String& query);
+    // Write a batch of queued queries, return false if there was nothing to write
+    //  or writing failed
+    bool flush();
+    // Fill the store from the database
+    void load();
+    void statusParams(String& str);
+private:
+    void heapSet(LocContact* c, unsigned int index);
+    void heapUp(unsigned int index);
+    void heapDown(unsigned int index);
+    void heapPush(LocContact* c);
+    void heapRemove(LocContact* c);
+    void drop(LocContact* c);
+    void requeue(ObjList& batch);
+    bool m_enabled;
+    bool m_route;
+    unsigned int m_interval;
+    unsigned int m_batch;
+    unsigned int m_verify;
+    HashList m_users;
+    unsigned int m_contacts;
+    LocContact** m_heap;
+    unsigned int m_heapLen;
+    unsigned int m_heapSize;
+    HashList m_pending;
+    ObjList m_order;
+    unsigned int m_dirty;
+    Mutex m_writeMutex;
+};
+
+// Periodically writes the queued location changes
+class LocationWriter : public Thread
+{
+public:
+    LocationWriter();
+    virtual ~LocationWriter();
+    virtual void run();
+    // Stop the writer and wait for it to terminate
+    static void stop();
+};
+
 static RegistModule module;
+static LocationStore s_location;
+static LocationWriter* s_writer = 0;
 
 // copy parameters from SQL result to a Message
 
@@ -319,6 +435,418 @@ static bool copyParams(Message &msg, Array *a, const String& resultName)
 }
 
 
+LocationStore::LocationStore()
+    : Mutex(false,"LocationStore"),
+      m_enabled(false), m_route(false), m_interval(1000), m_batch(100), m_verify(1800),
+      m_users(1023), m_contacts(0), m_heap(0), m_heapLen(0), m_heapSize(0),
+      m_pending(255), m_dirty(0),
+      m_writeMutex(false,"LocationWriter")
+{
+    m_order.setDelete(false);
+}
+
+LocationStore::~LocationStore()
+{
+    m_order.clear();
+    delete[] m_heap;
+}
+
+void LocationStore::initialize()
+{
+    m_enabled = s_cfg.getBoolValue("general","location");
+    m_interval = s_cfg.getIntValue("location","flush",1000,10,60000);
+    m_batch = s_cfg.getIntValue("location","batch",100,1,10000);
+    m_verify = s_cfg.getIntValue("location","verify",1800,0,86400);
+    m_route = s_cfg.getBoolValue("location","route");
+}
+
+void LocationStore::heapSet(LocContact* c, unsigned int index)
+{
+    m_heap[index] = c;
+    c->m_index = index;
+}
+
+void LocationStore::heapUp(unsigned int index)
+{
+    LocContact* c = m_heap[index];
+    while (index) {
+	unsigned int parent = (index - 1) / 2;
+	if (m_heap[parent]->m_expires <= c->m_expires)
+	    break;
+	heapSet(m_heap[parent],index);
+	index = parent;
+    }
+    heapSet(c,index);
+}
+
+void LocationStore::heapDown(unsigned int index)
+{
+    LocContact* c = m_heap[index];
+    for (;;) {
+	unsigned int child = 2 * index + 1;
+	if (child >= m_heapLen)
+	    break;
+	if ((child + 1 < m_heapLen) && (m_heap[child + 1]->m_expires < m_heap[child]->m_expires))
+	    child++;
+	if (c->m_expires <= m_heap[child]->m_expires)
+	    break;
+	heapSet(m_heap[child],index);
+	index = child;
+    }
+    heapSet(c,index);
+}
+
+void LocationStore::heapPush(LocContact* c)
+{
+    if (m_heapLen >= m_heapSize) {
+	m_heapSize = m_heapSize ? 2 * m_heapSize : 1024;
+	LocContact** heap = new LocContact*[m_heapSize];
+	for (unsigned int i = 0; i < m_heapLen; i++)
+	    heap[i] = m_heap[i];
+	delete[] m_heap;
+	m_heap = heap;
+    }
+    heapSet(c,m_heapLen++);
+    heapUp(c->m_index);
+}
+
+void LocationStore::heapRemove(LocContact* c)
+{
+    if (c->m_index < 0)
+	return;
+    unsigned int index = c->m_index;
+    c->m_index = -1;
+    if (index == --m_heapLen)
+	return;
+    heapSet(m_heap[m_heapLen],index);
+    heapUp(index);
+    heapDown(m_heap[index]->m_index);
+}
+
+// Remove a location and its user if it was the last one
+void LocationStore::drop(LocContact* c)
+{
+    heapRemove(c);
+    m_contacts--;
+    LocUser* u = static_cast<LocUser*>(m_users[c->m_user]);
+    if (!u)
+	return;
+    u->m_contacts.remove(c);
+    if (!u->m_contacts.skipNull())
+	m_users.remove(u);
+}
+
+bool LocationStore::refresh(const String& user, const String& data, int expires, bool add)
+{
+    if (!(m_enabled && user && data))
+	return false;
+    u_int32_t now = Time::secNow();
+    Lock lock(this);
+    LocUser* u = static_cast<LocUser*>(m_users[user]);
+    if (expires <= 0) {
+	// a location that never expires is not kept in memory
+	LocContact* c = u ? static_cast<LocContact*>(u->m_contacts[data]) : 0;
+	if (c)
+	    drop(c);
+	return false;
+    }
+    if (!u) {
+	// users with pending changes were already checked by the database
+	if (!(add || m_pending[user]))
+	    return false;
+	u = new LocUser(user);
+	u->m_checked = now;
+	m_users.append(u);
+    }
+    else if (add)
+	u->m_checked = now;
+    else if (m_verify && (u->m_checked + m_verify <= now) && !m_pending[user])
+	// ask the database again so deleted users are noticed,
+	//  wait until pending changes are written to keep them in order
+	return false;
+    LocContact* c = static_cast<LocContact*>(u->m_contacts.remove(data,false));
+    if (!c) {
+	c = new LocContact(data,user);
+	m_contacts++;
+    }
+    // most recent location is tried first when routing
+    u->m_contacts.insert(c);
+    heapRemove(c);
+    c->m_expires = now + expires;
+    heapPush(c);
+    return true;
+}
+
+void LocationStore::remove(const String& user, const String& data)
+{
+    if (!(m_enabled && user))
+	return;
+    Lock lock(this);
+    LocUser* u = static_cast<LocUser*>(m_users[user]);
+    if (!u)
+	return;
+    if (data) {
+	LocContact* c = static_cast<LocContact*>(u->m_contacts[data]);
+	if (c)
+	    drop(c);
+	return;
+    }
+    for (ObjList* l = u->m_contacts.skipNull(); l; l = l->skipNext()) {
+	LocContact* c = static_cast<LocContact*>(l->get());
+	heapRemove(c);
+	m_contacts--;
+    }
+    m_users.remove(u);
+}
+
+bool LocationStore::route(Message& msg, const String& user)
+{
+    if (!(routing() && user))
+	return false;
+    Lock lock(this);
+    LocUser* u = static_cast<LocUser*>(m_users[user]);
+    if (!u)
+	return false;
+    // build a result like the one of the routing query
+    Array* a = new Array(1,1);
+    a->set(new String("location"),0,0);
+    for (ObjList* l = u->m_contacts.skipNull(); l; l = l->skipNext()) {
+	a->addRow();
+	a->set(new String(*static_cast<LocContact*>(l->get())),0,a->getRows() - 1);
+    }
+    lock.drop();
+    copyParams(msg,a,"location");
+    TelEngine::destruct(a);
+    return !msg.retValue().null();
+}
+
+void LocationStore::expire(u_int32_t now)
+{
+    if (!m_enabled)
+	return;
+    Lock lock(this);
+    while (m_heapLen && (m_heap[0]->m_expires <= now)) {
+	LocContact* c = m_heap[0];
+	DDebug(&module,DebugAll,"Location '%s' of '%s' expired",c->c_str(),c->m_user.c_str());
+	drop(c);
+    }
+}
+
+void LocationStore::queue(const String& user, const String& data, const String& account,
+    const String& query)
+{
+    if (!(m_enabled && user && account && query))
+	return;
+    Lock lock(this);
+    LocPending* p = static_cast<LocPending*>(m_pending[user]);
+    if (!p) {
+	p = new LocPending(user);
+	m_pending.append(p);
+	m_order.append(p)->setDelete(false);
+    }
+    if (data) {
+	ObjList* o = p->m_queries.find(data);
+	if (o) {
+	    o->remove();
+	    m_dirty--;
+	}
+    }
+    else {
+	m_dirty -= p->m_queries.count();
+	p->m_queries.clear();
+    }
+    p->m_queries.append(new LocQuery(user,data,account,query));
+    m_dirty++;
+}
+
+// Put back the queries of a batch that was not written,
+//  unless newer changes of the same locations were queued meanwhile
+void LocationStore::requeue(ObjList& batch)
+{
+    Lock lock(this);
+    ObjList* l = batch.skipNull();
+    while (l) {
+	String user = static_cast<LocQuery*>(l->get())->m_user;
+	LocPending* p = static_cast<LocPending*>(m_pending[user]);
+	if (!p) {
+	    p = new LocPending(user);
+	    m_pending.append(p);
+	    m_order.insert(p)->setDelete(false);
+	}
+	// the failed queries go before the newer ones
+	ObjList newer;
+	GenObject* o = p->m_queries.remove(false);
+	while (o) {
+	    newer.append(o);
+	    o = p->m_queries.remove(false);
+	}
+	bool all = newer.find(String::empty()) != 0;
+	while (l && (static_cast<LocQuery*>(l->get())->m_user == user)) {
+	    LocQuery* q = static_cast<LocQuery*>(l->remove(false));
+	    l = l->skipNull();
+	    if (all || newer.find(*q)) {
+		TelEngine::destruct(q);
+		continue;
+	    }
+	    p->m_queries.append(q);
+	    m_dirty++;
+	}
+	o = newer.remove(false);
+	while (o) {
+	    p->m_queries.append(o);
+	    o = newer.remove(false);
+	}
+    }
+}
+
+bool LocationStore::flush()
+{
+    Lock wr(m_writeMutex);
+    Lock lock(this);
+    LocPending* p = static_cast<LocPending*>(m_order.remove(false));
+    if (!p)
+	return false;
+    // take whole users so their queries stay in order
+    String account;
+    String query;
+    ObjList batch;
+    unsigned int n = 0;
+    while (p) {
+	LocQuery* q = static_cast<LocQuery*>(p->m_queries.get());
+	if (q && account && (account != q->m_account)) {
+	    m_order.insert(p)->setDelete(false);
+	    break;
+	}
+	if (q)
+	    account = q->m_account;
+	while (q && (account == q->m_account)) {
+	    query.append(q->m_query,";");
+	    n++;
+	    batch.append(p->m_queries.remove(false));
+	    q = static_cast<LocQuery*>(p->m_queries.get());
+	}
+	if (q) {
+	    m_order.insert(p)->setDelete(false);
+	    break;
+	}
+	m_pending.remove(p);
+	if (n >= m_batch)
+	    break;
+	p = static_cast<LocPending*>(m_order.remove(false));
+    }
+    m_dirty -= n;
+    lock.drop();
+    if (!n)
+	return true;
+    Message m("database");
+    AAAHandler::prepareQuery(m,account,query,false);
+    if (Engine::dispatch(m) && !m.getParam(YSTRING("error")))
+	return true;
+    Debug(&module,DebugWarn,"Failed to write %u location changes on '%s': %s",
+	n,account.c_str(),m.getValue(YSTRING("error"),"not handled"));
+    // try again later
+    requeue(batch);
+    return false;
+}
+
+void LocationStore::load()
+{
+    if (!m_enabled)
+	return;
+    String account = s_cfg.getValue("location","account",s_cfg.getValue("default","account"));
+    String query = s_cfg.getValue("location","loadquery");
+    Engine::runParams().replaceParams(account,true);
+    Engine::runParams().replaceParams(query,true);
+    if (!(account && query))
+	return;
+    Message m("database");
+    AAAHandler::prepareQuery(m,account,query,true);
+    Array* a = Engine::dispatch(m) ? static_cast<Array*>(m.userObject(YATOM("Array"))) : 0;
+    if (!a) {
+	Debug(&module,DebugWarn,"Failed to load locations from '%s'",account.c_str());
+	return;
+    }
+    int user = -1;
+    int data = -1;
+    int expires = -1;
+    for (int i = 0; i < a->getColumns(); i++) {
+	String* s = YOBJECT(String,a->get(i,0));
+	if (!s)
+	    continue;
+	if (*s == YSTRING("username"))
+	    user = i;
+	else if ((*s == YSTRING("data")) || (*s == YSTRING("location")))
+	    data = i;
+	else if (*s == YSTRING("expires"))
+	    expires = i;
+    }
+    if (user < 0 || data < 0) {
+	Debug(&module,DebugWarn,"Location query must return 'username' and 'data' columns");
+	return;
+    }
+    unsigned int n = 0;
+    for (int j = 1; j < a->getRows(); j++) {
+	String* u = YOBJECT(String,a->get(user,j));
+	String* d = YOBJECT(String,a->get(data,j));
+	String* e = (expires >= 0) ? YOBJECT(String,a->get(expires,j)) : 0;
+	// locations that already expired or never expire are skipped
+	if (u && d && refresh(*u,*d,(expires >= 0) ? (e ? e->toInteger() : 0) : s_expire,true))
+	    n++;
+    }
+    Debug(&module,DebugInfo,"Loaded %u locations",n);
+}
+
+void LocationStore::statusParams(String& str)
+{
+    if (!m_enabled)
+	return;
+    Lock lock(this);
+    str << ",locations=" << m_users.count() << ",contacts=" << m_contacts;
+    str << ",dirty=" << m_dirty;
+}
+
+
+LocationWriter::LocationWriter()
+    : Thread("Register Writer")
+{
+    Lock lock(module);
+    s_writer = this;
+}
+
+LocationWriter::~LocationWriter()
+{
+    Lock lock(module);
+    if (s_writer == this)
+	s_writer = 0;
+}
+
+void LocationWriter::run()
+{
+    while (!Thread::check(false)) {
+	u_int64_t next = Time::now() + 1000 * (u_int64_t)s_location.interval();
+	while ((Time::now() < next) && !Thread::check(false))
+	    Thread::idle();
+	while (!Thread::check(false) && s_location.flush())
+	    ;
+    }
+}
+
+void LocationWriter::stop()
+{
+    Lock lock(module);
+    if (s_writer)
+	s_writer->cancel(false);
+    lock.drop();
+    while (true) {
+	lock.acquire(module);
+	if (!s_writer)
+	    break;
+	lock.drop();
+	Thread::idle();
+    }
+}
+
+
 AAAHandler::AAAHandler(const char* hname, int type, int prio)
     : MessageHandler(hname,prio),m_type(type)
 {
@@ -430,11 +958,23 @@ bool AAAHandler::received(Message& msg)
 		return false;
 	    if (s_critical)
 		return failure(&msg);
+	    // refreshes of known users are written later
+	    const String& user = msg[YSTRING("username")];
+	    const String& data = msg[YSTRING("data")];
+	    int expires = msg.getIntValue(YSTRING("expires"),s_expire);
+	    if (s_location.refresh(user,data,expires)) {
+		s_location.queue(user,data,account,query);
+		return true;
+	    }
 	    Message m("database");
 	    prepareQuery(m,account,query,true);
 	    if (Engine::dispatch(m))
-		if (m.getIntValue("affected") >= 1 || m.getIntValue("rows") >=1)
+		if (m.getIntValue("affected") >= 1 || m.getIntValue("rows") >=1) {
+		    s_location.refresh(user,data,expires,true);
 		    return true;
+		}
+	    // the user may have been deleted from the database
+	    s_location.remove(user,String::empty());
 	    return false;
 	}
 	break;
@@ -481,6 +1021,8 @@ bool AAAHandler::received(Message& msg)
 		return false;
 	    if (s_critical)
 		return failure(&msg);
+	    if (s_location.route(msg,msg[YSTRING("called")]))
+		return true;
 	    Message m("database");
 	    prepareQuery(m,account,query,true);
 	    if (Engine::dispatch(m))
@@ -507,6 +1049,12 @@ bool AAAHandler::received(Message& msg)
 	{
 	    if (!msg.getBoolValue(YSTRING("register_register"),true))
 		return false;
+	    if (s_location.enabled()) {
+		const String& user = msg[YSTRING("username")];
+		s_location.remove(user,msg[YSTRING("data")]);
+		s_location.queue(user,msg[YSTRING("data")],account,query);
+		break;
+	    }
 	    // no error check needed on unregister - we return false
 	    Message m("database");
 	    prepareQuery(m,account,query,true);
@@ -937,6 +1485,13 @@ void RegistModule::statusParams(String& str)
 	if (names)
     	    str << "," << names->name() << "=" << names->at(0);
     }
+    s_location.statusParams(str);
+}
+
+void RegistModule::msgTimer(Message& msg)
+{
+    Module::msgTimer(msg);
+    s_location.expire(msg.msgTime().sec());
 }
 
 bool RegistModule::received(Message& msg, int id)
@@ -950,6 +1505,18 @@ bool RegistModule::received(Message& msg, int id)
 	    if (h)
 		h->initQuery();
 	}
+	if (s_location.enabled()) {
+	    s_location.load();
+	    (new LocationWriter)->startup();
+	}
+	return false;
+    }
+    if (id == Halt) {
+	// write what is still pending while the database is available,
+	//  the writer must not be left running on an unloaded module
+	LocationWriter::stop();
+	while (s_location.flush())
+	    ;
 	return false;
     }
     return Module::received(msg,id);
@@ -1034,7 +1601,10 @@ void RegistModule::initialize()
     Output("Initializing module Register for database");
     s_expire = s_cfg.getIntValue("general","expires",s_expire);
     s_errOffline = s_cfg.getBoolValue("call.route","offlineauto",true);
+    s_location.initialize();
     Engine::install(new MessageRelay("engine.start",this,Private,150));
+    if (s_location.enabled())
+	installRelay(Halt,10);
     addHandler("call.cdr",AAAHandler::Cdr);
     addHandler("linetracker",AAAHandler::Cdr);
     addHandler("user.auth",AAAHandler::Auth);
@@ -40,12 +40,29 @@ static TranslatorCaps caps[7];
 static Mutex s_cmutex(false,"SpeexCodec");
 static int s_count = 0;
 
+// Idle encoder and decoder states kept for new calls
+static DataCodecPool s_pool("speex");
+
+// Encoder or decoder of one mode, kinds are "enc" or "dec" followed by the mode id
+class SpeexState : public DataCodecState
+{
+public:
+    SpeexState(const String& kind, bool encoding, int type, int rate);
+    virtual ~SpeexState();
+    virtual bool reset();
+    bool m_encoding;
+    void *m_state;
+    SpeexBits *m_bits;
+    int m_frameSize;
+};
+
 class SpeexPlugin : public Plugin, public TranslatorFactory
 {
 public:
     SpeexPlugin();
     ~SpeexPlugin();
-    virtual void initialize() { }
+    virtual void initialize()
+	{ s_pool.configure(); }
     virtual bool isBusy() const;
     virtual DataTranslator* create(const DataFormat& sFormat, const DataFormat& dFormat);
     virtual const TranslatorCaps* getCapabilities() const;
@@ -61,6 +78,7 @@ private:
     bool m_encoding;
     DataBlock m_data;
 
+    SpeexState *m_pooled;
     void *m_state;
     SpeexBits *m_bits;
     int m_frameSize;
@@ -71,17 +89,10 @@ private:
     unsigned int m_bsize;
 };
 
-SpeexCodec::SpeexCodec(const char* sFormat, const char* dFormat, bool encoding, int type)
-    : DataTranslator(sFormat,dFormat), m_encoding(encoding),
+SpeexState::SpeexState(const String& kind, bool encoding, int type, int rate)
+    : DataCodecState(kind), m_encoding(encoding),
       m_state(NULL), m_bits(NULL), m_frameSize(0)
 {
-    Debug("speexcodec", DebugAll,
-	    "SpeexCodec::SpeexCodec(\"%s\",\"%s\",%scoding,%d) [%p]",
-	    sFormat,dFormat, m_encoding ? "en" : "de",type,this);
-
-    m_sFormatInfo = FormatRepository::getFormat(sFormat);
-    m_dFormatInfo = FormatRepository::getFormat(dFormat);
-
     m_bits = new SpeexBits;
     speex_bits_init(m_bits);
 
@@ -102,7 +113,7 @@ SpeexCodec::SpeexCodec(const char* sFormat, const char* dFormat, bool encoding,
 	}
 
 	if (m_state) {
-	    int srate = m_dFormatInfo->sampleRate;
+	    int srate = rate;
 	    int samples = 0;
 	    int bitrate = 0;
 	    speex_encoder_ctl(m_state, SPEEX_SET_MODE, &mode);
@@ -114,10 +125,6 @@ SpeexCodec::SpeexCodec(const char* sFormat, const char* dFormat, bool encoding,
 		m_frameSize = ((bitrate * samples / srate) + 7) / 8;
 	    DDebug(DebugInfo,"Speex encoder frame size=%d [%p]",m_frameSize,this);
 	}
-
-	// Number of samples per frame in this Speex mode.
-	m_bsamples = m_dFormatInfo->sampleRate *
-	    (long)m_dFormatInfo->frameTime / 1000000;
     }
     else {
 	switch (type) {
@@ -132,24 +139,11 @@ SpeexCodec::SpeexCodec(const char* sFormat, const char* dFormat, bool encoding,
 		m_state = speex_decoder_init(&speex_nb_mode);
 		break;
 	}
-
-	// Number of samples per frame in this Speex mode.
-	m_bsamples = m_sFormatInfo->sampleRate *
-	    (long)m_sFormatInfo->frameTime / 1000000;
     }
-
-    // Size of one slin block for one frame of Speex data.
-    m_bsize = m_bsamples * sizeof(short);
-
-    s_cmutex.lock();
-    s_count++;
-    s_cmutex.unlock();
 }
 
-SpeexCodec::~SpeexCodec()
+SpeexState::~SpeexState()
 {
-    Debug(DebugAll,"SpeexCodec::~SpeexCodec() [%p]", this);
-
     if (m_state) {
 	if (m_encoding)
 	    speex_encoder_destroy(m_state);
@@ -163,6 +157,65 @@ SpeexCodec::~SpeexCodec()
 	delete m_bits;
 	m_bits = NULL;
     }
+}
+
+bool SpeexState::reset()
+{
+    if (!(m_state && m_bits))
+	return false;
+    // clears the filter memories, the mode and bitrate are kept
+    if (m_encoding)
+	speex_encoder_ctl(m_state, SPEEX_RESET_STATE, NULL);
+    else
+	speex_decoder_ctl(m_state, SPEEX_RESET_STATE, NULL);
+    speex_bits_reset(m_bits);
+    return true;
+}
+
+SpeexCodec::SpeexCodec(const char* sFormat, const char* dFormat, bool encoding, int type)
+    : DataTranslator(sFormat,dFormat), m_encoding(encoding), m_pooled(NULL),
+      m_state(NULL), m_bits(NULL), m_frameSize(0)
+{
+    Debug("speexcodec", DebugAll,
+	    "SpeexCodec::SpeexCodec(\"%s\",\"%s\",%scoding,%d) [%p]",
+	    sFormat,dFormat, m_encoding ? "en" : "de",type,this);
+
+    m_sFormatInfo = FormatRepository::getFormat(sFormat);
+    m_dFormatInfo = FormatRepository::getFormat(dFormat);
+
+    String kind(encoding ? "enc" : "dec");
+    kind << type;
+    m_pooled = static_cast<SpeexState*>(s_pool.get(kind));
+    if (!m_pooled)
+	m_pooled = new SpeexState(kind,encoding,type,
+	    (encoding ? m_dFormatInfo : m_sFormatInfo)->sampleRate);
+    m_state = m_pooled->m_state;
+    m_bits = m_pooled->m_bits;
+    m_frameSize = m_pooled->m_frameSize;
+
+    // Number of samples per frame in this Speex mode.
+    if (encoding)
+	m_bsamples = m_dFormatInfo->sampleRate *
+	    (long)m_dFormatInfo->frameTime / 1000000;
+    else
+	m_bsamples = m_sFormatInfo->sampleRate *
+	    (long)m_sFormatInfo->frameTime / 1000000;
+
+    // Size of one slin block for one frame of Speex data.
+    m_bsize = m_bsamples * sizeof(short);
+
+    s_cmutex.lock();
+    s_count++;
+    s_cmutex.unlock();
+}
+
+SpeexCodec::~SpeexCodec()
+{
+    Debug(DebugAll,"SpeexCodec::~SpeexCodec() [%p]", this);
+
+    m_state = NULL;
+    m_bits = NULL;
+    s_pool.put(m_pooled);
 
     s_cmutex.lock();
     s_count--;
@@ -0,0 +1,200 @@
+/**
+ * chains.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Translator chain cache test and benchmark
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+#include "testcase.h"
+
+using namespace TelEngine;
+
+#define BENCH_CREATES 100000
+
+// Chains are owned by their first translator
+static void destroy(DataTranslator* trans)
+{
+    if (trans)
+	TelEngine::destruct(trans->getFirstTranslator());
+}
+
+static TranslatorCaps s_caps[] = {
+    { 0, 0, 1 },
+    { 0, 0, 0 }
+};
+
+// Translator that only passes text along
+class TextTranslator : public DataTranslator
+{
+public:
+    inline TextTranslator(const DataFormat& sFormat, const DataFormat& dFormat)
+	: DataTranslator(sFormat,dFormat)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ return getTransSource() ? getTransSource()->Forward(data,tStamp,flags) : 0; }
+};
+
+class TextFactory : public TranslatorFactory
+{
+public:
+    inline TextFactory()
+	: TranslatorFactory("testtext")
+	{ }
+    virtual DataTranslator* create(const DataFormat& sFormat, const DataFormat& dFormat)
+	{ return converts(sFormat,dFormat) ? new TextTranslator(sFormat,dFormat) : 0; }
+    virtual const TranslatorCaps* getCapabilities() const
+	{ return s_caps; }
+};
+
+// Source feeding listeners of one format through a single translator
+class SharedSource : public DataSource
+{
+public:
+    inline SharedSource()
+	{ shareTranslators(true); }
+};
+
+class CountingConsumer : public DataConsumer
+{
+public:
+    inline CountingConsumer(const char* format)
+	: DataConsumer(format), m_count(0)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ m_count++; return invalidStamp(); }
+    unsigned int m_count;
+};
+
+class TestChains : public Plugin
+{
+public:
+    TestChains();
+    virtual void initialize();
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestChains);
+
+
+TestChains::TestChains()
+    : Plugin("testchains"),
+      m_init(false)
+{
+    Output("Hello, I am module TestChains");
+}
+
+void TestChains::initialize()
+{
+    Output("Initializing module TestChains");
+    if (m_init)
+	return;
+    m_init = true;
+
+    u_int64_t hits, misses, h2, m2;
+    String res;
+    DataTranslator::chainCache(hits,misses);
+    int c1 = DataTranslator::cost("slin/48000","alaw");
+    int c2 = DataTranslator::cost("slin/48000","alaw");
+    DataTranslator* t1 = DataTranslator::create("slin/48000","alaw");
+    DataTranslator* t2 = DataTranslator::create("slin/48000","alaw");
+    unsigned int n = DataTranslator::chainCache(h2,m2);
+    res << "cost " << c1 << " entries " << n << " hits " << (h2 - hits)
+	<< " misses " << (m2 - misses);
+    testReport("chains-hit",t1 && t2 && (c1 == 3) && (c1 == c2) && n
+	&& ((h2 - hits) == 3) && ((m2 - misses) == 1),res);
+    destroy(t1);
+    destroy(t2);
+
+    // failures are remembered too
+    DataTranslator::chainCache(hits,misses);
+    t1 = DataTranslator::create("plain","raw");
+    t2 = DataTranslator::create("plain","raw");
+    DataTranslator::chainCache(h2,m2);
+    res.clear();
+    res << "hits " << (h2 - hits) << " misses " << (m2 - misses);
+    testReport("chains-negative",!t1 && !t2 && ((h2 - hits) == 1) && ((m2 - misses) == 1),res);
+
+    // installing a factory must forget everything
+    s_caps[0].src = FormatRepository::getFormat("plain");
+    s_caps[0].dest = FormatRepository::getFormat("raw");
+    TextFactory* factory = new TextFactory;
+    n = DataTranslator::chainCache(hits,misses);
+    t1 = DataTranslator::create("plain","raw");
+    res.clear();
+    res << "entries after install " << n;
+    testReport("chains-install",t1 && !n,res);
+    destroy(t1);
+    delete factory;
+    n = DataTranslator::chainCache(hits,misses);
+    t1 = DataTranslator::create("plain","raw");
+    res.clear();
+    res << "entries after uninstall " << n;
+    testReport("chains-uninstall",!t1 && !n,res);
+
+    // listeners of the same format share the translator of the first one
+    SharedSource* src = new SharedSource;
+    CountingConsumer* cons[4];
+    cons[0] = new CountingConsumer("alaw");
+    cons[1] = new CountingConsumer("alaw");
+    cons[2] = new CountingConsumer("alaw");
+    cons[3] = new CountingConsumer("mulaw");
+    for (int i = 0; i < 4; i++)
+	DataTranslator::attachChain(src,cons[i]);
+    unsigned int chains = 0;
+    n = src->listeners(&chains);
+    DataBlock data(0,320);
+    src->Forward(data);
+    res.clear();
+    res << "listeners " << n << " chains " << chains;
+    testReport("chains-shared",(n == 4) && (chains == 2) && (cons[0]->m_count == 1)
+	&& (cons[2]->m_count == 1) && (cons[3]->m_count == 1),res);
+    DataTranslator::detachChain(src,cons[0]);
+    src->Forward(data);
+    chains = 0;
+    n = src->listeners(&chains);
+    res.clear();
+    res << "listeners " << n << " chains " << chains;
+    testReport("chains-shared-detach",(n == 3) && (chains == 2) && (cons[0]->m_count == 1)
+	&& (cons[1]->m_count == 2),res);
+    for (int i = 1; i < 4; i++)
+	DataTranslator::detachChain(src,cons[i]);
+    chains = 0;
+    n = src->listeners(&chains);
+    res.clear();
+    res << "listeners " << n << " chains " << chains;
+    testReport("chains-shared-release",!n && !chains,res);
+    for (int i = 0; i < 4; i++)
+	TelEngine::destruct(cons[i]);
+    TelEngine::destruct(src);
+
+    u_int64_t t = Time::now();
+    for (int i = 0; i < BENCH_CREATES; i++) {
+	t1 = DataTranslator::create("slin/48000","alaw");
+	destroy(t1);
+    }
+    t = Time::now() - t;
+    if (!t)
+	t = 1;
+    DataTranslator::chainCache(hits,misses);
+    Output("Created %u 'slin/48000' -> 'alaw' chains in %u ms, %u/s, hit rate %u%%",
+	BENCH_CREATES,(unsigned int)(t / 1000),(unsigned int)(BENCH_CREATES * (u_int64_t)1000000 / t),
+	(unsigned int)(hits * 100 / (hits + misses)));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,418 @@
+/**
+ * codecbench.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Standalone codec throughput benchmark
+ *
+ * Usage: codecbench [-f text|csv|json] [-n frames] [-s speech.slin] [yate options] module.yate...
+ *
+ * Loads only the given codec modules, then pushes speech and silence through
+ *  the encoder and decoder of every format the loaded translator factories
+ *  can convert to and from linear PCM. Results go to standard output, logs
+ *  to standard error.
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+using namespace TelEngine;
+
+// Default number of 20ms frames pushed for each measurement
+#define DEF_FRAMES 1500
+
+static String s_output = "text";
+static int s_frames = DEF_FRAMES;
+static String s_speech;
+
+// Allocations are counted only in the thread running the benchmark
+static __thread bool s_countAllocs = false;
+static __thread unsigned long s_allocs = 0;
+
+#ifdef __GLIBC__
+extern "C" {
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size)
+{
+    if (s_countAllocs)
+	s_allocs++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+    if (s_countAllocs)
+	s_allocs++;
+    return __libc_calloc(nmemb,size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    if (s_countAllocs)
+	s_allocs++;
+    return __libc_realloc(ptr,size);
+}
+}; // extern "C"
+#define ALLOCS_COUNTED true
+#else
+#define ALLOCS_COUNTED false
+#endif
+
+// Collects the output of a translator as separate frames
+class BenchSink : public DataConsumer
+{
+public:
+    inline BenchSink(const char* format)
+	: DataConsumer(format), m_keep(false), m_bytes(0)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{
+	    m_bytes += data.length();
+	    if (m_keep && data.length())
+		m_frames.append(new DataBlock(data));
+	    return invalidStamp();
+	}
+    bool m_keep;
+    u_int64_t m_bytes;
+    ObjList m_frames;
+};
+
+class BenchStart : public MessageHandler
+{
+public:
+    inline BenchStart()
+	: MessageHandler("engine.start",150,"codecbench")
+	{ }
+    virtual bool received(Message& msg);
+};
+
+class CodecBench : public Plugin
+{
+public:
+    CodecBench();
+    virtual void initialize();
+    void run();
+private:
+    void signals(int rate);
+    bool measure(const String& codec, int rate, bool encode, const char* signal,
+	const ObjList& input, ObjList* output);
+    void result(const String& codec, int rate, const char* dir, const char* signal,
+	unsigned int frames, u_int64_t usec, unsigned long allocs, u_int64_t bytes);
+    bool m_init;
+    bool m_first;
+    ObjList m_speech;
+    ObjList m_silence;
+};
+
+INIT_PLUGIN(CodecBench);
+
+
+// Split a linear buffer into 20ms frames
+static void frames(ObjList& list, const DataBlock& data, int rate)
+{
+    list.clear();
+    unsigned int len = rate / 50 * sizeof(int16_t);
+    for (unsigned int pos = 0; pos + len <= data.length(); pos += len)
+	list.append(new DataBlock((char*)data.data() + pos,len));
+}
+
+// Synthesize a speech like signal: a gliding pitch pulse train shaped by
+//  two moving formants, with syllable envelope and breathing pauses
+static void speech(DataBlock& data, unsigned int samples, int rate)
+{
+    data.assign(0,samples * sizeof(int16_t));
+    int16_t* s = (int16_t*)data.data();
+    double phase = 1.0;
+    double y1[2] = { 0, 0 };
+    double y2[2] = { 0, 0 };
+    unsigned int seed = 12345;
+    for (unsigned int i = 0; i < samples; i++) {
+	double t = (double)i / rate;
+	double pitch = 120 + 30 * ::sin(2 * M_PI * 0.5 * t);
+	phase += pitch / rate;
+	double x = 0;
+	if (phase >= 1.0) {
+	    phase -= 1.0;
+	    x = 1.0;
+	}
+	seed = seed * 1103515245 + 12345;
+	x += ((int)((seed >> 16) & 0x7fff) - 16384) / 300000.0;
+	double f[2];
+	f[0] = 500 + 250 * ::sin(2 * M_PI * 1.3 * t);
+	f[1] = 1500 + 500 * ::sin(2 * M_PI * 0.7 * t + 1);
+	for (int k = 0; k < 2; k++) {
+	    // two pole resonator with 100Hz bandwidth
+	    double r = ::exp(-M_PI * 100 / rate);
+	    double y = x + 2 * r * ::cos(2 * M_PI * f[k] / rate) * y1[k] - r * r * y2[k];
+	    y2[k] = y1[k];
+	    y1[k] = y;
+	    x = y;
+	}
+	double env = ::sin(2 * M_PI * 2 * t);
+	env = (env > 0) ? ::sqrt(env) : 0;
+	if (::fmod(t,3.0) > 2.4)
+	    env = 0;
+	double v = x * env * 400;
+	s[i] = (int16_t)((v > 30000) ? 30000 : ((v < -30000) ? -30000 : v));
+    }
+}
+
+// Low level noise as seen on a muted microphone
+static void silence(DataBlock& data, unsigned int samples)
+{
+    data.assign(0,samples * sizeof(int16_t));
+    int16_t* s = (int16_t*)data.data();
+    unsigned int seed = 1;
+    for (unsigned int i = 0; i < samples; i++) {
+	seed = seed * 1103515245 + 12345;
+	s[i] = (int16_t)(((seed >> 16) & 7) - 4);
+    }
+}
+
+
+bool BenchStart::received(Message& msg)
+{
+    __plugin.run();
+    Engine::halt(0);
+    return false;
+}
+
+
+CodecBench::CodecBench()
+    : Plugin("codecbench"),
+      m_init(false), m_first(true)
+{
+}
+
+void CodecBench::initialize()
+{
+    if (m_init)
+	return;
+    m_init = true;
+    Engine::install(new BenchStart);
+}
+
+// Prepare the input signals at a sample rate
+void CodecBench::signals(int rate)
+{
+    unsigned int samples = s_frames * (rate / 50);
+    DataBlock data;
+    if (s_speech && (rate == 8000)) {
+	File f;
+	if (f.openPath(s_speech)) {
+	    int64_t len = f.length();
+	    if (len > (int64_t)(samples * sizeof(int16_t)))
+		len = samples * sizeof(int16_t);
+	    data.assign(0,(unsigned int)len);
+	    if (f.readData(data.data(),data.length()) != (int)data.length())
+		data.clear();
+	}
+	if (!data.length())
+	    Debug("codecbench",DebugWarn,"Could not read speech from '%s', using synthetic",
+		s_speech.c_str());
+    }
+    if (!data.length())
+	speech(data,samples,rate);
+    frames(m_speech,data,rate);
+    silence(data,samples);
+    frames(m_silence,data,rate);
+}
+
+// Run one encoder or decoder over a list of frames
+bool CodecBench::measure(const String& codec, int rate, bool encode, const char* signal,
+    const ObjList& input, ObjList* output)
+{
+    String lin("slin");
+    if (rate != 8000)
+	lin << "/" << rate;
+    const String& src = encode ? lin : codec;
+    const String& dst = encode ? codec : lin;
+    DataTranslator* trans = DataTranslator::create(src,dst);
+    if (!trans) {
+	Debug("codecbench",DebugMild,"No translator from '%s' to '%s'",src.c_str(),dst.c_str());
+	return false;
+    }
+    DataTranslator* first = trans->getFirstTranslator();
+    BenchSink* sink = new BenchSink(dst);
+    trans->getTransSource()->attach(sink);
+    unsigned int count = 0;
+    unsigned long stamp = 0;
+    u_int64_t t = 0;
+    // the first pass warms up and keeps the output to feed the decoder
+    for (int pass = 0; pass < 2; pass++) {
+	sink->m_keep = !pass && output;
+	sink->m_bytes = 0;
+	count = 0;
+	s_allocs = 0;
+	t = Time::now();
+	s_countAllocs = (pass != 0);
+	for (ObjList* l = input.skipNull(); l; l = l->skipNext()) {
+	    const DataBlock* d = static_cast<const DataBlock*>(l->get());
+	    first->Consume(*d,stamp,0);
+	    stamp += encode ? (d->length() / sizeof(int16_t)) : (rate / 50);
+	    count++;
+	}
+	s_countAllocs = false;
+	t = Time::now() - t;
+    }
+    bool ok = (0 != sink->m_bytes);
+    if (ok)
+	result(codec,rate,encode ? "encode" : "decode",signal,count,t,s_allocs,sink->m_bytes);
+    else
+	Debug("codecbench",DebugMild,"Translator from '%s' to '%s' produced no data",
+	    src.c_str(),dst.c_str());
+    if (ok && output) {
+	while (GenObject* o = sink->m_frames.remove(false))
+	    output->append(o);
+    }
+    TelEngine::destruct(first);
+    TelEngine::destruct(sink);
+    return ok;
+}
+
+void CodecBench::result(const String& codec, int rate, const char* dir, const char* signal,
+    unsigned int frames, u_int64_t usec, unsigned long allocs, u_int64_t bytes)
+{
+    if (!usec)
+	usec = 1;
+    unsigned int fps = (unsigned int)(frames * (u_int64_t)1000000 / usec);
+    unsigned int nsec = frames ? (unsigned int)(usec * 1000 / frames) : 0;
+    char apf[32];
+    if (ALLOCS_COUNTED && frames)
+	::snprintf(apf,sizeof(apf),"%.2f",(double)allocs / frames);
+    else
+	::strcpy(apf,(s_output == YSTRING("json")) ? "null" : "-");
+    if (s_output == YSTRING("json"))
+	::printf("%s\n  {\"codec\":\"%s\",\"rate\":%d,\"direction\":\"%s\",\"signal\":\"%s\","
+	    "\"frames\":%u,\"frames_per_sec\":%u,\"ns_per_frame\":%u,\"allocs_per_frame\":%s,"
+	    "\"bytes_out\":%u}",(m_first ? "[" : ","),codec.c_str(),rate,dir,signal,
+	    frames,fps,nsec,apf,(unsigned int)bytes);
+    else if (s_output == YSTRING("csv")) {
+	if (m_first)
+	    ::printf("codec,rate,direction,signal,frames,frames_per_sec,ns_per_frame,allocs_per_frame,bytes_out\n");
+	::printf("%s,%d,%s,%s,%u,%u,%u,%s,%u\n",codec.c_str(),rate,dir,signal,
+	    frames,fps,nsec,apf,(unsigned int)bytes);
+    }
+    else {
+	if (m_first)
+	    ::printf("%-12s %6s %-7s %-8s %7s %10s %10s %8s\n","codec","rate","dir",
+		"signal","frames","frames/s","ns/frame","allocs");
+	::printf("%-12s %6d %-7s %-8s %7u %10u %10u %8s\n",codec.c_str(),rate,dir,
+	    signal,frames,fps,nsec,apf);
+    }
+    m_first = false;
+}
+
+void CodecBench::run()
+{
+    // every mono audio format one translator away from linear PCM
+    static const char* s_linear[] = { "slin", "slin/16000", "slin/32000", "slin/48000", 0 };
+    for (const char** lin = s_linear; *lin; lin++) {
+	const FormatInfo* li = FormatRepository::getFormat(*lin);
+	if (!li)
+	    continue;
+	ObjList* formats = DataTranslator::destFormats(*lin,-1,1);
+	bool prepared = false;
+	for (ObjList* l = formats ? formats->skipNull() : 0; l; l = l->skipNext()) {
+	    const String& codec = l->get()->toString();
+	    const FormatInfo* fi = FormatRepository::getFormat(codec);
+	    if (!fi || fi->converter || (fi->numChannels != 1) || (fi->sampleRate != li->sampleRate)
+		|| ::strcmp(fi->type,"audio") || codec.startsWith("slin"))
+		continue;
+	    if (!prepared) {
+		signals(li->sampleRate);
+		prepared = true;
+	    }
+	    ObjList encoded;
+	    if (measure(codec,li->sampleRate,true,"speech",m_speech,&encoded))
+		measure(codec,li->sampleRate,false,"speech",encoded,0);
+	    encoded.clear();
+	    if (measure(codec,li->sampleRate,true,"silence",m_silence,&encoded))
+		measure(codec,li->sampleRate,false,"silence",encoded,0);
+	}
+	TelEngine::destruct(formats);
+    }
+    if (s_output == YSTRING("json"))
+	::printf(m_first ? "[]\n" : "\n]\n");
+    if (m_first)
+	Debug("codecbench",DebugWarn,"No codec found to benchmark");
+    ::fflush(stdout);
+}
+
+
+static void usage(const char* name)
+{
+    ::fprintf(stderr,
+	"Usage: %s [-f text|csv|json] [-n frames] [-s speech.slin] [yate options] module.yate...\n"
+	"   -f format      Output format, default text\n"
+	"   -n frames      Number of 20ms frames for each measurement (%d)\n"
+	"   -s filename    Raw 8kHz signed linear speech recording to use\n"
+	"Load only one implementation of a codec to measure it\n",name,DEF_FRAMES);
+}
+
+extern "C" int main(int argc, const char** argv, const char** envp)
+{
+    // module files become -m and -x, options we don't know go to the engine
+    const char** args = new const char*[2 * argc + 1];
+    ObjList paths;
+    int n = 0;
+    args[n++] = argv[0];
+    for (int i = 1; i < argc; i++) {
+	String arg(argv[i]);
+	if ((arg == YSTRING("-f")) && (i + 1 < argc))
+	    s_output = argv[++i];
+	else if ((arg == YSTRING("-n")) && (i + 1 < argc))
+	    s_frames = String(argv[++i]).toInteger(DEF_FRAMES,0,50,1000000);
+	else if ((arg == YSTRING("-s")) && (i + 1 < argc))
+	    s_speech = argv[++i];
+	else if ((arg == YSTRING("-h")) || (arg == YSTRING("--help"))) {
+	    usage(argv[0]);
+	    return 0;
+	}
+	else if (arg.endsWith(".yate") && !arg.startsWith("-")) {
+	    // the engine resolves relative extra paths against the first one
+	    char* full = ::realpath(arg,0);
+	    String* path = new String(full ? full : arg.c_str());
+	    ::free(full);
+	    paths.append(path);
+	    args[n++] = (paths.count() == 1) ? "-m" : "-x";
+	    args[n++] = path->c_str();
+	}
+	else
+	    args[n++] = argv[i];
+    }
+    args[n] = 0;
+    if (!paths.count()) {
+	usage(argv[0]);
+	return 1;
+    }
+    if ((s_output != YSTRING("text")) && (s_output != YSTRING("csv")) && (s_output != YSTRING("json"))) {
+	usage(argv[0]);
+	return 1;
+    }
+    int ret = Engine::main(n,args,envp);
+    delete[] args;
+    return ret;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
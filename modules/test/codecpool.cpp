@@ -0,0 +1,149 @@
+/**
+ * codecpool.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Codec state pool test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+#include "testcase.h"
+
+using namespace TelEngine;
+
+static int s_states = 0;
+
+class PoolTestState : public DataCodecState
+{
+public:
+    inline PoolTestState(const char* kind, bool resettable = true)
+	: DataCodecState(kind), m_resets(0), m_resettable(resettable)
+	{ s_states++; }
+    virtual ~PoolTestState()
+	{ s_states--; }
+    virtual bool reset()
+	{ m_resets++; return m_resettable; }
+    int m_resets;
+    bool m_resettable;
+};
+
+class TestCodecPool : public Plugin
+{
+public:
+    TestCodecPool();
+    virtual void initialize();
+    void run();
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestCodecPool);
+
+
+TestCodecPool::TestCodecPool()
+    : Plugin("testcodecpool"),
+      m_init(false)
+{
+    Output("Hello, I am module TestCodecPool");
+}
+
+// Extract the number of reused states of a pool from the engine status
+static int reused(const String& stats, const char* name)
+{
+    String key;
+    key << name << "=";
+    int pos = stats.find(key);
+    if (pos < 0)
+	return -1;
+    ObjList* l = stats.substr(pos + key.length()).split('|');
+    int val = -1;
+    if (l->count() >= 3)
+	val = static_cast<String*>((*l)[2])->toInteger();
+    TelEngine::destruct(l);
+    return val;
+}
+
+void TestCodecPool::run()
+{
+    DataCodecPool* pool = new DataCodecPool("testpool",2);
+
+    // a state given back comes out reset for the same kind only
+    PoolTestState* s1 = new PoolTestState("enc");
+    pool->put(s1);
+    DataCodecState* other = pool->get("dec");
+    DataCodecState* same = pool->get("enc");
+    String res;
+    pool->status(res);
+    testReport("codecpool-reuse",!other && (same == s1) && (s1->m_resets == 1),res);
+    pool->put(same);
+
+    // no more than the limit are kept idle, a failed reset drops the state
+    pool->put(new PoolTestState("enc"));
+    pool->put(new PoolTestState("enc"));
+    pool->put(new PoolTestState("dec",false));
+    res.clear();
+    pool->status(res);
+    testReport("codecpool-limit",(s_states == 2) && (res == "testpool=2|2|1|1|2"),res);
+
+    // the pools are listed in the engine status
+    Message m("engine.status");
+    m.addParam("module","codecs");
+    Engine::dispatch(m);
+    testReport("codecpool-status",m.retValue().find("testpool=2|2|") >= 0,m.retValue().trimBlanks());
+
+    pool->limit(1);
+    res.clear();
+    pool->status(res);
+    bool ok = (s_states == 1);
+    TelEngine::destruct(pool);
+    testReport("codecpool-shrink",ok && !s_states,res);
+
+    // a translator created after another one was destroyed reuses its state
+    DataTranslator* trans = DataTranslator::create("slin","ilbc20");
+    if (!trans) {
+	Output("No iLBC codec loaded, skipping codecpool-translator");
+	return;
+    }
+    TelEngine::destruct(trans);
+    m.retValue().clear();
+    Engine::dispatch(m);
+    String before = m.retValue();
+    trans = DataTranslator::create("slin","ilbc20");
+    TelEngine::destruct(trans);
+    m.retValue().clear();
+    Engine::dispatch(m);
+    int b = reused(before,"ilbcwebrtc");
+    int a = reused(m.retValue(),"ilbcwebrtc");
+    if (b < 0) {
+	b = reused(before,"ilbc");
+	a = reused(m.retValue(),"ilbc");
+    }
+    res.clear();
+    res << "reused " << b << " -> " << a;
+    testReport("codecpool-translator",(b >= 0) && (a == b + 1),res);
+}
+
+void TestCodecPool::initialize()
+{
+    Output("Initializing module TestCodecPool");
+    if (m_init)
+	return;
+    m_init = true;
+    // codec modules must be loaded before we create translators
+    Engine::install(new TestStart<TestCodecPool>(this));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
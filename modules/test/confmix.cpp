@@ -0,0 +1,337 @@
+/**
+ * confmix.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Conference mixer test and benchmark
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+#include "testcase.h"
+
+using namespace TelEngine;
+
+// 20ms of slin at 8kHz
+#define FRAME_SAMPLES 160
+// Number of frames each party sends in a benchmark
+#define BENCH_FRAMES 50
+
+class ConfTestSink : public DataConsumer
+{
+public:
+    inline ConfTestSink(const char* format = "slin")
+	: DataConsumer(format), m_samples(0), m_last(0)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{
+	    if (getFormat() != YSTRING("slin")) {
+		// keep the encoded octet, count its samples
+		if (data.length()) {
+		    m_last = ((const unsigned char*)data.data())[data.length() / 2];
+		    m_samples += data.length();
+		}
+		return invalidStamp();
+	    }
+	    unsigned int n = data.length() / 2;
+	    if (n) {
+		m_last = ((const int16_t*)data.data())[n / 2];
+		m_samples += n;
+	    }
+	    return invalidStamp();
+	}
+    volatile unsigned int m_samples;
+    volatile int m_last;
+};
+
+class ConfTestParty : public CallEndpoint
+{
+public:
+    ConfTestParty(int level, bool noise = false, const char* format = "slin");
+    bool join(const String& room, const NamedList& params);
+    void send();
+    inline ConfTestSink* sink() const
+	{ return m_sink; }
+private:
+    RefPointer<DataSource> m_source;
+    RefPointer<ConfTestSink> m_sink;
+    DataBlock m_frame;
+    unsigned int m_seed;
+    int m_level;
+    bool m_noise;
+};
+
+class TestConfMix : public Plugin
+{
+public:
+    TestConfMix();
+    virtual void initialize();
+    void run();
+    bool createRoom(ObjList& parties, const String& room, const NamedList& params);
+    void sendRounds(ObjList& parties, int rounds, bool realTime = false);
+    void bench(int count, int mixers);
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestConfMix);
+
+
+ConfTestParty::ConfTestParty(int level, bool noise, const char* format)
+    : m_frame(0,FRAME_SAMPLES * 2), m_seed(level), m_level(level), m_noise(noise)
+{
+    m_source = new DataSource;
+    m_source->deref();
+    m_sink = new ConfTestSink(format);
+    m_sink->deref();
+    setSource(m_source);
+    setConsumer(m_sink);
+}
+
+// Connect to a conference room as if we were a call leg
+bool ConfTestParty::join(const String& room, const NamedList& params)
+{
+    Message m("call.execute");
+    m.copyParams(params);
+    m.setParam("callto","conf/" + room);
+    m.userData(this);
+    return Engine::dispatch(m);
+}
+
+// Send one frame of either constant level or noise of that amplitude
+void ConfTestParty::send()
+{
+    int16_t* s = (int16_t*)m_frame.data();
+    for (int i = 0; i < FRAME_SAMPLES; i++) {
+	if (m_noise) {
+	    m_seed = m_seed * 1103515245 + 12345;
+	    s[i] = (int16_t)((int)((m_seed >> 16) & 0x7fff) % (2 * m_level + 1) - m_level);
+	}
+	else
+	    s[i] = m_level;
+    }
+    m_source->Forward(m_frame);
+}
+
+
+TestConfMix::TestConfMix()
+    : Plugin("testconfmix"),
+      m_init(false)
+{
+    Output("Hello, I am module TestConfMix");
+}
+
+bool TestConfMix::createRoom(ObjList& parties, const String& room, const NamedList& params)
+{
+    for (ObjList* l = parties.skipNull(); l; l = l->skipNext()) {
+	if (!static_cast<ConfTestParty*>(l->get())->join(room,params))
+	    return false;
+    }
+    return true;
+}
+
+void TestConfMix::sendRounds(ObjList& parties, int rounds, bool realTime)
+{
+    u_int64_t next = Time::now();
+    for (int i = 0; i < rounds; i++) {
+	for (ObjList* l = parties.skipNull(); l; l = l->skipNext())
+	    static_cast<ConfTestParty*>(l->get())->send();
+	if (!realTime)
+	    continue;
+	next += 20000;
+	u_int64_t now = Time::now();
+	if (now < next)
+	    Thread::usleep(next - now);
+    }
+}
+
+// Extract one numeric value from a room status string
+static unsigned int statValue(const String& stats, const char* name)
+{
+    String key;
+    key << "," << name << "=";
+    int pos = stats.find(key);
+    if (pos < 0)
+	return 0;
+    pos += key.length();
+    int end = stats.find(',',pos);
+    if (end < 0)
+	end = stats.find('\r',pos);
+    return stats.substr(pos,end - pos).toInteger();
+}
+
+// Hang up all parties, the conference legs and the room go away with them
+static void hangup(ObjList& parties)
+{
+    for (ObjList* l = parties.skipNull(); l; l = l->skipNext())
+	static_cast<ConfTestParty*>(l->get())->disconnect("done");
+    parties.clear();
+}
+
+// Measure the mixer clock cost in a room of that many talking parties
+void TestConfMix::bench(int count, int mixers)
+{
+    String room;
+    room << "confmix-bench-" << count << "-" << mixers;
+    NamedList params("");
+    params.addParam("lonely","true");
+    params.addParam("mixers",String(mixers));
+    params.addParam("clock","true");
+    params.addParam("maxusers",String(count));
+    ObjList parties;
+    for (int i = 0; i < count; i++)
+	parties.append(new ConfTestParty(1000 + (i % 16) * 100,true));
+    if (!createRoom(parties,room,params)) {
+	testReport("confmix-bench",false,"cannot create room " + room);
+	hangup(parties);
+	return;
+    }
+    sendRounds(parties,BENCH_FRAMES,true);
+    Message m("engine.status");
+    m.addParam("module","conf/" + room);
+    Engine::dispatch(m);
+    hangup(parties);
+    unsigned int mixes = statValue(m.retValue(),"mixes");
+    unsigned int usec = statValue(m.retValue(),"mixtime");
+    Output("Conference of %d parties mixing %s: %u mixes, %u usec per 20ms tick (%u.%02u%% of a CPU)",
+	count,(mixers ? String(mixers).c_str() : "all"),mixes,usec,
+	usec / 200,(usec / 2) % 100);
+}
+
+void TestConfMix::run()
+{
+    NamedList params("");
+    params.addParam("lonely","true");
+    params.addParam("clock","false");
+
+    // a talker must not hear itself, everybody else hears it
+    ObjList parties;
+    ConfTestParty* talker = new ConfTestParty(1000);
+    ConfTestParty* quiet = new ConfTestParty(0);
+    parties.append(talker);
+    parties.append(quiet);
+    parties.append(new ConfTestParty(0));
+    bool ok = createRoom(parties,"confmix-minus",params);
+    if (ok)
+	sendRounds(parties,10);
+    String res;
+    res << "talker hears " << talker->sink()->m_last << ", listener hears " << quiet->sink()->m_last;
+    testReport("confmix-minus",ok && talker->sink()->m_samples
+	&& (talker->sink()->m_last == 0) && (quiet->sink()->m_last == 1000),res);
+    hangup(parties);
+
+    // only the loudest channels get mixed, the others hear the common mix
+    params.setParam("mixers","3");
+    for (int i = 1; i <= 6; i++)
+	parties.append(new ConfTestParty(100 * i));
+    quiet = new ConfTestParty(0);
+    parties.append(quiet);
+    ConfTestParty* low = static_cast<ConfTestParty*>(parties[0]);
+    ConfTestParty* high = static_cast<ConfTestParty*>(parties[5]);
+    ok = createRoom(parties,"confmix-top",params);
+    if (ok)
+	sendRounds(parties,10);
+    res.clear();
+    res << "listener " << quiet->sink()->m_last << " lowest " << low->sink()->m_last
+	<< " highest " << high->sink()->m_last;
+    testReport("confmix-top",ok && (quiet->sink()->m_last == 1500)
+	&& (low->sink()->m_last == 1500) && (high->sink()->m_last == 900),res);
+    hangup(parties);
+
+    // the mixer clock thread must deliver the mix on its own
+    params.clearParam("mixers");
+    params.setParam("clock","true");
+    talker = new ConfTestParty(1000);
+    quiet = new ConfTestParty(0);
+    parties.append(talker);
+    parties.append(quiet);
+    ok = createRoom(parties,"confmix-clock",params);
+    if (ok) {
+	sendRounds(parties,10,true);
+	Thread::msleep(100);
+    }
+    res.clear();
+    res << "listener got " << quiet->sink()->m_samples << " samples, hears " << quiet->sink()->m_last;
+    testReport("confmix-clock",ok && (quiet->sink()->m_samples >= 8 * FRAME_SAMPLES)
+	&& (quiet->sink()->m_last == 1000),res);
+    hangup(parties);
+
+    // listeners of one format share the encoder of the common mix
+    params.setParam("clock","false");
+    params.setParam("maxusers","50");
+    talker = new ConfTestParty(1000);
+    parties.append(talker);
+    ConfTestParty* alaw = 0;
+    ConfTestParty* mulaw = 0;
+    for (int i = 0; i < 20; i++) {
+	alaw = new ConfTestParty(0,false,"alaw");
+	parties.append(alaw);
+	mulaw = new ConfTestParty(0,false,"mulaw");
+	parties.append(mulaw);
+    }
+    ok = createRoom(parties,"confmix-encode",params);
+    if (ok)
+	sendRounds(parties,10);
+    Message m("engine.status");
+    m.addParam("module","conf/confmix-encode");
+    Engine::dispatch(m);
+    DataBlock slin(0,2), enc;
+    *(int16_t*)slin.data() = 1000;
+    enc.convert(slin,"slin","alaw");
+    int aval = enc.at(0);
+    enc.convert(slin,"slin","mulaw");
+    int uval = enc.at(0);
+    res.clear();
+    res << "encoders " << statValue(m.retValue(),"encoders") << " listeners "
+	<< statValue(m.retValue(),"listeners") << " alaw " << alaw->sink()->m_last
+	<< " mulaw " << mulaw->sink()->m_last;
+    testReport("confmix-encode",ok && (statValue(m.retValue(),"encoders") == 2)
+	&& (statValue(m.retValue(),"listeners") == 41)
+	&& (alaw->sink()->m_last == aval) && (mulaw->sink()->m_last == uval),res);
+    hangup(parties);
+
+    // a talker hears the mix without its own voice from an encoder of its own
+    talker = new ConfTestParty(1000,false,"alaw");
+    parties.append(talker);
+    parties.append(new ConfTestParty(500));
+    ok = createRoom(parties,"confmix-own",params);
+    if (ok)
+	sendRounds(parties,10);
+    *(int16_t*)slin.data() = 500;
+    enc.convert(slin,"slin","alaw");
+    res.clear();
+    res << "talker " << talker->sink()->m_last << " expected " << (int)enc.at(0);
+    testReport("confmix-own",ok && (talker->sink()->m_last == enc.at(0)),res);
+    hangup(parties);
+
+    bench(10,8);
+    bench(10,0);
+    bench(100,8);
+    bench(100,0);
+    bench(1000,8);
+    bench(1000,0);
+}
+
+void TestConfMix::initialize()
+{
+    Output("Initializing module TestConfMix");
+    if (m_init)
+	return;
+    m_init = true;
+    // the conference module must be initialized before we use it
+    Engine::install(new TestStart<TestConfMix>(this));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
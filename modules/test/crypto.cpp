@@ -75,6 +75,19 @@ void TestCrypto::initialize()
     report("sha1-hmac-1",sha1.hexDigest(),"fbdb1d1b18aa6c08324b7d64b71fb76370690e1d");
     sha1.hmac("key","The quick brown fox jumps over the lazy dog");
     report("sha1-hmac-2",sha1.hexDigest(),"de7c9b85b8b78aa6bc8a7a36f70a90701c9db4d9");
+    unsigned char ipad[64], opad[64];
+    for (unsigned int i = 0; i < 64; i++) {
+	unsigned char c = (i < 3) ? "key"[i] : 0;
+	ipad[i] = c ^ 0x36;
+	opad[i] = c ^ 0x5c;
+    }
+    SHA1 shaIpad(ipad,sizeof(ipad));
+    SHA1 shaOpad(opad,sizeof(opad));
+    unsigned char digest[20];
+    String hmac3;
+    if (SHA1::hmacDigest(digest,shaIpad,shaOpad,"The quick brown fox ",20,"jumps over the lazy dog",23))
+	hmac3.hexify(digest,sizeof(digest));
+    report("sha1-hmac-3",hmac3,"de7c9b85b8b78aa6bc8a7a36f70a90701c9db4d9");
 
     SHA256 sha256("");
     report("sha256-1",sha256.hexDigest(),"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
@@ -0,0 +1,246 @@
+/**
+ * dejitter.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * RTP dejitter buffer simulator test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+#include <yatertp.h>
+#include "testcase.h"
+
+using namespace TelEngine;
+
+// One way network delays in msec of 20 msec G.711 packets, recorded on a
+//  local network and over a congested WAN link
+static const unsigned char s_lan[] = {
+    12,10,10,10,12,10,13,13,10,13,11,11,11,13,13,10,13,11,12,12,
+    11,10,10,10,10,12,10,12,11,12,12,10,11,12,13,11,13,10,13,10,
+    13,10,10,12,10,11,10,10,10,10,12,11,10,12,10,11,10,12,12,12,
+    13,12,12,13,10,13,13,12,12,10,13,13,13,12,11,12,10,11,12,13,
+    10,10,13,11,11,13,12,10,13,11,11,10,11,12,11,11,10,10,12,13,
+    11,10,13,12,12,12,11,11,12,12,11,10,13,13,13,11,12,10,13,12,
+    13,12,12,10,10,11,13,12,13,13,12,10,11,13,11,12,11,11,12,11,
+    13,12,10,10,10,13,13,13,13,10,12,10,13,13,12,12,12,12,11,12,
+    11,11,10,10,11,13,13,11,12,12,11,11,10,13,10,13,11,12,10,10,
+    13,12,12,10,13,12,10,11,10,12,12,10,10,11,12,10,13,10,13,13
+};
+
+static const unsigned char s_wan[] = {
+    49,46,22,47,61,46,44,28,57,57,41,40,29,62,49,42,55,47,34,33,
+    51,93,40,36,29,117,55,36,36,43,50,42,54,20,20,60,49,38,45,33,
+    25,48,53,44,47,34,42,24,51,44,62,53,20,38,25,46,34,59,35,34,
+    44,44,24,29,38,38,36,46,35,32,43,42,41,43,35,45,49,23,38,42,
+    45,40,33,40,62,51,30,51,51,38,48,29,43,48,20,30,28,40,44,31,
+    20,34,53,42,40,59,45,44,31,44,38,38,53,146,32,108,24,29,38,40,
+    39,29,38,71,52,25,96,42,20,20,31,50,110,50,36,55,47,47,57,28,
+    43,20,30,32,57,63,39,43,25,45,21,47,42,26,33,60,46,57,47,40,
+    24,20,44,61,20,44,42,31,39,37,27,62,28,38,50,23,29,62,32,26,
+    50,46,47,31,37,40,41,41,34,58,44,44,32,34,52,26,59,40,126,55
+};
+
+#define MAX_PACKETS 1024
+
+// Simulated packet arrival
+struct SimPacket
+{
+    u_int64_t arrival;
+    unsigned int timestamp;
+    bool marker;
+};
+
+// Result of one simulation run
+struct SimResult
+{
+    unsigned int sent;
+    unsigned int played;
+    unsigned int maxDelay;
+    bool ordered;
+};
+
+class SimReceiver : public RTPReceiver
+{
+public:
+    inline SimReceiver()
+	: m_played(0), m_last(0), m_ordered(true)
+	{ }
+    virtual bool rtpRecv(bool marker, int payload, unsigned int timestamp,
+	const void* data, int len)
+	{
+	    if (m_played && ((int)(timestamp - m_last)) <= 0)
+		m_ordered = false;
+	    m_last = timestamp;
+	    m_played++;
+	    return true;
+	}
+    unsigned int m_played;
+    unsigned int m_last;
+    bool m_ordered;
+};
+
+class SimDejitter : public RTPDejitter
+{
+public:
+    inline SimDejitter(RTPReceiver* receiver, unsigned int mindelay, unsigned int maxdelay)
+	: RTPDejitter(receiver,mindelay,maxdelay)
+	{ }
+    inline void tick(u_int64_t when)
+	{ timerTick(Time(when)); }
+};
+
+// Builds a simulated stream out of trace segments separated by silence
+class SimStream
+{
+public:
+    inline SimStream()
+	: m_count(0), m_sendTime(1000000), m_timestamp(1000)
+	{ }
+    void add(const unsigned char* trace, unsigned int len, unsigned int silence = 0);
+    void run(SimDejitter& dejitter, SimReceiver& receiver, SimResult& result);
+private:
+    SimPacket m_packets[MAX_PACKETS];
+    unsigned int m_count;
+    u_int64_t m_sendTime;
+    unsigned int m_timestamp;
+};
+
+class TestDejitter : public Plugin
+{
+public:
+    TestDejitter();
+    virtual void initialize();
+};
+
+
+void SimStream::add(const unsigned char* trace, unsigned int len, unsigned int silence)
+{
+    m_sendTime += 1000 * silence;
+    m_timestamp += 8 * silence;
+    for (unsigned int i = 0; i < len && m_count < MAX_PACKETS; i++) {
+	SimPacket p;
+	p.arrival = m_sendTime + 1000 * trace[i];
+	p.timestamp = m_timestamp;
+	p.marker = !i;
+	m_sendTime += 20000;
+	m_timestamp += 160;
+	// keep the packets sorted by arrival time, this creates reordering
+	unsigned int j = m_count++;
+	for (; j && m_packets[j - 1].arrival > p.arrival; j--)
+	    m_packets[j] = m_packets[j - 1];
+	m_packets[j] = p;
+    }
+}
+
+void SimStream::run(SimDejitter& dejitter, SimReceiver& receiver, SimResult& result)
+{
+    result.sent = m_count;
+    result.maxDelay = 0;
+    if (!m_count)
+	return;
+    static const unsigned char payload[160] = { 0 };
+    unsigned int idx = 0;
+    u_int64_t end = m_packets[m_count - 1].arrival + 1000000;
+    // the dejitter is serviced every msec like by a RTPGroup
+    for (u_int64_t now = m_packets[0].arrival; now < end; now += 1000) {
+	for (; idx < m_count && m_packets[idx].arrival <= now; idx++) {
+	    const SimPacket& p = m_packets[idx];
+	    dejitter.rtpRecv(p.marker,0,p.timestamp,payload,sizeof(payload),p.arrival);
+	}
+	dejitter.tick(now);
+	if (result.maxDelay < dejitter.delay())
+	    result.maxDelay = dejitter.delay();
+    }
+    result.played = receiver.m_played;
+    result.ordered = receiver.m_ordered;
+}
+
+
+TestDejitter::TestDejitter()
+    : Plugin("testdejitter")
+{
+    Output("Hello, I am module TestDejitter");
+}
+
+static void simulate(SimStream& stream, SimResult& result, NamedList& stats,
+    bool adaptive, unsigned int mindelay = 20000, unsigned int maxdelay = 200000)
+{
+    SimReceiver receiver;
+    SimDejitter* dejitter = new SimDejitter(&receiver,mindelay,maxdelay);
+    if (adaptive)
+	dejitter->adaptive(true,8000);
+    stream.run(*dejitter,receiver,result);
+    dejitter->stats(stats);
+    TelEngine::destruct(dejitter);
+}
+
+void TestDejitter::initialize()
+{
+    Output("Initializing module TestDejitter");
+
+    SimResult res, ref;
+    NamedList stats(""), refStats("");
+
+    SimStream lan;
+    lan.add(s_lan,sizeof(s_lan));
+    simulate(lan,res,stats,true);
+    String str;
+    str << "played " << res.played << " of " << res.sent << ", delay " << res.maxDelay << " usec";
+    testReport("dejitter-lan",res.ordered && (res.played == res.sent) && (res.maxDelay == 20000),str);
+
+    SimStream wan;
+    wan.add(s_wan,sizeof(s_wan));
+    simulate(wan,ref,refStats,false);
+    simulate(wan,res,stats,true);
+    unsigned int late = stats.getIntValue(YSTRING("latepkts"));
+    unsigned int refLate = refStats.getIntValue(YSTRING("latepkts"));
+    str.clear();
+    str << "adaptive late " << late << ", fixed late " << refLate << " of " << res.sent
+	<< ", delay " << res.maxDelay << " usec";
+    testReport("dejitter-wan",res.ordered && (late < refLate) && (late * 100 <= res.sent * 5),str);
+    unsigned int dropped = stats.getIntValue(YSTRING("droppedpkts"));
+    str.clear();
+    str << "played " << res.played << " late " << late << " dropped " << dropped
+	<< " concealed " << stats.getValue(YSTRING("concealedpkts"))
+	<< " jitter " << stats.getValue(YSTRING("jitter")) << " ms";
+    testReport("dejitter-counters",(res.played + late + dropped) == res.sent,str);
+
+    // WAN talkspurt followed by LAN talkspurts, delay must shrink in silence
+    SimStream spurts;
+    spurts.add(s_wan,sizeof(s_wan));
+    spurts.add(s_lan,sizeof(s_lan),1000);
+    spurts.add(s_lan,sizeof(s_lan),1000);
+    simulate(spurts,res,stats,true);
+    unsigned int delay = 1000 * stats.getIntValue(YSTRING("playdelay"));
+    str.clear();
+    str << "delay " << delay << " usec after silence, " << res.maxDelay << " usec during WAN talkspurt";
+    testReport("dejitter-compress",res.ordered && (delay < res.maxDelay),str);
+
+    // LAN talkspurt followed by WAN talkspurt, delay must grow
+    SimStream grow;
+    grow.add(s_lan,sizeof(s_lan));
+    grow.add(s_wan,sizeof(s_wan),500);
+    grow.add(s_wan,sizeof(s_wan),500);
+    simulate(grow,res,stats,true);
+    delay = 1000 * stats.getIntValue(YSTRING("playdelay"));
+    str.clear();
+    str << "delay " << delay << " usec after WAN talkspurts";
+    testReport("dejitter-expand",res.ordered && (delay > 20000) && (delay <= 200000),str);
+}
+
+INIT_PLUGIN(TestDejitter);
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,368 @@
+/**
+ * fft.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Fast Fourier transform and vector kernels test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * Reference FFT routine taken from Murphy McCauley's FFT DLL based in turn
+ *  on the work of Don Cross <dcross@intersrv.com>, it was used by the
+ *  analyzer module before the engine provided one
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+#include <yatemath.h>
+#include "testcase.h"
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+using namespace TelEngine;
+
+// The radix-2 transform the analyzer used, in double precision
+class OldFFT
+{
+public:
+    OldFFT(unsigned int length);
+    ~OldFFT();
+    void compute(const Complex* input);
+    double* m_real;
+    double* m_imag;
+private:
+    unsigned int revBits(unsigned int index) const;
+    unsigned int m_length;
+    unsigned int m_nBits;
+};
+
+class TestFFT : public Plugin
+{
+public:
+    TestFFT();
+    virtual void initialize();
+    void run();
+    void bench(unsigned int length);
+    void benchKernels(unsigned int length);
+    void checkKernels(bool avx);
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestFFT);
+
+
+OldFFT::OldFFT(unsigned int length)
+    : m_length(length), m_nBits(0)
+{
+    while ((1U << m_nBits) < length)
+	m_nBits++;
+    m_real = new double[length];
+    m_imag = new double[length];
+}
+
+OldFFT::~OldFFT()
+{
+    delete[] m_real;
+    delete[] m_imag;
+}
+
+unsigned int OldFFT::revBits(unsigned int index) const
+{
+    unsigned int i, rev;
+    for (i = rev = 0; i < m_nBits; i++) {
+	rev = (rev << 1) | (index & 1);
+	index >>= 1;
+    }
+    return rev;
+}
+
+void OldFFT::compute(const Complex* input)
+{
+    unsigned int i, j, n;
+    for (i = 0; i < m_length; i++) {
+	j = revBits(i);
+	m_real[i] = input[j].re();
+	m_imag[i] = input[j].im();
+    }
+    unsigned int blockEnd = 1;
+    for (unsigned int blockSize = 2; blockSize <= m_length; blockSize <<= 1) {
+	double delta_angle = 2 * M_PI / blockSize;
+	double sm1 = ::sin(-delta_angle);
+	double sm2 = ::sin(-2 * delta_angle);
+	double cm1 = ::cos(-delta_angle);
+	double cm2 = ::cos(-2 * delta_angle);
+	double w = 2 * cm1;
+	double ar[3], ai[3];
+	for (i = 0; i < m_length; i += blockSize) {
+	    ar[1] = cm1;
+	    ai[1] = sm1;
+	    ar[2] = cm2;
+	    ai[2] = sm2;
+	    for (j = i, n = 0; n < blockEnd; j++, n++) {
+		ar[0] = w*ar[1] - ar[2];
+		ar[2] = ar[1];
+		ar[1] = ar[0];
+		ai[0] = w*ai[1] - ai[2];
+		ai[2] = ai[1];
+		ai[1] = ai[0];
+		unsigned int k = j + blockEnd;
+		double tr = ar[0]*m_real[k] - ai[0]*m_imag[k];
+		double ti = ar[0]*m_imag[k] + ai[0]*m_real[k];
+		m_real[k] = m_real[j] - tr;
+		m_imag[k] = m_imag[j] - ti;
+		m_real[j] += tr;
+		m_imag[j] += ti;
+	    }
+	}
+	blockEnd = blockSize;
+    }
+}
+
+
+// Fill a buffer with repeatable pseudo random values in [-1,1)
+static void random(Complex* data, unsigned int len, unsigned int seed = 1)
+{
+    for (unsigned int i = 0; i < len; i++) {
+	seed = seed * 1103515245 + 12345;
+	float re = ((seed >> 8) & 0xffff) / 32768.0f - 1;
+	seed = seed * 1103515245 + 12345;
+	float im = ((seed >> 8) & 0xffff) / 32768.0f - 1;
+	data[i].set(re,im);
+    }
+}
+
+// Largest difference between a transform and a direct DFT in double
+static double dftError(const Complex* input, const Complex* output, unsigned int len)
+{
+    double err = 0;
+    for (unsigned int k = 0; k < len; k++) {
+	double re = 0, im = 0;
+	for (unsigned int n = 0; n < len; n++) {
+	    double a = -2 * M_PI * (double)((k * n) % len) / len;
+	    double c = ::cos(a), s = ::sin(a);
+	    re += input[n].re() * c - input[n].im() * s;
+	    im += input[n].re() * s + input[n].im() * c;
+	}
+	double d = ::hypot(re - output[k].re(),im - output[k].im());
+	if (err < d)
+	    err = d;
+    }
+    return err;
+}
+
+
+TestFFT::TestFFT()
+    : Plugin("testfft"),
+      m_init(false)
+{
+    Output("Hello, I am module TestFFT");
+}
+
+// Time the old and new transform of one length
+void TestFFT::bench(unsigned int length)
+{
+    unsigned int loops = 4000000 / length;
+    Complex* input = new Complex[length];
+    Complex* data = new Complex[length];
+    random(input,length);
+    OldFFT old(length);
+    u_int64_t t = Time::now();
+    for (unsigned int i = 0; i < loops; i++)
+	old.compute(input);
+    u_int64_t tOld = Time::now() - t;
+    FFT fft(length);
+    t = Time::now();
+    for (unsigned int i = 0; i < loops; i++) {
+	for (unsigned int j = 0; j < length; j++)
+	    data[j] = input[j];
+	fft.forward(data);
+    }
+    u_int64_t tNew = Time::now() - t;
+    if (!tNew)
+	tNew = 1;
+    Output("FFT %5u points: old %6u ns, new %6u ns per transform, %.1fx faster",
+	length,(unsigned int)(tOld * 1000 / loops),(unsigned int)(tNew * 1000 / loops),
+	(double)tOld / tNew);
+    delete[] input;
+    delete[] data;
+}
+
+// Time the vector kernels against plain loops
+void TestFFT::benchKernels(unsigned int length)
+{
+    unsigned int loops = 20000000 / length;
+    Complex* a = new Complex[length];
+    Complex* b = new Complex[length];
+    Complex* acc = new Complex[length];
+    float* mag = new float[length];
+    random(a,length,1);
+    random(b,length,2);
+    Complex sum;
+    u_int64_t t = Time::now();
+    for (unsigned int i = 0; i < loops; i++) {
+	for (unsigned int j = 0; j < length; j++)
+	    sum += a[j] * b[j];
+    }
+    u_int64_t tLoop = Time::now() - t;
+    t = Time::now();
+    for (unsigned int i = 0; i < loops; i++)
+	sum += Math::dot(a,b,length);
+    u_int64_t tDot = Time::now() - t;
+    t = Time::now();
+    for (unsigned int i = 0; i < loops; i++) {
+	for (unsigned int j = 0; j < length; j++)
+	    mag[j] = a[j].norm();
+    }
+    u_int64_t tNormLoop = Time::now() - t;
+    t = Time::now();
+    for (unsigned int i = 0; i < loops; i++)
+	Math::norm(mag,a,length);
+    u_int64_t tNorm = Time::now() - t;
+    if (!tDot)
+	tDot = 1;
+    if (!tNorm)
+	tNorm = 1;
+    Output("Kernels %u points: dot loop %u ns, Math::dot %u ns (%.1fx), norm loop %u ns, Math::norm %u ns (%.1fx) [%g]",
+	length,(unsigned int)(tLoop * 1000 / loops),(unsigned int)(tDot * 1000 / loops),
+	(double)tLoop / tDot,(unsigned int)(tNormLoop * 1000 / loops),
+	(unsigned int)(tNorm * 1000 / loops),(double)tNormLoop / tNorm,sum.re() + mag[0]);
+    delete[] a;
+    delete[] b;
+    delete[] acc;
+    delete[] mag;
+}
+
+// Check the vector kernels of one implementation against plain loops
+void TestFFT::checkKernels(bool avx)
+{
+    const char* name = Math::vectorKernels(avx);
+    bool ok = true;
+    String res;
+    Complex a[37], b[37], acc[37], ref[37];
+    float fa[37], fb[37], mag[37];
+    random(a,37,3);
+    random(b,37,4);
+    for (unsigned int len = 0; len <= 37; len++) {
+	Complex dot;
+	float fdot = 0;
+	float pwr = 0;
+	for (unsigned int i = 0; i < len; i++) {
+	    dot += a[i] * b[i];
+	    fa[i] = a[i].re();
+	    fb[i] = b[i].im();
+	    fdot += fa[i] * fb[i];
+	    pwr += a[i].norm2();
+	    acc[i] = ref[i] = b[i];
+	    ref[i] += a[i] * b[i];
+	}
+	Math::mulAcc(acc,a,b,len);
+	Math::norm(mag,a,len);
+	bool kok = ((Math::dot(a,b,len) - dot).norm() < 1e-4)
+	    && (::fabs(Math::dot(fa,fb,len) - fdot) < 1e-4)
+	    && (::fabs(Math::power(a,len) - pwr) < 1e-4);
+	for (unsigned int i = 0; i < len; i++)
+	    kok = kok && ((acc[i] - ref[i]).norm() < 1e-5) && (::fabs(mag[i] - a[i].norm()) < 1e-5);
+	if (!kok)
+	    res.append(String(len),",");
+	ok = ok && kok;
+    }
+    testReport(String("fft-kernels-") + name,ok,res.null() ? String("all lengths match") : ("mismatch at " + res));
+}
+
+void TestFFT::run()
+{
+    // only powers of 2 are accepted
+    FFT fft;
+    bool ok = !fft.setup(1) && !fft.setup(3) && !fft.setup(100) && fft.setup(0)
+	&& fft.setup(2) && (fft.length() == 2) && !fft.forward((Complex*)0);
+    testReport("fft-setup",ok,String("length ") + String(fft.length()));
+
+    // the transform matches a direct DFT for odd and even powers of 2
+    Complex in[1024];
+    Complex out[1024];
+    String res;
+    ok = true;
+    for (unsigned int len = 2; len <= 1024; len *= 2) {
+	random(in,len,len);
+	for (unsigned int i = 0; i < len; i++)
+	    out[i] = in[i];
+	fft.setup(len);
+	fft.forward(out);
+	double err = dftError(in,out,len);
+	// single precision error grows with the log of the length
+	ok = ok && (err < 1e-5 * len);
+	res.append(String(len) + ":" + String(err * 1e6 / len),",");
+    }
+    testReport("fft-dft",ok,"error per point 1e-6 " + res);
+
+    // the inverse gives back the input
+    fft.setup(512);
+    random(in,512);
+    for (unsigned int i = 0; i < 512; i++)
+	out[i] = in[i];
+    fft.forward(out);
+    fft.inverse(out);
+    double err = 0;
+    for (unsigned int i = 0; i < 512; i++) {
+	double d = (out[i] - in[i]).norm();
+	if (err < d)
+	    err = d;
+    }
+    res.clear();
+    res << "max error " << err;
+    testReport("fft-inverse",err < 1e-5,res);
+
+    // same spectrum of a real signal as the routine it replaces,
+    //  that one turns the other way round so only the magnitudes match
+    fft.setup(256);
+    random(in,256,7);
+    for (unsigned int i = 0; i < 256; i++)
+	in[i].im(0);
+    OldFFT old(256);
+    old.compute(in);
+    ComplexVector v(256,in);
+    fft.forward(v);
+    err = 0;
+    for (unsigned int i = 0; i < 256; i++) {
+	double d = ::fabs(v[i].norm() - ::hypot(old.m_real[i],old.m_imag[i]));
+	if (err < d)
+	    err = d;
+    }
+    res.clear();
+    res << "max difference " << err;
+    testReport("fft-old",err < 1e-3,res);
+
+    // vector kernels give the same results as plain loops, also on the tails
+    checkKernels(false);
+    checkKernels(true);
+
+    for (unsigned int len = 64; len <= 4096; len *= 4)
+	bench(len);
+    benchKernels(1024);
+}
+
+void TestFFT::initialize()
+{
+    Output("Initializing module TestFFT");
+    if (m_init)
+	return;
+    m_init = true;
+    Engine::install(new TestStart<TestFFT>(this));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
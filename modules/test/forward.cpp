@@ -0,0 +1,314 @@
+/**
+ * forward.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Data source fan-out test and benchmark
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+#include "testcase.h"
+
+#include <string.h>
+
+#ifndef _WINDOWS
+#include <pthread.h>
+#endif
+
+using namespace TelEngine;
+
+// Time spent by the slow consumer in each Consume call
+#define SLOW_MSEC 100
+#define BENCH_FORWARDS 1000000
+
+class Counter : public DataConsumer
+{
+public:
+    inline Counter(unsigned int sleep = 0)
+	: m_sleep(sleep), m_inside(false), m_count(0)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{
+	    m_inside = true;
+	    if (m_sleep)
+		Thread::msleep(m_sleep);
+	    m_count++;
+	    m_inside = false;
+	    return invalidStamp();
+	}
+    unsigned int m_sleep;
+    volatile bool m_inside;
+    volatile unsigned int m_count;
+};
+
+class Forwarder : public Thread
+{
+public:
+    inline Forwarder(DataSource* source)
+	: Thread("Forwarder"), m_source(source)
+	{ s_done = false; }
+    virtual void run()
+	{
+	    DataBlock data(0,320);
+	    m_source->Forward(data);
+	    s_done = true;
+	}
+    DataSource* m_source;
+    // the thread object deletes itself when run() returns
+    static volatile bool s_done;
+};
+
+volatile bool Forwarder::s_done = false;
+
+// Consumer that sleeps only when called from the "Slow Reader" thread
+class Sleeper : public DataConsumer
+{
+public:
+    inline Sleeper()
+	: m_inside(0), m_detach(0), m_source(0)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{
+	    m_inside++;
+	    if (!::strcmp(Thread::currentName(),"Slow Reader"))
+		Thread::msleep(SLOW_MSEC);
+	    else if (m_detach && m_source) {
+		// wait (at most 2s) for another thread to run the consumer to detach
+		u_int64_t t = Time::now() + 2000000;
+		while (!static_cast<Sleeper*>(m_detach)->m_inside && Time::now() < t)
+		    Thread::yield();
+		m_source->detach(m_detach);
+	    }
+	    m_inside--;
+	    return invalidStamp();
+	}
+    volatile int m_inside;
+    DataConsumer* m_detach;
+    DataSource* m_source;
+};
+
+// Forwards one block, optionally detaches a consumer afterwards
+class Reader : public Thread
+{
+public:
+    inline Reader(const char* name, DataSource* source, DataConsumer* detach = 0)
+	: Thread(name), m_source(source), m_detach(detach)
+	{ s_running++; }
+    virtual void run()
+	{
+	    DataBlock data(0,320);
+	    m_source->Forward(data);
+	    if (m_detach) {
+		m_source->detach(m_detach);
+		s_insideAfter = static_cast<Sleeper*>(m_detach)->m_inside;
+	    }
+	    s_running--;
+	}
+    DataSource* m_source;
+    DataConsumer* m_detach;
+    static volatile int s_running;
+    static volatile int s_insideAfter;
+};
+
+volatile int Reader::s_running = 0;
+volatile int Reader::s_insideAfter = 0;
+
+#ifndef _WINDOWS
+// Consumer that sleeps only in its first call, for threads without a name
+class OnceSleeper : public DataConsumer
+{
+public:
+    inline OnceSleeper()
+	: m_inside(0), m_once(true)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{
+	    m_inside++;
+	    if (m_once) {
+		m_once = false;
+		Thread::msleep(SLOW_MSEC);
+	    }
+	    m_inside--;
+	    return invalidStamp();
+	}
+    volatile int m_inside;
+    volatile bool m_once;
+};
+
+// Forwards one block from a thread not created by Yate, optionally detaches afterwards
+class Foreign
+{
+public:
+    inline Foreign(DataSource* source, OnceSleeper* detach = 0)
+	: m_source(source), m_detach(detach), m_insideAfter(-1)
+	{ }
+    static void* run(void* arg)
+	{
+	    Foreign* f = static_cast<Foreign*>(arg);
+	    DataBlock data(0,320);
+	    f->m_source->Forward(data);
+	    if (f->m_detach) {
+		f->m_source->detach(f->m_detach);
+		f->m_insideAfter = f->m_detach->m_inside;
+	    }
+	    return 0;
+	}
+    DataSource* m_source;
+    OnceSleeper* m_detach;
+    volatile int m_insideAfter;
+};
+#endif
+
+class TestForward : public Plugin
+{
+public:
+    TestForward();
+    virtual void initialize();
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestForward);
+
+
+TestForward::TestForward()
+    : Plugin("testforward"),
+      m_init(false)
+{
+    Output("Hello, I am module TestForward");
+}
+
+void TestForward::initialize()
+{
+    Output("Initializing module TestForward");
+    if (m_init)
+	return;
+    m_init = true;
+
+    DataSource* src = new DataSource;
+    Counter* slow = new Counter(SLOW_MSEC);
+    Counter* fast = new Counter;
+    src->attach(slow);
+    (new Forwarder(src))->startup();
+    while (!slow->m_inside)
+	Thread::yield();
+
+    // attaching must not wait for the consumer running in the other thread
+    u_int64_t t = Time::now();
+    src->attach(fast);
+    t = Time::now() - t;
+    String res;
+    res << "attach took " << (unsigned int)t << " usec";
+    testReport("forward-attach",t < (SLOW_MSEC * 500),res);
+
+    // detaching must wait for it
+    src->detach(slow);
+    res.clear();
+    res << "consumed " << slow->m_count << " inside " << slow->m_inside;
+    testReport("forward-detach",(slow->m_count == 1) && !slow->m_inside,res);
+    while (!Forwarder::s_done)
+	Thread::yield();
+
+    // the snapshot taken by the forwarder must not reach the new consumer
+    DataBlock data(0,320);
+    src->Forward(data);
+    res.clear();
+    res << "slow " << slow->m_count << " fast " << fast->m_count;
+    testReport("forward-snapshot",(slow->m_count == 1) && (fast->m_count == 1),res);
+
+    // a thread that forwarded last must still wait for the other reader
+    DataSource* src2 = new DataSource;
+    Sleeper* shared = new Sleeper;
+    src2->attach(shared);
+    (new Reader("Slow Reader",src2))->startup();
+    while (!shared->m_inside)
+	Thread::yield();
+    (new Reader("Fast Reader",src2,shared))->startup();
+    t = Time::now();
+    while (Reader::s_running && (Time::now() - t) < 2000000)
+	Thread::msleep(1);
+    res.clear();
+    res << "running " << Reader::s_running << " inside after detach " << Reader::s_insideAfter;
+    testReport("forward-readers",!Reader::s_running && !Reader::s_insideAfter,res);
+
+    // detaching from inside a consumer waits for the other reader and returns
+    Sleeper* first = new Sleeper;
+    Sleeper* second = new Sleeper;
+    src2->attach(first);
+    src2->attach(second);
+    first->m_source = src2;
+    first->m_detach = second;
+    (new Reader("Fast Reader",src2))->startup();
+    while (!first->m_inside)
+	Thread::yield();
+    (new Reader("Slow Reader",src2))->startup();
+    t = Time::now();
+    while (Reader::s_running && (Time::now() - t) < 2000000)
+	Thread::msleep(1);
+    res.clear();
+    res << "running " << Reader::s_running << " inside " << second->m_inside;
+    testReport("forward-nested",!Reader::s_running && !second->m_inside,res);
+    src2->clear();
+    TelEngine::destruct(shared);
+    TelEngine::destruct(first);
+    TelEngine::destruct(second);
+    TelEngine::destruct(src2);
+
+#ifndef _WINDOWS
+    // threads not created by Yate must not be taken for the same reader
+    DataSource* src3 = new DataSource;
+    OnceSleeper* once = new OnceSleeper;
+    src3->attach(once);
+    Foreign slowF(src3);
+    Foreign fastF(src3,once);
+    pthread_t th1, th2;
+    ::pthread_create(&th1,0,Foreign::run,&slowF);
+    while (!once->m_inside)
+	Thread::yield();
+    ::pthread_create(&th2,0,Foreign::run,&fastF);
+    ::pthread_join(th2,0);
+    ::pthread_join(th1,0);
+    res.clear();
+    res << "inside after detach " << fastF.m_insideAfter;
+    testReport("forward-foreign",!fastF.m_insideAfter,res);
+    TelEngine::destruct(once);
+    TelEngine::destruct(src3);
+#endif
+
+    Counter* more = new Counter;
+    src->attach(more);
+    t = Time::now();
+    for (int i = 0; i < BENCH_FORWARDS; i++)
+	src->Forward(data);
+    t = Time::now() - t;
+    if (!t)
+	t = 1;
+    Output("Forwarded %u blocks to 2 consumers in %u ms, %u ns each",
+	BENCH_FORWARDS,(unsigned int)(t / 1000),(unsigned int)(t * 1000 / BENCH_FORWARDS));
+
+    src->clear();
+    res.clear();
+    res << "slow " << slow->refcount() << " fast " << fast->refcount()
+	<< " more " << more->refcount();
+    testReport("forward-release",(slow->refcount() == 1) && (fast->refcount() == 1)
+	&& (more->refcount() == 1),res);
+    TelEngine::destruct(slow);
+    TelEngine::destruct(fast);
+    TelEngine::destruct(more);
+    TelEngine::destruct(src);
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,181 @@
+/**
+ * g711.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * G.711 conversion kernels test and benchmark
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+#include "testcase.h"
+
+#include <string.h>
+
+using namespace TelEngine;
+
+// Number of 20ms frames converted for each benchmark
+#define BENCH_FRAMES 4000
+#define FRAME_SAMPLES 8000
+
+static bool same(const DataBlock& d1, const DataBlock& d2)
+{
+    return d1.length() && (d1.length() == d2.length())
+	&& !::memcmp(d1.data(),d2.data(),d1.length());
+}
+
+class Collector : public DataConsumer
+{
+public:
+    inline Collector(const char* format)
+	: DataConsumer(format)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ m_data += data; return invalidStamp(); }
+    DataBlock m_data;
+};
+
+class TestG711 : public Plugin
+{
+public:
+    TestG711();
+    virtual void initialize();
+    void check(const char* sFormat, const char* dFormat, const DataBlock& src);
+    void translate(const char* sFormat, const char* dFormat, const DataBlock& src);
+    void bench(const char* sFormat, const char* dFormat, const DataBlock& src);
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestG711);
+
+
+TestG711::TestG711()
+    : Plugin("testg711"),
+      m_init(false)
+{
+    Output("Hello, I am module TestG711");
+}
+
+// Compare the vector kernels with the lookup tables
+void TestG711::check(const char* sFormat, const char* dFormat, const DataBlock& src)
+{
+    DataBlock tab, vec;
+    DataBlock::vectorConvert(false);
+    tab.convert(src,sFormat,dFormat);
+    String kernel = DataBlock::vectorConvert(true);
+    vec.convert(src,sFormat,dFormat);
+    String name;
+    name << "g711-" << sFormat << "-" << dFormat;
+    String res;
+    res << kernel << " " << vec.length() << " octets";
+    testReport(name,same(tab,vec),res);
+}
+
+// Check a multi channel translator against the lookup tables
+void TestG711::translate(const char* sFormat, const char* dFormat, const DataBlock& src)
+{
+    String name;
+    name << "g711-" << sFormat << "-" << dFormat;
+    DataTranslator* trans = DataTranslator::create(sFormat,dFormat);
+    if (!trans) {
+	testReport(name,false,"no translator");
+	return;
+    }
+    Collector* out = new Collector(dFormat);
+    DataTranslator::attachChain(trans->getTransSource(),out);
+    trans->Consume(src,0,0);
+    DataBlock tab;
+    DataBlock::vectorConvert(false);
+    String sf(sFormat), df(dFormat);
+    tab.convert(src,sf.substr(2),df.substr(2));
+    DataBlock::vectorConvert(true);
+    String res;
+    res << out->m_data.length() << " octets";
+    testReport(name,same(tab,out->m_data),res);
+    DataTranslator::detachChain(trans->getTransSource(),out);
+    TelEngine::destruct(out);
+    TelEngine::destruct(trans);
+}
+
+void TestG711::bench(const char* sFormat, const char* dFormat, const DataBlock& src)
+{
+    DataBlock dst;
+    u_int64_t t[2];
+    for (int i = 0; i < 2; i++) {
+	DataBlock::vectorConvert(i != 0);
+	// warm up caches and CPU clock
+	for (int n = 0; n < BENCH_FRAMES / 10; n++)
+	    dst.convert(src,sFormat,dFormat);
+	t[i] = Time::now();
+	for (int n = 0; n < BENCH_FRAMES; n++)
+	    dst.convert(src,sFormat,dFormat);
+	t[i] = Time::now() - t[i];
+	if (!t[i])
+	    t[i] = 1;
+    }
+    String kernel = DataBlock::vectorConvert(true);
+    u_int64_t samples = (u_int64_t)BENCH_FRAMES * FRAME_SAMPLES;
+    Output("G.711 %s -> %s: table %u ksamples/s, %s %u ksamples/s (x%u.%02u)",
+	sFormat,dFormat,(unsigned int)(samples * 1000 / t[0]),kernel.c_str(),
+	(unsigned int)(samples * 1000 / t[1]),(unsigned int)(t[0] / t[1]),
+	(unsigned int)((t[0] * 100 / t[1]) % 100));
+}
+
+void TestG711::initialize()
+{
+    Output("Initializing module TestG711");
+    if (m_init)
+	return;
+    m_init = true;
+
+    // every linear value plus a few to exercise the tail handling
+    DataBlock slin(0,(65536 + 7) * 2);
+    short* s = (short*)slin.data();
+    for (int i = 0; i < 65536 + 7; i++)
+	s[i] = (short)i;
+    DataBlock law(0,256 * 3 + 5);
+    unsigned char* l = (unsigned char*)law.data();
+    for (unsigned int i = 0; i < law.length(); i++)
+	l[i] = (unsigned char)i;
+    check("slin","alaw",slin);
+    check("slin","mulaw",slin);
+    check("alaw","slin",law);
+    check("mulaw","slin",law);
+    check("alaw","mulaw",law);
+    check("mulaw","alaw",law);
+    translate("2*slin","2*alaw",slin);
+    translate("2*mulaw","2*slin",law);
+
+    // one frame of speech like samples spanning all segments
+    DataBlock frame(0,FRAME_SAMPLES * 2);
+    s = (short*)frame.data();
+    unsigned int seed = 1;
+    for (int i = 0; i < FRAME_SAMPLES; i++) {
+	seed = seed * 1103515245 + 12345;
+	s[i] = (short)(seed >> 16) >> (i & 7);
+    }
+    DataBlock frameA, frameU;
+    frameA.convert(frame,"slin","alaw");
+    frameU.convert(frame,"slin","mulaw");
+    bench("slin","alaw",frame);
+    bench("slin","mulaw",frame);
+    bench("alaw","slin",frameA);
+    bench("mulaw","slin",frameU);
+    bench("alaw","mulaw",frameA);
+    bench("mulaw","alaw",frameU);
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
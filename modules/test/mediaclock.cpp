@@ -0,0 +1,279 @@
+/**
+ * mediaclock.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Shared media clock test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+#include "testcase.h"
+
+using namespace TelEngine;
+
+// Columns of the clock statistics
+enum ClockColumn {
+    ClockSources = 0,
+    ClockTicks,
+    ClockJitter,
+    ClockMaxJitter,
+    ClockBusy,
+    ClockOverruns,
+};
+
+class ClockTestSource : public ClockedSource
+{
+public:
+    inline ClockTestSource(int frames = -1)
+	: m_frame(0,320), m_frames(frames), m_ticks(0), m_cleaned(false)
+	{ }
+    virtual int tick(u_int64_t when)
+	{
+	    if (!(m_frames && looping()))
+		return -1;
+	    if (m_frames > 0)
+		m_frames--;
+	    Forward(m_frame);
+	    m_ticks++;
+	    return 20000;
+	}
+    virtual void cleanup()
+	{ m_cleaned = true; }
+    DataBlock m_frame;
+    int m_frames;
+    volatile unsigned int m_ticks;
+    volatile bool m_cleaned;
+};
+
+class ClockTestSink : public DataConsumer
+{
+public:
+    inline ClockTestSink()
+	: m_bytes(0)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ m_bytes += data.length(); return invalidStamp(); }
+    volatile unsigned int m_bytes;
+};
+
+// Call legs used to attach the tone generator, only the listener has a consumer
+class ClockTestLeg : public CallEndpoint
+{
+public:
+    inline ClockTestLeg(bool listen = false)
+	{
+	    if (!listen)
+		return;
+	    m_sink = new ClockTestSink;
+	    m_sink->deref();
+	    setConsumer(m_sink);
+	}
+    inline ClockTestSink* sink() const
+	{ return m_sink; }
+private:
+    RefPointer<ClockTestSink> m_sink;
+};
+
+class TestMediaClock : public Plugin
+{
+public:
+    TestMediaClock();
+    virtual void initialize();
+    void run();
+    void load(unsigned int count);
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestMediaClock);
+
+
+TestMediaClock::TestMediaClock()
+    : Plugin("testmediaclock"),
+      m_init(false)
+{
+    Output("Hello, I am module TestMediaClock");
+}
+
+static String clockStatus()
+{
+    Message m("engine.status");
+    m.addParam("module","mediaclock");
+    Engine::dispatch(m);
+    return m.retValue().trimBlanks();
+}
+
+// Number of clock threads listed in the status
+static unsigned int clockCount(const String& stats)
+{
+    int pos = stats.find("clocks=");
+    if (pos < 0)
+	return 0;
+    pos += 7;
+    return stats.substr(pos,stats.find(',',pos) - pos).toInteger();
+}
+
+// Sum or maximum of one statistics column over all clock threads
+static unsigned int clockColumn(const String& stats, ClockColumn column, bool max = false)
+{
+    unsigned int val = 0;
+    int pos = stats.rfind(';');
+    if (pos < 0)
+	return 0;
+    ObjList* l = stats.substr(pos + 1).split(',');
+    for (ObjList* o = l->skipNull(); o; o = o->skipNext()) {
+	String* s = static_cast<String*>(o->get());
+	ObjList* cols = s->substr(s->find('=') + 1).split('|');
+	String* c = static_cast<String*>((*cols)[column]);
+	unsigned int v = c ? c->toInteger() : 0;
+	if (!max)
+	    val += v;
+	else if (val < v)
+	    val = v;
+	TelEngine::destruct(cols);
+    }
+    TelEngine::destruct(l);
+    return val;
+}
+
+// Run many sources for a second and show how the clocks keep up
+void TestMediaClock::load(unsigned int count)
+{
+    ObjList sources;
+    for (unsigned int i = 0; i < count; i++) {
+	ClockTestSource* src = new ClockTestSource;
+	sources.append(src);
+	src->start();
+    }
+    String before = clockStatus();
+    Thread::msleep(1000);
+    String after = clockStatus();
+    sources.clear();
+    unsigned int ticks = clockColumn(after,ClockTicks) - clockColumn(before,ClockTicks);
+    unsigned int over = clockColumn(after,ClockOverruns) - clockColumn(before,ClockOverruns);
+    Output("Media clocks serving %u sources: %u threads, %u ticks, %u overruns, %u usec average jitter, busy %u usec per tick",
+	count,clockCount(after),ticks,over,clockColumn(after,ClockJitter,true),
+	clockColumn(after,ClockBusy,true));
+    Thread::msleep(100);
+}
+
+void TestMediaClock::run()
+{
+    // with media_clocks=0 each source runs a thread not listed in the status
+    bool shared = ClockedSource::sharedClocks();
+    if (!shared)
+	Output("Media clocks are not shared, testing a thread per source");
+    // many sources are paced by a few clock threads
+    ObjList sources;
+    ObjList sinks;
+    for (int i = 0; i < 100; i++) {
+	ClockTestSource* src = new ClockTestSource;
+	ClockTestSink* sink = new ClockTestSink;
+	src->attach(sink);
+	sources.append(src);
+	sinks.append(sink);
+	src->start();
+    }
+    Thread::msleep(1000);
+    unsigned int lo = 1000000;
+    unsigned int hi = 0;
+    for (ObjList* l = sinks.skipNull(); l; l = l->skipNext()) {
+	unsigned int n = static_cast<ClockTestSink*>(l->get())->m_bytes / 320;
+	if (lo > n)
+	    lo = n;
+	if (hi < n)
+	    hi = n;
+    }
+    String stats = clockStatus();
+    String res;
+    res << "frames per source " << lo << ".." << hi << " in 1s, " << clockCount(stats) << " threads";
+    testReport("mediaclock-pace",(lo >= 45) && (hi <= 52) && (!shared
+	|| ((clockCount(stats) >= 1) && (clockCount(stats) <= 2))),res);
+    if (shared) {
+	res.clear();
+	res << "sources " << clockColumn(stats,ClockSources) << " ticks " << clockColumn(stats,ClockTicks)
+	    << " jitter " << clockColumn(stats,ClockJitter,true) << " max "
+	    << clockColumn(stats,ClockMaxJitter,true);
+	testReport("mediaclock-status",(clockColumn(stats,ClockSources) >= 100)
+	    && (clockColumn(stats,ClockTicks) >= 40),res);
+    }
+
+    // dropping the last reference makes the sources leave their clocks
+    sources.clear();
+    Thread::msleep(100);
+    stats = clockStatus();
+    res.clear();
+    res << "sources left " << clockColumn(stats,ClockSources);
+    testReport("mediaclock-release",clockColumn(stats,ClockSources) == 0,res);
+    sinks.clear();
+
+    // a source ending its data leaves the clock and is cleaned up
+    ClockTestSource* src = new ClockTestSource(5);
+    src->start();
+    Thread::msleep(200);
+    res.clear();
+    res << "ticks " << src->m_ticks << " cleaned " << String::boolText(src->m_cleaned)
+	<< " running " << String::boolText(src->running());
+    testReport("mediaclock-end",(src->m_ticks == 5) && src->m_cleaned && !src->running(),res);
+    TelEngine::destruct(src);
+
+    // tones are generated on the shared clock too
+    ClockTestLeg* player = new ClockTestLeg;
+    ClockTestLeg* listener = new ClockTestLeg(true);
+    player->connect(listener);
+    Message m("chan.attach");
+    m.userData(player);
+    m.addParam("source","tone/dial");
+    m.addParam("single","true");
+    if (Engine::dispatch(m)) {
+	Thread::msleep(500);
+	stats = clockStatus();
+	unsigned int bytes = listener->sink()->m_bytes;
+	res.clear();
+	res << "got " << bytes << " octets in 500ms, clock sources "
+	    << clockColumn(stats,ClockSources);
+	testReport("mediaclock-tone",(bytes >= 7000) && (bytes <= 8640)
+	    && (!shared || (clockColumn(stats,ClockSources) == 1)),res);
+    }
+    else
+	Output("No tone generator loaded, skipping mediaclock-tone");
+    m.userData(0);
+    player->disconnect("done");
+    TelEngine::destruct(player);
+    TelEngine::destruct(listener);
+    Thread::msleep(100);
+    stats = clockStatus();
+    res.clear();
+    res << "sources left " << clockColumn(stats,ClockSources);
+    testReport("mediaclock-tone-release",clockColumn(stats,ClockSources) == 0,res);
+
+    if (shared) {
+	load(1000);
+	load(5000);
+    }
+}
+
+void TestMediaClock::initialize()
+{
+    Output("Initializing module TestMediaClock");
+    if (m_init)
+	return;
+    m_init = true;
+    // the tone generator must be initialized before we use it
+    Engine::install(new TestStart<TestMediaClock>(this));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,240 @@
+/**
+ * prompts.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Wave file prompt cache test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+#include "testcase.h"
+
+#include <string.h>
+#include <utime.h>
+
+using namespace TelEngine;
+
+#define PROMPT_FILE "/tmp/yate-prompts-test.alaw"
+#define PROMPT_LEN 8000
+// Too long for the prompt cache so it is played from disk
+#define STREAM_FILE "/tmp/yate-prompts-stream.alaw"
+#define STREAM_LEN (1100 * 1024)
+
+class PromptSink : public DataConsumer
+{
+public:
+    inline PromptSink(const char* format)
+	: DataConsumer(format), m_first(0)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{
+	    if (!m_first)
+		m_first = data.data();
+	    m_data += data;
+	    return invalidStamp();
+	}
+    const void* volatile m_first;
+    DataBlock m_data;
+};
+
+// Two connected legs, the prompt is attached to the first and heard by the second
+class PromptLeg : public CallEndpoint
+{
+public:
+    PromptLeg(const char* format = 0);
+    inline PromptSink* sink() const
+	{ return m_sink; }
+private:
+    RefPointer<PromptSink> m_sink;
+};
+
+class TestPrompts : public Plugin
+{
+public:
+    TestPrompts();
+    virtual void initialize();
+    void run();
+    PromptSink* play(ObjList& legs, const char* format, const char* file = PROMPT_FILE);
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestPrompts);
+
+
+PromptLeg::PromptLeg(const char* format)
+{
+    if (!format)
+	return;
+    m_sink = new PromptSink(format);
+    m_sink->deref();
+    setConsumer(m_sink);
+}
+
+
+TestPrompts::TestPrompts()
+    : Plugin("testprompts"),
+      m_init(false)
+{
+    Output("Hello, I am module TestPrompts");
+}
+
+// Start playing the prompt file to a listener of the given format
+PromptSink* TestPrompts::play(ObjList& legs, const char* format, const char* file)
+{
+    PromptLeg* player = new PromptLeg;
+    PromptLeg* listener = new PromptLeg(format);
+    legs.append(player);
+    legs.append(listener);
+    player->connect(listener);
+    Message m("chan.attach");
+    m.userData(player);
+    m.addParam("source","wave/play/" + String(file));
+    Engine::dispatch(m);
+    return listener->sink();
+}
+
+static void hangup(ObjList& legs)
+{
+    for (ObjList* l = legs.skipNull(); l; l = l->skipNext())
+	static_cast<CallEndpoint*>(l->get())->disconnect("done");
+    legs.clear();
+}
+
+// Extract one numeric value from the module status string
+static unsigned int statValue(const char* name)
+{
+    Message m("engine.status");
+    m.addParam("module","wave");
+    Engine::dispatch(m);
+    String key;
+    key << name << "=";
+    int pos = m.retValue().find(key);
+    if (pos < 0)
+	return 0;
+    pos += key.length();
+    int end = m.retValue().find(',',pos);
+    if (end < 0)
+	end = m.retValue().find(';',pos);
+    return m.retValue().substr(pos,end - pos).toInteger();
+}
+
+static bool writePrompt(unsigned char seed, unsigned int mtime,
+    const char* file = PROMPT_FILE, int len = PROMPT_LEN)
+{
+    DataBlock data(0,len);
+    unsigned char* d = (unsigned char*)data.data();
+    for (int i = 0; i < len; i++)
+	d[i] = (unsigned char)(seed + i);
+    File f;
+    if (!(f.openPath(file,true,false,true) &&
+	(f.writeData(data.data(),data.length()) == len)))
+	return false;
+    f.terminate();
+    struct utimbuf t;
+    t.actime = t.modtime = mtime;
+    return 0 == ::utime(file,&t);
+}
+
+static bool starts(const DataBlock& data, unsigned char seed, unsigned int len = 160)
+{
+    if (data.length() < len)
+	return false;
+    for (unsigned int i = 0; i < len; i++) {
+	if (data.at(i) != (unsigned char)(seed + i))
+	    return false;
+    }
+    return true;
+}
+
+void TestPrompts::run()
+{
+    unsigned int now = Time::secNow();
+    if (!writePrompt(0,now - 100)) {
+	testReport("prompts-file",false,"cannot write " PROMPT_FILE);
+	return;
+    }
+
+    // the first play loads the file, the next ones share the same memory
+    ObjList legs;
+    unsigned int hits = statValue("prompthits");
+    PromptSink* s1 = play(legs,"alaw");
+    Thread::msleep(50);
+    PromptSink* s2 = play(legs,"alaw");
+    Thread::msleep(100);
+    String res;
+    res << "hits " << (statValue("prompthits") - hits) << " bytes " << statValue("promptbytes");
+    testReport("prompts-hit",(statValue("prompthits") == hits + 1)
+	&& starts(s1->m_data,0) && starts(s2->m_data,0),res);
+    res.printf("first blocks %p %p",s1->m_first,s2->m_first);
+    testReport("prompts-zerocopy",s1->m_first && (s1->m_first == s2->m_first),res);
+    hangup(legs);
+
+    // a listener in another format gets the transcoded copy, no translator
+    unsigned int bytes = statValue("promptbytes");
+    s1 = play(legs,"mulaw");
+    Thread::msleep(100);
+    DataBlock file(0,160), expect;
+    unsigned char* d = (unsigned char*)file.data();
+    for (int i = 0; i < 160; i++)
+	d[i] = (unsigned char)i;
+    expect.convert(file,"alaw","mulaw");
+    res.clear();
+    res << "got " << s1->m_data.length() << " octets, cache grew by "
+	<< (statValue("promptbytes") - bytes);
+    testReport("prompts-variant",(s1->m_data.length() >= 160)
+	&& !::memcmp(s1->m_data.data(),expect.data(),160)
+	&& (statValue("promptbytes") == bytes + PROMPT_LEN),res);
+    hangup(legs);
+
+    // a file changed on disk is read again
+    writePrompt(100,now - 50);
+    unsigned int misses = statValue("promptmisses");
+    s1 = play(legs,"alaw");
+    Thread::msleep(100);
+    res.clear();
+    res << "misses " << (statValue("promptmisses") - misses);
+    testReport("prompts-mtime",(statValue("promptmisses") == misses + 1) && starts(s1->m_data,100),res);
+    hangup(legs);
+    File::remove(PROMPT_FILE);
+
+    // a long file is streamed in order, read ahead when the clocks are shared
+    if (!writePrompt(50,now,STREAM_FILE,STREAM_LEN)) {
+	testReport("prompts-stream",false,"cannot write " STREAM_FILE);
+	return;
+    }
+    RefPointer<PromptSink> sink = play(legs,"alaw",STREAM_FILE);
+    Thread::msleep(300);
+    // stop the data before looking at it
+    hangup(legs);
+    unsigned int len = sink->m_data.length();
+    res.clear();
+    res << "got " << len << " octets, shared clocks " << String::boolText(ClockedSource::sharedClocks());
+    testReport("prompts-stream",(len >= 1600) && starts(sink->m_data,50,len),res);
+    File::remove(STREAM_FILE);
+}
+
+void TestPrompts::initialize()
+{
+    Output("Initializing module TestPrompts");
+    if (m_init)
+	return;
+    m_init = true;
+    // the wave file module must be initialized before we play
+    Engine::install(new TestStart<TestPrompts>(this));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
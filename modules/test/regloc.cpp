@@ -0,0 +1,273 @@
+/**
+ * regloc.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Register in-memory location store test
+ * Plays the database of the register module, which needs this register.conf:
+ *
+ * [general]
+ * location=yes
+ * user.register=yes
+ * user.unregister=yes
+ * call.route=yes
+ * [default]
+ * account=regloctest
+ * [user.register]
+ * query=REG ${username} ${data} ${expires}
+ * [user.unregister]
+ * query=UNREG ${username} ${data}
+ * [call.route]
+ * query=ROUTE ${called}
+ * result=location
+ * [location]
+ * loadquery=LOAD
+ * flush=100
+ * verify=3
+ * route=yes
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+#include "testcase.h"
+
+using namespace TelEngine;
+
+class TestRegLoc : public Plugin
+{
+public:
+    TestRegLoc();
+    virtual void initialize();
+    void run();
+private:
+    bool m_init;
+};
+
+// Answers the queries of the register module
+class DbHandler : public MessageHandler
+{
+public:
+    inline DbHandler()
+	: MessageHandler("database",10,"testregloc")
+	{ }
+    virtual bool received(Message& msg);
+};
+
+INIT_PLUGIN(TestRegLoc);
+
+static Mutex s_mutex(false,"TestRegLoc");
+// Queries seen since last taken
+static ObjList s_queries;
+// When the locations were loaded
+static u_int32_t s_loaded = 0;
+// Writes fail while set
+static bool s_fail = false;
+// Rows affected by a successful write
+static int s_affected = 1;
+
+// Take the queries seen so far
+static String queries()
+{
+    Lock lck(s_mutex);
+    String res;
+    for (ObjList* o = s_queries.skipNull(); o; o = o->skipNext())
+	res.append(o->get()->toString()," | ");
+    s_queries.clear();
+    return res;
+}
+
+// Status of the location store, like "locations=1,contacts=1,dirty=0"
+static String status()
+{
+    Message m("engine.status");
+    m.addParam("module","register");
+    Engine::dispatch(m);
+    int pos = m.retValue().find("locations=");
+    String res = (pos >= 0) ? m.retValue().substr(pos) : String::empty();
+    pos = res.find(";");
+    if (pos >= 0)
+	res = res.substr(0,pos);
+    res.trimSpaces();
+    return res;
+}
+
+static bool reg(const char* user, const char* data, const char* expires)
+{
+    Message m("user.register");
+    m.addParam("username",user);
+    m.addParam("data",data);
+    m.addParam("expires",expires);
+    return Engine::dispatch(m);
+}
+
+static String route(const char* user)
+{
+    Message m("call.route");
+    m.addParam("called",user);
+    Engine::dispatch(m);
+    return m.retValue();
+}
+
+
+bool DbHandler::received(Message& msg)
+{
+    if (msg[YSTRING("account")] != YSTRING("regloctest"))
+	return false;
+    const String& query = msg[YSTRING("query")];
+    Lock lck(s_mutex);
+    s_queries.append(new String(query));
+    if (query == YSTRING("LOAD")) {
+	// only the location with a known lifetime is kept
+	static const char* rows[3][3] = {
+	    { "u1", "sip:u1@test", "60" },
+	    { "u2", "sip:u2@test", "0" },
+	    { "u3", "sip:u3@test", 0 }
+	};
+	Array* a = new Array(3,1);
+	a->set(new String("username"),0,0);
+	a->set(new String("location"),1,0);
+	a->set(new String("expires"),2,0);
+	for (int i = 0; i < 3; i++) {
+	    a->addRow();
+	    for (int j = 0; j < 3; j++)
+		if (rows[i][j])
+		    a->set(new String(rows[i][j]),j,i + 1);
+	}
+	msg.userData(a);
+	TelEngine::destruct(a);
+	msg.setParam("rows","3");
+	s_loaded = Time::secNow();
+	return true;
+    }
+    if (query.startsWith("ROUTE ")) {
+	Array* a = new Array(1,2);
+	a->set(new String("location"),0,0);
+	a->set(new String("sip:db@test"),0,1);
+	msg.userData(a);
+	TelEngine::destruct(a);
+	msg.setParam("rows","1");
+	return true;
+    }
+    if (s_fail)
+	msg.setParam("error","failure");
+    else
+	msg.setParam("affected",String(s_affected));
+    return true;
+}
+
+
+TestRegLoc::TestRegLoc()
+    : Plugin("testregloc"),
+      m_init(false)
+{
+    Output("Hello, I am module TestRegLoc");
+}
+
+void TestRegLoc::run()
+{
+    Configuration cfg(Engine::configFile("register"));
+    unsigned int verify = cfg.getIntValue("location","verify");
+    // locations are loaded when the engine starts
+    for (int i = 0; i < 100 && !s_loaded; i++)
+	Thread::msleep(10);
+    String q = queries();
+    String st = status();
+    String res;
+    res << q << "; " << st;
+    bool ok = (q == YSTRING("LOAD")) && st.startsWith("locations=1,contacts=1,");
+    testReport("regloc-load",ok,res);
+    if (!ok)
+	return;
+
+    // refreshes of a known location are written once, later
+    bool r1 = reg("u1","sip:u1@test","45");
+    bool r2 = reg("u1","sip:u1@test","45");
+    bool r3 = reg("u1","sip:u1@test","45");
+    String before = queries();
+    String dirty = status();
+    Thread::msleep(400);
+    q = queries();
+    st = status();
+    res.clear();
+    res << "before flush '" << before << "' " << dirty << ", after '" << q << "' " << st;
+    testReport("regloc-coalesce",r1 && r2 && r3 && before.null() && dirty.endsWith("dirty=1")
+	&& (q == YSTRING("REG u1 sip:u1@test 45")) && st.endsWith("dirty=0"),res);
+
+    // changes that failed to be written are kept and written again
+    s_fail = true;
+    reg("u1","sip:u1@test","50");
+    Thread::msleep(400);
+    String failed = queries();
+    String kept = status();
+    s_fail = false;
+    Thread::msleep(400);
+    q = queries();
+    st = status();
+    res.clear();
+    res << "failed '" << failed << "' " << kept << ", retried '" << q << "' " << st;
+    testReport("regloc-requeue",failed.startsWith("REG u1 sip:u1@test 50") && kept.endsWith("dirty=1")
+	&& (q == YSTRING("REG u1 sip:u1@test 50")) && st.endsWith("dirty=0"),res);
+
+    // known users are routed from memory, others from the database
+    String known = route("u1");
+    q = queries();
+    String other = route("u9");
+    String q2 = queries();
+    res.clear();
+    res << known << " '" << q << "', " << other << " '" << q2 << "'";
+    testReport("regloc-route",(known == YSTRING("sip:u1@test")) && q.null()
+	&& (other == YSTRING("sip:db@test")) && (q2 == YSTRING("ROUTE u9")),res);
+
+    // a new user is checked by the database at once and expires from memory
+    bool added = reg("u4","sip:u4@test","1");
+    q = queries();
+    String mem = status();
+    Thread::msleep(2500);
+    st = status();
+    res.clear();
+    res << "added '" << q << "' " << mem << ", later " << st;
+    testReport("regloc-expire",added && (q == YSTRING("REG u4 sip:u4@test 1"))
+	&& mem.startsWith("locations=2,contacts=2,") && st.startsWith("locations=1,contacts=1,"),res);
+    queries();
+
+    // after the verify interval the database is asked again and a user
+    //  it no longer knows is forgotten
+    while (Time::secNow() <= s_loaded + verify)
+	Thread::msleep(100);
+    s_affected = 0;
+    bool refused = !reg("u1","sip:u1@test","60");
+    q = queries();
+    st = status();
+    String routed = route("u1");
+    queries();
+    s_affected = 1;
+    res.clear();
+    res << "verify '" << q << "' " << st << ", routed " << routed;
+    testReport("regloc-verify",verify && refused && (q == YSTRING("REG u1 sip:u1@test 60"))
+	&& st.startsWith("locations=0,contacts=0,") && (routed == YSTRING("sip:db@test")),res);
+}
+
+void TestRegLoc::initialize()
+{
+    Output("Initializing module TestRegLoc");
+    if (m_init)
+	return;
+    m_init = true;
+    Engine::install(new DbHandler);
+    // the register module writes from its own thread while we wait
+    Engine::install(new TestStart<TestRegLoc>(this,"RegLoc Test"));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,233 @@
+/**
+ * resample.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Polyphase resampler accuracy test and benchmark
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+#include "testcase.h"
+
+#include <math.h>
+
+using namespace TelEngine;
+
+// Seconds of audio pushed through the resampler for each test
+#define TEST_SECONDS 2
+#define BENCH_SECONDS 60
+// Tone amplitude and minimum accepted quality
+#define AMPLITUDE 16000.0
+#define MIN_SNR 60.0
+#define MIN_REJECT 60.0
+
+class Sink : public DataConsumer
+{
+public:
+    inline Sink(const char* format)
+	: DataConsumer(format), m_keep(true)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{
+	    if (m_keep)
+		m_data += data;
+	    return invalidStamp();
+	}
+    DataBlock m_data;
+    bool m_keep;
+};
+
+class TestResample : public Plugin
+{
+public:
+    TestResample();
+    virtual void initialize();
+    DataTranslator* run(const char* sFormat, const char* dFormat, double freq,
+	unsigned int seconds, Sink*& out);
+    void check(const char* sFormat, const char* dFormat, double freq);
+    void reject(const char* sFormat, const char* dFormat, double freq);
+    void bench(const char* sFormat, const char* dFormat);
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestResample);
+
+
+TestResample::TestResample()
+    : Plugin("testresample"),
+      m_init(false)
+{
+    Output("Hello, I am module TestResample");
+}
+
+// Push a tone in 20ms frames through a new translator
+DataTranslator* TestResample::run(const char* sFormat, const char* dFormat, double freq,
+    unsigned int seconds, Sink*& out)
+{
+    out = 0;
+    DataTranslator* trans = DataTranslator::create(sFormat,dFormat);
+    if (!trans)
+	return 0;
+    DataFormat fmt(sFormat);
+    int rate = fmt.sampleRate();
+    int chans = fmt.numChannels();
+    int samples = rate / 50;
+    out = new Sink(dFormat);
+    out->m_keep = (seconds <= TEST_SECONDS);
+    DataTranslator::attachChain(trans->getTransSource(),out);
+    DataBlock frame(0,2 * chans * samples);
+    short* s = (short*)frame.data();
+    unsigned long ts = 0;
+    for (unsigned int f = 0; f < seconds * 50; f++) {
+	for (int i = 0; i < samples; i++) {
+	    short v = (short)::floor(AMPLITUDE * ::sin(2.0 * M_PI * freq * (ts + i) / rate) + 0.5);
+	    for (int c = 0; c < chans; c++)
+		s[i * chans + c] = v;
+	}
+	trans->Consume(frame,ts,0);
+	ts += samples;
+    }
+    DataTranslator::detachChain(trans->getTransSource(),out);
+    return trans;
+}
+
+// A tone in the pass band must come out clean at the new rate
+void TestResample::check(const char* sFormat, const char* dFormat, double freq)
+{
+    String name;
+    name << "resample-" << sFormat << "-" << dFormat;
+    Sink* out = 0;
+    DataTranslator* trans = run(sFormat,dFormat,freq,TEST_SECONDS,out);
+    if (!trans) {
+	testReport(name,false,"no translator");
+	return;
+    }
+    DataFormat fmt(dFormat);
+    int rate = fmt.sampleRate();
+    int chans = fmt.numChannels();
+    const short* d = (const short*)out->m_data.data();
+    int n = out->m_data.length() / (2 * chans);
+    // skip the filter delay, fit a sine to channel 0 and measure what is left
+    int skip = rate / 10;
+    double sc = 0, cc = 0, ss = 0, sx = 0, cx = 0;
+    for (int i = skip; i < n; i++) {
+	double a = 2.0 * M_PI * freq * i / rate;
+	double x = d[i * chans];
+	sx += ::sin(a) * x;
+	cx += ::cos(a) * x;
+	ss += ::sin(a) * ::sin(a);
+	cc += ::cos(a) * ::cos(a);
+	sc += ::sin(a) * ::cos(a);
+    }
+    double det = ss * cc - sc * sc;
+    double ka = (sx * cc - cx * sc) / det;
+    double kb = (cx * ss - sx * sc) / det;
+    double sig = 0, err = 0;
+    bool same = true;
+    for (int i = skip; i < n; i++) {
+	double a = 2.0 * M_PI * freq * i / rate;
+	double fit = ka * ::sin(a) + kb * ::cos(a);
+	double e = d[i * chans] - fit;
+	sig += fit * fit;
+	err += e * e;
+	for (int c = 1; c < chans; c++)
+	    same = same && (d[i * chans + c] == d[i * chans]);
+    }
+    double snr = 10.0 * ::log10(sig / (err + 1e-9));
+    double gain = 20.0 * ::log10(::sqrt(ka * ka + kb * kb) / AMPLITUDE);
+    int expect = (int)((long long)TEST_SECONDS * rate);
+    String res;
+    res << n << "/" << expect << " samples, " << freq << "Hz gain " << gain
+	<< "dB SNR " << snr << "dB";
+    testReport(name,same && (n > expect - rate / 100) && (n <= expect)
+	&& (::fabs(gain) < 0.1) && (snr > MIN_SNR),res);
+    TelEngine::destruct(out);
+    TelEngine::destruct(trans);
+}
+
+// A tone above the output Nyquist frequency must not alias back
+void TestResample::reject(const char* sFormat, const char* dFormat, double freq)
+{
+    String name;
+    name << "resample-alias-" << sFormat << "-" << dFormat;
+    Sink* out = 0;
+    DataTranslator* trans = run(sFormat,dFormat,freq,TEST_SECONDS,out);
+    if (!trans) {
+	testReport(name,false,"no translator");
+	return;
+    }
+    int rate = DataFormat(dFormat).sampleRate();
+    const short* d = (const short*)out->m_data.data();
+    int n = out->m_data.length() / 2;
+    double pwr = 0;
+    for (int i = rate / 10; i < n; i++)
+	pwr += (double)d[i] * d[i];
+    pwr /= (n - rate / 10);
+    double att = 10.0 * ::log10((AMPLITUDE * AMPLITUDE / 2) / (pwr + 1e-9));
+    String res;
+    res << freq << "Hz attenuated " << att << "dB";
+    testReport(name,att > MIN_REJECT,res);
+    TelEngine::destruct(out);
+    TelEngine::destruct(trans);
+}
+
+void TestResample::bench(const char* sFormat, const char* dFormat)
+{
+    Sink* out = 0;
+    u_int64_t t = Time::now();
+    DataTranslator* trans = run(sFormat,dFormat,1000,BENCH_SECONDS,out);
+    t = Time::now() - t;
+    if (!trans)
+	return;
+    if (!t)
+	t = 1;
+    Output("Resample %s -> %s: %u seconds in %u.%03u ms, x%u realtime",
+	sFormat,dFormat,BENCH_SECONDS,(unsigned int)(t / 1000),(unsigned int)(t % 1000),
+	(unsigned int)(BENCH_SECONDS * (u_int64_t)1000000 / t));
+    TelEngine::destruct(out);
+    TelEngine::destruct(trans);
+}
+
+void TestResample::initialize()
+{
+    Output("Initializing module TestResample");
+    if (m_init)
+	return;
+    m_init = true;
+
+    check("slin","slin/16000",1000);
+    check("slin/16000","slin",1000);
+    check("slin","slin/44100",1000);
+    check("slin/44100","slin",1000);
+    check("slin/16000","slin/48000",3000);
+    check("slin/48000","slin/16000",3000);
+    check("slin/44100","slin/48000",5000);
+    check("slin/48000","slin",1500);
+    check("2*slin","2*slin/44100",700);
+    check("2*slin/48000","2*slin/16000",2500);
+    reject("slin/44100","slin",5000);
+    reject("slin/48000","slin/16000",9000);
+    reject("slin/32000","slin",6000);
+
+    bench("slin","slin/44100");
+    bench("slin/44100","slin");
+    bench("slin/16000","slin/48000");
+    bench("slin/48000","slin/16000");
+    bench("2*slin/48000","2*slin/44100");
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
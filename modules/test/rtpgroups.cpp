@@ -0,0 +1,109 @@
+/**
+ * rtpgroups.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * RTP group pool assignment and migration test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+#include <yatertp.h>
+#include "testcase.h"
+
+using namespace TelEngine;
+
+#define SESSIONS 12
+
+class TestGroups : public Plugin
+{
+public:
+    TestGroups();
+    virtual void initialize();
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestGroups);
+
+
+TestGroups::TestGroups()
+    : Plugin("testrtpgroups"),
+      m_init(false)
+{
+    Output("Hello, I am module TestGroups");
+}
+
+void TestGroups::initialize()
+{
+    Output("Initializing module TestGroups");
+    if (m_init)
+	return;
+    m_init = true;
+
+    RTPGroupPool* pool = new RTPGroupPool;
+    pool->setup(2,"0");
+    pool->balancing(RTPGroupPool::Streams,4);
+    RTPSession* sessions[SESSIONS];
+    for (int i = 0; i < SESSIONS; i++) {
+	sessions[i] = new RTPSession;
+	sessions[i]->initGroup(*pool);
+    }
+    RTPGroup* a = sessions[0]->group();
+    RTPGroup* b = sessions[1]->group();
+    String res;
+    pool->status(res);
+    testReport("rtpgroups-assign",(pool->count() == 2) && a && b && (a != b)
+	&& (a->streams() == SESSIONS / 2) && (b->streams() == SESSIONS / 2),res);
+
+    // empty one group, the pool must move half the difference back to it
+    for (int i = 0; i < SESSIONS; i++) {
+	if (sessions[i]->group() == a)
+	    TelEngine::destruct(sessions[i]);
+    }
+    for (int i = 0; i < 40; i++) {
+	if (a->streams() == SESSIONS / 4)
+	    break;
+	Thread::msleep(100);
+    }
+    res.clear();
+    pool->status(res);
+    testReport("rtpgroups-migrate",(a->streams() == SESSIONS / 4) && (b->streams() == SESSIONS / 4),res);
+
+    int moved = 0;
+    for (int i = 0; i < SESSIONS; i++) {
+	if (sessions[i] && (sessions[i]->group() == a))
+	    moved++;
+    }
+    res = "";
+    res << moved << " sessions moved";
+    testReport("rtpgroups-sessions",moved == SESSIONS / 4,res);
+
+    for (int i = 0; i < SESSIONS; i++)
+	TelEngine::destruct(sessions[i]);
+    res.clear();
+    pool->status(res);
+    testReport("rtpgroups-cleanup",(a->streams() == 0) && (b->streams() == 0),res);
+
+    // the groups must leave the pool before it is destroyed
+    u_int64_t t = Time::now();
+    delete pool;
+    t = Time::now() - t;
+    res = "";
+    res << "stopped in " << (unsigned int)(t / 1000) << " msec";
+    testReport("rtpgroups-stop",t < 1000000,res);
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
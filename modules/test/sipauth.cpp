@@ -0,0 +1,266 @@
+/**
+ * sipauth.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * SIP authentication cache test
+ * Needs the ysipchan module listening on UDP with auth_cache_ttl set and
+ *  the authtest method enabled in the [methods] section
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+#include <yatesip.h>
+#include "testcase.h"
+
+using namespace TelEngine;
+
+// Talks to the SIP listener over UDP like a phone would
+class SipPeer
+{
+public:
+    inline SipPeer()
+	: m_cseq(0)
+	{ }
+    bool init(const String& addr, int port);
+    // Send a request with an optional digest response and return the final answer code
+    int request(const String& method, const char* password = 0);
+    // Last challenge received
+    String m_nonce;
+    String m_realm;
+private:
+    SIPMessage* receive(u_int64_t usec);
+    Socket m_sock;
+    SocketAddr m_remote;
+    String m_local;
+    unsigned int m_cseq;
+};
+
+class TestSipAuth : public Plugin
+{
+public:
+    TestSipAuth();
+    virtual void initialize();
+    void run();
+private:
+    bool m_init;
+};
+
+// Answers user.auth, user.register and sip.authtest for the test user
+class AuthHandler : public MessageHandler
+{
+public:
+    inline AuthHandler(const char* name)
+	: MessageHandler(name,10,"testsipauth")
+	{ }
+    virtual bool received(Message& msg);
+};
+
+INIT_PLUGIN(TestSipAuth);
+
+// Branches must be unique across all peers
+static unsigned int s_branch = 0;
+
+// How many times the password was asked for
+static unsigned int s_asked = 0;
+static Mutex s_mutex(false,"TestSipAuth");
+
+static unsigned int asked()
+{
+    Lock lck(s_mutex);
+    return s_asked;
+}
+
+
+bool SipPeer::init(const String& addr, int port)
+{
+    m_remote.assign(SocketAddr::IPv4);
+    m_remote.host(addr);
+    m_remote.port(port);
+    SocketAddr local(SocketAddr::IPv4);
+    local.host("127.0.0.1");
+    if (!(m_sock.create(SocketAddr::IPv4,SOCK_DGRAM) && m_sock.bind(local)
+	&& m_sock.getSockName(local)))
+	return false;
+    m_local = local.host() + ":" + String(local.port());
+    return true;
+}
+
+int SipPeer::request(const String& method, const char* password)
+{
+    String uri("sip:" + m_remote.host());
+    String callId;
+    callId << "authtest-" << m_local << "-" << ++m_cseq;
+    String msg;
+    msg << method << " " << uri << " SIP/2.0\r\n";
+    msg << "Via: SIP/2.0/UDP " << m_local << ";branch=z9hG4bKauth" << ++s_branch << "\r\n";
+    msg << "Max-Forwards: 70\r\n";
+    msg << "From: <sip:authtest@" << m_remote.host() << ">;tag=auth" << m_cseq << "\r\n";
+    msg << "To: <sip:authtest@" << m_remote.host() << ">\r\n";
+    msg << "Call-ID: " << callId << "\r\n";
+    msg << "CSeq: " << m_cseq << " " << method << "\r\n";
+    msg << "Contact: <sip:authtest@" << m_local << ">\r\n";
+    if (password) {
+	MD5 ha1;
+	ha1 << "authtest:" << m_realm << ":" << password;
+	MD5 ha2;
+	ha2 << method << ":" << uri;
+	MD5 resp;
+	resp << ha1.hexDigest() << ":" << m_nonce << ":" << ha2.hexDigest();
+	msg << "Authorization: Digest username=\"authtest\", realm=\"" << m_realm <<
+	    "\", nonce=\"" << m_nonce << "\", uri=\"" << uri << "\", response=\"" <<
+	    resp.hexDigest() << "\", algorithm=MD5\r\n";
+    }
+    msg << "Content-Length: 0\r\n\r\n";
+    m_sock.sendTo(msg.c_str(),msg.length(),m_remote);
+    SIPMessage* answer;
+    while ((answer = receive(2000000))) {
+	int code = answer->code;
+	if (code >= 200 && answer->getHeaderValue("Call-ID") == callId) {
+	    const NamedString* nonce = answer->getParam("WWW-Authenticate","nonce");
+	    const NamedString* realm = answer->getParam("WWW-Authenticate","realm");
+	    if (nonce && realm) {
+		m_nonce = *nonce;
+		MimeHeaderLine::delQuotes(m_nonce);
+		m_realm = *realm;
+		MimeHeaderLine::delQuotes(m_realm);
+	    }
+	    TelEngine::destruct(answer);
+	    return code;
+	}
+	TelEngine::destruct(answer);
+    }
+    return 0;
+}
+
+SIPMessage* SipPeer::receive(u_int64_t usec)
+{
+    bool ok = false;
+    if (!(m_sock.select(&ok,0,0,(int64_t)usec) && ok))
+	return 0;
+    char buf[4096];
+    int len = m_sock.recvFrom(buf,sizeof(buf) - 1);
+    if (len <= 0)
+	return 0;
+    buf[len] = '\0';
+    return SIPMessage::fromParsing(0,buf,len);
+}
+
+
+bool AuthHandler::received(Message& msg)
+{
+    if (msg[YSTRING("username")] != YSTRING("authtest"))
+	return false;
+    if (msg == YSTRING("user.auth")) {
+	Lock lck(s_mutex);
+	s_asked++;
+	msg.retValue() = "secret";
+    }
+    return true;
+}
+
+
+TestSipAuth::TestSipAuth()
+    : Plugin("testsipauth"),
+      m_init(false)
+{
+    Output("Hello, I am module TestSipAuth");
+}
+
+void TestSipAuth::run()
+{
+    // use the same settings as the SIP channel
+    Configuration cfg(Engine::configFile("ysipchan"));
+    String addr = cfg.getValue("listener general","addr");
+    if (addr.null() || addr == YSTRING("0.0.0.0"))
+	addr = "127.0.0.1";
+    int port = cfg.getIntValue("listener general","port",5060);
+    SipPeer peer;
+    SipPeer other;
+    bool ok = cfg.getIntValue("general","auth_cache_ttl") && cfg.getBoolValue("methods","authtest")
+	&& peer.init(addr,port) && other.init(addr,port);
+    String res;
+    res << "auth_cache_ttl=" << cfg.getValue("general","auth_cache_ttl") <<
+	" authtest=" << cfg.getValue("methods","authtest") << " listener " << addr << ":" << port;
+    testReport("sipauth-setup",ok,res);
+    if (!ok)
+	return;
+
+    // a challenge provides the nonce, the first response asks for the password
+    //  and the next ones are checked with the cached one
+    int challenge = peer.request("REGISTER");
+    other.m_nonce = peer.m_nonce;
+    other.m_realm = peer.m_realm;
+    unsigned int base = asked();
+    int first = peer.request("REGISTER","secret");
+    unsigned int n1 = asked() - base;
+    int second = peer.request("REGISTER","secret");
+    int third = peer.request("REGISTER","secret");
+    unsigned int n2 = asked() - base;
+    res.clear();
+    res << "codes " << challenge << "," << first << "," << second << "," << third <<
+	" password asked " << n1 << "," << n2;
+    testReport("sipauth-hit",challenge == 401 && first == 200 && second == 200 && third == 200
+	&& n1 == 1 && n2 == 1,res);
+
+    // requests from another address or of another kind are not authorized
+    //  by the cached entry
+    base = asked();
+    int source = other.request("REGISTER","secret");
+    unsigned int n3 = asked() - base;
+    int kind = peer.request("AUTHTEST","secret");
+    unsigned int n4 = asked() - base;
+    res.clear();
+    res << "codes " << source << "," << kind << " password asked " << n3 << "," << n4;
+    testReport("sipauth-key",source == 200 && kind == 200 && n3 == 1 && n4 == 2,res);
+
+    // a response that does not match the cached password drops the entry
+    base = asked();
+    int wrong = peer.request("REGISTER","wrong");
+    unsigned int n5 = asked() - base;
+    int again = peer.request("REGISTER","secret");
+    unsigned int n6 = asked() - base;
+    res.clear();
+    res << "codes " << wrong << "," << again << " password asked " << n5 << "," << n6;
+    testReport("sipauth-mismatch",wrong >= 400 && again == 200 && n5 == 1 && n6 == 2,res);
+
+    // a changed account is asked for again, then cached again
+    Message m("user.update");
+    m.addParam("user","authtest");
+    Engine::dispatch(m);
+    base = asked();
+    int updated = peer.request("REGISTER","secret");
+    unsigned int n7 = asked() - base;
+    int cached = peer.request("REGISTER","secret");
+    unsigned int n8 = asked() - base;
+    res.clear();
+    res << "codes " << updated << "," << cached << " password asked " << n7 << "," << n8;
+    testReport("sipauth-update",updated == 200 && cached == 200 && n7 == 1 && n8 == 1,res);
+}
+
+void TestSipAuth::initialize()
+{
+    Output("Initializing module TestSipAuth");
+    if (m_init)
+	return;
+    m_init = true;
+    Engine::install(new AuthHandler("user.auth"));
+    Engine::install(new AuthHandler("user.register"));
+    Engine::install(new AuthHandler("sip.authtest"));
+    // the answers are read while the channel threads handle the requests
+    Engine::install(new TestStart<TestSipAuth>(this,"SipAuth Test"));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
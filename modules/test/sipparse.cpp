@@ -0,0 +1,383 @@
+/**
+ * sipparse.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * SIP message parser test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+#include <yatesip.h>
+#include "testcase.h"
+
+#include <string.h>
+
+using namespace TelEngine;
+
+// Messages as they are seen on the wire
+static const char* s_invite =
+    "INVITE sip:bob@biloxi.example.com SIP/2.0\r\n"
+    "Via: SIP/2.0/UDP pc33.atlanta.example.com:5060;branch=z9hG4bK776asdhds;rport\r\n"
+    "Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK4b43c2ff8.1;received=192.0.2.1\r\n"
+    "Record-Route: <sip:proxy.atlanta.example.com;lr>\r\n"
+    "Max-Forwards: 69\r\n"
+    "To: Bob <sip:bob@biloxi.example.com>\r\n"
+    "From: Alice <sip:alice@atlanta.example.com>;tag=1928301774\r\n"
+    "Call-ID: a84b4c76e66710@pc33.atlanta.example.com\r\n"
+    "CSeq: 314159 INVITE\r\n"
+    "Contact: <sip:alice@pc33.atlanta.example.com;transport=udp>\r\n"
+    "Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY, INFO\r\n"
+    "Supported: replaces, timer, 100rel\r\n"
+    "User-Agent: Softphone/1.2.3\r\n"
+    "P-Asserted-Identity: \"Alice\" <sip:alice@atlanta.example.com>\r\n"
+    "Session-Expires: 1800;refresher=uac\r\n"
+    "Content-Type: application/sdp\r\n"
+    "Content-Length: 142\r\n"
+    "\r\n"
+    "v=0\r\n"
+    "o=alice 2890844526 2890844526 IN IP4 pc33.atlanta.example.com\r\n"
+    "s=-\r\n"
+    "c=IN IP4 192.0.2.101\r\n"
+    "t=0 0\r\n"
+    "m=audio 49172 RTP/AVP 0\r\n"
+    "a=rtpmap:0 PCMU/8000\r\n";
+
+static const char* s_ok =
+    "SIP/2.0 200 OK\r\n"
+    "Via: SIP/2.0/UDP pc33.atlanta.example.com:5060;branch=z9hG4bK776asdhds;rport=5060\r\n"
+    "Record-Route: <sip:proxy2.biloxi.example.com;lr>, <sip:proxy.atlanta.example.com;lr>\r\n"
+    "Record-Route: <sip:edge.biloxi.example.com;lr>\r\n"
+    "To: Bob <sip:bob@biloxi.example.com>;tag=a6c85cf\r\n"
+    "From: Alice <sip:alice@atlanta.example.com>;tag=1928301774\r\n"
+    "Call-ID: a84b4c76e66710@pc33.atlanta.example.com\r\n"
+    "CSeq: 314159 INVITE\r\n"
+    "Contact: <sip:bob@192.0.2.4>\r\n"
+    "Allow: INVITE, ACK, CANCEL, OPTIONS, BYE\r\n"
+    "Server: PBX/4.0\r\n"
+    "Content-Type: application/sdp\r\n"
+    "Content-Length: 131\r\n"
+    "\r\n"
+    "v=0\r\n"
+    "o=bob 2808844564 2808844564 IN IP4 biloxi.example.com\r\n"
+    "s=-\r\n"
+    "c=IN IP4 192.0.2.4\r\n"
+    "t=0 0\r\n"
+    "m=audio 3456 RTP/AVP 0\r\n"
+    "a=rtpmap:0 PCMU/8000\r\n";
+
+static const char* s_register =
+    "REGISTER sip:registrar.biloxi.example.com SIP/2.0\r\n"
+    "Via: SIP/2.0/TCP bobspc.biloxi.example.com:5060;branch=z9hG4bKnashds7;alias\r\n"
+    "Max-Forwards: 70\r\n"
+    "To: Bob <sip:bob@biloxi.example.com>\r\n"
+    "From: Bob <sip:bob@biloxi.example.com>;tag=456248\r\n"
+    "Call-ID: 843817637684230@998sdasdh09\r\n"
+    "CSeq: 1826 REGISTER\r\n"
+    "Contact: <sip:bob@192.0.2.4>;expires=7200;+sip.instance=\"<urn:uuid:00000000-0000-1000-8000-000A95A0E128>\"\r\n"
+    "Authorization: Digest username=\"bob\", realm=\"biloxi.example.com\",\r\n"
+    "  nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\", uri=\"sip:registrar.biloxi.example.com\",\r\n"
+    "  response=\"6629fae49393a05397450978507c4ef1\", algorithm=MD5\r\n"
+    "Expires: 7200\r\n"
+    "User-Agent: Softphone/1.2.3\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+static const char* s_compact =
+    "OPTIONS sip:carol@chicago.example.com SIP/2.0\n"
+    "v: SIP/2.0/UDP pc33.atlanta.example.com;branch=z9hG4bKhjhs8ass877\n"
+    "t: <sip:carol@chicago.example.com>\n"
+    "f: Alice <sip:alice@atlanta.example.com>;tag=1928301774\n"
+    "i: a84b4c76e66710\n"
+    "CSeq: 63104 OPTIONS\n"
+    "m: <sip:alice@pc33.atlanta.example.com>\n"
+    "s: folded\n"
+    "\tsubject  \n"
+    "X:  custom\n"
+    "l: 0\n"
+    "\n";
+
+static const char* s_corpus[] = { s_invite, s_ok, s_register, s_compact, 0 };
+
+class TestSipParse : public Plugin
+{
+public:
+    TestSipParse();
+    virtual void initialize();
+    void run();
+    void bench(unsigned int count);
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestSipParse);
+
+
+// Split the header lines of a message and build all of them, like it was done
+//  before header lines were built on first use
+static String eagerHeaders(const char* buf)
+{
+    String res;
+    int len = ::strlen(buf);
+    String* line = MimeBody::getUnfoldedLine(buf,len);
+    TelEngine::destruct(line);
+    while (len > 0) {
+	line = MimeBody::getUnfoldedLine(buf,len);
+	if (line->null()) {
+	    TelEngine::destruct(line);
+	    break;
+	}
+	int col = line->find(':');
+	String name = line->substr(0,col);
+	name.trimBlanks();
+	static const char* compact[] = {
+	    "v", "Via", "t", "To", "f", "From", "i", "Call-ID",
+	    "m", "Contact", "s", "Subject", "l", "Content-Length", 0 };
+	for (const char** p = compact; *p; p += 2)
+	    if (name == p[0])
+		name = p[1];
+	*line >> ":";
+	line->trimBlanks();
+	MimeHeaderLine* hl = (name &= "Authorization") ?
+	    new MimeAuthLine(name,*line) : new MimeHeaderLine(name,*line);
+	hl->buildLine(res);
+	res << "\r\n";
+	TelEngine::destruct(hl);
+	TelEngine::destruct(line);
+    }
+    return res;
+}
+
+// What the engine and channel look at in most incoming messages
+static unsigned int touch(const SIPMessage* msg)
+{
+    unsigned int n = 0;
+    if (msg->getParam("Via","branch"))
+	n++;
+    if (msg->getHeader("Call-ID"))
+	n++;
+    if (msg->getParam("From","tag"))
+	n++;
+    if (msg->getParam("To","tag"))
+	n++;
+    if (msg->getHeader("Contact"))
+	n++;
+    return n + msg->getCSeq();
+}
+
+
+TestSipParse::TestSipParse()
+    : Plugin("testsipparse"),
+      m_init(false)
+{
+    Output("Hello, I am module TestSipParse");
+}
+
+// Parse the corpus over and over, with the headers built on use or all of them
+void TestSipParse::bench(unsigned int count)
+{
+    unsigned int sum[2] = { 0, 0 };
+    u_int64_t spent[2] = { 0, 0 };
+    for (int eager = 0; eager < 2; eager++) {
+	u_int64_t t = Time::now();
+	for (unsigned int i = 0; i < count; i++) {
+	    for (const char** p = s_corpus; *p; p++) {
+		SIPMessage* msg = SIPMessage::fromParsing(0,*p);
+		if (!msg)
+		    continue;
+		if (eager)
+		    msg->parseHeaders();
+		sum[eager] += touch(msg);
+		TelEngine::destruct(msg);
+	    }
+	}
+	spent[eager] = Time::now() - t;
+	if (!spent[eager])
+	    spent[eager] = 1;
+    }
+    u_int64_t msgs = (u_int64_t)count * (sizeof(s_corpus) / sizeof(s_corpus[0]) - 1);
+    Output("SIP parser %u messages: lazy %u msg/sec, %u ns each; eager %u msg/sec, %u ns each%s",
+	(unsigned int)msgs,
+	(unsigned int)(msgs * 1000000 / spent[0]),(unsigned int)(spent[0] * 1000 / msgs),
+	(unsigned int)(msgs * 1000000 / spent[1]),(unsigned int)(spent[1] * 1000 / msgs),
+	(sum[0] == sum[1]) ? "" : " (results differ!)");
+}
+
+void TestSipParse::run()
+{
+    // all headers come out exactly as when they were all parsed upfront
+    int i = 0;
+    for (const char** p = s_corpus; *p; p++, i++) {
+	SIPMessage* msg = SIPMessage::fromParsing(0,*p);
+	String lazy;
+	if (msg) {
+	    lazy = msg->getHeaders();
+	    lazy = lazy.substr(lazy.find('\n') + 1);
+	}
+	String eager = eagerHeaders(*p);
+	testReport("sipparse-equal",msg && (lazy == eager),
+	    "message " + String(i) + (msg ? "" : " not parsed"));
+	if (lazy != eager)
+	    Output("Lazy:\r\n%s\r\nEager:\r\n%s",lazy.c_str(),eager.c_str());
+	TelEngine::destruct(msg);
+    }
+
+    // headers asked for are built without filling the header list
+    SIPMessage* pm = SIPMessage::fromParsing(0,s_invite);
+    if (!pm) {
+	testReport("sipparse-lazy",false,"INVITE not parsed");
+	return;
+    }
+    unsigned int before = pm->header.count();
+    const NamedString* br = pm->getParam("Via","branch");
+    unsigned int after = pm->header.count();
+    String res;
+    res << "list " << before << "/" << after << " branch " << (br ? br->c_str() : "(none)")
+	<< " cseq " << pm->getCSeq();
+    // only the nameless line marking the place of the parsed ones is listed
+    testReport("sipparse-lazy",(before == 1) && (after == 1) && br
+	&& (*br == YSTRING("z9hG4bK776asdhds")) && (pm->getCSeq() == 314159),res);
+
+    // headers added or removed before the rest is built keep their place
+    pm->header.insert(new MimeHeaderLine("Via","SIP/2.0/UDP inserted"));
+    pm->addHeader("Via","SIP/2.0/UDP added");
+    pm->clearHeaders("Record-Route");
+    pm->setHeader("Max-Forwards","68");
+    int vias = pm->countHeaders("Via");
+    const String& first = pm->getHeaderValue("Via");
+    const String& last = pm->getHeaderValue("Via",true);
+    res.clear();
+    res << "vias " << vias << " first '" << first << "' last '" << last << "'";
+    bool ok = (vias == 4) && (first == YSTRING("SIP/2.0/UDP inserted"))
+	&& (last == YSTRING("SIP/2.0/UDP added"));
+    // the text of the lines comes in the same order without building them
+    ObjList hdrs;
+    pm->getHeaderLines(hdrs);
+    String text;
+    for (ObjList* l = hdrs.skipNull(); l; l = l->skipNext()) {
+	const NamedString* ns = static_cast<const NamedString*>(l->get());
+	text << ns->name() << ": " << *ns << "\r\n";
+    }
+    pm->parseHeaders();
+    String names;
+    String built;
+    for (ObjList* l = pm->header.skipNull(); l; l = l->skipNext()) {
+	const MimeHeaderLine* hl = static_cast<const MimeHeaderLine*>(l->get());
+	names.append(hl->name(),",");
+	hl->buildLine(built);
+	built << "\r\n";
+    }
+    res << " order " << names;
+    testReport("sipparse-order",ok && (names == "Via,Via,Via,To,From,Call-ID,CSeq,Contact,Allow,Supported,"
+	"User-Agent,P-Asserted-Identity,Session-Expires,Content-Type,Content-Length,Via,Max-Forwards"),res);
+    testReport("sipparse-lines",text == built,"lines " + String(hdrs.count()));
+    if (text != built)
+	Output("Lines:\r\n%s\r\nBuilt:\r\n%s",text.c_str(),built.c_str());
+    TelEngine::destruct(pm);
+
+    // compact names are expanded and folded lines joined
+    SIPMessage* msg = SIPMessage::fromParsing(0,s_compact);
+    res.clear();
+    if (msg)
+	res << "call '" << msg->getHeaderValue("Call-ID") << "' subject '" << msg->getHeaderValue("Subject")
+	    << "' custom '" << msg->getHeaderValue("x") << "' contacts " << msg->countHeaders("Contact");
+    testReport("sipparse-compact",msg && (msg->getHeaderValue("Call-ID") == YSTRING("a84b4c76e66710"))
+	&& (msg->getHeaderValue("Subject") == YSTRING("foldedsubject"))
+	&& (msg->getHeaderValue("X") == YSTRING("custom")) && (msg->countHeaders("Contact") == 1)
+	&& msg->getParam("From","tag") && msg->getHeader("Content-Length"),res);
+    TelEngine::destruct(msg);
+
+    // authentication lines are built as such, with their parameters
+    msg = SIPMessage::fromParsing(0,s_register);
+    const MimeAuthLine* auth = msg ? YOBJECT(MimeAuthLine,msg->getHeader("Authorization")) : 0;
+    const String& user = msg ? msg->getParamValue("Authorization","username") : String::empty();
+    res.clear();
+    res << "auth " << (auth ? "yes" : "no") << " user " << user;
+    testReport("sipparse-auth",auth && (user == YSTRING("\"bob\"")),res);
+    TelEngine::destruct(msg);
+
+    // answers take their method from CSeq and get the body
+    msg = SIPMessage::fromParsing(0,s_ok);
+    res.clear();
+    if (msg)
+	res << "method " << msg->method << " body " << (msg->body ? msg->body->getType().c_str() : "(none)")
+	    << " routes " << msg->countHeaders("Record-Route");
+    ObjList* routes = msg ? msg->getRoutes() : 0;
+    testReport("sipparse-answer",msg && msg->isAnswer() && (msg->method == YSTRING("INVITE"))
+	&& msg->body && (msg->body->getType() == YSTRING("application/sdp"))
+	&& routes && (routes->count() == 3),res);
+    TelEngine::destruct(routes);
+
+    // a copy has all the headers but CSeq
+    SIPMessage* copy = msg ? new SIPMessage(*msg) : 0;
+    res.clear();
+    if (copy)
+	res << "headers " << copy->header.count() << " cseq " << copy->countHeaders("CSeq");
+    testReport("sipparse-copy",copy && (copy->header.count() == 11) && !copy->countHeaders("CSeq"),res);
+    TelEngine::destruct(copy);
+    TelEngine::destruct(msg);
+
+    // first lines are accepted exactly as the expressions used before did
+    static const char* lines[] = {
+	"SIP/2.0 180 Ringing", "180 SIP/2.0 Ringing",
+	"sip/2.0 404  \tNot Found", "404 SIP/2.0 Not Found",
+	"SIP/2.0 200", 0,
+	"SIP/2.0 2000 OK", 0,
+	"ack  sip:bob@example.com\tSIP/2.0", "ACK sip:bob@example.com SIP/2.0",
+	"INVITE sip:bob@example.com SIP/2.0 x", 0,
+	"INV1TE sip:bob@example.com SIP/2.0", 0,
+	"INVITE sip:bob@example.com SIP/2", 0,
+	"REGISTER sip:example.com SIP/2.10", "REGISTER sip:example.com SIP/2.10",
+	0, 0 };
+    res.clear();
+    ok = true;
+    for (const char** p = lines; *p; p += 2) {
+	msg = SIPMessage::fromParsing(0,String(*p) + "\r\nContent-Length: 0\r\n\r\n");
+	String got;
+	if (msg) {
+	    if (msg->isAnswer())
+		got << msg->code << " " << msg->version << " " << msg->reason;
+	    else
+		got << msg->method << " " << msg->uri << " " << msg->version;
+	}
+	if (p[1] ? (got != p[1]) : (0 != msg)) {
+	    ok = false;
+	    res.append("'" + String(*p) + "' got '" + got + "'"," ");
+	}
+	TelEngine::destruct(msg);
+    }
+    testReport("sipparse-first",ok,ok ? "all matched" : res.c_str());
+
+    // broken header lines still fail the whole message
+    msg = SIPMessage::fromParsing(0,"INVITE sip:x@y SIP/2.0\r\nVia: SIP/2.0/UDP a\r\nBroken\r\n\r\n");
+    SIPMessage* msg2 = SIPMessage::fromParsing(0,"INVITE sip:x@y SIP/2.0\r\n: empty\r\n\r\n");
+    testReport("sipparse-invalid",!msg && !msg2,"broken lines rejected");
+    TelEngine::destruct(msg);
+    TelEngine::destruct(msg2);
+
+    bench(2000);
+    bench(20000);
+}
+
+void TestSipParse::initialize()
+{
+    Output("Initializing module TestSipParse");
+    if (m_init)
+	return;
+    m_init = true;
+    Engine::install(new TestStart<TestSipParse>(this));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
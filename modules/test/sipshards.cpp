@@ -0,0 +1,252 @@
+/**
+ * sipshards.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * SIP engine shards test
+ * Needs the ysipchan module listening on UDP with engine_shards set to 2 or more
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+#include <yatesip.h>
+#include "testcase.h"
+
+using namespace TelEngine;
+
+// Number of requests of each kind sent to every shard
+#define PER_SHARD 4
+
+// Talks to the SIP listener over UDP like a phone would
+class SipPeer
+{
+public:
+    inline SipPeer()
+	: m_branch(0)
+	{ }
+    bool init(const String& addr, int port);
+    // Send a request in a new transaction
+    void request(const String& method, const String& callId, unsigned int cseq);
+    // Acknowledge a non 2xx final answer to an INVITE
+    void ack(const SIPMessage* answer);
+    // Wait for the next message, returns NULL on timeout
+    SIPMessage* receive(u_int64_t usec);
+private:
+    void send(const String& msg);
+    Socket m_sock;
+    SocketAddr m_remote;
+    String m_local;
+    unsigned int m_branch;
+};
+
+class TestSipShards : public Plugin
+{
+public:
+    TestSipShards();
+    virtual void initialize();
+    void run();
+private:
+    bool m_init;
+};
+
+// Routes the test calls to a busy destination
+class BusyRoute : public MessageHandler
+{
+public:
+    inline BusyRoute()
+	: MessageHandler("call.route",10,"testsipshards")
+	{ }
+    virtual bool received(Message& msg);
+};
+
+INIT_PLUGIN(TestSipShards);
+
+
+bool SipPeer::init(const String& addr, int port)
+{
+    m_remote.assign(SocketAddr::IPv4);
+    m_remote.host(addr);
+    m_remote.port(port);
+    SocketAddr local(SocketAddr::IPv4);
+    local.host("127.0.0.1");
+    if (!(m_sock.create(SocketAddr::IPv4,SOCK_DGRAM) && m_sock.bind(local)
+	&& m_sock.getSockName(local)))
+	return false;
+    m_local = local.host() + ":" + String(local.port());
+    return true;
+}
+
+void SipPeer::send(const String& msg)
+{
+    m_sock.sendTo(msg.c_str(),msg.length(),m_remote);
+}
+
+void SipPeer::request(const String& method, const String& callId, unsigned int cseq)
+{
+    String msg;
+    msg << method << " sip:shardtest@" << m_remote.host() << " SIP/2.0\r\n";
+    msg << "Via: SIP/2.0/UDP " << m_local << ";branch=z9hG4bKshard" << ++m_branch << "\r\n";
+    msg << "Max-Forwards: 70\r\n";
+    msg << "From: <sip:tester@" << m_local << ">;tag=shard" << m_branch << "\r\n";
+    msg << "To: <sip:shardtest@" << m_remote.host() << ">\r\n";
+    msg << "Call-ID: " << callId << "\r\n";
+    msg << "CSeq: " << cseq << " " << method << "\r\n";
+    msg << "Contact: <sip:tester@" << m_local << ">\r\n";
+    msg << "Content-Length: 0\r\n\r\n";
+    send(msg);
+}
+
+void SipPeer::ack(const SIPMessage* answer)
+{
+    // the ACK of a failed INVITE is part of its transaction
+    const NamedString* branch = answer->getParam("Via","branch");
+    const NamedString* from = answer->getParam("From","tag");
+    const NamedString* to = answer->getParam("To","tag");
+    String msg;
+    msg << "ACK sip:shardtest@" << m_remote.host() << " SIP/2.0\r\n";
+    msg << "Via: SIP/2.0/UDP " << m_local << ";branch=" << TelEngine::c_safe(branch) << "\r\n";
+    msg << "Max-Forwards: 70\r\n";
+    msg << "From: <sip:tester@" << m_local << ">;tag=" << TelEngine::c_safe(from) << "\r\n";
+    msg << "To: <sip:shardtest@" << m_remote.host() << ">;tag=" << TelEngine::c_safe(to) << "\r\n";
+    msg << "Call-ID: " << answer->getHeaderValue("Call-ID") << "\r\n";
+    msg << "CSeq: " << answer->getCSeq() << " ACK\r\n";
+    msg << "Content-Length: 0\r\n\r\n";
+    send(msg);
+}
+
+SIPMessage* SipPeer::receive(u_int64_t usec)
+{
+    bool ok = false;
+    if (!(m_sock.select(&ok,0,0,(int64_t)usec) && ok))
+	return 0;
+    char buf[4096];
+    int len = m_sock.recvFrom(buf,sizeof(buf) - 1);
+    if (len <= 0)
+	return 0;
+    buf[len] = '\0';
+    return SIPMessage::fromParsing(0,buf,len);
+}
+
+
+bool BusyRoute::received(Message& msg)
+{
+    if (msg[YSTRING("called")] != YSTRING("shardtest"))
+	return false;
+    msg.setParam("error","busy");
+    return true;
+}
+
+
+TestSipShards::TestSipShards()
+    : Plugin("testsipshards"),
+      m_init(false)
+{
+    Output("Hello, I am module TestSipShards");
+}
+
+void TestSipShards::run()
+{
+    // use the same settings as the SIP channel
+    Configuration cfg(Engine::configFile("ysipchan"));
+    unsigned int shards = cfg.getIntValue("general","engine_shards",1,1);
+    String addr = cfg.getValue("listener general","addr");
+    if (addr.null() || addr == YSTRING("0.0.0.0"))
+	addr = "127.0.0.1";
+    int port = cfg.getIntValue("listener general","port",5060);
+    SipPeer peer;
+    bool ok = (shards > 1) && peer.init(addr,port);
+    String res;
+    res << "engine_shards=" << shards << " listener " << addr << ":" << port;
+    testReport("sipshards-setup",ok,res);
+    if (!ok)
+	return;
+
+    // pick Call-IDs so each shard gets the same number of them
+    ObjList ids;
+    unsigned int* count = new unsigned int[shards];
+    for (unsigned int i = 0; i < shards; i++)
+	count[i] = 0;
+    for (unsigned int n = 0; ids.count() < shards * PER_SHARD; n++) {
+	String* id = new String("shardtest-");
+	*id << n << "@" << addr;
+	unsigned int shard = id->hash() % shards;
+	if (count[shard] >= PER_SHARD) {
+	    TelEngine::destruct(id);
+	    continue;
+	}
+	count[shard]++;
+	ids.append(id);
+    }
+    delete[] count;
+
+    // every shard answers the requests of its own Call-IDs
+    for (ObjList* o = ids.skipNull(); o; o = o->skipNext())
+	peer.request("OPTIONS",o->get()->toString(),1);
+    ObjList answered;
+    SIPMessage* msg;
+    while ((msg = peer.receive(2000000))) {
+	const String& id = msg->getHeaderValue("Call-ID");
+	if (msg->code == 200 && ids.find(id) && !answered.find(id))
+	    answered.append(new String(id));
+	TelEngine::destruct(msg);
+	if (answered.count() == ids.count())
+	    break;
+    }
+    res.clear();
+    res << answered.count() << "/" << ids.count() << " answered";
+    testReport("sipshards-options",answered.count() == ids.count(),res);
+
+    // calls on all shards fail and their ACK is matched by the shard that
+    //  sent the answer, otherwise the answer is sent again
+    for (ObjList* o = ids.skipNull(); o; o = o->skipNext())
+	peer.request("INVITE",o->get()->toString(),1);
+    ObjList failed;
+    unsigned int again = 0;
+    u_int64_t stop = Time::now() + 5000000;
+    while (Time::now() < stop) {
+	msg = peer.receive(stop - Time::now());
+	if (!msg)
+	    break;
+	const String& id = msg->getHeaderValue("Call-ID");
+	if (msg->code >= 300 && ids.find(id)) {
+	    if (failed.find(id))
+		again++;
+	    else {
+		failed.append(new String(id));
+		peer.ack(msg);
+		// wait for retransmissions of the answers longer than T1
+		if (failed.count() == ids.count())
+		    stop = Time::now() + 1500000;
+	    }
+	}
+	TelEngine::destruct(msg);
+    }
+    res.clear();
+    res << failed.count() << "/" << ids.count() << " rejected, " << again << " answers sent again";
+    testReport("sipshards-invite",(failed.count() == ids.count()) && !again,res);
+}
+
+void TestSipShards::initialize()
+{
+    Output("Initializing module TestSipShards");
+    if (m_init)
+	return;
+    m_init = true;
+    Engine::install(new BusyRoute);
+    // the answers are read while the channel threads handle the requests
+    Engine::install(new TestStart<TestSipShards>(this,"SipShards Test"));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,347 @@
+/**
+ * siptrans.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * SIP transaction matching test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+#include <yatesip.h>
+#include "testcase.h"
+
+#include <string.h>
+
+using namespace TelEngine;
+
+// Engine that never sends anything, it only matches messages
+class TransTestEngine : public SIPEngine
+{
+public:
+    inline TransTestEngine()
+	{
+	    debugLevel(DebugWarn);
+	    addAllowed("INVITE");
+	    addAllowed("OPTIONS");
+	}
+    virtual ~TransTestEngine()
+	{ clearTransactions(); }
+    virtual bool buildParty(SIPMessage* message)
+	{ return false; }
+    virtual void allocTraceId(String& id)
+	{ }
+    virtual void traceMsg(SIPMessage* message, bool incoming)
+	{ }
+    // Match a message by walking all transactions like it was done before indexing
+    SIPTransaction* linear(SIPMessage* message, const String& branch);
+    // Look for an event in all transactions like it was done before queueing
+    SIPEvent* linearEvent();
+    inline void setT1(u_int64_t usec)
+	{ m_t1 = usec; }
+};
+
+class TestSipTrans : public Plugin
+{
+public:
+    TestSipTrans();
+    virtual void initialize();
+    void run();
+    void bench(unsigned int count);
+    void benchEvents(unsigned int count);
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestSipTrans);
+
+
+SIPTransaction* TransTestEngine::linear(SIPMessage* message, const String& branch)
+{
+    Lock lock(this);
+    for (ObjList* l = m_transList.skipNull(); l; l = l->skipNext()) {
+	SIPTransaction* t = static_cast<SIPTransaction*>(l->get());
+	if (t->processMessage(message,branch) == SIPTransaction::Matched)
+	    return t;
+    }
+    return 0;
+}
+
+SIPEvent* TransTestEngine::linearEvent()
+{
+    Lock lock(this);
+    u_int64_t time = Time::now();
+    for (ObjList* l = m_transList.skipNull(); l; l = l->skipNext()) {
+	SIPEvent* e = static_cast<SIPTransaction*>(l->get())->getEvent(true,time);
+	if (e)
+	    return e;
+    }
+    for (ObjList* l = m_transList.skipNull(); l; l = l->skipNext()) {
+	SIPEvent* e = static_cast<SIPTransaction*>(l->get())->getEvent(false,time);
+	if (e)
+	    return e;
+    }
+    return 0;
+}
+
+
+// Build an incoming request, an empty branch makes it look like a RFC 2543 one
+static SIPMessage* request(const char* method, const String& branch, const String& callid,
+    int cseq = 1, const char* toTag = 0)
+{
+    String buf;
+    buf << method << " sip:bob@example.com SIP/2.0\r\n";
+    buf << "Via: SIP/2.0/UDP 192.168.0.1:5060";
+    if (branch)
+	buf << ";branch=" << branch;
+    buf << "\r\nFrom: <sip:alice@example.com>;tag=1928301774\r\n";
+    buf << "To: <sip:bob@example.com>";
+    if (toTag)
+	buf << ";tag=" << toTag;
+    buf << "\r\nCall-ID: " << callid << "\r\n";
+    buf << "CSeq: " << cseq << " " << (::strcmp(method,"ACK") ? method : "INVITE") << "\r\n";
+    buf << "Max-Forwards: 70\r\nContent-Length: 0\r\n\r\n";
+    return SIPMessage::fromParsing(0,buf);
+}
+
+// Add a request to the engine and return the transaction that took it
+static SIPTransaction* add(SIPEngine& engine, SIPMessage* msg)
+{
+    SIPTransaction* t = msg ? engine.addMessage(msg) : 0;
+    TelEngine::destruct(msg);
+    return t;
+}
+
+// Get all the events that are due now and return how many there were
+static unsigned int drain(SIPEngine& engine, unsigned int* outgoing = 0)
+{
+    unsigned int n = 0;
+    while (SIPEvent* e = engine.getEvent()) {
+	if (outgoing && e->isOutgoing())
+	    (*outgoing)++;
+	delete e;
+	n++;
+    }
+    return n;
+}
+
+
+TestSipTrans::TestSipTrans()
+    : Plugin("testsiptrans"),
+      m_init(false)
+{
+    Output("Hello, I am module TestSipTrans");
+}
+
+// Match retransmissions of random requests among many transactions
+void TestSipTrans::bench(unsigned int count)
+{
+    TransTestEngine engine;
+    for (unsigned int i = 0; i < count; i++) {
+	String id(i);
+	// one in ten peers is an old RFC 2543 one
+	add(engine,request((i % 3) ? "INVITE" : "REGISTER",
+	    (i % 10) ? ("z9hG4bKbench" + id) : String::empty(),"bench" + id));
+    }
+    unsigned int packets = 20000;
+    ObjList msgs;
+    for (unsigned int i = 0; i < packets; i++) {
+	String id(Random::random() % count);
+	unsigned int n = id.toInteger();
+	msgs.append(request((n % 3) ? "INVITE" : "REGISTER",
+	    (n % 10) ? ("z9hG4bKbench" + id) : String::empty(),"bench" + id));
+    }
+    // look at each packet once so both walks find them in the same cache state
+    for (ObjList* l = msgs.skipNull(); l; l = l->skipNext())
+	static_cast<SIPMessage*>(l->get())->getParam("Via","branch",true);
+    unsigned int matched = 0;
+    u_int64_t t = Time::now();
+    for (ObjList* l = msgs.skipNull(); l; l = l->skipNext())
+	if (engine.addMessage(static_cast<SIPMessage*>(l->get())))
+	    matched++;
+    t = Time::now() - t;
+    if (!t)
+	t = 1;
+    // the old linear walk is too slow to run on all packets
+    unsigned int slow = packets / 20;
+    u_int64_t t2 = Time::now();
+    ObjList* l = msgs.skipNull();
+    for (unsigned int i = 0; l && (i < slow); i++, l = l->skipNext()) {
+	SIPMessage* m = static_cast<SIPMessage*>(l->get());
+	const NamedString* br = m->getParam("Via","branch",true);
+	engine.linear(m,br ? *br : String::empty());
+    }
+    t2 = Time::now() - t2;
+    if (!t2)
+	t2 = 1;
+    Output("SIP transactions %u: hashed %u packets/sec (%u matched), linear %u packets/sec",
+	engine.transactionCount(),(unsigned int)((u_int64_t)packets * 1000000 / t),matched,
+	(unsigned int)((u_int64_t)slow * 1000000 / t2));
+}
+
+// Look for events when most transactions have nothing to do
+void TestSipTrans::benchEvents(unsigned int count)
+{
+    TransTestEngine engine;
+    for (unsigned int i = 0; i < count; i++) {
+	String id(i);
+	add(engine,request("INVITE","z9hG4bKidle" + id,"idle" + id));
+    }
+    drain(engine);
+    unsigned int calls = 2000;
+    u_int64_t t = Time::now();
+    for (unsigned int i = 0; i < calls; i++)
+	delete engine.getEvent();
+    t = Time::now() - t;
+    unsigned int slow = calls / 20;
+    u_int64_t t2 = Time::now();
+    for (unsigned int i = 0; i < slow; i++)
+	delete engine.linearEvent();
+    t2 = Time::now() - t2;
+    Output("SIP transactions %u idle: queued %u ns per getEvent, linear %u ns per getEvent",
+	engine.transactionCount(),(unsigned int)(t * 1000 / calls),
+	(unsigned int)(t2 * 1000 / slow));
+}
+
+void TestSipTrans::run()
+{
+    TransTestEngine engine;
+
+    // retransmissions are matched by branch
+    SIPTransaction* t1 = add(engine,request("INVITE","z9hG4bKaaa","call1@test"));
+    SIPTransaction* t = add(engine,request("INVITE","z9hG4bKaaa","call1@test"));
+    String res;
+    res << "transactions " << engine.transactionCount();
+    testReport("siptrans-branch",t1 && (t == t1) && (engine.transactionCount() == 1),res);
+
+    // a CANCEL has the branch of the INVITE but is a transaction of its own
+    t = add(engine,request("CANCEL","z9hG4bKaaa","call1@test"));
+    SIPTransaction* t2 = add(engine,request("CANCEL","z9hG4bKaaa","call1@test"));
+    res.clear();
+    res << "transactions " << engine.transactionCount();
+    testReport("siptrans-method",t && (t != t1) && (t2 == t) && (engine.transactionCount() == 2),res);
+
+    // the ACK to a failure has the branch of the INVITE
+    t1->setResponse(486);
+    t = add(engine,request("ACK","z9hG4bKaaa","call1@test",1,t1->getDialogTag()));
+    res.clear();
+    res << "state " << SIPTransaction::stateName(t1->getState());
+    testReport("siptrans-ack",(t == t1) && (t1->getState() == SIPTransaction::Cleared),res);
+
+    // the ACK to a 2xx has a new branch, it is matched by Call-ID
+    t1 = add(engine,request("INVITE","z9hG4bKbbb","call2@test",5));
+    t1->setResponse(200);
+    t = add(engine,request("ACK","z9hG4bKccc","call2@test",5,t1->getDialogTag()));
+    t2 = add(engine,request("ACK","z9hG4bKccc","call2@test",5,"other"));
+    res.clear();
+    res << "state " << SIPTransaction::stateName(t1->getState());
+    testReport("siptrans-ack2xx",(t == t1) && !t2 && (t1->getState() == SIPTransaction::Cleared),res);
+
+    // RFC 2543 requests without a branch are matched by Call-ID and CSeq
+    t1 = add(engine,request("OPTIONS","","call3@test",1));
+    t = add(engine,request("OPTIONS","","call3@test",1));
+    t2 = add(engine,request("OPTIONS","","call3@test",2));
+    SIPTransaction* t3 = add(engine,request("OPTIONS","rfc2543branch","call3@test",1));
+    res.clear();
+    res << "transactions " << engine.transactionCount();
+    testReport("siptrans-rfc2543",t1 && (t == t1) && t2 && (t2 != t1) && (t3 == t1),res);
+
+    // removed transactions are not matched anymore
+    unsigned int before = engine.transactionCount();
+    engine.remove(t1);
+    TelEngine::destruct(t1);
+    t = add(engine,request("OPTIONS","","call3@test",1));
+    res.clear();
+    res << "transactions " << before << " -> " << engine.transactionCount();
+    testReport("siptrans-remove",t && (t != t2) && (engine.transactionCount() == before),res);
+
+    // a message matches the same transaction as the old list walk
+    unsigned int same = 0;
+    for (int i = 0; i < 100; i++) {
+	String id(i);
+	add(engine,request("REGISTER",(i % 2) ? ("z9hG4bKr" + id) : String::empty(),"reg" + id,i));
+    }
+    for (int i = 0; i < 100; i++) {
+	String id(i);
+	String br;
+	if (i % 2)
+	    br = "z9hG4bKr" + id;
+	SIPMessage* m = request("REGISTER",br,"reg" + id,i);
+	if (engine.linear(m,br) == engine.addMessage(m))
+	    same++;
+	TelEngine::destruct(m);
+    }
+    res.clear();
+    res << "same match for " << same << " of 100";
+    testReport("siptrans-linear",same == 100,res);
+    engine.clearTransactions();
+
+    // a new server transaction sends 100 Trying and reports the request
+    TransTestEngine events;
+    events.setT1(5000);
+    t1 = add(events,request("INVITE","z9hG4bKev1","ev1@test"));
+    unsigned int out = 0;
+    unsigned int n = drain(events,&out);
+    res.clear();
+    res << "events " << n << " outgoing " << out << " state "
+	<< SIPTransaction::stateName(t1->getState());
+    testReport("siptrans-events",(n == 2) && (out == 1) && (t1->getState() == SIPTransaction::Process)
+	&& !events.getEvent(),res);
+
+    // an answer wakes up the transaction, retransmissions follow its timer
+    u_int64_t start = Time::now();
+    t1->setResponse(486);
+    out = 0;
+    n = drain(events,&out);
+    unsigned int retrans = 0;
+    while (events.transactionCount() && (Time::now() - start < 2000000)) {
+	Thread::msleep(1);
+	drain(events,&retrans);
+    }
+    unsigned int spent = (unsigned int)((Time::now() - start) / 1000);
+    res.clear();
+    res << "answer " << n << " retransmissions " << retrans << " cleared after " << spent << " ms";
+    // timer G doubles from T1 for 6 times before giving up
+    testReport("siptrans-timer",(n == 1) && (out == 1) && (retrans == 5)
+	&& !events.transactionCount() && (spent >= 310) && (spent < 500),res);
+
+    // a transaction that is not in the list is never picked up again
+    t1 = add(events,request("OPTIONS","z9hG4bKev2","ev2@test"));
+    t1->ref();
+    events.remove(t1);
+    t1->deref();
+    t1->setResponse(200);
+    res.clear();
+    res << "transactions " << events.transactionCount();
+    testReport("siptrans-removed",!events.getEvent() && !events.transactionCount(),res);
+    TelEngine::destruct(t1);
+
+    bench(1000);
+    bench(10000);
+    bench(20000);
+    benchEvents(1000);
+    benchEvents(20000);
+}
+
+void TestSipTrans::initialize()
+{
+    Output("Initializing module TestSipTrans");
+    if (m_init)
+	return;
+    m_init = true;
+    Engine::install(new TestStart<TestSipTrans>(this));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,228 @@
+/**
+ * srtp.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * SRTP correctness test and protect/unprotect benchmark
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+#include <yatertp.h>
+#include "testcase.h"
+
+#include <string.h>
+
+using namespace TelEngine;
+
+// Master key and salt from RFC 3711 B.3
+static const char* s_master = "inline:4fl6DT4Bi+DWT6MsBt5BOQ7Gda1Jiv7rtpYLOqvm";
+
+// Packet SSRC=DEADBEEF SEQ=1 protected with AES_CM_128_HMAC_SHA1_80 and the key above
+static const char* s_packet =
+    "80000001000000a0deadbeef5ec59c81f1796d0f3b9222cfac64ec5c472d2c3b5e0a9328"
+    "3eb446d64ee44ea4d3d5d81ca5e30c676ac3204a36ad43f5c97cf9b973";
+static const char* s_plain = "The quick brown fox jumps over the lazy dog";
+
+#define BENCH_PACKETS 200000
+#define PAYLOAD_LEN 160
+#define AUTH_LEN 10
+
+class CipherHolder : public RefObject
+{
+public:
+    inline CipherHolder()
+	: m_cipher(0)
+	{ }
+    virtual ~CipherHolder()
+	{ TelEngine::destruct(m_cipher); }
+    virtual void* getObject(const String& name) const
+	{ return (name == YATOM("Cipher*")) ? (void*)&m_cipher : RefObject::getObject(name); }
+    inline Cipher* cipher()
+	{ Cipher* tmp = m_cipher; m_cipher = 0; return tmp; }
+private:
+    Cipher* m_cipher;
+};
+
+class SrtpSession : public RTPSession
+{
+public:
+    virtual Cipher* createCipher(const String& name, Cipher::Direction dir);
+    virtual bool checkCipher(const String& name);
+};
+
+class SrtpSecure : public RTPSecure
+{
+public:
+    inline SrtpSecure()
+	: RTPSecure(String("AES_CM_128_HMAC_SHA1_80"))
+	{ }
+    inline void protect(unsigned char* packet, int len)
+	{
+	    rtpEncipher(packet + 12,len - 12);
+	    rtpAddIntegrity(packet,len,packet + len);
+	}
+    inline bool unprotect(unsigned char* packet, int len, u_int32_t ssrc, u_int64_t seq)
+	{
+	    return rtpCheckIntegrity(packet,len,packet + len,ssrc,seq)
+		&& rtpDecipher(packet + 12,len - 12,0,ssrc,seq);
+	}
+};
+
+class TestSrtp : public Plugin
+{
+public:
+    TestSrtp();
+    virtual void initialize();
+    void run();
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestSrtp);
+
+
+Cipher* SrtpSession::createCipher(const String& name, Cipher::Direction dir)
+{
+    Message msg("engine.cipher");
+    msg.addParam("cipher",name);
+    msg.addParam("direction",lookup(dir,Cipher::directions(),"unknown"));
+    CipherHolder* cHold = new CipherHolder;
+    msg.userData(cHold);
+    cHold->deref();
+    return Engine::dispatch(msg) ? cHold->cipher() : 0;
+}
+
+bool SrtpSession::checkCipher(const String& name)
+{
+    Message msg("engine.cipher");
+    msg.addParam("cipher",name);
+    return Engine::dispatch(msg);
+}
+
+
+TestSrtp::TestSrtp()
+    : Plugin("testsrtp"),
+      m_init(false)
+{
+    Output("Hello, I am module TestSrtp");
+}
+
+void TestSrtp::initialize()
+{
+    Output("Initializing module TestSrtp");
+    if (m_init)
+	return;
+    m_init = true;
+    // ciphers are provided by other modules, wait for all of them
+    Engine::install(new TestStart<TestSrtp>(this));
+}
+
+void TestSrtp::run()
+{
+    SrtpSession* session = new SrtpSession;
+    if (!session->checkCipher("aes_ctr")) {
+	Debug("srtp",DebugWarn,"Cipher aes_ctr not available, is the openssl module loaded?");
+	TelEngine::destruct(session);
+	return;
+    }
+    RTPSender* sender = new RTPSender(session,false);
+    sender->ssrcInit();
+    SrtpSecure* secure = new SrtpSecure;
+    String suite("AES_CM_128_HMAC_SHA1_80");
+    secure->setup(suite,s_master);
+    secure->owner(sender);
+
+    // known answer test
+    DataBlock pkt;
+    pkt.unHexify(s_packet);
+    unsigned char* p = (unsigned char*)pkt.data();
+    int len = pkt.length() - AUTH_LEN;
+    bool ok = secure->unprotect(p,len,0xdeadbeef,1);
+    String str((const char*)p + 12,len - 12);
+    testReport("srtp-vector",ok && (str == s_plain),"'" + str + "'");
+    p[len]++;
+    testReport("srtp-tamper",!secure->unprotect(p,len,0xdeadbeef,1),"altered tag rejected");
+
+    // each call must start on a new counter block, even after a partial one
+    Cipher* cipher = session->createCipher("aes_ctr",Cipher::Bidir);
+    if (cipher) {
+	unsigned char key[16];
+	unsigned char iv[16];
+	unsigned char stream[64];
+	unsigned char part[40];
+	for (unsigned int i = 0; i < 16; i++) {
+	    key[i] = (unsigned char)(i * 17);
+	    iv[i] = (i < 14) ? (unsigned char)(0xf0 + i) : 0xff;
+	}
+	::memset(stream,0,sizeof(stream));
+	::memset(part,0,sizeof(part));
+	ok = cipher->setKey(key,sizeof(key)) && cipher->initVector(iv,sizeof(iv))
+	    && cipher->encrypt(stream,sizeof(stream));
+	ok = cipher->initVector(iv,sizeof(iv)) && cipher->encrypt(part,20)
+	    && cipher->encrypt(part + 20,20) && ok;
+	ok = ok && (0 == ::memcmp(part,stream,20)) && (0 == ::memcmp(part + 20,stream + 32,20));
+	testReport("aes-ctr-partial",ok,"counter advanced over partial blocks");
+	TelEngine::destruct(cipher);
+    }
+    else
+	testReport("aes-ctr-partial",false,"cannot create aes_ctr cipher");
+
+    // round trip through our own sender SSRC and sequence
+    unsigned char buf[12 + PAYLOAD_LEN + AUTH_LEN];
+    unsigned char ref[12 + PAYLOAD_LEN];
+    for (unsigned int i = 0; i < sizeof(ref); i++)
+	ref[i] = (unsigned char)i;
+    len = sizeof(ref);
+    ::memcpy(buf,ref,len);
+    secure->protect(buf,len);
+    ok = (0 != ::memcmp(buf + 12,ref + 12,PAYLOAD_LEN))
+	&& secure->unprotect(buf,len,sender->ssrc(),sender->fullSeq())
+	&& (0 == ::memcmp(buf,ref,len));
+    testReport("srtp-roundtrip",ok,"payload restored");
+
+    // benchmark on a single core, warm up caches and CPU clock first
+    for (unsigned int i = 0; i < BENCH_PACKETS; i++)
+	secure->protect(buf,len);
+    u_int64_t start = Time::now();
+    for (unsigned int i = 0; i < BENCH_PACKETS; i++)
+	secure->protect(buf,len);
+    u_int64_t protTime = Time::now() - start;
+    unsigned char work[sizeof(buf)];
+    ::memcpy(buf,ref,len);
+    secure->protect(buf,len);
+    ok = true;
+    start = Time::now();
+    for (unsigned int i = 0; i < BENCH_PACKETS; i++) {
+	::memcpy(work,buf,sizeof(work));
+	ok = secure->unprotect(work,len,sender->ssrc(),sender->fullSeq()) && ok;
+    }
+    u_int64_t unprotTime = Time::now() - start;
+    if (!protTime)
+	protTime = 1;
+    if (!unprotTime)
+	unprotTime = 1;
+    Output("SRTP protect: %u packets of %u octets in " FMT64U " usec, " FMT64U " packets/s",
+	BENCH_PACKETS,PAYLOAD_LEN,protTime,(u_int64_t)BENCH_PACKETS * 1000000 / protTime);
+    Output("SRTP unprotect: %u packets of %u octets in " FMT64U " usec, " FMT64U " packets/s",
+	BENCH_PACKETS,PAYLOAD_LEN,unprotTime,(u_int64_t)BENCH_PACKETS * 1000000 / unprotTime);
+    testReport("srtp-bench",ok,"all benchmark packets authenticated");
+
+    TelEngine::destruct(secure);
+    delete sender;
+    TelEngine::destruct(session);
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
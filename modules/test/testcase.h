@@ -0,0 +1,77 @@
+/**
+ * testcase.h
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Helpers shared by the test modules
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef __TESTCASE_H
+#define __TESTCASE_H
+
+#include <yatengine.h>
+
+namespace TelEngine {
+
+// Log the outcome of a test case, the test name is used as debug name
+static inline void testReport(const char* test, bool ok, const String& result)
+{
+    if (ok)
+	Debug(test,DebugInfo,"Passed: %s",result.c_str());
+    else
+	Debug(test,DebugWarn,"Failed: %s",result.c_str());
+}
+
+// Thread running the tests of a module
+template <class T> class TestThread : public Thread
+{
+public:
+    inline TestThread(T* tests, const char* name)
+	: Thread(name), m_tests(tests)
+	{ }
+    virtual void run()
+	{ m_tests->run(); }
+private:
+    T* m_tests;
+};
+
+// Runs the tests of a module once all modules were initialized.
+// Tests that need the engine to dispatch enqueued messages run in a thread
+template <class T> class TestStart : public MessageHandler
+{
+public:
+    inline TestStart(T* tests, const char* thread = 0)
+	: MessageHandler("engine.start",150,tests->name()),
+	  m_tests(tests), m_thread(thread)
+	{ }
+    virtual bool received(Message& msg)
+	{
+	    if (m_thread)
+		(new TestThread<T>(m_tests,m_thread))->startup();
+	    else
+		m_tests->run();
+	    return false;
+	}
+private:
+    T* m_tests;
+    const char* m_thread;
+};
+
+}; // namespace TelEngine
+
+#endif /* __TESTCASE_H */
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
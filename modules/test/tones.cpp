@@ -0,0 +1,338 @@
+/**
+ * tones.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Tone detector accuracy and speed test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+#include "testcase.h"
+
+#include <string.h>
+#include <math.h>
+
+using namespace TelEngine;
+
+// Samples in 20ms of 8kHz audio
+#define FRAME_SAMPLES 160
+// Amplitude of each generated tone
+#define TONE_LEVEL 6000
+
+static const char s_digits[] = "123A456B789C*0#D";
+static const int s_freqL[] = { 697, 770, 852, 941 };
+static const int s_freqH[] = { 1209, 1336, 1477, 1633 };
+
+// What the detectors reported, one word per event
+static Mutex s_eventsMutex(false,"ToneTest");
+static String s_events;
+
+// Signal generator writing mono or one channel of stereo samples
+class ToneSignal
+{
+public:
+    inline ToneSignal(bool stereo = false)
+	: m_stereo(stereo), m_seed(1)
+	{ }
+    void tone(unsigned int msec, int f1, int f2 = 0, int channel = 0);
+    void silence(unsigned int msec);
+    void noise(unsigned int msec, int level);
+    void digits(const char* digits, unsigned int on, unsigned int off, int channel = 0);
+    inline const DataBlock& data() const
+	{ return m_data; }
+private:
+    int16_t* grow(unsigned int samples);
+    DataBlock m_data;
+    bool m_stereo;
+    unsigned int m_seed;
+};
+
+// Intercepts the messages sent by detectors attached by this test
+class ToneEvents : public MessageHandler
+{
+public:
+    inline ToneEvents()
+	: MessageHandler("chan.masquerade",10,"testtones")
+	{ }
+    virtual bool received(Message& msg);
+};
+
+class TestTones : public Plugin
+{
+public:
+    TestTones();
+    virtual void initialize();
+    void run();
+    String detect(const char* detector, const DataBlock& data, unsigned int block = FRAME_SAMPLES);
+    void bench(const char* detector, unsigned int count);
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestTones);
+
+
+int16_t* ToneSignal::grow(unsigned int samples)
+{
+    unsigned int pos = m_data.length();
+    DataBlock tmp(0,samples * (m_stereo ? 4 : 2));
+    m_data += tmp;
+    return (int16_t*)m_data.data(pos);
+}
+
+// Add one or two sine tones, on channel 0 (left) or 1 (right) if stereo
+void ToneSignal::tone(unsigned int msec, int f1, int f2, int channel)
+{
+    unsigned int samples = msec * 8;
+    int16_t* s = grow(samples);
+    int step = m_stereo ? 2 : 1;
+    if (m_stereo)
+	s += channel;
+    for (unsigned int i = 0; i < samples; i++, s += step) {
+	double t = i / 8000.0;
+	double v = TONE_LEVEL * ::sin(2 * M_PI * f1 * t);
+	if (f2)
+	    v += TONE_LEVEL * ::sin(2 * M_PI * f2 * t);
+	*s = (int16_t)v;
+    }
+}
+
+void ToneSignal::silence(unsigned int msec)
+{
+    grow(msec * 8);
+}
+
+// White noise on all channels
+void ToneSignal::noise(unsigned int msec, int level)
+{
+    unsigned int samples = msec * 8 * (m_stereo ? 2 : 1);
+    int16_t* s = grow(msec * 8);
+    for (unsigned int i = 0; i < samples; i++) {
+	m_seed = m_seed * 1103515245 + 12345;
+	s[i] = (int16_t)((int)((m_seed >> 16) & 0x7fff) * 2 * level / 0x7fff - level);
+    }
+}
+
+// Dial a string of DTMF digits with given tone and pause durations
+void ToneSignal::digits(const char* digits, unsigned int on, unsigned int off, int channel)
+{
+    for (; *digits; digits++) {
+	const char* p = ::strchr(s_digits,*digits);
+	if (!p)
+	    continue;
+	int idx = p - s_digits;
+	tone(on,s_freqL[idx / 4],s_freqH[idx % 4],channel);
+	silence(off);
+    }
+}
+
+
+bool ToneEvents::received(Message& msg)
+{
+    if (!msg[YSTRING("id")].startsWith("tonetest/"))
+	return false;
+    const String& what = msg[YSTRING("message")];
+    Lock lock(s_eventsMutex);
+    if (what == YSTRING("chan.dtmf"))
+	s_events << msg[YSTRING("text")];
+    else if (what == YSTRING("call.fax"))
+	s_events << "F";
+    return true;
+}
+
+
+TestTones::TestTones()
+    : Plugin("testtones"),
+      m_init(false)
+{
+    Output("Hello, I am module TestTones");
+}
+
+// Feed a signal to a new detector in blocks and return what it reported
+String TestTones::detect(const char* detector, const DataBlock& data, unsigned int block)
+{
+    static int s_id = 0;
+    String name("tone/");
+    name << detector;
+    bool stereo = name.startsWith("tone/left/") || name.startsWith("tone/right/")
+	|| name.startsWith("tone/mixed/");
+    DataSource* src = new DataSource(stereo ? "2*slin" : "slin");
+    Message m("chan.attach");
+    m.userData(src);
+    m.addParam("consumer",name);
+    m.addParam("id","tonetest/" + String(++s_id));
+    m.addParam("single","true");
+    s_eventsMutex.lock();
+    s_events.clear();
+    s_eventsMutex.unlock();
+    if (Engine::dispatch(m)) {
+	unsigned int len = block * (stereo ? 4 : 2);
+	for (unsigned int pos = 0; pos < data.length(); pos += len) {
+	    unsigned int n = data.length() - pos;
+	    if (n > len)
+		n = len;
+	    DataBlock tmp((char*)data.data() + pos,n,false);
+	    src->Forward(tmp);
+	    tmp.clear(false);
+	}
+    }
+    else
+	Debug("testtones",DebugWarn,"Could not attach '%s'",name.c_str());
+    m.userData(0);
+    TelEngine::destruct(src);
+    // detections are enqueued, give the engine time to dispatch them
+    Thread::msleep(100);
+    Lock lock(s_eventsMutex);
+    return s_events;
+}
+
+// Run many detectors over speech like noise with some digits in it
+void TestTones::bench(const char* detector, unsigned int count)
+{
+    bool stereo = !::strncmp(detector,"mixed/",6);
+    ToneSignal sig(stereo);
+    for (int i = 0; i < 5; i++) {
+	sig.noise(1500,3000);
+	sig.digits("42",80,80);
+    }
+    unsigned int frames = sig.data().length() / (FRAME_SAMPLES * (stereo ? 4 : 2));
+    ObjList sources;
+    Message m("chan.attach");
+    m.addParam("consumer",String("tone/") + detector);
+    m.addParam("single","true");
+    for (unsigned int i = 0; i < count; i++) {
+	DataSource* src = new DataSource(stereo ? "2*slin" : "slin");
+	sources.append(src);
+	m.userData(src);
+	m.setParam("id","tonebench/" + String(i));
+	Engine::dispatch(m);
+    }
+    m.userData(0);
+    unsigned int len = FRAME_SAMPLES * (stereo ? 4 : 2);
+    u_int64_t t = Time::now();
+    for (unsigned int f = 0; f < frames; f++) {
+	DataBlock tmp((char*)sig.data().data() + f * len,len,false);
+	for (ObjList* l = sources.skipNull(); l; l = l->skipNext())
+	    static_cast<DataSource*>(l->get())->Forward(tmp);
+	tmp.clear(false);
+    }
+    t = Time::now() - t;
+    if (!t)
+	t = 1;
+    sources.clear();
+    u_int64_t audio = (u_int64_t)frames * 20000 * count;
+    Output("Tone detector '%s': %u channels, %u sec of audio each in %u ms, %u ns per sample, %u channels per core",
+	detector,count,frames / 50,(unsigned int)(t / 1000),
+	(unsigned int)(t * 1000 / (audio / 125)),(unsigned int)(audio / t));
+}
+
+void TestTones::run()
+{
+    // every digit is found once and in order
+    ToneSignal sig;
+    sig.silence(100);
+    sig.digits(s_digits,80,80);
+    String res = detect("dtmf",sig.data());
+    testReport("tones-dtmf",res == s_digits,"got '" + res + "'");
+
+    // the result does not depend on how the samples are split in blocks
+    res = detect("dtmf",sig.data(),37);
+    String res2 = detect("dtmf",sig.data(),1000);
+    testReport("tones-dtmf-blocks",(res == s_digits) && (res2 == s_digits),
+	"got '" + res + "' and '" + res2 + "'");
+
+    // digits too short are ignored
+    ToneSignal shrt;
+    shrt.digits("159",20,80);
+    res = detect("dtmf",shrt.data());
+    testReport("tones-dtmf-short",res.null(),"got '" + res + "'");
+
+    // a single frequency, noise or silence are not digits
+    ToneSignal other;
+    other.tone(500,697);
+    other.silence(100);
+    other.tone(500,1336);
+    other.noise(2000,8000);
+    other.silence(500);
+    res = detect("*",other.data());
+    testReport("tones-dtmf-false",res.null(),"got '" + res + "'");
+
+    // noisy digits are still found
+    ToneSignal noisy;
+    for (const char* d = "0369"; *d; d++) {
+	noisy.noise(200,1000);
+	noisy.digits(String(*d),80,0);
+    }
+    noisy.noise(200,1000);
+    res = detect("dtmf",noisy.data());
+    testReport("tones-dtmf-noise",res == "0369","got '" + res + "'");
+
+    // calling fax and answering fax tones
+    ToneSignal cng;
+    cng.silence(100);
+    cng.tone(600,1100);
+    res = detect("fax",cng.data());
+    testReport("tones-fax",res == "F","got '" + res + "'");
+    ToneSignal ced;
+    ced.silence(100);
+    ced.tone(600,2100);
+    res = detect("rfax",ced.data());
+    res2 = detect("rfax",cng.data());
+    testReport("tones-rfax",(res == "F") && res2.null(),"got '" + res + "' and '" + res2 + "'");
+
+    // continuity check tones
+    ToneSignal cotv;
+    cotv.silence(100);
+    cotv.tone(600,2010);
+    ToneSignal cots;
+    cots.silence(100);
+    cots.tone(600,1780);
+    res = detect("cotv",cotv.data());
+    res2 = detect("cots",cots.data());
+    testReport("tones-cot",(res == "O") && (res2 == "O"),"got '" + res + "' and '" + res2 + "'");
+
+    // stereo detectors listen to the selected channel
+    ToneSignal left(true);
+    left.silence(100);
+    left.digits("7#",80,80,0);
+    ToneSignal right(true);
+    right.silence(100);
+    right.digits("7#",80,80,1);
+    res = detect("left/dtmf",left.data());
+    res2 = detect("right/dtmf",left.data());
+    String res3 = detect("right/dtmf",right.data());
+    String res4 = detect("mixed/dtmf",right.data());
+    res = res + "," + res2 + "," + res3 + "," + res4;
+    testReport("tones-stereo",res == "7#,,7#,7#","got '" + res + "'");
+
+    bench("*",100);
+    bench("dtmf",100);
+    bench("fax",100);
+    bench("mixed/*",100);
+}
+
+void TestTones::initialize()
+{
+    Output("Initializing module TestTones");
+    if (m_init)
+	return;
+    m_init = true;
+    // the tone detector must be initialized before we attach it
+    Engine::install(new ToneEvents);
+    Engine::install(new TestStart<TestTones>(this,"Tone Test"));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,344 @@
+/**
+ * vad.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Voice activity detection and silence skipping test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+#include "testcase.h"
+
+#include <math.h>
+
+using namespace TelEngine;
+
+// Samples in 20ms of 8kHz audio
+#define FRAME_SAMPLES 160
+
+// Builds a slin signal of noise, tones and DTMF digits
+class VadSignal
+{
+public:
+    inline VadSignal()
+	: m_seed(1)
+	{ }
+    void tone(unsigned int msec, int f1, int f2, int level);
+    void noise(unsigned int msec, int level);
+    inline const DataBlock& data() const
+	{ return m_data; }
+    inline unsigned int frames() const
+	{ return m_data.length() / (2 * FRAME_SAMPLES); }
+    inline DataBlock frame(unsigned int index) const
+	{ return DataBlock((char*)m_data.data() + index * 2 * FRAME_SAMPLES,2 * FRAME_SAMPLES); }
+private:
+    int16_t* grow(unsigned int samples);
+    DataBlock m_data;
+    unsigned int m_seed;
+};
+
+// Consumer remembering the flags of every frame it got
+class VadSink : public DataConsumer
+{
+public:
+    inline VadSink()
+	: m_frames(0), m_silent(0)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{
+	    m_flags += (flags & DataSilent) ? "s" : "v";
+	    m_frames++;
+	    if (flags & DataSilent)
+		m_silent++;
+	    return invalidStamp();
+	}
+    String m_flags;
+    unsigned int m_frames;
+    unsigned int m_silent;
+};
+
+// Intercepts the digits found by the detectors attached by this test
+class VadTestEvents : public MessageHandler
+{
+public:
+    inline VadTestEvents()
+	: MessageHandler("chan.masquerade",10,"testvad")
+	{ }
+    virtual bool received(Message& msg);
+};
+
+class TestVad : public Plugin
+{
+public:
+    TestVad();
+    virtual void initialize();
+    void run();
+    void bench(const VadSignal& sig, bool vad, unsigned int count);
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestVad);
+
+static Mutex s_digitsMutex(false,"VadTest");
+static String s_digits;
+
+
+int16_t* VadSignal::grow(unsigned int samples)
+{
+    unsigned int pos = m_data.length();
+    DataBlock tmp(0,samples * 2);
+    m_data += tmp;
+    return (int16_t*)m_data.data(pos);
+}
+
+void VadSignal::tone(unsigned int msec, int f1, int f2, int level)
+{
+    unsigned int samples = msec * 8;
+    int16_t* s = grow(samples);
+    for (unsigned int i = 0; i < samples; i++) {
+	double t = i / 8000.0;
+	double v = level * ::sin(2 * M_PI * f1 * t);
+	if (f2)
+	    v += level * ::sin(2 * M_PI * f2 * t);
+	s[i] = (int16_t)v;
+    }
+}
+
+void VadSignal::noise(unsigned int msec, int level)
+{
+    unsigned int samples = msec * 8;
+    int16_t* s = grow(samples);
+    for (unsigned int i = 0; i < samples; i++) {
+	m_seed = m_seed * 1103515245 + 12345;
+	s[i] = level ? (int16_t)((int)((m_seed >> 16) & 0x7fff) * 2 * level / 0x7fff - level) : 0;
+    }
+}
+
+
+bool VadTestEvents::received(Message& msg)
+{
+    if (!msg[YSTRING("id")].startsWith("vadtest/"))
+	return false;
+    if (msg[YSTRING("message")] == YSTRING("chan.dtmf")) {
+	Lock lock(s_digitsMutex);
+	s_digits << msg[YSTRING("text")];
+    }
+    return true;
+}
+
+
+TestVad::TestVad()
+    : Plugin("testvad"),
+      m_init(false)
+{
+    Output("Hello, I am module TestVad");
+}
+
+// Extract one numeric value from a module status
+static u_int64_t statValue(const char* module, const char* name)
+{
+    Message m("engine.status");
+    m.addParam("module",module);
+    Engine::dispatch(m);
+    String key;
+    key << name << "=";
+    int pos = m.retValue().find(key);
+    if (pos < 0)
+	return 0;
+    pos += key.length();
+    int end = m.retValue().find(',',pos);
+    if (end < 0)
+	end = m.retValue().find(';',pos);
+    if (end < 0)
+	end = m.retValue().find('\r',pos);
+    return m.retValue().substr(pos,end - pos).toInt64();
+}
+
+// Attach many tone detectors and time feeding them the signal
+void TestVad::bench(const VadSignal& sig, bool vad, unsigned int count)
+{
+    ObjList sources;
+    Message m("chan.attach");
+    m.addParam("consumer","tone/*");
+    m.addParam("single","true");
+    for (unsigned int i = 0; i < count; i++) {
+	DataSource* src = new DataSource;
+	src->setVad(vad);
+	sources.append(src);
+	m.userData(src);
+	m.setParam("id","vadbench/" + String(i));
+	Engine::dispatch(m);
+    }
+    m.userData(0);
+    u_int64_t t = Time::now();
+    for (unsigned int f = 0; f < sig.frames(); f++) {
+	DataBlock frame = sig.frame(f);
+	for (ObjList* l = sources.skipNull(); l; l = l->skipNext())
+	    static_cast<DataSource*>(l->get())->Forward(frame);
+    }
+    t = Time::now() - t;
+    if (!t)
+	t = 1;
+    sources.clear();
+    u_int64_t samples = (u_int64_t)sig.frames() * FRAME_SAMPLES * count;
+    Output("Tone detectors %s VAD: %u channels, %u ms of audio each in %u ms, %u ns per sample, %u channels per core",
+	(vad ? "with" : "without"),count,sig.frames() * 20,(unsigned int)(t / 1000),
+	(unsigned int)(t * 1000 / samples),(unsigned int)((u_int64_t)sig.frames() * 20000 * count / t));
+}
+
+void TestVad::run()
+{
+    // speech is found at once, silence only after the hangover
+    VadSignal sig;
+    sig.noise(1000,30);
+    sig.tone(400,440,0,3000);
+    sig.noise(1000,30);
+    DataVad vad(8000,200);
+    String res;
+    for (unsigned int f = 0; f < sig.frames(); f++)
+	res << (vad.process(sig.frame(f)) ? "v" : "s");
+    // 50 frames of noise, 20 of tone, 50 of noise with 10 frames of hangover
+    String expect = String('v',10) + String('s',40) + String('v',30) + String('s',40);
+    testReport("vad-detect",res == expect,res);
+
+    // a loud tone lasting long is never taken for background noise
+    VadSignal steady;
+    steady.tone(10000,2100,0,2000);
+    vad.reset();
+    unsigned int silent = 0;
+    for (unsigned int f = 0; f < steady.frames(); f++)
+	if (!vad.process(steady.frame(f)))
+	    silent++;
+    res.clear();
+    res << "silent frames " << silent << " of " << steady.frames();
+    testReport("vad-steady",!silent,res);
+
+    // noise louder than the absolute limit is not silence either
+    VadSignal loud;
+    loud.noise(2000,1000);
+    vad.reset();
+    silent = 0;
+    for (unsigned int f = 0; f < loud.frames(); f++)
+	if (!vad.process(loud.frame(f)))
+	    silent++;
+    res.clear();
+    res << "silent frames " << silent << " of " << loud.frames();
+    testReport("vad-loud",!silent,res);
+
+    // a source marks the silence for its consumers, only if it carries slin
+    DataSource* src = new DataSource;
+    DataSource* alaw = new DataSource("alaw");
+    VadSink* sink = new VadSink;
+    bool ok = src->setVad(true) && src->vad() && !alaw->setVad(true) && !alaw->vad();
+    src->attach(sink);
+    for (unsigned int f = 0; f < sig.frames(); f++)
+	src->Forward(sig.frame(f));
+    res.clear();
+    res << "flags " << sink->m_flags;
+    testReport("vad-source",ok && (sink->m_flags == expect),res);
+    src->clear();
+    TelEngine::destruct(src);
+    TelEngine::destruct(alaw);
+    TelEngine::destruct(sink);
+
+    // engine statistics include the frames seen by destroyed detectors
+    u_int64_t frames = 0;
+    u_int64_t marked = 0;
+    DataVad::statistics(frames,marked);
+    res.clear();
+    res << "frames " << frames << " silent " << marked << " percent " << statValue("vad","percent");
+    testReport("vad-status",(frames >= sig.frames()) && (marked >= 80),res);
+
+    // tone detectors skip the silence and still find the digits
+    VadSignal dial;
+    dial.noise(1000,30);
+    const char* digits = "159#";
+    const int freqL[] = { 697, 770, 852, 941 };
+    const int freqH[] = { 1209, 1336, 1477, 1633 };
+    const int dig[][2] = { {0,0}, {1,1}, {2,2}, {3,2} };
+    for (int i = 0; i < 4; i++) {
+	dial.tone(80,freqL[dig[i][0]],freqH[dig[i][1]],6000);
+	dial.noise(600,30);
+    }
+    u_int64_t skipped = statValue("tonedetect","skipped");
+    src = new DataSource;
+    src->setVad(true);
+    Message m("chan.attach");
+    m.userData(src);
+    m.addParam("consumer","tone/dtmf");
+    m.addParam("id","vadtest/1");
+    m.addParam("single","true");
+    s_digitsMutex.lock();
+    s_digits.clear();
+    s_digitsMutex.unlock();
+    if (Engine::dispatch(m)) {
+	for (unsigned int f = 0; f < dial.frames(); f++)
+	    src->Forward(dial.frame(f));
+    }
+    m.userData(0);
+    TelEngine::destruct(src);
+    Thread::msleep(100);
+    skipped = statValue("tonedetect","skipped") - skipped;
+    s_digitsMutex.lock();
+    res.clear();
+    res << "digits '" << s_digits << "' skipped " << (unsigned int)skipped << " of " << dial.frames();
+    ok = (s_digits == digits) && (skipped > dial.frames() / 2);
+    s_digitsMutex.unlock();
+    testReport("vad-tonedetect",ok,res);
+
+    // silence with a single loud click is still filtered
+    VadSignal click;
+    click.noise(1000,30);
+    src = new DataSource;
+    m.userData(src);
+    m.setParam("id","vadtest/2");
+    skipped = statValue("tonedetect","skipped");
+    if (Engine::dispatch(m)) {
+	int16_t* s = (int16_t*)click.data().data();
+	s[FRAME_SAMPLES * 20 + 5] = 20000;
+	for (unsigned int f = 0; f < click.frames(); f++)
+	    src->Forward(click.frame(f),DataNode::invalidStamp(),DataNode::DataSilent);
+    }
+    m.userData(0);
+    TelEngine::destruct(src);
+    skipped = statValue("tonedetect","skipped") - skipped;
+    res.clear();
+    res << "skipped " << (unsigned int)skipped << " of " << click.frames();
+    testReport("vad-click",skipped == click.frames() - 1,res);
+
+    // typical conversation, one side talks while the other listens
+    VadSignal talk;
+    for (int i = 0; i < 5; i++) {
+	talk.noise(1500,40);
+	talk.noise(1500,3000);
+    }
+    bench(talk,false,100);
+    bench(talk,true,100);
+}
+
+void TestVad::initialize()
+{
+    Output("Initializing module TestVad");
+    if (m_init)
+	return;
+    m_init = true;
+    // the tone detector must be initialized before we attach it
+    Engine::install(new VadTestEvents);
+    Engine::install(new TestStart<TestVad>(this,"VAD Test"));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,349 @@
+/**
+ * waverec.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Write-behind wave recorder test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2014 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+#include "testcase.h"
+
+#include <string.h>
+
+using namespace TelEngine;
+
+// 20ms of slin at 8kHz
+#define FRAME_LEN 320
+// Size of the au header written by the recorder
+#define AU_HEADER 32
+// Default write block of the recorder
+#define BLOCK_LEN 65536
+
+// What the last recorded stream saw, it is deleted by the recorder
+static Mutex s_recMutex(false,"RecTest");
+static DataBlock s_recData;
+static unsigned int s_recWrites = 0;
+static unsigned int s_recUnaligned = 0;
+static bool s_recClosed = false;
+static String s_recNotify;
+
+// Stream recording to memory, can be slowed down like a busy disk
+class RecTestStream : public Stream, public GenObject
+{
+public:
+    inline RecTestStream(unsigned int delay = 0, bool fail = false)
+	: m_pos(0), m_delay(delay), m_fail(fail)
+	{
+	    Lock lock(s_recMutex);
+	    s_recData.clear();
+	    s_recWrites = s_recUnaligned = 0;
+	    s_recClosed = false;
+	}
+    virtual ~RecTestStream()
+	{
+	    Lock lock(s_recMutex);
+	    s_recData = m_data;
+	    s_recClosed = true;
+	}
+    virtual void* getObject(const String& name) const;
+    virtual bool terminate()
+	{ return true; }
+    virtual bool valid() const
+	{ return true; }
+    virtual int writeData(const void* buffer, int length);
+    virtual int readData(void* buffer, int length)
+	{ return 0; }
+    virtual int64_t length()
+	{ return m_data.length(); }
+    virtual int64_t seek(SeekPos pos, int64_t offset = 0);
+private:
+    DataBlock m_data;
+    int64_t m_pos;
+    unsigned int m_delay;
+    bool m_fail;
+};
+
+// Catches the notification of a recorder that failed writing
+class RecTestNotify : public MessageHandler
+{
+public:
+    inline RecTestNotify()
+	: MessageHandler("chan.notify",10,"testwaverec")
+	{ }
+    virtual bool received(Message& msg);
+};
+
+// Call leg that sends the frames recorded by its peer
+class RecTestLeg : public CallEndpoint
+{
+public:
+    inline RecTestLeg(bool sender)
+	{
+	    if (!sender)
+		return;
+	    m_source = new DataSource;
+	    m_source->deref();
+	    setSource(m_source);
+	}
+    void send(unsigned int frames);
+private:
+    RefPointer<DataSource> m_source;
+};
+
+class TestWaveRec : public Plugin
+{
+public:
+    TestWaveRec();
+    virtual void initialize();
+    void run();
+    bool record(ObjList& legs, RecTestStream* stream, const char* notify = 0);
+private:
+    bool m_init;
+};
+
+INIT_PLUGIN(TestWaveRec);
+
+
+int RecTestStream::writeData(const void* buffer, int length)
+{
+    if (m_delay)
+	Thread::msleep(m_delay);
+    if (m_fail)
+	return -1;
+    if (m_pos + length > (int64_t)m_data.length()) {
+	DataBlock tmp(0,(unsigned int)(m_pos + length - m_data.length()));
+	m_data += tmp;
+    }
+    ::memcpy(m_data.data(m_pos,length),buffer,length);
+    // the header patch is the only expected write not ending on a block
+    if (m_pos && ((m_pos + length) % BLOCK_LEN))
+	s_recUnaligned++;
+    m_pos += length;
+    s_recWrites++;
+    return length;
+}
+
+void* RecTestStream::getObject(const String& name) const
+{
+    if (name == YATOM("Stream"))
+	return static_cast<Stream*>(const_cast<RecTestStream*>(this));
+    return GenObject::getObject(name);
+}
+
+int64_t RecTestStream::seek(SeekPos pos, int64_t offset)
+{
+    switch (pos) {
+	case SeekBegin:
+	    m_pos = offset;
+	    break;
+	case SeekEnd:
+	    m_pos = m_data.length() + offset;
+	    break;
+	case SeekCurrent:
+	    m_pos += offset;
+	    break;
+    }
+    return m_pos;
+}
+
+
+bool RecTestNotify::received(Message& msg)
+{
+    if (msg["targetid"] != YSTRING("rectest"))
+	return false;
+    Lock lock(s_recMutex);
+    s_recNotify = msg["reason"];
+    return true;
+}
+
+
+// Send frames of a known slin sample as fast as possible
+void RecTestLeg::send(unsigned int frames)
+{
+    DataBlock frame(0,FRAME_LEN);
+    int16_t* s = (int16_t*)frame.data();
+    for (unsigned int i = 0; i < FRAME_LEN / 2; i++)
+	s[i] = 0x1234;
+    for (unsigned int i = 0; i < frames; i++)
+	m_source->Forward(frame);
+}
+
+
+TestWaveRec::TestWaveRec()
+    : Plugin("testwaverec"),
+      m_init(false)
+{
+    Output("Hello, I am module TestWaveRec");
+}
+
+// Extract one numeric value from the wave module or recorders status
+static unsigned int statValue(const char* module, const char* name)
+{
+    Message m("engine.status");
+    m.addParam("module",module);
+    Engine::dispatch(m);
+    String key;
+    key << name << "=";
+    int pos = m.retValue().find(key);
+    if (pos < 0)
+	return 0;
+    pos += key.length();
+    int end = m.retValue().find(',',pos);
+    if (end < 0)
+	end = m.retValue().find(';',pos);
+    if (end < 0)
+	end = m.retValue().find('\r',pos);
+    return m.retValue().substr(pos,end - pos).toInteger();
+}
+
+static void hangup(ObjList& legs)
+{
+    for (ObjList* l = legs.skipNull(); l; l = l->skipNext())
+	static_cast<CallEndpoint*>(l->get())->disconnect("done");
+    legs.clear();
+}
+
+// Wait for the recorder to close the stream after the call ended
+static bool closed(unsigned int msec)
+{
+    for (; msec; msec -= 10) {
+	s_recMutex.lock();
+	bool ok = s_recClosed;
+	s_recMutex.unlock();
+	if (ok)
+	    return true;
+	Thread::msleep(10);
+    }
+    return false;
+}
+
+// Record an au file to the stream, the first leg sends what the second records
+bool TestWaveRec::record(ObjList& legs, RecTestStream* stream, const char* notify)
+{
+    RecTestLeg* sender = new RecTestLeg(true);
+    RecTestLeg* recorder = new RecTestLeg(false);
+    legs.append(sender);
+    legs.append(recorder);
+    sender->connect(recorder);
+    Message m("chan.attach");
+    m.userData(recorder);
+    m.addParam(new NamedPointer("consumer",stream,"wave/record/test.au"));
+    m.addParam("single","true");
+    if (notify)
+	m.addParam("notify",notify);
+    bool ok = Engine::dispatch(m);
+    m.userData(0);
+    return ok;
+}
+
+void TestWaveRec::run()
+{
+    // the media thread only fills the buffer, nothing hits the disk yet
+    ObjList legs;
+    if (!record(legs,new RecTestStream)) {
+	testReport("waverec-attach",false,"wave module not loaded");
+	return;
+    }
+    static_cast<RecTestLeg*>(legs[0])->send(100);
+    unsigned int queued = statValue("wave","recqueued");
+    String res;
+    res << "queued " << queued << " writes " << s_recWrites;
+    testReport("waverec-behind",(queued == AU_HEADER + 100 * FRAME_LEN) && !s_recWrites,res);
+
+    // the file is written in one go and the header is completed
+    hangup(legs);
+    bool ok = closed(1000);
+    res.clear();
+    res << "length " << s_recData.length() << " writes " << s_recWrites;
+    testReport("waverec-coalesce",ok && (s_recData.length() == AU_HEADER + 100 * FRAME_LEN)
+	&& (s_recWrites == 2),res);
+    const unsigned char* d = (const unsigned char*)s_recData.data();
+    unsigned int len = d ? ((d[8] << 24) | (d[9] << 16) | (d[10] << 8) | d[11]) : 0;
+    res.clear();
+    res << "header length " << len;
+    testReport("waverec-au",ok && d && (len == 100 * FRAME_LEN) && (d[AU_HEADER] == 0x12)
+	&& (d[AU_HEADER + 1] == 0x34),res);
+
+    // long recordings are written in whole blocks
+    if (record(legs,new RecTestStream)) {
+	for (int i = 0; i < 20; i++) {
+	    static_cast<RecTestLeg*>(legs[0])->send(50);
+	    Thread::msleep(5);
+	}
+	hangup(legs);
+    }
+    ok = closed(2000);
+    res.clear();
+    res << "length " << s_recData.length() << " writes " << s_recWrites
+	<< " unaligned " << s_recUnaligned;
+    testReport("waverec-blocks",ok && (s_recData.length() == AU_HEADER + 1000 * FRAME_LEN)
+	&& (s_recWrites < 10) && (s_recUnaligned <= 2),res);
+
+    // a stalled disk makes the recorder drop data, the media thread goes on
+    unsigned int dropped = statValue("wave","recdropped");
+    u_int64_t spent = 0;
+    if (record(legs,new RecTestStream(300))) {
+	u_int64_t t = Time::now();
+	static_cast<RecTestLeg*>(legs[0])->send(3000);
+	spent = Time::now() - t;
+	hangup(legs);
+    }
+    ok = closed(3000);
+    dropped = statValue("wave","recdropped") - dropped;
+    res.clear();
+    res << "dropped " << dropped << " octets, sending took " << (unsigned int)(spent / 1000) << " ms";
+    testReport("waverec-drop",ok && dropped && (spent < 250000),res);
+
+    // a file that cannot be written is reported to the channel once
+    Engine::install(new RecTestNotify);
+    unsigned int failed = statValue("wave","recfailed");
+    if (record(legs,new RecTestStream(0,true),"rectest")) {
+	for (int i = 0; i < 4; i++) {
+	    static_cast<RecTestLeg*>(legs[0])->send(250);
+	    Thread::msleep(50);
+	}
+	hangup(legs);
+    }
+    ok = closed(2000);
+    for (int i = 0; i < 50; i++) {
+	Lock lock(s_recMutex);
+	if (s_recNotify)
+	    break;
+	lock.drop();
+	Thread::msleep(10);
+    }
+    failed = statValue("wave","recfailed") - failed;
+    s_recMutex.lock();
+    res.clear();
+    res << "failed " << failed << " notified '" << s_recNotify << "'";
+    ok = ok && (failed == 1) && (s_recNotify == YSTRING("error"));
+    s_recMutex.unlock();
+    testReport("waverec-fail",ok,res);
+}
+
+void TestWaveRec::initialize()
+{
+    Output("Initializing module TestWaveRec");
+    if (m_init)
+	return;
+    m_init = true;
+    // the wave file module must be initialized before we record
+    // notifications are enqueued so the tests must leave the engine starting
+    Engine::install(new TestStart<TestWaveRec>(this,"WaveRec Test"));
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
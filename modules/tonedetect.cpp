@@ -47,6 +47,14 @@ namespace { // anonymous
 // minimum DTMF detect time
 #define DETECT_DTMF_MSEC 32
 
+// samples below this can never add up to the minimum power
+#define SILENCE_PEAK 1000
+// frames counted locally before updating the module statistics
+#define STATS_FLUSH 256
+
+// how many samples are converted at once before filtering
+#define SAMPLES_CHUNK 256
+
 // 2-pole filter parameters
 typedef struct
 {
@@ -55,32 +63,41 @@ typedef struct
     double y1;
 } Params2Pole;
 
-// Half 2-pole filter - the other part is common to all filters
-class Tone2PoleFilter
+// Bank of half 2-pole filters - the other part is common to all filters
+// Each coefficient and state is kept in its own array so all the filters of
+//  a group are updated together for a sample, in vector registers if possible
+class Tone2PoleBank
 {
 public:
-    inline Tone2PoleFilter()
-	: m_mult(0.0), m_y0(0.0), m_y1(0.0)
-	{ }
-    inline Tone2PoleFilter(double gain, double y0, double y1)
-	: m_mult(1.0/gain), m_y0(y0), m_y1(y1)
-	{ init(); }
-    inline Tone2PoleFilter(const Params2Pole& params)
-	: m_mult(1.0/params.gain), m_y0(params.y0), m_y1(params.y1)
-	{ init(); }
-    inline void assign(const Params2Pole& params)
-	{ m_mult = 1.0/params.gain; m_y0 = params.y0; m_y1 = params.y1; init(); }
-    inline void init()
-	{ m_val = m_y[1] = m_y[2] = 0.0; }
-    inline double value() const
-	{ return m_val; }
-    void update(double xd);
+    enum Filter {
+	Fax = 0,
+	Cont,
+	DtmfL,
+	DtmfH = DtmfL + 4,
+	Count = DtmfH + 4
+    };
+    Tone2PoleBank();
+    void assign(int index, const Params2Pole& params);
+    void init();
+    inline double value(int index) const
+	{ return m_val[index]; }
+    // Update a group of filters with the same input
+    // Called with constant arguments so the loop has a known trip count
+    inline void update(double xd, int first, int count)
+	{
+	    for (int i = first; i < first + count; i++) {
+		double y = (xd * m_mult[i]) + (m_y0[i] * m_y[0][i]) + (m_y1[i] * m_y[1][i]);
+		m_y[0][i] = m_y[1][i];
+		m_y[1][i] = y;
+		m_val[i] = MOVING_AVG_KEEP*m_val[i] + (1-MOVING_AVG_KEEP)*y*y;
+	    }
+	}
 private:
-    double m_mult;
-    double m_y0;
-    double m_y1;
-    double m_val;
-    double m_y[3];
+    double m_mult[Count];
+    double m_y0[Count];
+    double m_y1[Count];
+    double m_val[Count];
+    double m_y[2][Count];
 };
 
 class ToneConsumer : public DataConsumer
@@ -106,6 +123,9 @@ private:
     void checkDtmf();
     void checkFax();
     void checkCont();
+    bool skipSilence(const DataBlock& data, unsigned int samp);
+    void flushStats();
+    const int16_t* extract(const int16_t* s, double* x, unsigned int samp) const;
     String m_id;
     String m_name;
     String m_faxDivert;
@@ -120,12 +140,11 @@ private:
     bool m_detDnis;
     char m_dtmfTone;
     int m_dtmfCount;
-    double m_xv[3];
+    double m_xv[2];
     double m_pwr;
-    Tone2PoleFilter m_fax;
-    Tone2PoleFilter m_cont;
-    Tone2PoleFilter m_dtmfL[4];
-    Tone2PoleFilter m_dtmfH[4];
+    unsigned int m_frames;
+    unsigned int m_skipped;
+    Tone2PoleBank m_filters;
 };
 
 class ToneDetectorModule : public Module
@@ -141,6 +160,8 @@ private:
 
 static Mutex s_mutex(false,"ToneDetect");
 static int s_count = 0;
+static u_int64_t s_frames = 0;
+static u_int64_t s_skipped = 0;
 
 static ToneDetectorModule plugin;
 
@@ -215,26 +236,40 @@ static void updatePwr(double& avg, double val)
 }
 
 
-void Tone2PoleFilter::update(double xd)
+Tone2PoleBank::Tone2PoleBank()
+{
+    for (int i = 0; i < Count; i++)
+	m_mult[i] = m_y0[i] = m_y1[i] = 0.0;
+    init();
+}
+
+void Tone2PoleBank::assign(int index, const Params2Pole& params)
+{
+    m_mult[index] = 1.0/params.gain;
+    m_y0[index] = params.y0;
+    m_y1[index] = params.y1;
+    m_val[index] = m_y[0][index] = m_y[1][index] = 0.0;
+}
+
+void Tone2PoleBank::init()
 {
-    m_y[0] = m_y[1]; m_y[1] = m_y[2];
-    m_y[2] = (xd * m_mult) +
-	(m_y0 * m_y[0]) +
-	(m_y1 * m_y[1]);
-    updatePwr(m_val,m_y[2]);
+    for (int i = 0; i < Count; i++)
+	m_val[i] = m_y[0][i] = m_y[1][i] = 0.0;
 }
 
 
 ToneConsumer::ToneConsumer(const String& id, const String& name)
     : m_id(id), m_name(name), m_mode(Mono),
       m_detFax(true), m_detCont(false), m_detDtmf(true), m_detDnis(false),
-      m_fax(s_paramsCNG), m_cont(s_paramsCOTv)
+      m_frames(0), m_skipped(0)
 {
     Debug(&plugin,DebugAll,"ToneConsumer::ToneConsumer(%s,'%s') [%p]",
 	id.c_str(),name.c_str(),this);
+    m_filters.assign(Tone2PoleBank::Fax,s_paramsCNG);
+    m_filters.assign(Tone2PoleBank::Cont,s_paramsCOTv);
     for (int i = 0; i < 4; i++) {
-	m_dtmfL[i].assign(s_paramsDtmfL[i]);
-	m_dtmfH[i].assign(s_paramsDtmfH[i]);
+	m_filters.assign(Tone2PoleBank::DtmfL + i,s_paramsDtmfL[i]);
+	m_filters.assign(Tone2PoleBank::DtmfH + i,s_paramsDtmfH[i]);
     }
     init();
     String tmp = name;
@@ -261,12 +296,12 @@ ToneConsumer::ToneConsumer(const String& id, const String& name)
 	    m_detDtmf = m_detDtmf || (*s == "dtmf");
 	    if (*s == "rfax") {
 		// detection of receiving Fax requested
-		m_fax.assign(s_paramsCED);
+		m_filters.assign(Tone2PoleBank::Fax,s_paramsCED);
 		m_detFax = true;
 	    }
 	    else if (*s == "cots") {
 		// detection of COT Send tone requested
-		m_cont.assign(s_paramsCOTs);
+		m_filters.assign(Tone2PoleBank::Cont,s_paramsCOTs);
 		m_detCont = true;
 	    }
 	    else if (*s == "callsetup") {
@@ -284,22 +319,55 @@ ToneConsumer::ToneConsumer(const String& id, const String& name)
 ToneConsumer::~ToneConsumer()
 {
     Debug(&plugin,DebugAll,"ToneConsumer::~ToneConsumer [%p]",this);
+    flushStats();
     s_mutex.lock();
     s_count--;
     s_mutex.unlock();
 }
 
+// Add the local frame counters to the module statistics
+void ToneConsumer::flushStats()
+{
+    if (!m_frames)
+	return;
+    s_mutex.lock();
+    s_frames += m_frames;
+    s_skipped += m_skipped;
+    s_mutex.unlock();
+    m_frames = m_skipped = 0;
+}
+
+// Skip filtering a frame marked as silence if it cannot change the detection
+bool ToneConsumer::skipSilence(const DataBlock& data, unsigned int samp)
+{
+    if (m_pwr >= THRESHOLD2_ABS)
+	return false;
+    // power stays under the threshold if no sample gets near it
+    const int16_t* s = (const int16_t*)data.data();
+    unsigned int n = data.length() / 2;
+    int peak = 0;
+    for (unsigned int i = 0; i < n; i++) {
+	int v = (s[i] < 0) ? -s[i] : s[i];
+	if (peak < v)
+	    peak = v;
+    }
+    if (peak >= SILENCE_PEAK)
+	return false;
+    // filters restart from rest, their output would have faded anyway
+    m_pwr *= ::pow(MOVING_AVG_KEEP,(double)samp);
+    m_xv[0] = m_xv[1] = 0.0;
+    m_filters.init();
+    m_dtmfTone = '\0';
+    m_dtmfCount = 0;
+    return true;
+}
+
 // Re-init filter(s)
 void ToneConsumer::init()
 {
-    m_xv[1] = m_xv[2] = 0.0;
+    m_xv[0] = m_xv[1] = 0.0;
     m_pwr = 0.0;
-    m_fax.init();
-    m_cont.init();
-    for (int i = 0; i < 4; i++) {
-	m_dtmfL[i].init();
-	m_dtmfH[i].init();
-    }
+    m_filters.init();
     m_dtmfTone = '\0';
     m_dtmfCount = 0;
 }
@@ -311,18 +379,18 @@ void ToneConsumer::checkDtmf()
     char c = m_dtmfTone;
     m_dtmfTone = '\0';
     int l = 0;
-    double maxL = m_dtmfL[0].value();
+    double maxL = m_filters.value(Tone2PoleBank::DtmfL);
     for (i = 1; i < 4; i++) {
-	if (maxL < m_dtmfL[i].value()) {
-	    maxL = m_dtmfL[i].value();
+	if (maxL < m_filters.value(Tone2PoleBank::DtmfL + i)) {
+	    maxL = m_filters.value(Tone2PoleBank::DtmfL + i);
 	    l = i;
 	}
     }
     int h = 0;
-    double maxH = m_dtmfH[0].value();
+    double maxH = m_filters.value(Tone2PoleBank::DtmfH);
     for (i = 1; i < 4; i++) {
-	if (maxH < m_dtmfH[i].value()) {
-	    maxH = m_dtmfH[i].value();
+	if (maxH < m_filters.value(Tone2PoleBank::DtmfH + i)) {
+	    maxH = m_filters.value(Tone2PoleBank::DtmfH + i);
 	    h = i;
 	}
     }
@@ -387,16 +455,17 @@ void ToneConsumer::checkDtmf()
 // Check if we detected a Fax CNG or CED tone
 void ToneConsumer::checkFax()
 {
-    if (m_fax.value() < m_pwr*THRESHOLD2_REL_FAX)
+    double fax = m_filters.value(Tone2PoleBank::Fax);
+    if (fax < m_pwr*THRESHOLD2_REL_FAX)
 	return;
-    if (m_fax.value() > m_pwr) {
+    if (fax > m_pwr) {
 	DDebug(&plugin,DebugNote,"Overshoot on %s, signal=%0.2f, total=%0.2f",
-	    m_id.c_str(),m_fax.value(),m_pwr);
+	    m_id.c_str(),fax,m_pwr);
 	init();
 	return;
     }
     DDebug(&plugin,DebugInfo,"Fax detected on %s, signal=%0.1f, total=%0.1f",
-	m_id.c_str(),m_fax.value(),m_pwr);
+	m_id.c_str(),fax,m_pwr);
     // prepare for new detection
     init();
     m_detFax = false;
@@ -421,16 +490,17 @@ void ToneConsumer::checkFax()
 // Check if we detected a Continuity Test tone
 void ToneConsumer::checkCont()
 {
-    if (m_cont.value() < m_pwr*THRESHOLD2_REL_COT)
+    double cont = m_filters.value(Tone2PoleBank::Cont);
+    if (cont < m_pwr*THRESHOLD2_REL_COT)
 	return;
-    if (m_cont.value() > m_pwr) {
+    if (cont > m_pwr) {
 	DDebug(&plugin,DebugNote,"Overshoot on %s, signal=%0.2f, total=%0.2f",
-	    m_id.c_str(),m_cont.value(),m_pwr);
+	    m_id.c_str(),cont,m_pwr);
 	init();
 	return;
     }
     DDebug(&plugin,DebugInfo,"Continuity detected on %s, signal=%0.1f, total=%0.1f",
-	m_id.c_str(),m_cont.value(),m_pwr);
+	m_id.c_str(),cont,m_pwr);
     // prepare for new detection
     init();
     m_detCont = false;
@@ -442,6 +512,33 @@ void ToneConsumer::checkCont()
     Engine::enqueue(m);
 }
 
+// Convert a run of samples of the used channel(s) to floating point
+const int16_t* ToneConsumer::extract(const int16_t* s, double* x, unsigned int samp) const
+{
+    unsigned int i;
+    switch (m_mode) {
+	case Left:
+	    // use 1st sample, skip 2nd
+	    for (i = 0; i < samp; i++, s += 2)
+		x[i] = s[0];
+	    break;
+	case Right:
+	    // skip 1st sample, use 2nd
+	    for (i = 0; i < samp; i++, s += 2)
+		x[i] = s[1];
+	    break;
+	case Mixed:
+	    // add together samples
+	    for (i = 0; i < samp; i++, s += 2)
+		x[i] = s[0]+(int)s[1];
+	    break;
+	default:
+	    for (i = 0; i < samp; i++)
+		x[i] = *s++;
+    }
+    return s;
+}
+
 // Feed samples to the filter(s)
 unsigned long ToneConsumer::Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
 {
@@ -453,60 +550,47 @@ unsigned long ToneConsumer::Consume(const DataBlock& data, unsigned long tStamp,
     const int16_t* s = (const int16_t*)data.data();
     if (!s)
 	return 0;
-    while (samp--) {
-	m_xv[0] = m_xv[1]; m_xv[1] = m_xv[2];
-	switch (m_mode) {
-	    case Left:
-		// use 1st sample, skip 2nd
-		m_xv[2] = *s++;
-		s++;
-		break;
-	    case Right:
-		// skip 1st sample, use 2nd
-		s++;
-		m_xv[2] = *s++;
-		break;
-	    case Mixed:
-		// add together samples
-		m_xv[2] = s[0]+(int)s[1];
-		s+=2;
-		break;
-	    default:
-		m_xv[2] = *s++;
-	}
-	double dx = m_xv[2] - m_xv[0];
-	updatePwr(m_pwr,m_xv[2]);
-
-	// update all active detectors
-	if (m_detFax)
-	    m_fax.update(dx);
-	if (m_detCont)
-	    m_cont.update(dx);
-	if (m_detDtmf || m_detDnis) {
-	    for (int j = 0; j < 4; j++) {
-		m_dtmfL[j].update(dx);
-		m_dtmfH[j].update(dx);
-	    }
-	}
-	// only do checks every millisecond
-	if (samp % 8)
-	    continue;
-	// is it enough total power to accept a signal?
-	if (m_pwr >= THRESHOLD2_ABS) {
+    if (++m_frames >= STATS_FLUSH)
+	flushStats();
+    if ((flags & DataSilent) && skipSilence(data,samp)) {
+	m_skipped++;
+	return invalidStamp();
+    }
+    double x[SAMPLES_CHUNK];
+    while (samp) {
+	// channels are picked once for a whole chunk, not for each sample
+	unsigned int n = (samp > SAMPLES_CHUNK) ? SAMPLES_CHUNK : samp;
+	s = extract(s,x,n);
+	for (unsigned int i = 0; i < n; i++) {
+	    double dx = x[i] - m_xv[0];
+	    m_xv[0] = m_xv[1]; m_xv[1] = x[i];
+	    updatePwr(m_pwr,x[i]);
+
+	    // update all active detectors, fax and continuity are paired
+	    if (m_detFax || m_detCont)
+		m_filters.update(dx,Tone2PoleBank::Fax,2);
 	    if (m_detDtmf || m_detDnis)
-		checkDtmf();
-	    if (m_detFax)
-		checkFax();
-	    if (m_detCont)
-		checkCont();
-	}
-	else {
-	    m_dtmfTone = '\0';
-	    m_dtmfCount = 0;
+		m_filters.update(dx,Tone2PoleBank::DtmfL,8);
+	    // only do checks every millisecond
+	    if (--samp % 8)
+		continue;
+	    // is it enough total power to accept a signal?
+	    if (m_pwr >= THRESHOLD2_ABS) {
+		if (m_detDtmf || m_detDnis)
+		    checkDtmf();
+		if (m_detFax)
+		    checkFax();
+		if (m_detCont)
+		    checkCont();
+	    }
+	    else {
+		m_dtmfTone = '\0';
+		m_dtmfCount = 0;
+	    }
 	}
     }
     XDebug(&plugin,DebugAll,"Fax detector on %s: signal=%0.1f, total=%0.1f",
-	m_id.c_str(),m_fax.value(),m_pwr);
+	m_id.c_str(),m_filters.value(Tone2PoleBank::Fax),m_pwr);
     return invalidStamp();
 }
 
@@ -638,7 +722,9 @@ ToneDetectorModule::~ToneDetectorModule()
 
 void ToneDetectorModule::statusParams(String& str)
 {
+    Lock lock(s_mutex);
     str.append("count=",",") << s_count;
+    str << ",frames=" << s_frames << ",skipped=" << s_skipped;
 }
 
 void ToneDetectorModule::initialize()
@@ -118,11 +118,10 @@ private:
     const short* m_data;
 };
 
-class ToneSource : public ThreadedSource
+class ToneSource : public ClockedSource
 {
 public:
     virtual void destroyed();
-    virtual void run();
     inline const String& name()
 	{ return m_name; }
     bool startup();
@@ -134,6 +133,7 @@ protected:
     ToneSource(const ToneDesc* tone = 0);
     virtual bool noChan() const
 	{ return false; }
+    virtual int tick(u_int64_t when);
     virtual void cleanup();
     void advanceTone(const Tone*& tone);
     static const ToneDesc* getBlock(String& tone, const ToneDesc* table);
@@ -147,6 +147,10 @@ private:
     unsigned m_brate;
     unsigned m_total;
     u_int64_t m_time;
+    const Tone* m_cur;                   // Tone currently played
+    int m_samp;                          // Sample number in current tone
+    int m_dpos;                          // Position in tone data
+    int m_nsam;                          // Samples in current tone
 };
 
 class TempSource : public ToneSource
@@ -657,7 +661,8 @@ bool ToneData::decode(const String& desc, int& samples, const short*& data, bool
 
 ToneSource::ToneSource(const ToneDesc* tone)
     : m_tone(0), m_repeat(tone == 0), m_firstPass(true),
-      m_data(0,320), m_brate(16000), m_total(0), m_time(0)
+      m_data(0,320), m_brate(16000), m_total(0), m_time(0),
+      m_cur(0), m_samp(0), m_dpos(1), m_nsam(0)
 {
     if (tone) {
 	m_tone = tone->tones();
@@ -671,7 +676,7 @@ void ToneSource::destroyed()
 {
     Debug(&__plugin,DebugAll,"ToneSource::destroyed() '%s' [%p] total=%u stamp=%lu",
 	m_name.c_str(),this,m_total,timeStamp());
-    ThreadedSource::destroyed();
+    ClockedSource::destroyed();
     if (m_time)
 	Debug(&__plugin,DebugInfo,"ToneSource rate=%u b/s",byteRate(m_time,m_total));
 }
@@ -679,7 +684,14 @@ void ToneSource::destroyed()
 bool ToneSource::startup()
 {
     DDebug(&__plugin,DebugAll,"ToneSource::startup(\"%s\") tone=%p",m_name.c_str(),m_tone);
-    return m_tone && start("Tone Source");
+    if (!m_tone)
+	return false;
+    m_cur = m_tone;
+    m_nsam = m_cur->nsamples;
+    if (m_nsam < 0)
+	m_nsam = -m_nsam;
+    m_time = Time::now();
+    return start();
 }
 
 void ToneSource::cleanup()
@@ -688,7 +700,7 @@ void ToneSource::cleanup()
     __plugin.lock();
     tones.remove(this,false);
     __plugin.unlock();
-    ThreadedSource::cleanup();
+    ClockedSource::cleanup();
 }
 
 void ToneSource::advanceTone(const Tone*& tone)
@@ -846,57 +858,42 @@ ToneSource* ToneSource::getTone(String& tone, const String& prefix)
     return t;
 }
 
-void ToneSource::run()
+// Generate and send one block of tone data each time the media clock ticks
+int ToneSource::tick(u_int64_t when)
 {
-    Debug(&__plugin,DebugAll,"ToneSource::run() [%p]",this);
-    u_int64_t tpos = Time::now();
-    m_time = tpos;
-    int samp = 0; // sample number
-    int dpos = 1; // position in data
-    const Tone* tone = m_tone;
-    int nsam = tone->nsamples;
-    if (nsam < 0)
-	nsam = -nsam;
-    while (m_tone && looping(noChan())) {
-	Thread::check();
-	short *d = (short *) m_data.data();
-	for (unsigned int i = m_data.length()/2; i--; samp++,dpos++) {
-	    if (samp >= nsam) {
-		// go to the start of the next tone
-		samp = 0;
-		const Tone *otone = tone;
-		advanceTone(tone);
-		nsam = tone ? tone->nsamples : 32000;
-		if (nsam < 0) {
-		    nsam = -nsam;
-		    // reset repeat point here
-		    m_tone = tone;
-		}
-		if (tone != otone)
-		    dpos = 1;
-	    }
-	    if (tone && tone->data) {
-		if (dpos > tone->data[0])
-		    dpos = 1;
-		*d++ = tone->data[dpos];
+    if (!(m_tone && looping(noChan()))) {
+	Debug(&__plugin,DebugAll,"ToneSource [%p] end, total=%u (%u b/s)",
+	    this,m_total,byteRate(m_time,m_total));
+	m_time = 0;
+	return -1;
+    }
+    short *d = (short *) m_data.data();
+    for (unsigned int i = m_data.length()/2; i--; m_samp++,m_dpos++) {
+	if (m_samp >= m_nsam) {
+	    // go to the start of the next tone
+	    m_samp = 0;
+	    const Tone *otone = m_cur;
+	    advanceTone(m_cur);
+	    m_nsam = m_cur ? m_cur->nsamples : 32000;
+	    if (m_nsam < 0) {
+		m_nsam = -m_nsam;
+		// reset repeat point here
+		m_tone = m_cur;
 	    }
-	    else
-		*d++ = 0;
+	    if (m_cur != otone)
+		m_dpos = 1;
 	}
-	int64_t dly = tpos - Time::now();
-	if (dly > 0) {
-	    XDebug(&__plugin,DebugAll,"ToneSource sleeping for " FMT64 " usec",dly);
-	    Thread::usleep((unsigned long)dly);
+	if (m_cur && m_cur->data) {
+	    if (m_dpos > m_cur->data[0])
+		m_dpos = 1;
+	    *d++ = m_cur->data[m_dpos];
 	}
-	if (!looping(noChan()))
-	    break;
-	Forward(m_data,m_total/2);
-	m_total += m_data.length();
-	tpos += (m_data.length()*(u_int64_t)1000000/m_brate);
+	else
+	    *d++ = 0;
     }
-    Debug(&__plugin,DebugAll,"ToneSource [%p] end, total=%u (%u b/s)",
-	this,m_total,byteRate(m_time,m_total));
-    m_time = 0;
+    Forward(m_data,m_total/2);
+    m_total += m_data.length();
+    return (int)(m_data.length()*(u_int64_t)1000000/m_brate);
 }
 
 
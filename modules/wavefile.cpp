@@ -26,15 +26,76 @@
 using namespace TelEngine;
 namespace { // anonymous
 
-class WaveSource : public ThreadedSource
+// The content of a prompt file in one data format
+class WaveVariant : public GenObject
 {
+public:
+    inline WaveVariant(const DataFormat& format, unsigned rate, unsigned brate)
+	: m_format(format), m_rate(rate), m_brate(brate)
+	{ }
+    virtual const String& toString() const
+	{ return m_format; }
+    DataFormat m_format;
+    DataBlock m_data;
+    unsigned m_rate;
+    unsigned m_brate;
+};
+
+// A prompt file kept in memory and shared by all sources playing it
+class WavePrompt : public RefObject, public Mutex
+{
+public:
+    WavePrompt(const String& file, unsigned int mtime, WaveVariant* native);
+    virtual const String& toString() const
+	{ return m_file; }
+    inline const WaveVariant* native() const
+	{ return static_cast<const WaveVariant*>(m_variants.get()); }
+    const WaveVariant* variant(const DataFormat& format);
+    static WavePrompt* find(const String& file);
+    static void add(WavePrompt* prompt);
+    static void grown(WavePrompt* prompt, unsigned int bytes);
+    static void trim();
+    String m_file;
+    unsigned int m_mtime;
+    unsigned int m_bytes;
+private:
+    ObjList m_variants;
+};
+
+// Collects the output of the translator building a prompt variant
+class WaveCapture : public DataConsumer
+{
+public:
+    inline WaveCapture(const char* format)
+	: DataConsumer(format)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ m_data += data; return invalidStamp(); }
+    DataBlock m_data;
+};
+
+// A block read ahead from a file being played
+class WaveChunk : public GenObject
+{
+public:
+    inline WaveChunk(unsigned int len)
+	: m_data(0,len), m_len(0)
+	{ }
+    DataBlock m_data;
+    unsigned int m_len;
+};
+
+class WaveSource : public ClockedSource
+{
+    friend class WaveReader;
 public:
     static WaveSource* create(const String& file, CallEndpoint* chan,
 	bool autoclose, bool autorepeat, const NamedString* param);
     ~WaveSource();
-    virtual void run();
+    virtual int tick(u_int64_t when);
     virtual void cleanup();
     virtual void attached(bool added);
+    virtual bool setFormat(const DataFormat& format);
     void setNotify(const String& id);
 private:
     WaveSource(const char* file, CallEndpoint* chan, bool autoclose);
@@ -43,19 +104,113 @@ private:
     void detectWavFormat();
     void detectIlbcFormat();
     bool computeDataRate();
+    bool loadPrompt(const String& file);
+    int playPrompt();
+    int playStream();
+    int readBlock(DataBlock& data);
+    bool prefetch();
     void notify(WaveSource* source, const char* reason = 0);
     CallEndpoint* m_chan;
     Stream* m_stream;
+    RefPointer<WavePrompt> m_prompt;
+    const WaveVariant* m_variant;
     DataBlock m_data;
     bool m_swap;
     unsigned m_rate;
     unsigned m_brate;
     int64_t m_repeatPos;
+    unsigned int m_pos;
+    unsigned long m_stamp;
     unsigned m_total;
     u_int64_t m_time;
     String m_id;
     bool m_autoclose;
     bool m_nodata;
+    bool m_noChan;
+    bool m_playing;
+    bool m_prefetch;
+    ObjList m_ahead;
+    int m_readEnd;
+};
+
+// Thread reading ahead the files played from shared media clocks
+class WaveReader : public Thread
+{
+public:
+    WaveReader();
+    ~WaveReader();
+    virtual void run();
+    static void add(WaveSource* source);
+    static void remove(WaveSource* source);
+    static void wake();
+private:
+    Semaphore m_wake;
+};
+
+class WaveWriter;
+
+// Write-behind ring buffer of a recorder, drained by one of the writer threads
+class WaveBuffer : public RefObject, public Mutex
+{
+public:
+    WaveBuffer(Stream* stream, const String& file);
+    ~WaveBuffer();
+    virtual const String& toString() const
+	{ return m_id; }
+    bool write(const void* data, unsigned int len);
+    bool drain(bool force);
+    void close(bool fixAu);
+    void orphan();
+    void status(String& str, u_int64_t now);
+    u_int64_t lag(u_int64_t now) const;
+    inline unsigned int queued() const
+	{ return (unsigned int)(m_in - m_out); }
+    inline u_int64_t dropped() const
+	{ return m_dropped; }
+    inline bool failed()
+	{ Lock lck(this); return m_failed; }
+private:
+    void finish();
+    Stream* m_stream;
+    WaveWriter* m_writer;
+    String m_id;
+    String m_file;
+    unsigned char* m_ring;
+    unsigned int m_size;
+    u_int64_t m_in;
+    u_int64_t m_out;
+    int64_t m_base;
+    u_int64_t m_start;
+    u_int64_t m_maxLag;
+    unsigned int m_writes;
+    u_int64_t m_dropped;
+    unsigned int m_blocked;
+    bool m_closed;
+    bool m_orphan;
+    bool m_fixAu;
+    bool m_failed;
+};
+
+// Thread writing the buffered recordings to disk in large blocks
+class WaveWriter : public Thread
+{
+public:
+    WaveWriter(unsigned int index);
+    ~WaveWriter();
+    virtual void run();
+    virtual void cleanup();
+    void add(WaveBuffer* buffer);
+    inline void wake()
+	{ m_wake.unlock(); }
+    static WaveWriter* pick();
+private:
+    void service(bool force);
+    void release();
+    Mutex m_mutex;
+    Semaphore m_wake;
+    ObjList m_buffers;
+    unsigned int m_index;
+    unsigned int m_count;
 };
 
 class WaveConsumer : public DataConsumer
@@ -75,13 +230,19 @@ public:
     inline void setNotify(const String& id)
 	{ m_id = id; }
 private:
-    void writeIlbcHeader() const;
+    void writeIlbcHeader();
     void writeAuHeader();
+    void put(const void* data, unsigned int len);
+    void writeFailed();
+    void closeOutput(bool fixAu);
     CallEndpoint* m_chan;
     Stream* m_stream;
+    WaveBuffer* m_buffer;
+    String m_file;
     bool m_swap;
     bool m_locked;
     bool m_created;
+    bool m_failed;
     Header m_header;
     unsigned m_total;
     unsigned m_maxlen;
@@ -122,7 +283,9 @@ public:
     virtual void initialize();
     virtual bool msgExecute(Message& msg, String& dest);
 protected:
+    virtual bool received(Message& msg, int id);
     void statusParams(String& str);
+    void statusRecord(Message& msg);
     bool canStopCall() const
 	{ return true; }
 private:
@@ -137,6 +300,47 @@ int s_writing = 0;
 bool s_dataPadding = true;
 bool s_pubReadable = false;
 
+// Prompt cache, most recently used first
+ObjList s_cache;
+Mutex s_cacheMutex(false,"WaveFile::cache");
+unsigned int s_cacheSize = 0;
+unsigned int s_cacheFile = 0;
+bool s_cacheVariants = true;
+unsigned int s_cacheBytes = 0;
+u_int64_t s_cacheHits = 0;
+u_int64_t s_cacheMisses = 0;
+
+// Blocks read ahead for a file played from a shared media clock
+#define READ_AHEAD 5
+// Microseconds between read-ahead passes when not woken up
+#define READ_POLL 20000
+
+// Most writer threads that can be configured
+#define WRITERS_MAX 16
+// Writer threads wake up at least this often (usec) to flush old data
+#define WRITERS_POLL 100000
+// Longest time (msec) a media thread may be blocked by a full buffer, one frame
+#define RECORD_BLOCK_MAX 20
+
+// Write-behind recording, all recording buffers and the writer threads
+ObjList s_buffers;
+Mutex s_bufMutex(false,"WaveFile::buffers");
+WaveWriter* s_writers[WRITERS_MAX];
+unsigned int s_recWriters = 2;
+unsigned int s_recBuffer = 262144;
+unsigned int s_recBlock = 65536;
+u_int64_t s_recFlush = 1000000;
+bool s_recWait = false;
+unsigned int s_recNext = 0;
+u_int64_t s_recDropped = 0;
+unsigned int s_recFailed = 0;
+
+// Read-ahead of the files played from shared clocks, the reader holds no
+//  reference so the sources leave its list themselves
+ObjList s_prefetch;
+Mutex s_prefetchMutex(false,"WaveFile::prefetch");
+WaveReader* s_reader = 0;
+
 INIT_PLUGIN(WaveFileDriver);
 
 
@@ -186,6 +390,127 @@ static const char* ilbcFormat(Stream& stream)
 }
 
 
+WavePrompt::WavePrompt(const String& file, unsigned int mtime, WaveVariant* native)
+    : Mutex(false,"WavePrompt"),
+      m_file(file), m_mtime(mtime), m_bytes(native->m_data.length())
+{
+    m_variants.append(native);
+}
+
+// Get the content in a format, transcode the whole file on first request
+const WaveVariant* WavePrompt::variant(const DataFormat& format)
+{
+    Lock mylock(this);
+    const WaveVariant* v = static_cast<const WaveVariant*>(m_variants[format]);
+    if (v || !s_cacheVariants)
+	return v;
+    const FormatInfo* info = format.getInfo();
+    const WaveVariant* src = native();
+    if (!(info && info->dataRate() && src->m_brate))
+	return 0;
+    DataTranslator* trans = DataTranslator::create(src->m_format,format);
+    if (!trans)
+	return 0;
+    DataTranslator* first = trans->getFirstTranslator();
+    WaveCapture* cap = new WaveCapture(format);
+    // reserve the expected size so appending does not reallocate
+    cap->m_data.overAlloc((unsigned int)((u_int64_t)src->m_data.length() *
+	info->dataRate() / src->m_brate) + 1024);
+    trans->getTransSource()->attach(cap);
+    unsigned int blen = (src->m_brate * 20) / 1000;
+    unsigned long ts = 0;
+    for (unsigned int pos = 0; pos < src->m_data.length(); pos += blen) {
+	unsigned int len = src->m_data.length() - pos;
+	if (len > blen)
+	    len = blen;
+	DataBlock chunk((char*)src->m_data.data() + pos,len,false);
+	first->Consume(chunk,ts,0);
+	chunk.clear(false);
+	ts += len * (u_int64_t)src->m_rate / src->m_brate;
+    }
+    TelEngine::destruct(first);
+    WaveVariant* w = 0;
+    if (cap->m_data.length()) {
+	w = new WaveVariant(format,info->sampleRate,info->dataRate());
+	w->m_data = cap->m_data;
+	m_variants.append(w);
+    }
+    TelEngine::destruct(cap);
+    mylock.drop();
+    if (!w)
+	return 0;
+    Debug(&__plugin,DebugInfo,"Prompt '%s' transcoded from %s to %s, %u bytes",
+	m_file.c_str(),src->m_format.c_str(),format.c_str(),w->m_data.length());
+    grown(this,w->m_data.length());
+    return w;
+}
+
+// Find a cached prompt that is still current, return it referenced
+WavePrompt* WavePrompt::find(const String& file)
+{
+    unsigned int mtime = 0;
+    if (!(s_cacheSize && File::getFileTime(file,mtime)))
+	return 0;
+    Lock mylock(s_cacheMutex);
+    ObjList* l = s_cache.find(file);
+    WavePrompt* p = l ? static_cast<WavePrompt*>(l->get()) : 0;
+    if (p && (p->m_mtime == mtime) && p->ref()) {
+	s_cacheHits++;
+	if (l != s_cache.skipNull()) {
+	    l->remove(false);
+	    s_cache.insert(p);
+	}
+	return p;
+    }
+    s_cacheMisses++;
+    if (p) {
+	DDebug(&__plugin,DebugInfo,"Prompt '%s' changed on disk",file.c_str());
+	s_cacheBytes -= p->m_bytes;
+	l->remove();
+    }
+    return 0;
+}
+
+// Insert a prompt in the cache, replacing an older copy of the same file
+void WavePrompt::add(WavePrompt* prompt)
+{
+    if (!(prompt && prompt->ref()))
+	return;
+    Lock mylock(s_cacheMutex);
+    ObjList* l = s_cache.find(prompt->toString());
+    if (l) {
+	s_cacheBytes -= static_cast<WavePrompt*>(l->get())->m_bytes;
+	l->remove();
+    }
+    s_cache.insert(prompt);
+    s_cacheBytes += prompt->m_bytes;
+    trim();
+}
+
+// Account memory used by a new variant of a prompt
+void WavePrompt::grown(WavePrompt* prompt, unsigned int bytes)
+{
+    Lock mylock(s_cacheMutex);
+    prompt->m_bytes += bytes;
+    if (s_cache.find(prompt)) {
+	s_cacheBytes += bytes;
+	trim();
+    }
+}
+
+// Drop least recently used prompts until the cache fits, lock must be held
+void WavePrompt::trim()
+{
+    while (s_cacheBytes > s_cacheSize) {
+	WavePrompt* p = static_cast<WavePrompt*>(s_cache[s_cache.count() - 1]);
+	if (!p)
+	    break;
+	DDebug(&__plugin,DebugAll,"Prompt '%s' dropped from cache",p->toString().c_str());
+	s_cacheBytes -= p->m_bytes;
+	s_cache.remove(p);
+    }
+}
+
 WaveSource* WaveSource::create(const String& file, CallEndpoint* chan, bool autoclose, bool autorepeat, const NamedString* param)
 {
     WaveSource* tmp = new WaveSource(file,chan,autoclose);
@@ -212,12 +537,27 @@ WaveSource* WaveSource::create(const String& file, CallEndpoint* chan, bool auto
 
 void WaveSource::init(const String& file, bool autorepeat)
 {
+    bool cache = !m_stream;
     if (!m_stream) {
 	if (file == "-") {
 	    m_nodata = true;
 	    m_rate = 8000;
 	    m_brate = 8000;
-	    start("Wave Source");
+	    start();
+	    return;
+	}
+	WavePrompt* prompt = WavePrompt::find(file);
+	if (prompt) {
+	    DDebug(&__plugin,DebugAll,"WaveSource playing '%s' from cache [%p]",file.c_str(),this);
+	    m_prompt = prompt;
+	    prompt->deref();
+	    m_variant = m_prompt->native();
+	    m_format = m_variant->m_format;
+	    m_rate = m_variant->m_rate;
+	    m_brate = m_variant->m_brate;
+	    if (autorepeat)
+		m_repeatPos = 0;
+	    start();
 	    return;
 	}
 	m_stream = new File;
@@ -263,9 +603,13 @@ void WaveSource::init(const String& file, bool autorepeat)
     else if (!file.endsWith(".slin"))
 	Debug(DebugMild,"Unknown format for playback file '%s', assuming signed linear",file.c_str());
     if (computeDataRate()) {
-	if (autorepeat)
+	if (cache && loadPrompt(file)) {
+	    if (autorepeat)
+		m_repeatPos = 0;
+	}
+	else if (autorepeat)
 	    m_repeatPos = m_stream->seek(Stream::SeekCurrent);
-	start("Wave Source");
+	start();
     }
     else {
 	Debug(DebugWarn,"Unable to compute data rate for file '%s'",file.c_str());
@@ -274,9 +618,11 @@ void WaveSource::init(const String& file, bool autorepeat)
 }
 
 WaveSource::WaveSource(const char* file, CallEndpoint* chan, bool autoclose)
-    : m_chan(chan), m_stream(0), m_swap(false), m_rate(8000), m_brate(0), m_repeatPos(-1),
-      m_total(0), m_time(0), m_autoclose(autoclose),
-      m_nodata(false)
+    : m_chan(chan), m_stream(0), m_variant(0),
+      m_swap(false), m_rate(8000), m_brate(0), m_repeatPos(-1),
+      m_pos(0), m_stamp(0), m_total(0), m_time(0), m_autoclose(autoclose),
+      m_nodata(false), m_noChan(0 == chan), m_playing(false),
+      m_prefetch(false), m_readEnd(0)
 {
     Debug(&__plugin,DebugAll,"WaveSource::WaveSource(\"%s\",%p) [%p]",file,chan,this);
     s_statsMutex.lock();
@@ -288,6 +634,7 @@ WaveSource::~WaveSource()
 {
     Debug(&__plugin,DebugAll,"WaveSource::~WaveSource() [%p] total=%u stamp=%lu",this,m_total,timeStamp());
     stop();
+    WaveReader::remove(this);
     if (m_time) {
         m_time = Time::now() - m_time;
 	if (m_time) {
@@ -370,99 +717,247 @@ bool WaveSource::computeDataRate()
     return (m_brate != 0);
 }
 
-void WaveSource::run()
+// Read the rest of the file in the cache and play it from there
+bool WaveSource::loadPrompt(const String& file)
 {
-    unsigned long ts = 0;
-    int r = 0;
-    // internally reference if used for override or replace purpose
-    bool noChan = (0 == m_chan);
-    // wait until at least one consumer is attached
-    unsigned int fast = 4;
-    while (!r) {
-	lock();
-	r = m_consumers.count();
-	unlock();
-	if (r)
-	    ;
-	else if (fast) {
-	    --fast;
-	    Thread::yield();
+    unsigned int mtime = 0;
+    if (!(s_cacheSize && File::getFileTime(file,mtime)))
+	return false;
+    int64_t pos = m_stream->seek(Stream::SeekCurrent);
+    int64_t len = m_stream->length() - pos;
+    if ((pos < 0) || (len <= 0) || (len > (int64_t)s_cacheFile))
+	return false;
+    WaveVariant* v = new WaveVariant(m_format,m_rate,m_brate);
+    v->m_data.assign(0,(unsigned int)len);
+    if (m_stream->readData(v->m_data.data(),v->m_data.length()) != (int)len) {
+	TelEngine::destruct(v);
+	m_stream->seek(pos);
+	return false;
+    }
+    if (m_swap) {
+	uint16_t* p = (uint16_t*)v->m_data.data();
+	for (unsigned int i = 1; i < v->m_data.length(); i += 2) {
+	    *p = ntohs(*p);
+	    ++p;
 	}
-	else
-	    Thread::idle();
-	if (!looping(noChan)) {
-	    notify(0,"replaced");
-	    return;
+	m_swap = false;
+    }
+    WavePrompt* prompt = new WavePrompt(file,mtime,v);
+    WavePrompt::add(prompt);
+    m_prompt = prompt;
+    prompt->deref();
+    m_variant = v;
+    delete m_stream;
+    m_stream = 0;
+    return true;
+}
+
+// Accept a consumer's format before playback if the prompt can be converted to it
+bool WaveSource::setFormat(const DataFormat& format)
+{
+    if (!m_prompt)
+	return false;
+    Lock mylock(this);
+    if (m_playing || m_consumers.count())
+	return false;
+    if (format == m_format)
+	return true;
+    const WaveVariant* v = m_prompt->variant(format);
+    if (!v)
+	return false;
+    DDebug(&__plugin,DebugAll,"WaveSource switching from %s to cached %s [%p]",
+	m_format.c_str(),format.c_str(),this);
+    m_variant = v;
+    m_format = v->m_format;
+    m_rate = v->m_rate;
+    m_brate = v->m_brate;
+    return true;
+}
+
+// Forward one block straight from the cached prompt, negative at end of data
+int WaveSource::playPrompt()
+{
+    const unsigned char* data = (const unsigned char*)m_variant->m_data.data();
+    unsigned int len = m_variant->m_data.length();
+    if (m_pos >= len) {
+	if ((m_repeatPos < 0) || !len) {
+	    Debug(&__plugin,DebugAll,"WaveSource '%s' end of cached data (%u played) chan=%p [%p]",
+		m_id.c_str(),m_total,m_chan,this);
+	    notify(this,"eof");
+	    return -1;
 	}
+	DDebug(&__plugin,DebugAll,"Autorepeating cached prompt [%p]",this);
+	m_pos = 0;
     }
     unsigned int blen = (m_brate*20)/1000;
-    DDebug(&__plugin,DebugAll,"Consumer found, starting to play data with rate %d [%p]",m_brate,this);
-    m_data.assign(0,blen);
-    u_int64_t tpos = 0;
-    m_time = tpos;
-    while ((r > 0) && looping(noChan)) {
-	r = m_stream ? m_stream->readData(m_data.data(),m_data.length()) : m_data.length();
-	if (r < 0) {
-	    if (m_stream->canRetry()) {
-		if (looping(noChan)) {
-		    r = 1;
-		    continue;
-		}
-		r = 0;
-	    }
-	    break;
-	}
+    unsigned int r = len - m_pos;
+    if (r > blen)
+	r = blen;
+    // forward the cached data itself, only a padded last block is copied
+    DataBlock chunk;
+    bool copied = (r < blen) && s_dataPadding && ((m_format == "mulaw") || (m_format == "alaw"));
+    if (copied) {
+	chunk.assign(0,blen);
+	unsigned char* d = (unsigned char*)chunk.data();
+	::memcpy(d,data + m_pos,r);
+	::memset(d + r,data[m_pos + r - 1],blen - r);
+    }
+    else
+	chunk.assign((void*)(data + m_pos),r,false);
+    Forward(chunk,m_stamp);
+    m_stamp += chunk.length()*m_rate/m_brate;
+    if (!copied)
+	chunk.clear(false);
+    m_total += r;
+    m_pos += r;
+    return (int)(r*(u_int64_t)1000000/m_brate);
+}
+
+// Read and forward one block from the stream, negative at end of data
+// Read one block from the stream, return its length, zero if no data can be
+//  read yet, -1 at end of data or -2 on failure
+int WaveSource::readBlock(DataBlock& data)
+{
+    bool repeated = false;
+    for (;;) {
+	int r = m_stream ? m_stream->readData(data.data(),data.length()) : data.length();
+	if (r < 0)
+	    return m_stream->canRetry() ? 0 : -2;
 	// start counting time after the first successful read
-	if (!tpos)
-	    m_time = tpos = Time::now();
+	if (!m_time)
+	    m_time = Time::now();
 	if (!r) {
-	    if (m_repeatPos >= 0) {
+	    if ((m_repeatPos >= 0) && !repeated) {
 		DDebug(&__plugin,DebugAll,"Autorepeating from offset " FMT64 " [%p]",
 		    m_repeatPos,this);
 		m_stream->seek(m_repeatPos);
-		m_data.assign(0,blen);
-		r = 1;
+		data.assign(0,(m_brate*20)/1000);
+		repeated = true;
 		continue;
 	    }
-	    break;
+	    return -1;
 	}
-	if (r < (int)m_data.length()) {
+	if (r < (int)data.length()) {
 	    // if desired and possible extend last byte to fill buffer
 	    if (s_dataPadding && ((m_format == "mulaw") || (m_format == "alaw"))) {
-		unsigned char* d = (unsigned char*)m_data.data();
+		unsigned char* d = (unsigned char*)data.data();
 		unsigned char last = d[r-1];
-		while (r < (int)m_data.length())
-		    d[r++] = last;
+		int n = r;
+		while (n < (int)data.length())
+		    d[n++] = last;
 	    }
 	    else
-		m_data.assign(m_data.data(),r);
+		data.assign(data.data(),r);
 	}
 	if (m_swap) {
-	    uint16_t* p = (uint16_t*)m_data.data();
+	    uint16_t* p = (uint16_t*)data.data();
 	    for (int i = 0; i < r; i+= 2) {
 		*p = ntohs(*p);
 		++p;
 	    }
 	}
-	int64_t dly = tpos - Time::now();
-	if (dly > 0) {
-	    XDebug(&__plugin,DebugAll,"WaveSource sleeping for " FMT64 " usec",dly);
-	    Thread::usleep((unsigned long)dly);
+	return r;
+    }
+}
+
+// Fill the read-ahead queue, called from the reader thread
+// Return false when there is nothing more to read
+bool WaveSource::prefetch()
+{
+    unsigned int blen = (m_brate*20)/1000;
+    for (;;) {
+	lock();
+	unsigned int n = m_ahead.count();
+	bool done = (0 != m_readEnd);
+	unlock();
+	if (done)
+	    return false;
+	if (n >= READ_AHEAD)
+	    return true;
+	WaveChunk* c = new WaveChunk(blen);
+	int r = readBlock(c->m_data);
+	if (r <= 0)
+	    TelEngine::destruct(c);
+	else
+	    c->m_len = r;
+	lock();
+	if (c)
+	    m_ahead.append(c);
+	else if (r < 0)
+	    m_readEnd = r;
+	unlock();
+	if (!r)
+	    return true;
+    }
+}
+
+// Forward one block from the stream or from the read-ahead queue,
+//  zero if no data is available yet, negative at end of data
+int WaveSource::playStream()
+{
+    DataBlock* data = &m_data;
+    WaveChunk* c = 0;
+    int r = 0;
+    if (m_prefetch) {
+	lock();
+	c = static_cast<WaveChunk*>(m_ahead.remove(false));
+	r = c ? (int)c->m_len : m_readEnd;
+	unlock();
+	WaveReader::wake();
+	if (c)
+	    data = &c->m_data;
+    }
+    else
+	r = readBlock(m_data);
+    if (!r)
+	return 0;
+    if (r < 0) {
+	if (r == -1) {
+	    Debug(&__plugin,DebugAll,"WaveSource '%s' end of data (%u played) chan=%p [%p]",
+		m_id.c_str(),m_total,m_chan,this);
+	    notify(this,"eof");
+	}
+	else
+	    notify(0,"replaced");
+	return -1;
+    }
+    Forward(*data,m_stamp);
+    m_stamp += data->length()*m_rate/m_brate;
+    m_total += r;
+    TelEngine::destruct(c);
+    return (int)(r*(u_int64_t)1000000/m_brate);
+}
+
+// Called by the media clock, waits for a consumer then plays one block per tick
+int WaveSource::tick(u_int64_t when)
+{
+    if (!m_playing) {
+	lock();
+	if (m_consumers.count())
+	    m_playing = true;
+	unlock();
+	if (m_playing) {
+	    DDebug(&__plugin,DebugAll,"Consumer found, starting to play data with rate %d [%p]",
+		m_brate,this);
+	    if (m_variant)
+		m_time = Time::now();
+	    else {
+		m_data.assign(0,(m_brate*20)/1000);
+		// a shared clock must not wait for the disk
+		m_prefetch = m_stream && ClockedSource::sharedClocks();
+		if (m_prefetch)
+		    WaveReader::add(this);
+	    }
 	}
-	if (!looping(noChan))
-	    break;
-	Forward(m_data,ts);
-	ts += m_data.length()*m_rate/m_brate;
-	m_total += r;
-	tpos += (r*(u_int64_t)1000000/m_brate);
     }
-    if (r)
+    // internally referenced if used for override or replace purpose
+    if (!looping(m_noChan)) {
 	notify(0,"replaced");
-    else {
-	Debug(&__plugin,DebugAll,"WaveSource '%s' end of data (%u played) chan=%p [%p]",
-	    m_id.c_str(),m_total,m_chan,this);
-	notify(this,"eof");
+	return -1;
     }
+    if (!m_playing)
+	return 0;
+    return m_variant ? playPrompt() : playStream();
 }
 
 void WaveSource::cleanup()
@@ -476,9 +971,10 @@ void WaveSource::cleanup()
     }
     Debug(&__plugin,DebugAll,"WaveSource cleanup, total=%u, chan=%p [%p]",
 	m_total,(void*)chan,this);
+    WaveReader::remove(this);
     if (chan)
 	chan->clearData(this);
-    ThreadedSource::cleanup();
+    ClockedSource::cleanup();
 }
 
 void WaveSource::attached(bool added)
@@ -492,7 +988,7 @@ void WaveSource::attached(bool added)
 void WaveSource::setNotify(const String& id)
 {
     m_id = id;
-    if (!(m_stream || m_nodata))
+    if (!(m_stream || m_nodata || m_variant))
 	notify(this);
 }
 
@@ -529,7 +1025,8 @@ void WaveSource::notify(WaveSource* source, const char* reason)
 
 WaveConsumer::WaveConsumer(const String& file, CallEndpoint* chan, unsigned maxlen,
     const char* format, bool append, const NamedString* param)
-    : m_chan(chan), m_stream(0), m_swap(false), m_locked(false), m_created(true), m_header(None),
+    : m_chan(chan), m_stream(0), m_buffer(0), m_file(file),
+      m_swap(false), m_locked(false), m_created(true), m_failed(false), m_header(None),
       m_total(0), m_maxlen(maxlen), m_time(0)
 {
     Debug(&__plugin,DebugAll,"WaveConsumer::WaveConsumer(\"%s\",%p,%u,\"%s\",%s,%p) [%p]",
@@ -625,7 +1122,61 @@ WaveConsumer::~WaveConsumer()
 	    Debug(&__plugin,DebugInfo,"WaveConsumer rate=" FMT64U " b/s",m_time);
 	}
     }
-    if (m_stream && (Au == m_header)) {
+    closeOutput(Au == m_header);
+    s_statsMutex.lock();
+    s_writing--;
+    s_statsMutex.unlock();
+}
+
+// Send data to the write-behind buffer if there is one, else to the file
+void WaveConsumer::put(const void* data, unsigned int len)
+{
+    if (m_buffer) {
+	m_buffer->write(data,len);
+	if (m_buffer->failed())
+	    writeFailed();
+    }
+    else if (m_stream && (m_stream->writeData(data,len) != (int)len))
+	writeFailed();
+}
+
+// Tell the channel once that the recording could not be written
+void WaveConsumer::writeFailed()
+{
+    if (m_failed)
+	return;
+    m_failed = true;
+    s_statsMutex.lock();
+    s_recFailed++;
+    s_statsMutex.unlock();
+    RefPointer<CallEndpoint> chan;
+    if (m_chan) {
+	s_consMutex.lock();
+	chan = m_chan;
+	s_consMutex.unlock();
+    }
+    Debug(&__plugin,DebugWarn,"WaveConsumer failed writing '%s' after %u bytes, chan=%p [%p]",
+	m_file.c_str(),m_total,(void*)chan,this);
+    if (!(m_id || chan))
+	return;
+    Message* m = new Message("chan.notify");
+    if (chan)
+	m->addParam("id",chan->id());
+    m->addParam("targetid",m_id ? m_id : chan->id());
+    m->addParam("reason","error");
+    m->addParam("file",m_file);
+    Engine::enqueue(m);
+}
+
+// Finish the file, the buffer does it later from its writer thread
+void WaveConsumer::closeOutput(bool fixAu)
+{
+    if (m_buffer) {
+	m_buffer->close(fixAu);
+	TelEngine::destruct(m_buffer);
+	return;
+    }
+    if (m_stream && fixAu) {
 	int64_t len = m_stream->length();
 	if ((len >= (int64_t)(sizeof(AuHeader) + sizeof(AuInfo))) && (m_stream->seek(8) == 8)) {
 	    uint32_t bytes = htonl(len - sizeof(AuHeader) - sizeof(AuInfo));
@@ -634,17 +1185,14 @@ WaveConsumer::~WaveConsumer()
     }
     delete m_stream;
     m_stream = 0;
-    s_statsMutex.lock();
-    s_writing--;
-    s_statsMutex.unlock();
 }
 
-void WaveConsumer::writeIlbcHeader() const
+void WaveConsumer::writeIlbcHeader()
 {
     if (m_format == "ilbc20")
-	m_stream->writeData("#!iLBC20\n",ILBC_HEADER_LEN);
+	put("#!iLBC20\n",ILBC_HEADER_LEN);
     else if (m_format == "ilbc30")
-	m_stream->writeData("#!iLBC30\n",ILBC_HEADER_LEN);
+	put("#!iLBC30\n",ILBC_HEADER_LEN);
     else
 	Debug(DebugMild,"Invalid iLBC format '%s', not writing header",m_format.c_str());
 }
@@ -682,8 +1230,8 @@ void WaveConsumer::writeAuHeader()
     header.freq = htonl(rate);
     header.chan = htonl(chans);
     header.len = 0xFFFFFFFF;
-    m_stream->writeData(&header,sizeof(header));
-    m_stream->writeData(AuInfo,sizeof(AuInfo));
+    put(&header,sizeof(header));
+    put(AuInfo,sizeof(AuInfo));
 }
 
 bool WaveConsumer::setFormat(const DataFormat& format)
@@ -721,7 +1269,12 @@ unsigned long WaveConsumer::Consume(const DataBlock& data, unsigned long tStamp,
     if (!data.null()) {
 	if (!m_time)
 	    m_time = Time::now();
-	if (m_stream) {
+	// the media thread only copies to memory from now on
+	if (m_stream && s_recWriters) {
+	    m_buffer = new WaveBuffer(m_stream,m_file);
+	    m_stream = 0;
+	}
+	if (m_stream || m_buffer) {
 	    if (m_created) {
 		m_created = false;
 		switch (m_header) {
@@ -742,16 +1295,15 @@ unsigned long WaveConsumer::Consume(const DataBlock& data, unsigned long tStamp,
 		uint16_t* d = (uint16_t*)swapped.data();
 		for (unsigned int i = 0; i < n; i+= 2)
 		    *d++ = htons(*s++);
-		m_stream->writeData(swapped);
+		put(swapped.data(),n);
 	    }
 	    else
-		m_stream->writeData(data);
+		put(data.data(),data.length());
 	}
 	m_total += data.length();
 	if (m_maxlen && (m_total >= m_maxlen)) {
 	    m_maxlen = 0;
-	    delete m_stream;
-	    m_stream = 0;
+	    closeOutput(false);
 	    RefPointer<CallEndpoint> chan;
 	    if (m_chan) {
 		s_consMutex.lock();
@@ -780,6 +1332,389 @@ void WaveConsumer::attached(bool added)
 }
 
 
+WaveBuffer::WaveBuffer(Stream* stream, const String& file)
+    : Mutex(false,"WaveBuffer"),
+      m_stream(stream), m_writer(0), m_file(file), m_ring(0), m_size(s_recBuffer),
+      m_in(0), m_out(0), m_base(0), m_start(0), m_maxLag(0),
+      m_writes(0), m_dropped(0), m_blocked(0),
+      m_closed(false), m_orphan(false), m_fixAu(false), m_failed(false)
+{
+    // keep the writes aligned to blocks of the file when appending to it
+    m_base = m_stream->seek(Stream::SeekCurrent);
+    if (m_base < 0)
+	m_base = 0;
+    m_ring = new unsigned char[m_size];
+    s_bufMutex.lock();
+    m_id << "rec" << ++s_recNext;
+    s_buffers.append(this)->setDelete(false);
+    s_bufMutex.unlock();
+    DDebug(&__plugin,DebugAll,"WaveBuffer '%s' %u bytes for '%s' [%p]",
+	m_id.c_str(),m_size,file.c_str(),this);
+    m_writer = WaveWriter::pick();
+    if (m_writer)
+	m_writer->add(this);
+    else
+	m_orphan = true;
+}
+
+WaveBuffer::~WaveBuffer()
+{
+    DDebug(&__plugin,DebugAll,"WaveBuffer '%s' destroyed, %u writes, max lag %u ms [%p]",
+	m_id.c_str(),m_writes,(unsigned int)(m_maxLag / 1000),this);
+    s_bufMutex.lock();
+    s_buffers.remove(this,false);
+    s_bufMutex.unlock();
+    finish();
+    delete[] m_ring;
+}
+
+// How long the oldest queued data has been waiting, assuming a steady rate
+u_int64_t WaveBuffer::lag(u_int64_t now) const
+{
+    if (!(m_in && m_start) || (now <= m_start))
+	return 0;
+    return (now - m_start) * (m_in - m_out) / m_in;
+}
+
+// Copy data to the ring from the media thread, false if it had to be dropped
+bool WaveBuffer::write(const void* data, unsigned int len)
+{
+    if (!(data && len))
+	return true;
+    Lock lck(this);
+    if (m_orphan) {
+	// no writer thread left, write directly
+	lck.drop();
+	drain(true);
+	lck.acquire(this);
+	if (m_stream && !m_failed && (m_stream->writeData(data,len) != (int)len))
+	    m_failed = true;
+	return !m_failed;
+    }
+    unsigned int waited = 0;
+    while (m_size - queued() < len) {
+	if (!s_recWait || m_closed || m_orphan || (waited >= RECORD_BLOCK_MAX)) {
+	    m_dropped += len;
+	    lck.drop();
+	    s_statsMutex.lock();
+	    s_recDropped += len;
+	    s_statsMutex.unlock();
+	    return false;
+	}
+	if (!waited)
+	    m_blocked++;
+	m_writer->wake();
+	lck.drop();
+	Thread::msleep(2);
+	waited += 2;
+	lck.acquire(this);
+    }
+    if (!m_start)
+	m_start = Time::now();
+    unsigned int pos = (unsigned int)(m_in % m_size);
+    unsigned int n = m_size - pos;
+    if (n > len)
+	n = len;
+    ::memcpy(m_ring + pos,data,n);
+    if (n < len)
+	::memcpy(m_ring,(const unsigned char*)data + n,len - n);
+    m_in += len;
+    if (queued() >= s_recBlock)
+	m_writer->wake();
+    return true;
+}
+
+// Write out whole blocks, everything if forced, closed or too old
+// Returns true once closed and everything was written
+bool WaveBuffer::drain(bool force)
+{
+    lock();
+    u_int64_t now = Time::now();
+    u_int64_t lg = lag(now);
+    if (m_maxLag < lg)
+	m_maxLag = lg;
+    bool closed = m_closed;
+    unsigned int n = queued();
+    if (n && !(force || closed || (lg >= s_recFlush))) {
+	// stop at the last block boundary of the file
+	u_int64_t end = m_base + m_in;
+	end -= end % s_recBlock;
+	u_int64_t start = m_base + m_out;
+	n = (end > start) ? (unsigned int)(end - start) : 0;
+    }
+    unsigned int pos = (unsigned int)(m_out % m_size);
+    bool failed = m_failed;
+    unlock();
+    // the media thread only appends so the data can be written unlocked
+    while (n) {
+	unsigned int len = m_size - pos;
+	if (len > n)
+	    len = n;
+	if (m_stream && !failed) {
+	    if (m_stream->writeData(m_ring + pos,len) != (int)len) {
+		Debug(&__plugin,DebugWarn,"Writing '%s' failed: error %d: %s",
+		    m_file.c_str(),m_stream->error(),::strerror(m_stream->error()));
+		failed = true;
+	    }
+	    m_writes++;
+	}
+	lock();
+	m_out += len;
+	// the recorder checks the failure from the media thread
+	if (failed)
+	    m_failed = true;
+	unlock();
+	n -= len;
+	pos = (pos + len) % m_size;
+    }
+    if (!closed)
+	return false;
+    lock();
+    bool done = !queued();
+    unlock();
+    if (done)
+	finish();
+    return done;
+}
+
+// Called by the recorder when it is done, the writer finishes the file
+void WaveBuffer::close(bool fixAu)
+{
+    lock();
+    m_closed = true;
+    m_fixAu = fixAu;
+    bool orphan = m_orphan;
+    if (!orphan)
+	m_writer->wake();
+    unlock();
+    if (orphan)
+	drain(true);
+}
+
+// The writer thread is going away, the recorder must write by itself
+void WaveBuffer::orphan()
+{
+    drain(true);
+    lock();
+    m_orphan = true;
+    m_writer = 0;
+    unlock();
+}
+
+// Patch the length in the au header and close the file
+void WaveBuffer::finish()
+{
+    if (!m_stream)
+	return;
+    lock();
+    bool fixAu = m_fixAu && !m_failed;
+    unlock();
+    if (fixAu) {
+	int64_t len = m_stream->length();
+	if ((len >= (int64_t)(sizeof(AuHeader) + sizeof(AuInfo))) && (m_stream->seek(8) == 8)) {
+	    uint32_t bytes = htonl(len - sizeof(AuHeader) - sizeof(AuInfo));
+	    m_stream->writeData(&bytes,sizeof(bytes));
+	}
+    }
+    delete m_stream;
+    m_stream = 0;
+}
+
+void WaveBuffer::status(String& str, u_int64_t now)
+{
+    Lock lck(this);
+    str.append(m_id,",") << "=" << m_file << "|" << queued();
+    str << "|" << (unsigned int)(lag(now) / 1000) << "|" << (unsigned int)(m_maxLag / 1000);
+    str << "|" << m_writes << "|" << m_dropped << "|" << m_blocked;
+}
+
+
+WaveReader::WaveReader()
+    : Thread("Wave Reader"),
+      m_wake(1,"WaveReader::wake",0)
+{
+    DDebug(&__plugin,DebugAll,"WaveReader::WaveReader() [%p]",this);
+}
+
+WaveReader::~WaveReader()
+{
+    DDebug(&__plugin,DebugAll,"WaveReader::~WaveReader() [%p]",this);
+    s_prefetchMutex.lock();
+    if (s_reader == this)
+	s_reader = 0;
+    s_prefetchMutex.unlock();
+}
+
+// Read ahead for all the sources periodically or when one of them used data
+void WaveReader::run()
+{
+    while (!Thread::check(false)) {
+	m_wake.lock(READ_POLL);
+	// hold the sources only while reading, dying ones are skipped
+	ObjList work;
+	s_prefetchMutex.lock();
+	for (ObjList* l = s_prefetch.skipNull(); l; l = l->skipNext()) {
+	    WaveSource* src = static_cast<WaveSource*>(l->get());
+	    if (src->ref())
+		work.append(src)->setDelete(false);
+	}
+	s_prefetchMutex.unlock();
+	while (WaveSource* src = static_cast<WaveSource*>(work.remove(false))) {
+	    if (!src->prefetch())
+		remove(src);
+	    // the last reference may be dropped here so the list must be unlocked
+	    src->deref();
+	}
+    }
+}
+
+// Start reading ahead for a source, start the reader thread if needed
+void WaveReader::add(WaveSource* source)
+{
+    Lock lck(s_prefetchMutex);
+    if (!s_prefetch.find(source))
+	s_prefetch.append(source)->setDelete(false);
+    if (s_reader) {
+	s_reader->m_wake.unlock();
+	return;
+    }
+    s_reader = new WaveReader;
+    if (!s_reader->startup()) {
+	Debug(&__plugin,DebugWarn,"Failed to start wave reader thread");
+	WaveReader* r = s_reader;
+	s_reader = 0;
+	// the destructor needs the list mutex
+	lck.drop();
+	delete r;
+    }
+}
+
+void WaveReader::remove(WaveSource* source)
+{
+    Lock lck(s_prefetchMutex);
+    s_prefetch.remove(source,false);
+}
+
+void WaveReader::wake()
+{
+    Lock lck(s_prefetchMutex);
+    if (s_reader)
+	s_reader->m_wake.unlock();
+}
+
+WaveWriter::WaveWriter(unsigned int index)
+    : Thread("Wave Writer"),
+      m_mutex(false,"WaveWriter"), m_wake(1,"WaveWriter::wake",0),
+      m_index(index), m_count(0)
+{
+    DDebug(&__plugin,DebugAll,"WaveWriter::WaveWriter(%u) [%p]",index,this);
+}
+
+WaveWriter::~WaveWriter()
+{
+    DDebug(&__plugin,DebugAll,"WaveWriter::~WaveWriter() %u [%p]",m_index,this);
+    s_bufMutex.lock();
+    if (s_writers[m_index] == this)
+	s_writers[m_index] = 0;
+    s_bufMutex.unlock();
+}
+
+// Start a writer until the configured number runs, then use the least loaded
+WaveWriter* WaveWriter::pick()
+{
+    Lock lck(s_bufMutex);
+    WaveWriter* writer = 0;
+    int free = -1;
+    for (unsigned int i = 0; i < s_recWriters; i++) {
+	WaveWriter* w = s_writers[i];
+	if (!w) {
+	    if (free < 0)
+		free = i;
+	}
+	else if (!writer || (w->m_count < writer->m_count))
+	    writer = w;
+    }
+    if (writer && ((free < 0) || !writer->m_count))
+	return writer;
+    if (free < 0)
+	return 0;
+    WaveWriter* w = new WaveWriter(free);
+    if (!w->startup()) {
+	Debug(&__plugin,DebugWarn,"Failed to start wave writer thread %d",free);
+	// the destructor needs the list mutex
+	lck.drop();
+	delete w;
+	return writer;
+    }
+    s_writers[free] = w;
+    return w;
+}
+
+void WaveWriter::add(WaveBuffer* buffer)
+{
+    buffer->ref();
+    Lock lck(m_mutex);
+    m_buffers.append(buffer);
+    m_count++;
+}
+
+void WaveWriter::run()
+{
+    while (!Thread::check(false)) {
+	m_wake.lock(WRITERS_POLL);
+	service(false);
+    }
+    release();
+}
+
+void WaveWriter::cleanup()
+{
+    release();
+}
+
+// Drain all our buffers, drop the ones that finished their files
+void WaveWriter::service(bool force)
+{
+    m_mutex.lock();
+    ObjList* l = m_buffers.skipNull();
+    while (l) {
+	WaveBuffer* buf = static_cast<WaveBuffer*>(l->get());
+	m_mutex.unlock();
+	bool done = buf->drain(force);
+	m_mutex.lock();
+	if (!done) {
+	    l = l->skipNext();
+	    continue;
+	}
+	// only this thread removes buffers so the list item is still valid
+	l->remove(false);
+	m_count--;
+	m_mutex.unlock();
+	buf->deref();
+	m_mutex.lock();
+	l = l->skipNull();
+    }
+    m_mutex.unlock();
+}
+
+// Write everything and leave the buffers still recording to their owners
+void WaveWriter::release()
+{
+    for (;;) {
+	m_mutex.lock();
+	ObjList* l = m_buffers.skipNull();
+	WaveBuffer* buf = l ? static_cast<WaveBuffer*>(l->remove(false)) : 0;
+	if (buf)
+	    m_count--;
+	m_mutex.unlock();
+	if (!buf)
+	    break;
+	buf->orphan();
+	buf->deref();
+    }
+}
+
+
 Disconnector::Disconnector(CallEndpoint* chan, const String& id, WaveSource* source, WaveConsumer* consumer, bool disc, const char* reason)
     : Thread("WaveDisconnector"),
       m_chan(chan), m_msg(0), m_source(0), m_consumer(consumer), m_disc(disc)
@@ -1233,9 +2168,61 @@ void WaveFileDriver::statusParams(String& str)
 {
     str.append("play=",",") << s_reading;
     str << ",record=" << s_writing;
+    s_cacheMutex.lock();
+    u_int64_t total = s_cacheHits + s_cacheMisses;
+    str << ",prompts=" << s_cache.count() << ",promptbytes=" << s_cacheBytes;
+    str << ",prompthits=" << s_cacheHits << ",promptmisses=" << s_cacheMisses;
+    s_cacheMutex.unlock();
+    if (total)
+	str << ",prompthitrate=" << (unsigned int)(s_cacheHits * 100 / total);
+    u_int64_t now = Time::now();
+    unsigned int queued = 0;
+    u_int64_t lag = 0;
+    s_bufMutex.lock();
+    for (ObjList* l = s_buffers.skipNull(); l; l = l->skipNext()) {
+	WaveBuffer* buf = static_cast<WaveBuffer*>(l->get());
+	buf->lock();
+	queued += buf->queued();
+	if (lag < buf->lag(now))
+	    lag = buf->lag(now);
+	buf->unlock();
+    }
+    str << ",recorders=" << s_buffers.count() << ",recqueued=" << queued;
+    s_bufMutex.unlock();
+    str << ",reclag=" << (unsigned int)(lag / 1000);
+    s_statsMutex.lock();
+    str << ",recdropped=" << s_recDropped << ",recfailed=" << s_recFailed;
+    s_statsMutex.unlock();
     Driver::statusParams(str);
 }
 
+// Status of each write-behind recording buffer
+void WaveFileDriver::statusRecord(Message& msg)
+{
+    String str;
+    u_int64_t now = Time::now();
+    s_bufMutex.lock();
+    unsigned int n = s_buffers.count();
+    for (ObjList* l = s_buffers.skipNull(); l; l = l->skipNext())
+	static_cast<WaveBuffer*>(l->get())->status(str,now);
+    s_bufMutex.unlock();
+    msg.retValue() << "name=" << prefix() << "record,type=" << type();
+    msg.retValue() << ",format=File|Queued|Lag|MaxLag|Writes|Dropped|Blocked";
+    msg.retValue() << ";recorders=" << n << ",writers=" << s_recWriters;
+    if (str && msg.getBoolValue("details",true))
+	msg.retValue() << ";" << str;
+    msg.retValue() << "\r\n";
+}
+
+bool WaveFileDriver::received(Message& msg, int id)
+{
+    if ((id == Status) && ((prefix() + "record") == msg["module"])) {
+	statusRecord(msg);
+	return true;
+    }
+    return Driver::received(msg,id);
+}
+
 WaveFileDriver::WaveFileDriver()
     : Driver("wave","misc"), m_handler(0)
 {
@@ -1248,6 +2235,22 @@ void WaveFileDriver::initialize()
     setup();
     s_dataPadding = Engine::config().getBoolValue("hacks","datapadding",true);
     s_pubReadable = Engine::config().getBoolValue("hacks","wavepubread",false);
+    Configuration cfg(Engine::configFile("wavefile"));
+    s_cacheMutex.lock();
+    s_cacheSize = 1024 * cfg.getIntValue("general","cache_size",16384,0,4194303);
+    s_cacheFile = 1024 * cfg.getIntValue("general","cache_file",1024,1,1048576);
+    s_cacheVariants = cfg.getBoolValue("general","cache_variants",true);
+    WavePrompt::trim();
+    s_cacheMutex.unlock();
+    s_bufMutex.lock();
+    s_recWriters = cfg.getIntValue("record","writers",2,0,WRITERS_MAX);
+    s_recBlock = 1024 * cfg.getIntValue("record","block",64,4,4096);
+    s_recBuffer = 1024 * cfg.getIntValue("record","buffer",256,8,65536);
+    if (s_recBuffer < 2 * s_recBlock)
+	s_recBuffer = 2 * s_recBlock;
+    s_recFlush = 1000 * (u_int64_t)cfg.getIntValue("record","flush",1000,20,60000);
+    s_recWait = (cfg.getValue("record","overflow") == YSTRING("block"));
+    s_bufMutex.unlock();
     if (!m_handler) {
 	m_handler = new AttachHandler;
 	Engine::install(m_handler);
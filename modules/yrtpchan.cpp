@@ -81,6 +81,20 @@ static TokenDict dict_yrtp_dir[] = {
     { 0 , 0 },
 };
 
+/* Codec impairment factors for the E-model, from ITU-T G.113 Appendix I */
+static const struct {
+    const char* format;
+    unsigned int ie;
+    unsigned int bpl;                    // Packet loss robustness x 10
+} s_impairments[] = {
+    { "mulaw",     0, 251 },
+    { "alaw",      0, 251 },
+    { "g723",     15, 161 },
+    { "g729",     11, 190 },
+    { "gsm-efr",   5, 100 },
+    { 0,           0,   0 },
+};
+
 static bool s_ipv6 = false;              // IPv6 support enabled
 static int s_minport = MIN_PORT;
 static int s_maxport = MAX_PORT;
@@ -95,6 +109,7 @@ static bool s_warnLater = false;
 static bool s_monitor   = false;
 static bool s_rtcp  = true;
 static bool s_drill = false;
+static bool s_relay = false;
 
 static Thread::Priority s_priority = Thread::Normal;
 static String s_affinity;
@@ -105,8 +120,33 @@ static int s_interval= 0;
 static int s_timeout = 0;
 static int s_udptlTimeout = 0;
 
+static bool s_reportXR = false;
+
 static int s_minJitter = 0;
 static int s_maxJitter = 0;
+static bool s_adaptiveJitter = false;
+
+static RTPGroupPool s_groups;
+
+// Put a session in a pooled group or in a group of its own
+static bool initGroup(UDPSession* sess, int msec, const Message& msg)
+{
+    const String& affinity = msg[YSTRING("affinity")];
+    // an explicit affinity asks for a dedicated group
+    if (s_groups.enabled() && !affinity)
+	return sess->initGroup(s_groups);
+    return sess->initGroup(msec,Thread::priority(msg.getValue(YSTRING("thread")),s_priority),
+	affinity ? affinity : s_affinity);
+}
+
+// RTP clock rate of an audio format
+static unsigned int rtpClock(const String& format)
+{
+    // G.722 uses a 8 kHz RTP clock for historical reasons, see RFC 3551
+    if (format.startsWith("g722"))
+	return 8000;
+    return DataFormat(format).sampleRate();
+}
 
 class YRTPSource;
 class YRTPConsumer;
@@ -162,6 +202,8 @@ public:
 	{ return m_audio; }
     inline bool valid() const
 	{ return m_valid; }
+    inline bool relay() const
+	{ return m_relay; }
     DataSource* getSource();
     DataConsumer* getConsumer();
     void addDirection(RTPSession::Direction direction);
@@ -200,6 +242,7 @@ private:
     bool m_audio;
     bool m_valid;
     bool m_ipv6;
+    bool m_relay;
 
     unsigned int m_noAudio;
     unsigned int m_lostAudio;
@@ -223,11 +266,14 @@ public:
 	{ m_resync = true; }
     inline void anySSRC(bool acceptAny = true)
 	{ m_anyssrc = acceptAny; }
+    inline u_int32_t relayed() const
+	{ return m_relayed; }
 protected:
     virtual void timeout(bool initial);
 private:
     YRTPWrapper* m_wrap;
     u_int32_t m_lastLost;
+    u_int32_t m_relayed;
     int m_newPayload;
     bool m_resync;
     bool m_anyssrc;
@@ -261,6 +307,7 @@ public:
 	{ return m_wrap && m_wrap->valid(); }
     inline void busy(bool isBusy)
 	{ m_busy = isBusy; }
+    bool relay(bool marker, unsigned int timestamp, const void* data, int len);
 private:
     YRTPWrapper* m_wrap;
     volatile bool m_busy;
@@ -274,7 +321,9 @@ public:
     ~YRTPConsumer();
     virtual bool valid() const
 	{ return m_wrap && m_wrap->valid(); }
+    virtual void* getObject(const String& name) const;
     virtual unsigned long Consume(const DataBlock &data, unsigned long tStamp, unsigned long flags);
+    bool relay(const DataSource* source, bool marker, unsigned int timestamp, const void* data, int len);
     inline void setSplitable()
 	{ m_splitable = (m_format == YSTRING("alaw")) || (m_format == YSTRING("mulaw")); }
 private:
@@ -410,7 +459,8 @@ YRTPWrapper::YRTPWrapper(const char* localip, CallEndpoint* conn, const char* me
     RTPSession::Direction direction, Message& msg, bool udptl, bool ipv6)
     : m_rtp(0), m_udptl(0), m_dir(direction), m_conn(conn),
       m_source(0), m_consumer(0), m_media(media),
-      m_bufsize(0), m_port(0), m_valid(true), m_ipv6(ipv6), m_noAudio(0), m_lostAudio(0),
+      m_bufsize(0), m_port(0), m_valid(true), m_ipv6(ipv6), m_relay(s_relay),
+      m_noAudio(0), m_lostAudio(0),
       m_traceId(msg.getValue(YSTRING("trace_id")))
 {
     TraceDebug(m_traceId,&splugin,DebugAll,"YRTPWrapper::YRTPWrapper('%s',%p,'%s',%s,%p,%s) [%p]",
@@ -459,6 +509,7 @@ YRTPWrapper::~YRTPWrapper()
 	    m_rtp->getStats(*m);
 	    m->setParam("noaudio",String(m_noAudio));
 	    m->setParam("lostaudio",String(m_lostAudio));
+	    m->setParam("relayed",String(m_rtp->relayed()));
 	    Engine::enqueue(m);
 	}
 	TelEngine::destruct(m_rtp);
@@ -710,6 +761,7 @@ bool YRTPWrapper::startRTP(const char* raddr, unsigned int rport, Message& msg)
     if (!setRemote(raddr,rport,msg))
 	return false;
     m_rtp->anySSRC(msg.getBoolValue(YSTRING("anyssrc"),s_anyssrc));
+    m_relay = msg.getBoolValue(YSTRING("relay"),s_relay);
     m_format = format;
     // Change format of source and/or consumer,
     //  reinstall them to rebuild codec chains
@@ -736,8 +788,7 @@ bool YRTPWrapper::startRTP(const char* raddr, unsigned int rport, Message& msg)
 	    m_consumer->deref();
 	}
     }
-    if (!(m_rtp->initGroup(msec,Thread::priority(msg.getValue(YSTRING("thread")),s_priority),msg.getValue(YSTRING("affinity"),s_affinity)) &&
-	 m_rtp->direction(m_dir)))
+    if (!(initGroup(m_rtp,msec,msg) && m_rtp->direction(m_dir)))
 	return false;
 
     m_rtp->initDebugData(msg);
@@ -774,12 +825,25 @@ bool YRTPWrapper::startRTP(const char* raddr, unsigned int rport, Message& msg)
     }
     setTimeout(msg,s_timeout);
     m_rtp->setReports(msg.getIntValue(YSTRING("rtcp_interval"),s_interval));
-    // dejittering is only meaningful for audio
+    m_rtp->setReportXR(msg.getBoolValue(YSTRING("rtcp_xr"),s_reportXR));
+    // dejittering and quality estimation are only meaningful for audio
     if (isAudio()){
+	unsigned int rate = rtpClock(m_format);
+	if (m_rtp->receiver()) {
+	    RTPQuality& q = m_rtp->receiver()->quality();
+	    q.clockRate(rate);
+	    for (int i = 0; s_impairments[i].format; i++) {
+		if (m_format == s_impairments[i].format) {
+		    q.impairment(s_impairments[i].ie,s_impairments[i].bpl);
+		    break;
+		}
+	    }
+	}
 	int minJitter = msg.getIntValue(YSTRING("minjitter"),s_minJitter);
 	int maxJitter = msg.getIntValue(YSTRING("maxjitter"),s_maxJitter);
 	if (minJitter >= 0 && maxJitter > 0)
-	    m_rtp->setDejitter(minJitter*1000,maxJitter*1000);
+	    m_rtp->setDejitter(minJitter*1000,maxJitter*1000,
+		msg.getBoolValue(YSTRING("adaptivejitter"),s_adaptiveJitter),rate);
     }
     m_bufsize = s_bufsize;
     return true;
@@ -797,8 +861,7 @@ bool YRTPWrapper::startUDPTL(const char* raddr, unsigned int rport, Message& msg
     int msec = msg.getIntValue(YSTRING("msleep"),s_sleep);
     if (!setRemote(raddr,rport,msg))
 	return false;
-    if (!m_udptl->initGroup(msec,Thread::priority(msg.getValue(YSTRING("thread")),s_priority),
-				msg.getValue(YSTRING("affinity"),s_affinity)))
+    if (!initGroup(m_udptl,msec,msg))
 	return false;
 
     m_udptl->setTOS(tos);
@@ -981,6 +1044,8 @@ void YRTPWrapper::terminate(Message& msg)
 	m_udptl->getStats(stats);
     if (stats)
 	msg.setParam("stats",stats);
+    if (m_rtp && m_rtp->receiver() && m_rtp->receiver()->ioPackets())
+	m_rtp->receiver()->qualityStats(msg,"rtp_");
     m_valid = false;
 }
 
@@ -1002,7 +1067,7 @@ void YRTPWrapper::setFaxDivert(const Message& msg)
 
 YRTPSession::YRTPSession(YRTPWrapper* wrap)
     : RTPSession(&splugin,wrap ? wrap->traceId().c_str() : (const char*)0),
-    m_wrap(wrap), m_lastLost(0), m_newPayload(-1),
+    m_wrap(wrap), m_lastLost(0), m_relayed(0), m_newPayload(-1),
     m_resync(false), m_anyssrc(false), m_getFax(true)
 {
 }
@@ -1038,6 +1103,12 @@ bool YRTPSession::rtpRecvData(bool marker, unsigned int timestamp, const void* d
 	m_lastLost = lost;
     }
     // the source will not be destroyed until we reset the busy flag
+    if (!(flags & DataNode::DataMissed) && m_wrap->relay() &&
+	source->relay(marker,timestamp,data,len)) {
+	m_relayed++;
+	source->busy(false);
+	return true;
+    }
     DataBlock block;
     block.assign((void*)data, len, false);
     source->Forward(block,timestamp,flags);
@@ -1186,6 +1257,36 @@ YRTPSource::~YRTPSource()
     }
 }
 
+// Send received data directly to the RTP consumer of another wrapper
+// Fails if the regular data chain is needed (transcoding, recording, override)
+bool YRTPSource::relay(bool marker, unsigned int timestamp, const void* data, int len)
+{
+    Lock mylock(this,100000);
+    if (!(mylock.locked() && alive()))
+	return false;
+    ObjList* l = m_consumers.skipNull();
+    if (!l || l->skipNext())
+	return false;
+    YRTPConsumer* c = static_cast<YRTPConsumer*>(static_cast<DataConsumer*>(l->get())->getObject(YATOM("YRTPConsumer")));
+    if (!(c && (c->getFormat() == m_format) && (c->getConnSource() == this) && c->ref()))
+	return false;
+    // send unlocked like Forward() does, detach() waits for us
+    DataSourceReader* reader = addReader();
+    mylock.drop();
+    bool ok = c->relay(this,marker,timestamp,data,len);
+    lock();
+    releaseReader(reader);
+    if (ok) {
+	const FormatInfo* f = m_format.getInfo();
+	unsigned long nSamp = f ? f->guessSamples(len) : 0;
+	m_timestamp = timestamp;
+	m_nextStamp = nSamp ? (timestamp + nSamp) : invalidStamp();
+    }
+    unlock();
+    c->deref();
+    return ok;
+}
+
 
 YRTPConsumer::YRTPConsumer(YRTPWrapper *wrap)
     : m_wrap(wrap), m_splitable(false)
@@ -1216,6 +1317,31 @@ YRTPConsumer::~YRTPConsumer()
     }
 }
 
+void* YRTPConsumer::getObject(const String& name) const
+{
+    if (name == YATOM("YRTPConsumer"))
+	return const_cast<YRTPConsumer*>(this);
+    return DataConsumer::getObject(name);
+}
+
+// Called by the regular source as a reader, bypasses the Forward/Consume chain
+bool YRTPConsumer::relay(const DataSource* source, bool marker, unsigned int timestamp, const void* data, int len)
+{
+    if (!(m_wrap && m_wrap->valid() && m_wrap->bufSize() && m_wrap->rtp()))
+	return false;
+    // buffers that need splitting must go through Consume
+    if ((unsigned int)len > m_wrap->bufSize())
+	return false;
+    // apply the timestamp offset of the regular path
+    unsigned long tStamp = relayStamp(source,timestamp);
+    if (tStamp == invalidStamp())
+	return false;
+    if (!m_wrap->rtp()->rtpSendData(marker,tStamp,data,len))
+	return false;
+    relayed(tStamp);
+    return true;
+}
+
 unsigned long YRTPConsumer::Consume(const DataBlock &data, unsigned long tStamp, unsigned long flags)
 {
     if (!(m_wrap && m_wrap->valid()))
@@ -1627,6 +1753,10 @@ void YRTPPlugin::statusParams(String& str)
     s_refMutex.lock();
     str.append("mirrors=",",") << s_mirrors.count();
     s_refMutex.unlock();
+    if (s_groups.enabled()) {
+	str.append("groups=",",") << s_groups.count();
+	s_groups.status(str);
+    }
 }
 
 void YRTPPlugin::statusDetail(String& str)
@@ -1903,6 +2033,7 @@ void YRTPPlugin::initialize()
     s_bufsize = cfg.getIntValue("general","buffer",BUF_SIZE);
     s_minJitter = cfg.getIntValue("general","minjitter",50);
     s_maxJitter = cfg.getIntValue("general","maxjitter",Engine::clientMode() ? 120 : 0);
+    s_adaptiveJitter = cfg.getBoolValue("general","adaptivejitter",false);
     s_tos = cfg.getIntValue("general","tos",Socket::tosValues());
     s_udpbuf = cfg.getIntValue("general","udpbuf",0);
     s_localip = cfg.getValue("general","localip");
@@ -1911,12 +2042,17 @@ void YRTPPlugin::initialize()
     s_padding = cfg.getIntValue("general","padding",0);
     s_rtcp = cfg.getBoolValue("general","rtcp",true);
     s_interval = cfg.getIntValue("general","rtcp_interval",4500);
+    s_reportXR = cfg.getBoolValue("general","rtcp_xr",false);
     s_drill = cfg.getBoolValue("general","drillhole",Engine::clientMode());
+    s_relay = cfg.getBoolValue("general","relay",false);
     s_monitor = cfg.getBoolValue("general","monitoring",false);
     s_sleep = cfg.getIntValue("general","defsleep",5);
     RTPGroup::setMinSleep(cfg.getIntValue("general","minsleep"));
     s_priority = Thread::priority(cfg.getValue("general","thread"));
     s_affinity = cfg.getValue("general","affinity");
+    s_groups.setup(cfg.getIntValue("general","groups_per_cpu",0,0),s_affinity,s_sleep,s_priority);
+    s_groups.balancing((RTPGroupPool::Policy)cfg.getIntValue("general","group_balance",
+	RTPGroupPool::s_policies,RTPGroupPool::Streams),cfg.getIntValue("general","group_imbalance",4,0));
     s_rtpWarnSeq = cfg.getBoolValue("general","rtp_warn_seq",true);
     s_timeout = cfg.getIntValue("timeouts","timeout",3000);
     s_udptlTimeout = cfg.getIntValue("timeouts","udptl_timeout",25000);
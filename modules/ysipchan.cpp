@@ -41,12 +41,16 @@ class YateTCPParty;                      // A SIP TCP/TLS party
 class YateSIPEngine;                     // The SIP engine
 class YateSIPLine;                       // A line
 class YateSIPEndPoint;                   // Endpoint processor
+class YateSIPShard;                      // Event processor of an engine shard
 class SIPDriver;
 
 #define EXPIRES_MIN 60
 #define EXPIRES_DEF 600
 #define EXPIRES_MAX 3600
 
+// Most SIP engines transactions can be spread on
+#define SHARDS_MAX 64
+
 // TCP transport idle values in seconds
 // Outgoing: interval to send keep alive
 // Incoming: interval allowed to stay with refcounter=1 and no data received/sent
@@ -656,6 +660,53 @@ protected:
 
 class SipHandler;
 
+// Digest HA1 and the parameters returned by user.auth for an username and realm
+class YateSIPAuthEntry : public String
+{
+public:
+    inline YateSIPAuthEntry(const String& key, const String& ha1, u_int64_t expire)
+	: String(key), m_ha1(ha1), m_params(""), m_expire(expire)
+	{ }
+    String m_ha1;
+    NamedList m_params;
+    u_int64_t m_expire;
+};
+
+// Cache of user.auth results used to check digest responses locally
+class YateSIPAuthCache : public Mutex
+{
+public:
+    YateSIPAuthCache();
+    // Set the entries lifetime in seconds, 0 disables the cache
+    void setup(unsigned int ttl);
+    inline bool enabled() const
+	{ return m_ttl != 0; }
+    // Retrieve the HA1 and parameters of an username and realm
+    //  for requests of the same kind coming from the same address
+    bool find(const String& username, const String& realm, const String& source,
+	String& ha1, NamedList& params);
+    // Remember the password returned for an username, realm and request source.
+    // Keep the message parameters that are not in the original request
+    void add(const String& username, const String& realm, const String& source,
+	const String& password, const NamedList& msg, const NamedList& orig);
+    // Remove the entries of an username, all entries if empty
+    void drop(const String& username = String::empty(), const String& realm = String::empty());
+    // Account the time spent to check a digest response
+    void stats(bool cached, u_int64_t start);
+    // Append statistics to a status string
+    void statusParams(String& str);
+private:
+    static void buildKey(String& key, const String& username, const String& realm,
+	const String& source = String::empty());
+    HashList m_entries;
+    u_int64_t m_ttl;
+    u_int64_t m_nextPurge;
+    unsigned int m_hits;
+    unsigned int m_misses;
+    u_int64_t m_hitTime;
+    u_int64_t m_missTime;
+};
+
 class YateSIPEngine : public SIPEngine
 {
 public:
@@ -669,32 +720,39 @@ public:
 	const String& method, const String& uri, const String& response,
 	const SIPMessage* message, const MimeHeaderLine* authLine, GenObject* userData);
     virtual SIPTransaction* forkInvite(SIPMessage* answer, SIPTransaction* trans);
+    // Check a digest response against a known HA1
+    static bool checkDigest(const String& ha1, const String& nonce, const String& method,
+	const String& uri, const String& response);
     // Transport status changed notification
     void transportChangedStatus(YateSIPTransport* trans, int stat, const String& reason);
     // Check if the engine has an active transaction using a given transport
     bool hasActiveTransaction(YateSIPTransport* trans);
     // Check if the engine has pending transactions
     bool hasInitialTransaction();
-    // Clear transactions
-    inline void clearTransactions() {
-	    Lock lck(this);
-	    m_transList.clear();
-	}
     inline bool prack() const
 	{ return m_prack; }
     inline bool info() const
 	{ return m_info; }
     inline bool foreignAuth() const
 	{ return m_foreignAuth; }
+    // Use the nonces and CSeq sequence of the first shard
+    inline void share(YateSIPEngine* first)
+	{ m_first = first; m_seq = first->m_seq; }
+    virtual void nonceGet(String& nonce);
+    virtual long nonceAge(const String& nonce);
 private:
+    bool dispatchAuth(Message& m, String& username, const String& realm,
+	const String& nonce, const String& method, const String& uri, const String& response,
+	const MimeHeaderLine* authLine, NamedList* params);
     static bool copyAuthParams(NamedList* dest, const NamedList& src, bool ok = true);
     YateSIPEndPoint* m_ep;
+    YateSIPEngine* m_first;
     bool m_prack;
     bool m_info;
     bool m_fork;
     bool m_forkEarly;
     bool m_foreignAuth;
-    uint64_t m_traceIds;
+    static uint64_t s_traceIds;
 };
 
 class YateSIPLine : public String, public Mutex, public CallAccount, public YateSIPPartyHolder
@@ -781,12 +839,15 @@ class YateSIPEndPoint : public Thread
 {
     friend class SIPDriver;
     friend class YateSIPTCPListener;
+    friend class YateSIPShard;
 public:
     YateSIPEndPoint(Thread::Priority prio = Thread::Normal,
-	unsigned int partyMutexCount = 5);
+	unsigned int partyMutexCount = 5, unsigned int shards = 1);
     ~YateSIPEndPoint();
     bool Init(void);
     void run(void);
+    // Get and handle the events of an engine shard until cancelled
+    void processEvents(unsigned int shard);
     bool incoming(SIPEvent* e, SIPTransaction* t);
     void invite(SIPEvent* e, SIPTransaction* t);
     void regReq(SIPEvent* e, SIPTransaction* t);
@@ -838,8 +899,22 @@ public:
     // Complete transport names
     void completeTransports(Message& msg, const String& partWord,
 	bool udp = true, bool tcp = true, bool tls = true);
+    // The first engine shard, also used for settings common to all shards
     inline YateSIPEngine* engine() const
 	{ return m_engine; }
+    // The engine shard keeping transactions of a Call-ID
+    inline YateSIPEngine* engine(const String& callid) const
+	{ return (m_shards > 1) ? m_engines[callid.hash() % m_shards] : m_engine; }
+    // The engine shard a message must be added to
+    YateSIPEngine* engine(SIPMessage* msg);
+    inline unsigned int shards() const
+	{ return m_shards; }
+    // Accounting over all engine shards
+    unsigned int transactionCount();
+    bool hasInitialTransaction();
+    bool hasActiveTransaction(YateSIPTransport* trans);
+    void clearTransactions();
+    void initializeEngines(NamedList* params);
     inline void incFailedAuths()
 	{ m_failedAuths++; }
     inline unsigned int failedAuths()
@@ -863,9 +938,16 @@ public:
     MutexPool m_partyMutexPool;          // SIPParty mutex pool
     // Check if data is allowed to be read from socket(s) and processed
     static bool canRead();
-    static int s_evCount;
+    // Consecutive events handled by the busiest engine shard
+    static int evCount();
 private:
+    void startShards();
+    void stopShards();
     YateSIPEngine *m_engine;
+    YateSIPEngine** m_engines;           // Engines handling Call-ID shards, first is m_engine
+    unsigned int m_shards;
+    Thread::Priority m_prio;
+    ObjList m_shardThreads;              // Threads running shards other than the first
     Mutex m_mutex;                       // Protect transports and listeners
     ObjList m_transports;                // All transports (non UDP are not owned)
     YateSIPUDPTransport* m_defTransport; // Default transport (pointer to object in m_transports)
@@ -876,6 +958,18 @@ private:
     unsigned int m_timedOutByes;
 };
 
+// Thread getting and handling the events of one engine shard
+class YateSIPShard : public Thread, public GenObject
+{
+public:
+    YateSIPShard(YateSIPEndPoint* ep, unsigned int shard, Thread::Priority prio);
+    ~YateSIPShard();
+    virtual void run();
+private:
+    YateSIPEndPoint* m_ep;
+    unsigned int m_shard;
+};
+
 // Handle transfer requests
 // Respond to the enclosed transaction
 class YateSIPRefer : public Thread
@@ -1207,6 +1301,16 @@ public:
     virtual bool received(Message &msg);
 };
 
+// Drop cached credentials of users that changed
+class AuthUpdateHandler : public MessageHandler
+{
+public:
+    AuthUpdateHandler(const char* name = "user.update")
+	: MessageHandler(name,50,plugin.name())
+	{ }
+    virtual bool received(Message &msg);
+};
+
 class SipHandler : public MessageHandler
 {
 public:
@@ -1245,6 +1349,18 @@ static bool s_ack_required = true;
 static bool s_1xx_formats = true;
 static bool s_sdp_implicit = true;
 static bool s_rtp_preserve = false;
+// RTP quality metrics kept from chan.rtp stream termination
+static const char* s_rtpQuality[] = {
+    "rtp_jitter",
+    "rtp_reordered",
+    "rtp_burstdensity",
+    "rtp_gapdensity",
+    "rtp_burstduration",
+    "rtp_gapduration",
+    "rtp_rfactor",
+    "rtp_mos",
+    0
+};
 static bool s_enable_transfer = false;
 static bool s_enable_options = false;
 static bool s_enable_message = false;
@@ -1266,6 +1382,7 @@ static bool s_initialHeaders = false;    // Put all headers as received in initi
 static bool s_sipt_isup = false;         // Control the application/isup body processing
 static bool s_printMsg = true;           // Print sent/received SIP messages to output
 static ObjList* s_authCopyHeader = 0;    // Copy headers in user.auth
+static YateSIPAuthCache s_authCache;     // Credentials returned by user.auth
 
 static bool s_ipv6 = false;              // IPv6 support enabled
 static u_int64_t s_waitActiveUdpTrans = 1000000; // Time to wait for active UDP transactions
@@ -1292,7 +1409,11 @@ static const String s_username = "username";
 
 static u_int64_t s_printFloodTime = 0;
 
-int YateSIPEndPoint::s_evCount = 0;
+// Consecutive events handled by each engine shard, written only by its thread
+static int s_evCounts[SHARDS_MAX];
+static unsigned int s_evShards = 1;
+uint64_t YateSIPEngine::s_traceIds = 0;
+static Mutex s_traceMutex(false,"SIPTraceIds");
 bool SIPDriver::s_trace = false;
 
 // DTMF methods
@@ -1760,9 +1881,11 @@ static bool matchAny(const String& name, const char** strs)
 static void copySipHeaders(NamedList& msg, const SIPMessage& sip, bool filter = true, bool auth = false,
     bool all = false)
 {
-    const ObjList* l = sip.header.skipNull();
-    for (; l; l = l->skipNext()) {
-	const MimeHeaderLine* t = static_cast<const MimeHeaderLine*>(l->get());
+    // take the text of the headers without building all the parsed lines
+    ObjList lines;
+    sip.getHeaderLines(lines);
+    for (ObjList* l = lines.skipNull(); l; l = l->skipNext()) {
+	const NamedString* t = static_cast<const NamedString*>(l->get());
 	String name(t->name());
 	name.toLower();
 	// Filtered headers (from/to) are added explicitly
@@ -1774,9 +1897,7 @@ static void copySipHeaders(NamedList& msg, const SIPMessage& sip, bool filter =
 		continue;
 	    prefix = "sipheader_";
 	}
-	NamedString* ns = new NamedString(prefix + name);
-	t->buildLine(*ns,false);
-	msg.addParam(ns);
+	msg.addParam(prefix + name,*t);
     }
 }
 
@@ -3182,6 +3303,7 @@ void YateSIPTransport::receiveMsg(SIPMessage*& msg)
 	    TelEngine::destruct(party);
 	}
     }
+    engine = plugin.ep() ? plugin.ep()->engine(msg) : engine;
     engine->addMessage(msg);
     TelEngine::destruct(msg);
 }
@@ -3345,7 +3467,7 @@ int YateSIPUDPTransport::process()
 	    m_setRtpAddr = false;
 	}
     }
-    int& evc = YateSIPEndPoint::s_evCount;
+    int evc = YateSIPEndPoint::evCount();
     // Do nothing if the endpoint is flooded with events or terminating
     if (!(YateSIPEndPoint::canRead() || ((evc & 3) == 0)))
 	return Thread::idleUsec();
@@ -4623,10 +4745,144 @@ void YateTCPParty::destroyed()
 }
 
 
+YateSIPAuthCache::YateSIPAuthCache()
+    : Mutex(false,"SIPAuthCache"),
+      m_entries(61), m_ttl(0), m_nextPurge(0),
+      m_hits(0), m_misses(0), m_hitTime(0), m_missTime(0)
+{
+}
+
+void YateSIPAuthCache::setup(unsigned int ttl)
+{
+    Lock lock(this);
+    m_ttl = 1000000 * (u_int64_t)ttl;
+    // passwords may have changed while reloading
+    m_entries.clear();
+    m_nextPurge = Time::now() + m_ttl;
+}
+
+void YateSIPAuthCache::buildKey(String& key, const String& username, const String& realm,
+    const String& source)
+{
+    key << username << ":" << realm << ":" << source;
+}
+
+bool YateSIPAuthCache::find(const String& username, const String& realm, const String& source,
+    String& ha1, NamedList& params)
+{
+    String key;
+    buildKey(key,username,realm,source);
+    Lock lock(this);
+    if (!m_ttl)
+	return false;
+    ObjList* o = m_entries.find(key);
+    if (!o)
+	return false;
+    YateSIPAuthEntry* e = static_cast<YateSIPAuthEntry*>(o->get());
+    if (e->m_expire < Time::now()) {
+	o->remove();
+	return false;
+    }
+    ha1 = e->m_ha1;
+    params.copyParams(e->m_params);
+    return true;
+}
+
+void YateSIPAuthCache::add(const String& username, const String& realm, const String& source,
+    const String& password, const NamedList& msg, const NamedList& orig)
+{
+    String key;
+    buildKey(key,username,realm,source);
+    MD5 md5;
+    md5 << username << ":" << realm << ":" << password;
+    u_int64_t now = Time::now();
+    Lock lock(this);
+    if (!m_ttl)
+	return;
+    if (m_nextPurge < now) {
+	// remove entries of users that are no longer authenticating
+	m_nextPurge = now + m_ttl;
+	for (unsigned int i = 0; i < m_entries.length(); i++) {
+	    ObjList* l = m_entries.getList(i);
+	    while (l) {
+		YateSIPAuthEntry* e = static_cast<YateSIPAuthEntry*>(l->get());
+		if (e && e->m_expire < now) {
+		    l->remove();
+		    continue;
+		}
+		l = l->next();
+	    }
+	}
+    }
+    m_entries.remove(key);
+    YateSIPAuthEntry* e = new YateSIPAuthEntry(key,md5.hexDigest(),now + m_ttl);
+    unsigned int n = msg.length();
+    for (unsigned int i = 0; i < n; i++) {
+	const NamedString* s = msg.getParam(i);
+	if (!s)
+	    continue;
+	const String* o = orig.getParam(s->name());
+	if (!o || (*o != *s))
+	    e->m_params.addParam(s->name(),*s);
+    }
+    m_entries.append(e);
+}
+
+void YateSIPAuthCache::drop(const String& username, const String& realm)
+{
+    Lock lock(this);
+    if (!username) {
+	m_entries.clear();
+	return;
+    }
+    String prefix;
+    if (realm)
+	buildKey(prefix,username,realm);
+    else
+	prefix << username << ":";
+    for (unsigned int i = 0; i < m_entries.length(); i++) {
+	ObjList* l = m_entries.getList(i);
+	while (l) {
+	    YateSIPAuthEntry* e = static_cast<YateSIPAuthEntry*>(l->get());
+	    if (e && e->startsWith(prefix)) {
+		l->remove();
+		continue;
+	    }
+	    l = l->next();
+	}
+    }
+}
+
+void YateSIPAuthCache::stats(bool cached, u_int64_t start)
+{
+    u_int64_t t = Time::now() - start;
+    Lock lock(this);
+    if (cached) {
+	m_hits++;
+	m_hitTime += t;
+    }
+    else {
+	m_misses++;
+	m_missTime += t;
+    }
+}
+
+void YateSIPAuthCache::statusParams(String& str)
+{
+    Lock lock(this);
+    if (!m_ttl)
+	return;
+    str.append("authcache=",",") << m_entries.count();
+    str << ",authhits=" << m_hits << ",authmisses=" << m_misses;
+    // average check time in microseconds
+    str << ",authhittime=" << (unsigned int)(m_hits ? m_hitTime / m_hits : 0);
+    str << ",authmisstime=" << (unsigned int)(m_misses ? m_missTime / m_misses : 0);
+}
+
+
 YateSIPEngine::YateSIPEngine(YateSIPEndPoint* ep)
     : SIPEngine(s_cfg.getValue("general","useragent")),
-      m_ep(ep), m_prack(false), m_info(false), m_foreignAuth(false),
-      m_traceIds(0)
+      m_ep(ep), m_first(0), m_prack(false), m_info(false), m_foreignAuth(false)
 {
     addAllowed("INVITE");
     addAllowed("BYE");
@@ -4754,13 +5010,27 @@ bool YateSIPEngine::buildParty(SIPMessage* message)
     return m_ep->buildParty(message);
 }
 
+// Nonces of all shards come from the first engine so any of them can check one
+void YateSIPEngine::nonceGet(String& nonce)
+{
+    if (m_first)
+	m_first->nonceGet(nonce);
+    else
+	SIPEngine::nonceGet(nonce);
+}
+
+long YateSIPEngine::nonceAge(const String& nonce)
+{
+    return m_first ? m_first->nonceAge(nonce) : SIPEngine::nonceAge(nonce);
+}
+
 void YateSIPEngine::allocTraceId(String& id)
 {
     if (!plugin.traceActive())
       return;
     id << "sip-";
-    Lock l(this);
-    id << m_traceIds++;
+    Lock l(s_traceMutex);
+    id << s_traceIds++;
 }
 
 void YateSIPEngine::traceMsg(SIPMessage* message, bool incoming)
@@ -4819,6 +5089,25 @@ bool YateSIPEngine::copyAuthParams(NamedList* dest, const NamedList& src, bool o
     return ok;
 }
 
+// response = md5(ha1:nonce:md5(method:uri)), retry without URI parameters
+bool YateSIPEngine::checkDigest(const String& ha1, const String& nonce, const String& method,
+    const String& uri, const String& response)
+{
+    MD5 md5;
+    md5 << method << ":" << uri;
+    String res;
+    buildAuth(ha1,nonce,md5.hexDigest(),res);
+    if (res == response)
+	return true;
+    int sc = uri.find(';');
+    if (sc < 0)
+	return false;
+    md5.clear();
+    md5 << method << ":" << uri.substr(0,sc);
+    buildAuth(ha1,nonce,md5.hexDigest(),res);
+    return res == response;
+}
+
 bool YateSIPEngine::checkUser(String& username, const String& realm, const String& nonce,
     const String& method, const String& uri, const String& response,
     const SIPMessage* message, const MimeHeaderLine* authLine, GenObject* userData)
@@ -4861,17 +5150,17 @@ bool YateSIPEngine::checkUser(String& username, const String& realm, const Strin
 	if (hl)
 	    m.addParam("device",*hl);
 	m.addParam("trace_id",message->traceId());
+	ObjList lines;
+	message->getHeaderLines(lines);
 	s_globalMutex.lock();
-	for (const ObjList* l = message->header.skipNull(); l; l = l->skipNext()) {
-	    hl = static_cast<const MimeHeaderLine*>(l->get());
-	    String name(hl->name());
+	for (const ObjList* l = lines.skipNull(); l; l = l->skipNext()) {
+	    const NamedString* ns = static_cast<const NamedString*>(l->get());
+	    String name(ns->name());
 	    name.toLower();
 	    if (!(name.startsWith("security-") ||
 		(s_authCopyHeader && s_authCopyHeader->find(name))))
 		continue;
-	    String tmp;
-	    hl->buildLine(tmp,false);
-	    m.addParam("sip_" + name,tmp);
+	    m.addParam("sip_" + name,*ns);
 	}
 	s_globalMutex.unlock();
     }
@@ -4895,6 +5184,53 @@ bool YateSIPEngine::checkUser(String& username, const String& realm, const Strin
     else
 	authLine = 0;
 
+    // with a cached password the response is checked without asking again
+    //  but only for the same kind of request from the same source address
+    String source;
+    if (username && response && s_authCache.enabled()) {
+	const String& addr = m[YSTRING("address")];
+	if (addr)
+	    source << method << ":" << m[YSTRING("newcall")] << ":" <<
+		m[YSTRING("ip_transport")] << ":" << addr;
+    }
+    bool cache = !source.null();
+    u_int64_t start = cache ? Time::now() : 0;
+    if (cache) {
+	String ha1;
+	NamedList cached("");
+	if (s_authCache.find(username,realm,source,ha1,cached)) {
+	    if (checkDigest(ha1,nonce,method,uri,response)) {
+		unsigned int n = cached.length();
+		for (unsigned int i = 0; i < n; i++) {
+		    const NamedString* s = cached.getParam(i);
+		    if (s)
+			m.setParam(s->name(),*s);
+		}
+		s_authCache.stats(true,start);
+		return copyAuthParams(params,m);
+	    }
+	    // the password may have changed
+	    s_authCache.drop(username,realm);
+	}
+    }
+    NamedList orig("");
+    if (cache)
+	orig = m;
+
+    bool ok = dispatchAuth(m,username,realm,nonce,method,uri,response,authLine,params);
+    if (cache) {
+	if (ok && m.retValue() && (m.retValue() != "-"))
+	    s_authCache.add(username,realm,source,m.retValue(),m,orig);
+	s_authCache.stats(false,start);
+    }
+    return ok;
+}
+
+// Dispatch an user.auth message and check the response with the returned password
+bool YateSIPEngine::dispatchAuth(Message& m, String& username, const String& realm,
+    const String& nonce, const String& method, const String& uri, const String& response,
+    const MimeHeaderLine* authLine, NamedList* params)
+{
     if (!Engine::dispatch(m))
 	return copyAuthParams(params,m,false);
 
@@ -4940,7 +5276,10 @@ bool YateSIPEngine::checkUser(String& username, const String& realm, const Strin
 
     if (!ok && !response.null()) {
 	DDebug(&plugin,DebugNote,"Failed authentication for username='%s'",username.c_str());
+	// engine shards may fail authentications at the same time
+	plugin.lock();
 	m_ep->incFailedAuths();
+	plugin.unlock();
 	plugin.changed();
 	Message* fail = new Message(m);
 	*fail = "user.authfail";
@@ -4951,14 +5290,17 @@ bool YateSIPEngine::checkUser(String& username, const String& realm, const Strin
 }
 
 
-YateSIPEndPoint::YateSIPEndPoint(Thread::Priority prio, unsigned int partyMutexCount)
+YateSIPEndPoint::YateSIPEndPoint(Thread::Priority prio, unsigned int partyMutexCount,
+    unsigned int shards)
     : Thread("YSIP EndPoint",prio),
       m_partyMutexPool(partyMutexCount,true,"SIPParty"),
-      m_engine(0), m_mutex(true,"YateSIPEndPoint"), m_defTransport(0),
+      m_engine(0), m_engines(0), m_shards(shards ? shards : 1),
+      m_prio(prio),
+      m_mutex(true,"YateSIPEndPoint"), m_defTransport(0),
       m_failedAuths(0),m_timedOutTrs(0), m_timedOutByes(0)
 {
-    Debug(&plugin,DebugAll,"YateSIPEndPoint::YateSIPEndPoint(%s) [%p]",
-	Thread::priority(prio),this);
+    Debug(&plugin,DebugAll,"YateSIPEndPoint::YateSIPEndPoint(%s,%u) [%p]",
+	Thread::priority(prio),m_shards,this);
 }
 
 YateSIPEndPoint::~YateSIPEndPoint()
@@ -4966,11 +5308,15 @@ YateSIPEndPoint::~YateSIPEndPoint()
     Debug(&plugin,DebugAll,"YateSIPEndPoint::~YateSIPEndPoint() [%p]",this);
     plugin.channels().clear();
     s_lines.clear();
-    if (m_engine) {
-	// send any pending events
-	while (m_engine->process())
-	    ;
-	delete m_engine;
+    if (m_engines) {
+	for (unsigned int i = 0; i < m_shards; i++) {
+	    // send any pending events
+	    while (m_engines[i]->process())
+		;
+	    delete m_engines[i];
+	}
+	delete[] m_engines;
+	m_engines = 0;
 	m_engine = 0;
     }
     m_defTransport = 0;
@@ -5157,7 +5503,7 @@ bool YateSIPEndPoint::removeUdpTransport(const String& name, const char* reason)
 	if (!intervals)
 	    intervals = 1;
 	while (intervals > 0 && !Engine::exiting() &&
-	    m_engine->hasActiveTransaction(rd)) {
+	    hasActiveTransaction(rd)) {
 	    Thread::idle();
 	    intervals--;
 	}
@@ -5242,9 +5588,9 @@ void YateSIPEndPoint::transportChangedStatus(YateSIPTransport* trans, int stat,
 	    line->buildParty();
 	}
     }
-    // Notify transactions in engine
-    if (m_engine)
-	m_engine->transportChangedStatus(trans,stat,reason);
+    // Notify transactions in engines
+    for (unsigned int i = 0; m_engines && (i < m_shards); i++)
+	m_engines[i]->transportChangedStatus(trans,stat,reason);
     if (stat != YateSIPTCPTransport::Terminated)
 	return;
     // Notify unregister
@@ -5401,34 +5747,141 @@ void YateSIPEndPoint::completeTransports(Message& msg, const String& partWord,
 
 bool YateSIPEndPoint::Init()
 {
-    m_engine = new YateSIPEngine(this);
-    m_engine->debugChain(&plugin);
+    if (m_shards > SHARDS_MAX)
+	m_shards = SHARDS_MAX;
+    m_engines = new YateSIPEngine*[m_shards];
+    for (unsigned int i = 0; i < m_shards; i++) {
+	m_engines[i] = new YateSIPEngine(this);
+	m_engines[i]->debugChain(&plugin);
+	if (i)
+	    m_engines[i]->share(m_engines[0]);
+	s_evCounts[i] = 0;
+    }
+    s_evShards = m_shards;
+    m_engine = m_engines[0];
     return true;
 }
 
+YateSIPEngine* YateSIPEndPoint::engine(SIPMessage* msg)
+{
+    if (m_shards < 2 || !msg)
+	return m_engine;
+    // New outgoing requests get their Call-ID when completed
+    if (msg->isOutgoing() && !msg->isAnswer() && !msg->getHeader("Call-ID"))
+	msg->complete(m_engine);
+    return engine(msg->getHeaderValue("Call-ID"));
+}
+
+unsigned int YateSIPEndPoint::transactionCount()
+{
+    unsigned int n = 0;
+    for (unsigned int i = 0; m_engines && (i < m_shards); i++)
+	n += m_engines[i]->transactionCount();
+    return n;
+}
+
+bool YateSIPEndPoint::hasInitialTransaction()
+{
+    for (unsigned int i = 0; m_engines && (i < m_shards); i++)
+	if (m_engines[i]->hasInitialTransaction())
+	    return true;
+    return false;
+}
+
+bool YateSIPEndPoint::hasActiveTransaction(YateSIPTransport* trans)
+{
+    for (unsigned int i = 0; m_engines && (i < m_shards); i++)
+	if (m_engines[i]->hasActiveTransaction(trans))
+	    return true;
+    return false;
+}
+
+void YateSIPEndPoint::clearTransactions()
+{
+    for (unsigned int i = 0; m_engines && (i < m_shards); i++)
+	m_engines[i]->clearTransactions();
+}
+
+void YateSIPEndPoint::initializeEngines(NamedList* params)
+{
+    for (unsigned int i = 0; m_engines && (i < m_shards); i++)
+	m_engines[i]->initialize(params);
+}
+
+// Start a thread for each engine shard but the first one
+void YateSIPEndPoint::startShards()
+{
+    for (unsigned int i = 1; i < m_shards; i++) {
+	YateSIPShard* s = new YateSIPShard(this,i,m_prio);
+	Lock lock(m_mutex);
+	m_shardThreads.append(s)->setDelete(false);
+	lock.drop();
+	if (!s->startup()) {
+	    Alarm(&plugin,"system",DebugWarn,"Failed to start thread for SIP engine shard %u",i);
+	    delete s;
+	}
+    }
+}
+
+// Cancel shard threads and wait for them to terminate
+void YateSIPEndPoint::stopShards()
+{
+    m_mutex.lock();
+    for (ObjList* o = m_shardThreads.skipNull(); o; o = o->skipNext())
+	static_cast<YateSIPShard*>(o->get())->cancel();
+    m_mutex.unlock();
+    while (true) {
+	Lock lck(m_mutex);
+	if (!m_shardThreads.skipNull())
+	    break;
+	lck.drop();
+	Thread::idle();
+    }
+}
+
 // Check if data is allowed to be read from socket(s) and processed
 bool YateSIPEndPoint::canRead()
 {
-    return s_floodEvents <= 1 || (s_evCount < s_floodEvents) || Engine::exiting();
+    return s_floodEvents <= 1 || (evCount() < s_floodEvents) || Engine::exiting();
+}
+
+int YateSIPEndPoint::evCount()
+{
+    int busiest = 0;
+    for (unsigned int i = 0; i < s_evShards; i++)
+	if (busiest < s_evCounts[i])
+	    busiest = s_evCounts[i];
+    return busiest;
 }
 
 void YateSIPEndPoint::run()
 {
+    startShards();
+    processEvents(0);
+    stopShards();
+    plugin.epTerminated(this);
+}
+
+void YateSIPEndPoint::processEvents(unsigned int shard)
+{
+    YateSIPEngine* engine = m_engines[shard];
+    int& evCount = s_evCounts[shard];
     for (;;)
     {
-	if (!canRead()) {
-	    if (s_evCount == s_floodEvents)
-	        Debug(&plugin,DebugMild,"Flood detected: %d handled events",s_evCount);
-	    else if ((s_evCount % s_floodEvents) == 0)
-	        Debug(&plugin,DebugWarn,"Severe flood detected: %d events",s_evCount);
-	}
-	SIPEvent* e = m_engine->getEvent();
+	// each shard warns about its own flood
+	if ((s_floodEvents > 1) && (evCount >= s_floodEvents) && !Engine::exiting()) {
+	    if (evCount == s_floodEvents)
+	        Debug(&plugin,DebugMild,"Flood detected: %d handled events",evCount);
+	    else if ((evCount % s_floodEvents) == 0)
+	        Debug(&plugin,DebugWarn,"Severe flood detected: %d events",evCount);
+	}
+	SIPEvent* e = engine->getEvent();
 	if (e)
-	    s_evCount++;
+	    evCount++;
 	else
-	    s_evCount = 0;
+	    evCount = 0;
 	// hack: use a loop so we can use break and continue
-	for (; e; m_engine->processEvent(e),e = 0) {
+	for (; e; engine->processEvent(e),e = 0) {
 	    SIPTransaction* t = e->getTransaction();
 	    if (!t)
 		continue;
@@ -5482,14 +5935,33 @@ void YateSIPEndPoint::run()
 		break;
 	    }
 	}
-	if (s_evCount || s_engineHalt) {
+	if (evCount || s_engineHalt) {
 	    if (Thread::check(false))
 		break;
 	}
 	else
 	    Thread::usleep(Thread::idleUsec());
     }
-    plugin.epTerminated(this);
+}
+
+
+YateSIPShard::YateSIPShard(YateSIPEndPoint* ep, unsigned int shard, Thread::Priority prio)
+    : Thread("YSIP Shard",prio),
+      m_ep(ep), m_shard(shard)
+{
+    DDebug(&plugin,DebugAll,"YateSIPShard::YateSIPShard(%p,%u) [%p]",ep,shard,this);
+}
+
+YateSIPShard::~YateSIPShard()
+{
+    DDebug(&plugin,DebugAll,"YateSIPShard::~YateSIPShard() shard=%u [%p]",m_shard,this);
+    Lock lock(m_ep->m_mutex);
+    m_ep->m_shardThreads.remove(this,false);
+}
+
+void YateSIPShard::run()
+{
+    m_ep->processEvents(m_shard);
 }
 
 bool YateSIPEndPoint::incoming(SIPEvent* e, SIPTransaction* t)
@@ -6090,7 +6562,7 @@ void YateSIPRefer::release(bool fromCleanup)
 	    String s;
 	    s << "SIP/2.0 " << m_notifyCode << " " << lookup(m_notifyCode,SIPResponses) << "\r\n";
 	    m_sipNotify->setBody(new MimeStringBody("message/sipfrag;version=2.0",s));
-	    plugin.ep()->engine()->addMessage(m_sipNotify);
+	    plugin.ep()->engine(m_sipNotify)->addMessage(m_sipNotify);
 	    m_sipNotify = 0;
 	}
 	else
@@ -6524,7 +6996,7 @@ YateSIPConnection::YateSIPConnection(Message& msg, const String& uri, const char
 	sdp = createRtpSDP(m_host,msg);
     m->setBody(buildSIPBody(msg,sdp));
     int tries = msg.getIntValue(YSTRING("xsip_trans_count"),-1);
-    m_tr = plugin.ep()->engine()->addMessage(m,&m_autoChangeParty);
+    m_tr = plugin.ep()->engine(m)->addMessage(m,&m_autoChangeParty);
     if (m_tr) {
 	m_tr->ref();
 	m_tr->setUserData(this);
@@ -6680,7 +7152,7 @@ void YateSIPConnection::hangup()
 			m->addHeader(hl);
 		    }
 		    m->setBody(buildSIPBody());
-		    if (plugin.ep()->engine()->addMessage(m,&m_autoChangeParty) && !s_preventive_bye)
+		    if (plugin.ep()->engine(m)->addMessage(m,&m_autoChangeParty) && !s_preventive_bye)
 			sendBye = false;
 		}
 		m->deref();
@@ -6709,7 +7181,7 @@ void YateSIPConnection::hangup()
 	    copySipBody(*m,parameters());
 	    paramMutex().unlock();
 	    m->setBody(buildSIPBody());
-	    plugin.ep()->engine()->addMessage(m,&m_autoChangeParty);
+	    plugin.ep()->engine(m)->addMessage(m,&m_autoChangeParty);
 	    m->deref();
 	}
     }
@@ -6826,7 +7298,7 @@ bool YateSIPConnection::emitPRACK(const SIPMessage* msg)
     tmp = *rs;
     tmp << " " << *cs;
     m->addHeader("RAck",tmp);
-    plugin.ep()->engine()->addMessage(m,&m_autoChangeParty);
+    plugin.ep()->engine(m)->addMessage(m,&m_autoChangeParty);
     m->deref();
     return true;
 }
@@ -6882,11 +7354,16 @@ void YateSIPConnection::mediaChanged(const SDPMedia& media)
 	  m.addParam("trace_id",m_traceId);
 	Engine::dispatch(m);
 	const char* stats = m.getValue(YSTRING("stats"));
-	if (stats) {
-	    paramMutex().lock();
+	paramMutex().lock();
+	if (stats)
 	    parameters().setParam("rtp_stats"+media.suffix(),stats);
-	    paramMutex().unlock();
+	// keep the RTP quality metrics so they show up in chan.hangup
+	for (const char** p = s_rtpQuality; *p; p++) {
+	    const String* val = m.getParam(*p);
+	    if (val)
+		parameters().setParam(*p + media.suffix(),*val);
 	}
+	paramMutex().unlock();
     }
     // Clear the data endpoint, will be rebuilt later if required
     clearEndpoint(media);
@@ -7995,7 +8472,7 @@ bool YateSIPConnection::msgText(Message& msg, const char* text)
 	    m->setBody(new MimeStringBody("text/plain",text));
 	}
 	copySipHeaders(*m,msg);
-	plugin.ep()->engine()->addMessage(m,&m_autoChangeParty);
+	plugin.ep()->engine(m)->addMessage(m,&m_autoChangeParty);
 	m->deref();
 	return true;
     }
@@ -8380,7 +8857,7 @@ bool YateSIPConnection::startClientReInvite(NamedList& msg, bool rtpForward)
 	m->setBody(sdp);
     else
 	m->addHeader(new MimeHeaderLine("Accept","application/sdp"));
-    m_tr2 = plugin.ep()->engine()->addMessage(m,&m_autoChangeParty);
+    m_tr2 = plugin.ep()->engine(m)->addMessage(m,&m_autoChangeParty);
     if (m_tr2) {
 	m_tr2->ref();
 	m_tr2->setUserData(this);
@@ -8592,7 +9069,7 @@ bool YateSIPConnection::sendTone(Message& msg, const char* tone, int meth, bool&
 		    String tmp;
 		    tmp << "Signal=" << j << "\r\n";
 		    m->setBody(new MimeStringBody("application/dtmf-relay",tmp));
-		    plugin.ep()->engine()->addMessage(m,&m_autoChangeParty);
+		    plugin.ep()->engine(m)->addMessage(m,&m_autoChangeParty);
 		    m->deref();
 		    break;
 		}
@@ -8794,7 +9271,7 @@ void YateSIPLine::login()
 
     DDebug(&plugin,DebugInfo,"YateSIPLine '%s' emiting %p [%p]",
 	c_str(),m,this);
-    m_tr = plugin.ep()->engine()->addMessage(m);
+    m_tr = plugin.ep()->engine(m)->addMessage(m);
     if (m_tr) {
 	m_tr->ref();
 	m_tr->setUserData(this);
@@ -8825,7 +9302,7 @@ void YateSIPLine::logout(bool sendLogout, const char* reason)
 	m_partyPort = 0;
 	if (!m)
 	    return;
-	plugin.ep()->engine()->addMessage(m);
+	plugin.ep()->engine(m)->addMessage(m);
 	m->deref();
     }
     m_callid.clear();
@@ -9091,7 +9568,7 @@ void YateSIPLine::transportChangedStatus(int stat, const String& reason)
 YateSIPGenerate::YateSIPGenerate(SIPMessage* m, int tries)
     : m_tr(0), m_code(0)
 {
-    m_tr = plugin.ep()->engine()->addMessage(m);
+    m_tr = plugin.ep()->engine(m)->addMessage(m);
     if (m_tr) {
 	m_tr->ref();
 	m_tr->setUserData(this);
@@ -9156,6 +9633,20 @@ bool UserHandler::received(Message &msg)
 }
 
 
+bool AuthUpdateHandler::received(Message &msg)
+{
+    const String* user = msg.getParam(YSTRING("user"));
+    if (TelEngine::null(user))
+	user = msg.getParam(s_username);
+    if (!TelEngine::null(user))
+	s_authCache.drop(*user);
+    // an account update without user may affect anyone
+    else if (msg == YSTRING("user.update"))
+	s_authCache.drop();
+    return false;
+}
+
+
 bool SipHandler::received(Message &msg)
 {
     const char* method = msg.getValue(YSTRING("method"));
@@ -9308,7 +9799,7 @@ bool SIPDriver::received(Message& msg, int id)
 	    noHalt = (0 != channels().skipNull());
 	}
 	if (!noHalt)
-	    noHalt = m_endpoint->engine()->hasInitialTransaction();
+	    noHalt = m_endpoint->hasInitialTransaction();
 	Debug(this,DebugAll,"Returning %s from %s handler",String::boolText(noHalt),msg.c_str());
 	return noHalt;
     }
@@ -9318,7 +9809,7 @@ bool SIPDriver::received(Message& msg, int id)
 	channels().clear();
 	s_lines.clear();
 	// Clear transactions: they keep references to parties and transports
-	m_endpoint->engine()->clearTransactions();
+	m_endpoint->clearTransactions();
 	m_endpoint->clearUdpTransports("Exiting");
 	// Wait for transports to terminate
 	unsigned int n = 100;
@@ -9496,10 +9987,14 @@ void SIPDriver::initialize()
     s_initialHeaders = s_cfg.getBoolValue("general","initial_headers");
     m_parser.initialize(s_cfg.getSection("codecs"),s_cfg.getSection("hacks"),s_cfg.getSection("general"));
     s_trace = s_cfg.getBoolValue("general","trace");
+    s_authCache.setup(s_cfg.getIntValue("general","auth_cache_ttl",0,0,86400));
     if (!m_endpoint) {
 	Thread::Priority prio = Thread::priority(s_cfg.getValue("general","thread"));
 	unsigned int partyMutexCount = s_cfg.getIntValue("general","party_mutexcount",47,13,101);
-	m_endpoint = new YateSIPEndPoint(prio,partyMutexCount);
+	unsigned int shards = s_cfg.getIntValue("general","engine_shards",1,1,SHARDS_MAX);
+	if (shards > 1)
+	    Debug(this,DebugNote,"Using %u SIP engine shards, this is experimental",shards);
+	m_endpoint = new YateSIPEndPoint(prio,partyMutexCount,shards);
 	if (!(m_endpoint->Init())) {
 	    delete m_endpoint;
 	    m_endpoint = 0;
@@ -9517,11 +10012,13 @@ void SIPDriver::initialize()
 	installRelay(MsgExecute);
 	installRelay(Help);
 	Engine::install(new UserHandler);
+	Engine::install(new AuthUpdateHandler);
+	Engine::install(new AuthUpdateHandler("user.unregister"));
 	if (s_cfg.getBoolValue("general","generate"))
 	    Engine::install(new SipHandler);
     }
     else {
-	m_endpoint->engine()->initialize(s_cfg.getSection("general"));
+	m_endpoint->initializeEngines(s_cfg.getSection("general"));
 	loadLimits();
     }
     // Unsafe globals
@@ -9704,7 +10201,8 @@ void SIPDriver::statusParams(String& str)
 {
     Driver::statusParams(str);
     if (m_endpoint->engine())
-	str.append("transactions=",",") << m_endpoint->engine()->transactionCount();
+	str.append("transactions=",",") << m_endpoint->transactionCount();
+    s_authCache.statusParams(str);
 }
 
 // Build and dispatch a socket.ssl message
@@ -9813,7 +10311,7 @@ bool SIPDriver::sendMethod(Message& msg, const char* method, bool msgExec,
 	sip->setAutoAuth(user,pass);
     if (!msg.getBoolValue(YSTRING("wait"))) {
 	// no answer requested - start transaction and forget
-	ep()->engine()->addMessage(sip);
+	ep()->engine(sip)->addMessage(sip);
 	sip->deref();
 	return true;
     }
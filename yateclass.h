@@ -4444,6 +4444,15 @@ public:
     bool convert(const DataBlock& src, const String& sFormat,
 	const String& dFormat, unsigned maxlen = 0);
 
+    /**
+     * Select the implementation of the G.711 and linear PCM conversions.
+     * Vector kernels produce the same output as the lookup tables
+     * @param vector True to use the best vector kernels supported by the CPU,
+     *  false to use the lookup tables
+     * @return Name of the implementation in use: "avx2", "sse4.1" or "table"
+     */
+    static const char* vectorConvert(bool vector = true);
+
     /**
      * Build this data block from a hexadecimal string representation.
      * Each octet must be represented in the input string with 2 hexadecimal characters.
@@ -4844,6 +4853,21 @@ public:
      */
     static bool fips186prf(DataBlock& out, const DataBlock& seed, unsigned int len);
 
+    /**
+     * Compute a HMAC-SHA1 from hashes preloaded with the padded key.
+     * No memory is allocated so it is suitable for per packet processing
+     * @param digest Buffer to fill with the 20 octets of the HMAC
+     * @param ipad Unfinalized hash updated with the key XORed with the inner pad
+     * @param opad Unfinalized hash updated with the key XORed with the outer pad
+     * @param data Pointer to the data to authenticate
+     * @param len Length of the data in octets
+     * @param extra Optional data to authenticate after the first block
+     * @param extraLen Length of the extra data in octets
+     * @return True on success, false if the pad hashes were not prepared
+     */
+    static bool hmacDigest(unsigned char* digest, const SHA1& ipad, const SHA1& opad,
+	const void* data, unsigned int len, const void* extra = 0, unsigned int extraLen = 0);
+
 protected:
     bool updateInternal(const void* buf, unsigned int len);
 
@@ -1527,6 +1527,87 @@ public:
 };
 
 
+/**
+ * This class computes the discrete Fourier transform of complex data with a
+ *  power of 2 length. Twiddle factors and the input permutation are computed
+ *  once when the length is set so the same object can transform many buffers,
+ *  also from different threads.
+ * Radix-4 butterflies are used (with one radix-2 stage for odd powers of 2),
+ *  they are processed in vector registers when the build target supports it
+ * @short Fast Fourier transform of a fixed length
+ */
+class YATE_API FFT : public GenObject
+{
+    YCLASS(FFT,GenObject)
+    YNOCOPY(FFT); // No automatic copies please
+public:
+    /**
+     * Constructor
+     * @param length Transform length, must be a power of 2 or 0
+     */
+    explicit FFT(unsigned int length = 0);
+
+    /**
+     * Destructor
+     */
+    virtual ~FFT();
+
+    /**
+     * Change the transform length, rebuild the tables
+     * @param length New transform length, must be a power of 2 (at least 2) or 0
+     * @return True on success, false if the length is invalid
+     */
+    bool setup(unsigned int length);
+
+    /**
+     * Retrieve the transform length
+     * @return Number of complex samples transformed at once, 0 if not set
+     */
+    inline unsigned int length() const
+	{ return m_length; }
+
+    /**
+     * Compute the forward transform in place
+     * @param data Buffer of length() complex samples
+     * @return True on success, false if no data or length is not set
+     */
+    inline bool forward(Complex* data) const
+	{ return transform(data,false); }
+
+    /**
+     * Compute the forward transform of a vector in place
+     * @param data Vector of length() samples
+     * @return True on success, false if the vector length does not match
+     */
+    inline bool forward(ComplexVector& data) const
+	{ return (data.length() == m_length) && transform(data.data(),false); }
+
+    /**
+     * Compute the inverse transform in place, the result is scaled by 1/length()
+     * @param data Buffer of length() complex samples
+     * @return True on success, false if no data or length is not set
+     */
+    inline bool inverse(Complex* data) const
+	{ return transform(data,true); }
+
+    /**
+     * Compute the inverse transform of a vector in place
+     * @param data Vector of length() samples
+     * @return True on success, false if the vector length does not match
+     */
+    inline bool inverse(ComplexVector& data) const
+	{ return (data.length() == m_length) && transform(data.data(),true); }
+
+private:
+    bool transform(Complex* data, bool inverse) const;
+    void clear();
+    unsigned int m_length;               // Transform length
+    unsigned int* m_swap;                // Pairs of indexes swapped by bit reversal
+    unsigned int m_swaps;                // Number of swapped pairs
+    Complex* m_twiddle;                  // Twiddle factors of all radix-4 passes
+};
+
+
 /**
  * This class global Math utility methods
  * @short Math utilities
@@ -1555,6 +1636,58 @@ public:
      */
     static String& dumpFloat(String& buf, const float& val, const char* sep = 0,
 	const char* fmt = 0);
+
+    /**
+     * Select the implementation of the vector kernels (dot, mulAcc, norm, power).
+     * All implementations produce the same results within rounding
+     * @param avx True to use AVX if the CPU supports it, false to use at most SSE2
+     * @return Name of the implementation in use: "avx", "sse2" or "scalar"
+     */
+    static const char* vectorKernels(bool avx = true);
+
+    /**
+     * Compute the sum of element by element products of two complex buffers.
+     * This is the narrow band integrator used to measure a known tone
+     * @param a First buffer
+     * @param b Second buffer
+     * @param len Number of elements in each buffer
+     * @return Sum of a[i] * b[i]
+     */
+    static Complex dot(const Complex* a, const Complex* b, unsigned int len);
+
+    /**
+     * Compute the dot product of two float buffers
+     * @param a First buffer
+     * @param b Second buffer
+     * @param len Number of elements in each buffer
+     * @return Sum of a[i] * b[i]
+     */
+    static float dot(const float* a, const float* b, unsigned int len);
+
+    /**
+     * Complex multiply and accumulate: dest[i] += a[i] * b[i]
+     * @param dest Destination buffer
+     * @param a First buffer
+     * @param b Second buffer
+     * @param len Number of elements in each buffer
+     */
+    static void mulAcc(Complex* dest, const Complex* a, const Complex* b, unsigned int len);
+
+    /**
+     * Compute the magnitude of each element of a complex buffer
+     * @param dest Destination buffer
+     * @param src Source buffer, may be the same memory as the destination
+     * @param len Number of elements
+     */
+    static void norm(float* dest, const Complex* src, unsigned int len);
+
+    /**
+     * Compute the energy of a complex buffer
+     * @param data Buffer to process
+     * @param len Number of elements
+     * @return Sum of squared magnitudes of all elements
+     */
+    static float power(const Complex* data, unsigned int len);
 };
 
 
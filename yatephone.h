@@ -386,10 +386,120 @@ protected:
     unsigned long m_timestamp;
 };
 
+/**
+ * An energy based voice activity detector for mono signed linear audio.
+ * It follows the frame energy and the background noise level and tells
+ *  speech frames apart from silence, keeping a hangover so the end of
+ *  words and short pauses are not reported as silence.
+ * The detector is not thread safe, it must be fed from a single thread.
+ * @short Voice activity detector
+ */
+class YATE_API DataVad
+{
+    YNOCOPY(DataVad); // no automatic copies please
+public:
+    /**
+     * Constructor
+     * @param rate Sampling rate of the analyzed audio
+     * @param hangover Time in milliseconds speech is assumed after the last loud frame
+     */
+    explicit DataVad(unsigned int rate = 8000, unsigned int hangover = 200);
+
+    /**
+     * Destructor, adds the local counters to the global statistics
+     */
+    ~DataVad();
+
+    /**
+     * Analyze a block of signed linear samples
+     * @param data Block of 16 bit mono samples
+     * @return True if the block holds speech or other significant signal
+     */
+    bool process(const DataBlock& data);
+
+    /**
+     * Analyze a block of samples and compute the flags to forward it with
+     * @param data Block of 16 bit mono samples
+     * @param flags Flags the block already has
+     * @return Flags with DataNode::DataSilent added if the block is silence
+     */
+    inline unsigned long mark(const DataBlock& data, unsigned long flags)
+	{ return process(data) ? flags : (flags | DataNode::DataSilent); }
+
+    /**
+     * Forget the learned noise level and the speech state
+     */
+    void reset();
+
+    /**
+     * Check if the last analyzed block was considered speech
+     * @return True if speech was detected in the last block or during hangover
+     */
+    inline bool speech() const
+	{ return m_speech; }
+
+    /**
+     * Get the mean square energy of the last analyzed block
+     * @return Mean of squared sample values
+     */
+    inline unsigned int energy2() const
+	{ return m_energy2; }
+
+    /**
+     * Get the estimated mean square energy of the background noise
+     * @return Noise level as mean of squared sample values
+     */
+    inline unsigned int noise2() const
+	{ return m_noise2; }
+
+    /**
+     * Get the number of blocks analyzed by this detector
+     * @return Count of analyzed blocks
+     */
+    inline u_int64_t frames() const
+	{ return m_frames; }
+
+    /**
+     * Get the number of blocks this detector reported as silence
+     * @return Count of silent blocks
+     */
+    inline u_int64_t silent() const
+	{ return m_silent; }
+
+    /**
+     * Retrieve the statistics of all detectors, including destroyed ones
+     * @param frames Total number of analyzed blocks
+     * @param silent Total number of blocks reported as silence
+     */
+    static void statistics(u_int64_t& frames, u_int64_t& silent);
+
+    /**
+     * Highest mean square energy a block can have and still be silence,
+     *  louder blocks are always speech whatever the noise level
+     * @return Absolute silence energy limit
+     */
+    static unsigned int maxSilence();
+
+private:
+    void flush();
+    unsigned int m_hangover;
+    unsigned int m_remain;
+    unsigned int m_energy2;
+    unsigned int m_noise2;
+    bool m_speech;
+    u_int64_t m_frames;
+    u_int64_t m_silent;
+    unsigned int m_flushFrames;
+    unsigned int m_flushSilent;
+};
+
 class DataSource;
 class DataTranslator;
 class TranslatorFactory;
 class ThreadedSourcePrivate;
+class MediaClock;
+class DataSourceSnapshot;
+class DataSourceReader;
 
 /**
  * A data consumer
@@ -461,6 +571,24 @@ protected:
      */
     virtual bool synchronize(DataSource* source);
 
+    /**
+     * Translate the timestamp of data sent directly by the regular source,
+     *  bypassing Consume(), the same way Consume() would
+     * @param source Source sending the data
+     * @param tStamp Timestamp of the data in the source's time base
+     * @return Timestamp of the data for this consumer, invalidStamp() if
+     *  the source is not the regular one or an override is attached
+     */
+    inline unsigned long relayStamp(const DataSource* source, unsigned long tStamp) const
+	{ return (source && (source == m_source) && !m_override) ? tStamp + m_regularTsDelta : invalidStamp(); }
+
+    /**
+     * Account data delivered bypassing Consume() so later gaps are detected
+     * @param tStamp Timestamp of the data for this consumer
+     */
+    inline void relayed(unsigned long tStamp)
+	{ m_timestamp = tStamp; m_lastTsTime = Time::now(); }
+
 private:
     unsigned long Consume(const DataBlock& data, unsigned long tStamp,
 	unsigned long flags, DataSource* source);
@@ -485,7 +613,8 @@ public:
      */
     inline explicit DataSource(const char* format = "slin")
 	: DataNode(format), Mutex(false,"DataSource"),
-	  m_nextStamp(invalidStamp()), m_translator(0) { }
+	  m_nextStamp(invalidStamp()), m_translator(0), m_snapshot(0),
+	  m_vad(0), m_shareTrans(false) { }
 
     /**
      * Source's destruct notification - detaches all consumers
@@ -562,7 +691,61 @@ public:
     inline unsigned long nextStamp() const
 	{ return m_nextStamp; }
 
+    /**
+     * Check if consumers of the same format share a translator chain
+     * @return True if translator chains attached to this source are shared
+     */
+    inline bool shareTranslators() const
+	{ return m_shareTrans; }
+
+    /**
+     * Count the consumers fed by this source directly or through translators
+     * @param chains Optional pointer to store the number of translator chains
+     * @return Number of consumers that receive the data
+     */
+    unsigned int listeners(unsigned int* chains = 0);
+
+    /**
+     * Enable or disable voice activity detection on forwarded data.
+     * Blocks found to hold silence are forwarded with the DataSilent flag
+     *  so consumers can skip processing them. Only mono signed linear
+     *  sources can detect voice activity.
+     * @param enable True to analyze the data, false to stop
+     * @param hangover Time in milliseconds speech is assumed after the last loud block
+     * @return True if detection is enabled after the call
+     */
+    bool setVad(bool enable, unsigned int hangover = 200);
+
+    /**
+     * Check if voice activity detection is enabled on this source
+     * @return True if forwarded data is analyzed for silence
+     */
+    bool vad() const;
+
 protected:
+    /**
+     * Allow consumers of the same format to share a translator chain so
+     *  each frame is converted only once for all of them
+     * @param share True to share translator chains when attaching consumers
+     */
+    inline void shareTranslators(bool share)
+	{ m_shareTrans = share; }
+
+    /**
+     * Register the calling thread as running consumers with the source unlocked.
+     * Until released, detach() and clear() called from other threads wait.
+     * Threads not created by Yate are told apart by their system thread identifier.
+     * The source must be locked by the caller
+     * @return Registration to pass to releaseReader()
+     */
+    DataSourceReader* addReader();
+
+    /**
+     * Release a registration made by addReader(), the source must be locked
+     * @param reader Registration of the calling thread
+     */
+    void releaseReader(DataSourceReader* reader);
+
     unsigned long m_nextStamp;
     ObjList m_consumers;
 private:
@@ -571,7 +754,13 @@ private:
 	    m_translator = translator;
 	}
     bool detachInternal(DataConsumer* consumer);
+    void updateSnapshot();
+    void quiesce();
     DataTranslator* m_translator;
+    DataSourceSnapshot* m_snapshot;
+    ObjList m_readers;
+    DataVad* m_vad;
+    bool m_shareTrans;
 };
 
 /**
@@ -643,6 +832,96 @@ private:
     ThreadedSourcePrivate* m_thread;
 };
 
+/**
+ * A data source paced by a media clock thread that wakes up at absolute
+ *  deadlines every tick so the timing does not drift. Each source gets a
+ *  clock thread of its own unless media_clocks enables a few clock threads
+ *  shared by many sources.
+ * @short Data source driven by a media clock
+ */
+class YATE_API ClockedSource : public DataSource
+{
+    friend class MediaClock;
+public:
+    /**
+     * The destruction notification, checks that the source left its clock
+     */
+    virtual void destroyed();
+
+    /**
+     * Attach the source to its own or to the least loaded shared clock thread
+     * @return True if attached, false if no clock thread could be started
+     */
+    bool start();
+
+    /**
+     * Detach the source from its clock, it will receive no more ticks.
+     * The clock thread calls cleanup() after the current tick finishes
+     */
+    void stop();
+
+    /**
+     * Check if the source is attached to a media clock
+     * @return True if the source was started and not stopped yet
+     */
+    bool running() const;
+
+    /**
+     * Get the period of the media clock ticks
+     * @return Tick period in microseconds
+     */
+    static unsigned int tickPeriod();
+
+    /**
+     * Check if the sources share a few media clock threads.
+     * A source on a shared clock must not block in tick(), otherwise all the
+     *  other sources of that clock are delayed
+     * @return True if media_clocks is set, false if each source has a thread
+     */
+    static bool sharedClocks();
+
+    /**
+     * Retrieve the statistics of all media clock threads
+     * @param str String to append one Sources|Ticks|Jitter|MaxJitter|Busy|Overruns
+     *  entry per clock thread to, times are in microseconds
+     * @return Number of media clock threads running
+     */
+    static unsigned int clockStatus(String& str);
+
+protected:
+    /**
+     * Clocked Source constructor
+     * @param format Name of the data format, default "slin" (Signed Linear)
+     */
+    explicit ClockedSource(const char* format = "slin");
+
+    /**
+     * Produce data, called from the clock thread each time the source is due.
+     * A source is called again in the same tick while it is behind schedule
+     * @param when Time in microseconds the data is due
+     * @return Duration in microseconds of the data forwarded, zero if no data
+     *  was ready yet (try again next tick), negative to leave the clock
+     */
+    virtual int tick(u_int64_t when) = 0;
+
+    /**
+     * The cleanup after leaving the clock, called from the clock thread
+     */
+    virtual void cleanup();
+
+    /**
+     * Check if the source should keep producing data
+     * @param runConsumers True to keep running as long consumers are attached
+     * @return True if the source should remain attached to its clock
+     */
+    bool looping(bool runConsumers = false) const;
+
+private:
+    MediaClock* m_clock;
+    u_int64_t m_due;
+    bool m_stopping;
+};
+
 /**
  * The DataTranslator holds a translator (codec) capable of unidirectional
  * conversion of data from one type to another.
@@ -792,6 +1071,14 @@ public:
      */
     static void setMaxChain(unsigned int maxChain);
 
+    /**
+     * Retrieve the statistics of the format pair to translator chain cache
+     * @param hits Filled with the number of lookups answered from the cache
+     * @param misses Filled with the number of lookups that searched the factories
+     * @return Number of format pairs currently held in the cache
+     */
+    static unsigned int chainCache(u_int64_t& hits, u_int64_t& misses);
+
 protected:
     /**
      * Get access to the list of consumers of the data source
@@ -824,6 +1111,8 @@ private:
     static void compose();
     static void compose(TranslatorFactory* factory);
     static bool canConvert(const FormatInfo* fmt1, const FormatInfo* fmt2);
+    static TranslatorFactory* bestFactory(const FormatInfo* src, const FormatInfo* dest, int& cost);
+    static DataSource* sharedChain(DataSource* source, const DataFormat& format);
     DataSource* m_tsource;
     static Mutex s_mutex;
     static ObjList s_factories;
@@ -919,6 +1208,130 @@ private:
     NamedCounter* m_counter;
 };
 
+/**
+ * Base class for the native state of a codec that a translator can give back
+ *  to a pool when destroyed so a later translator of the same kind reuses it
+ * @short A reusable codec state
+ */
+class YATE_API DataCodecState : public GenObject
+{
+    YNOCOPY(DataCodecState); // no automatic copies please
+public:
+    /**
+     * Constructor
+     * @param kind Name of the state kind, only states of the same kind are interchangeable
+     */
+    inline explicit DataCodecState(const char* kind)
+	: m_kind(kind)
+	{ }
+
+    /**
+     * Bring the state back as if it was freshly created
+     * @return True if the state can be reused, false to destroy it
+     */
+    virtual bool reset() = 0;
+
+    /**
+     * Get the kind of the state, used to match states in a pool
+     * @return Kind name as specified in the constructor
+     */
+    virtual const String& toString() const
+	{ return m_kind; }
+
+private:
+    String m_kind;
+};
+
+/**
+ * A bounded pool of idle codec states kept by a translator factory.
+ * States are reset when put back so getting one is cheap at call setup.
+ * All pools are listed by the "codecs" selector of engine.status
+ * @short Pool of reusable codec states
+ */
+class YATE_API DataCodecPool : public GenObject
+{
+    YNOCOPY(DataCodecPool); // no automatic copies please
+public:
+    /**
+     * Constructor - registers the pool in the global list
+     * @param name Name of the pool, also used to configure its limit
+     * @param limit Maximum number of idle states to keep
+     */
+    explicit DataCodecPool(const char* name, unsigned int limit = 16);
+
+    /**
+     * Destructor - unregisters from the global list and destroys idle states
+     */
+    virtual ~DataCodecPool();
+
+    /**
+     * Get an idle state of a given kind
+     * @param kind Kind of the state to retrieve
+     * @return Reset state removed from the pool or NULL if one must be created
+     */
+    DataCodecState* get(const String& kind);
+
+    /**
+     * Give a state back to the pool, it gets reset or destroyed
+     * @param state State to keep for reuse, the pool takes ownership
+     */
+    void put(DataCodecState* state);
+
+    /**
+     * Destroy all idle states
+     */
+    void clear();
+
+    /**
+     * Read the limit from key codec_pool_NAME or codec_pool of section
+     *  [telephony] in the engine configuration
+     */
+    void configure();
+
+    /**
+     * Set the maximum number of idle states, extra idle states are destroyed
+     * @param limit New limit, zero disables pooling
+     */
+    void limit(unsigned int limit);
+
+    /**
+     * Get the maximum number of idle states kept
+     * @return Limit of the pool
+     */
+    inline unsigned int limit() const
+	{ return m_limit; }
+
+    /**
+     * Append the statistics of the pool as name=idle|limit|reused|created|dropped
+     * @param str String to append to
+     */
+    void status(String& str);
+
+    /**
+     * Append the statistics of all registered pools
+     * @param str String to append to, items are comma separated
+     * @return Number of registered pools
+     */
+    static unsigned int statusAll(String& str);
+
+    /**
+     * Get the name of the pool
+     * @return Name as specified in the constructor
+     */
+    virtual const String& toString() const
+	{ return m_name; }
+
+private:
+    String m_name;
+    Mutex m_mutex;
+    ObjList m_idle;
+    unsigned int m_count;
+    unsigned int m_limit;
+    u_int64_t m_reused;
+    u_int64_t m_created;
+    u_int64_t m_dropped;
+};
+
 /**
  * The DataEndpoint holds an endpoint capable of performing unidirectional
  * or bidirectional data transfers